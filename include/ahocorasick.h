@@ -0,0 +1,40 @@
+#ifndef AHOCORASICK_H__
+#define AHOCORASICK_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+
+typedef struct ac_automaton ac_automaton;
+
+/** Function that is called for every occurrence of a literal found by ac_scan() */
+typedef void (*ac_match_func)(uint32_t id, void *userdata);
+
+ac_automaton* ac_new(void);
+void          ac_free(ac_automaton *ac);
+int           ac_add(ac_automaton *ac, const char *literal, uint32_t id);
+int           ac_compile(ac_automaton *ac);
+void          ac_scan(const ac_automaton *ac, const char *text, uint32_t len, ac_match_func found, void *userdata);
+
+#endif /* AHOCORASICK_H__ */
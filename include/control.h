@@ -0,0 +1,56 @@
+#ifndef CONTROL_H__
+#define CONTROL_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+
+#include "event_loop.h"
+
+/** maximum length of a command line, including the line feed */
+#define CONTROL_MAX_LINE 1024
+
+/** maximum number of words of a command */
+#define CONTROL_MAX_ARGS 16
+
+typedef struct control_server control_server;
+typedef struct control_client control_client;
+
+/** Function that carries out a command received on the control socket.
+ *
+ * \a argv[0] is the name of the command. The function answers with any number of control_reply()
+ * lines, followed by exactly one call of control_reply_ok() or control_reply_error().
+ */
+typedef void (*control_func)(control_client *client, int argc, char **argv, void *userdata);
+
+control_server* control_server_new(event_loop *loop, const char *path, control_func func, void *userdata);
+void control_server_free(control_server *server);
+void control_server_set_timeout(control_server *server, uint32_t timeout_ms);
+void control_reply(control_client *client, const char *format, ...);
+void control_reply_ok(control_client *client, const char *format, ...);
+void control_reply_error(control_client *client, const char *format, ...);
+
+int  control_send(const char *path, const char *command);
+
+#endif /* CONTROL_H__ */
@@ -0,0 +1,83 @@
+#ifndef DOWNLOAD_QUEUE_H__
+#define DOWNLOAD_QUEUE_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+
+#include "list.h"
+#include "segmented.h"
+#include "web.h"
+
+/** feed ID of the jobs whose feed has been removed from the configuration */
+#define DOWNLOAD_NO_FEED UINT16_MAX
+
+typedef struct download_job   download_job;
+typedef struct download_queue download_queue;
+
+/** A single file download waiting in (or running from) a download_queue */
+struct download_job {
+  download_job   *next;
+  download_queue *queue;
+  uint32_t  id;         /**< unique number of the job */
+  char     *url;        /**< URL of the file */
+  char     *filename;   /**< full path where the file is stored */
+  char     *useragent;  /**< User-Agent of the filter that matched */
+  char     *name;       /**< title of the RSS item */
+  int16_t   priority;   /**< jobs with a higher priority are started first */
+  uint16_t  feed_id;    /**< ID of the feed the item belongs to */
+  uint64_t  max_speed;  /**< bandwidth limit of the download in bytes per second (0: none) */
+  simple_list mirrors;  /**< other URLs of the RSS item, which might serve the same file */
+  segmented_download *segmented; /**< set while the job runs as a segmented download */
+  uint8_t   cancelled;  /**< the job is dropped once its transfer has stopped */
+  uint8_t   requeue;    /**< the job goes back into the queue once its transfer has stopped */
+};
+
+/** Function that is called once a download job has finished.
+ *
+ * \a response is \c NULL if the transfer failed. The function does not own \a job, but
+ * is responsible for freeing \a response.
+ */
+typedef void (*download_done_func)(const download_job *job, HTTPResponse *response, void *userdata);
+
+download_queue* download_queue_new(web_multi *engine, uint16_t max_active, uint16_t max_queued,
+                                   download_done_func done, void *userdata);
+void     download_queue_free(download_queue *q);
+void     download_queue_set_segments(download_queue *q, uint16_t segments, uint64_t min_segment_size);
+void     download_queue_set_limits(download_queue *q, uint16_t max_active, uint16_t max_queued);
+int      download_queue_add(download_queue *q, const char *url, const char *filename, const char *useragent,
+                            const char *name, int16_t priority, uint16_t feed_id, const simple_list mirrors,
+                            uint64_t max_speed);
+uint8_t  download_queue_contains(const download_queue *q, const char *filename);
+uint8_t  download_queue_throttled(const download_queue *q);
+uint32_t download_queue_length(const download_queue *q);
+uint32_t download_queue_active(const download_queue *q);
+int      download_queue_cancel(download_queue *q, uint32_t id);
+void     download_queue_pause(download_queue *q, uint8_t pause);
+uint8_t  download_queue_paused(const download_queue *q);
+void     download_queue_remap_feeds(download_queue *q, const uint16_t *ids, uint32_t count);
+const download_job* download_queue_waiting(const download_queue *q);
+const download_job* download_queue_running(const download_queue *q);
+
+#endif /* DOWNLOAD_QUEUE_H__ */
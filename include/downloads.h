@@ -24,9 +24,31 @@
 	#include "memwatch.h"
 #endif
 
-#include "list.h"
+#include <stdint.h>
 
-int addToBucket(const char* identifier, NODE **head, const uint16_t maxBucketItems);
-uint8_t has_been_downloaded(const simple_list bucket, const char *url);
+#include "hash.h"
+#include "hashring.h"
+#include "statedb.h"
+
+/** \cond */
+struct download_history {
+  statedb  *snapshot;   /**< memory-mapped state file */
+  hashring *recent;     /**< downloads that are not part of the snapshot yet (statedb_meta payload) */
+  uint64_t  added;      /**< number of entries ever added to recent */
+  uint32_t  max_items;  /**< maximum number of entries kept in the state file, 0 means unlimited */
+};
+/** \endcond */
+
+typedef struct download_history download_history;
+
+download_history* history_new(void);
+void     history_free(download_history *history);
+int      history_add(download_history *history, const char *url, const statedb_meta *meta);
+int      history_append(download_history *history, const char *url, const statedb_meta *meta);
+uint64_t history_count(const download_history *history);
+void     history_set_snapshot(download_history *history, statedb *snapshot, uint64_t keep_recent);
+
+int addToBucket(const char* identifier, download_history *bucket, const uint32_t maxBucketItems, const statedb_meta *meta);
+uint8_t has_been_downloaded(const download_history *bucket, const char *url);
 
 #endif
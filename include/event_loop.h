@@ -0,0 +1,61 @@
+#ifndef EVENT_LOOP_H__
+#define EVENT_LOOP_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+/** \cond */
+#define EVENT_READ   0x01
+#define EVENT_WRITE  0x02
+#define EVENT_ERROR  0x04
+/** \endcond */
+
+typedef struct event_loop  event_loop;
+typedef struct event_timer event_timer;
+
+/** Function that is called when a watched file descriptor is ready (\a events: EVENT_READ, EVENT_WRITE, EVENT_ERROR) */
+typedef void (*event_func)(int fd, uint32_t events, void *userdata);
+
+/** Function that is called when a timer has expired */
+typedef void (*event_timer_func)(event_timer *timer, void *userdata);
+
+/** Function that is called for each signal delivered to the event loop */
+typedef void (*event_signal_func)(int sig, void *userdata);
+
+event_loop*  event_loop_new(void);
+void         event_loop_free(event_loop *loop);
+int          event_loop_watch(event_loop *loop, int fd, uint32_t events, event_func func, void *userdata);
+void         event_loop_unwatch(event_loop *loop, int fd);
+int          event_loop_signals(event_loop *loop, const int *signals, uint32_t count, event_signal_func func, void *userdata);
+int          event_loop_run(event_loop *loop, int timeout_ms);
+
+event_timer* event_timer_new(event_loop *loop, event_timer_func func, void *userdata);
+void         event_timer_free(event_timer *timer);
+int          event_timer_at(event_timer *timer, time_t when);
+int          event_timer_after(event_timer *timer, uint32_t ms);
+void         event_timer_stop(event_timer *timer);
+
+#endif /* EVENT_LOOP_H__ */
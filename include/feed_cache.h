@@ -0,0 +1,32 @@
+#ifndef FEED_CACHE_H__
+#define FEED_CACHE_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include "rss_feed.h"
+
+int feed_cache_load(const char *path, rss_feeds feeds, uint64_t filter_digest);
+int feed_cache_save(const char *path, const rss_feeds feeds, uint64_t filter_digest);
+
+#endif /* FEED_CACHE_H__ */
@@ -37,11 +37,13 @@ struct feed_item {
 	char *name; /**< "Name" field of the RSS item */
 	simple_list urls;  /**< URL field of the RSS item    */
   char *category;
+  char *guid;        /**< "guid" field of the RSS item (may be NULL) */
 	/** \} */
 };
 
 void freeFeedItem(void *item);
 feed_item newFeedItem(void);
-uint8_t isMatch(const simple_list filters, const char* item, am_filter *out_filter);
+uint8_t isMatch(filter_matcher *matcher, const char* item, am_filter *out_filter);
+uint64_t getFeedItemID(const feed_item item);
 
 #endif
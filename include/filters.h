@@ -25,15 +25,30 @@
 #endif
 
 #include "list.h"
+#include "regex.h"
 #include "utils.h"
 
 typedef struct am_filter* am_filter;
 typedef struct NODE* am_filters;
+typedef struct filter_matcher filter_matcher;
+typedef struct filter_matcher_stats filter_matcher_stats;
+typedef struct match_cache match_cache;
 
 /** struct representing an RSS feed */
 struct am_filter {
 	char   *pattern;  /**< Feed URL */
   char    *agent;
+  int16_t  priority; /**< downloads of filters with a higher priority are started first */
+  uint32_t max_speed; /**< bandwidth limit of each download in kB/s (0: none) */
+  am_regex *regex;   /**< compiled pattern */
+};
+
+/** Counters of a filter_matcher */
+struct filter_matcher_stats {
+  uint64_t urls;               /**< strings that were checked */
+  uint64_t prefilter_rejects;  /**< strings that were rejected without evaluating a regular expression */
+  uint64_t regex_runs;         /**< regular expressions that were evaluated */
+  uint64_t cache_hits;         /**< strings that were answered from the match cache */
 };
 
 PUBLIC am_filter filter_new(void);
@@ -41,4 +56,13 @@ PUBLIC void filter_free(void* listItem);
 PUBLIC void filter_printList(simple_list list);
 PUBLIC void filter_add(am_filter p, NODE **head);
 
+PUBLIC filter_matcher* filter_matcher_new(const am_filters filters);
+PUBLIC void filter_matcher_free(filter_matcher *m);
+PUBLIC am_filter filter_matcher_match(filter_matcher *m, const char *str, uint32_t len);
+PUBLIC const filter_matcher_stats* filter_matcher_get_stats(const filter_matcher *m);
+PUBLIC void filter_matcher_set_cache(filter_matcher *m, match_cache *cache);
+
+PUBLIC match_cache* match_cache_new(uint32_t size);
+PUBLIC void match_cache_free(match_cache *c);
+
 #endif  /* FILTERS_H__ */
@@ -0,0 +1,54 @@
+#ifndef HASH_H__
+#define HASH_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** 128-bit digest, made of two independently seeded 64-bit hashes */
+typedef struct hash128 {
+  uint64_t h1;  /**< equal to hash_string() of the same input */
+  uint64_t h2;
+} hash128;
+
+/** State of an incremental XXH64 computation */
+typedef struct xxh64_state {
+  uint64_t total_len;
+  uint64_t v[4];
+  uint8_t  mem[32];   /**< input that doesn't fill a complete stripe yet */
+  uint32_t mem_size;
+  uint64_t seed;
+} xxh64_state;
+
+uint64_t xxh64(const void *data, size_t len, uint64_t seed);
+void     xxh64_reset(xxh64_state *state, uint64_t seed);
+void     xxh64_update(xxh64_state *state, const void *data, size_t len);
+uint64_t xxh64_digest(const xxh64_state *state);
+uint64_t hash_string(const char *str);
+void     hash128_data(const void *data, size_t len, hash128 *digest);
+void     hash128_string(const char *str, hash128 *digest);
+int      hash128_cmp(const hash128 *a, const hash128 *b);
+
+#endif /* HASH_H__ */
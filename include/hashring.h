@@ -0,0 +1,51 @@
+#ifndef HASHRING_H__
+#define HASHRING_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+
+#include <stddef.h>
+
+/** Set of 64-bit keys (each with an optional string value) that remembers the insertion order.
+ *
+ * Lookups go through an open-addressing hash index, the entries themselves live in a ring buffer
+ * so the oldest entry can be evicted in constant time. Each entry can carry a fixed-size payload
+ * that is stored inline.
+ */
+typedef struct hashring hashring;
+
+hashring*   hashring_new(size_t payload_size);
+void        hashring_free(hashring *h);
+int         hashring_add(hashring *h, uint64_t key, const char *value);
+int         hashring_append(hashring *h, uint64_t key, const char *value);
+uint8_t     hashring_contains(const hashring *h, uint64_t key, const char *value);
+void        hashring_trim(hashring *h, uint32_t max_entries);
+void        hashring_clear(hashring *h);
+uint32_t    hashring_count(const hashring *h);
+uint64_t    hashring_key(const hashring *h, uint32_t i);
+const char* hashring_value(const hashring *h, uint32_t i);
+void*       hashring_payload(const hashring *h, uint32_t i);
+
+#endif /* HASHRING_H__ */
@@ -0,0 +1,64 @@
+#ifndef METRICS_H__
+#define METRICS_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "event_loop.h"
+
+/** maximum number of buckets of a histogram, not counting the +Inf bucket */
+#define METRICS_MAX_BUCKETS 16
+
+typedef struct metrics        metrics;
+typedef struct metric         metric;
+typedef struct metrics_server metrics_server;
+
+/** Function that updates the gauges of a registry right before it is rendered */
+typedef void (*metrics_collect_func)(metrics *registry, void *userdata);
+
+metrics* metrics_new(void);
+void     metrics_free(metrics *registry);
+metric*  metrics_counter(metrics *registry, const char *name, const char *help);
+metric*  metrics_gauge(metrics *registry, const char *name, const char *help);
+metric*  metrics_histogram(metrics *registry, const char *name, const char *help, const double *bounds, uint32_t count);
+void     metrics_set_collect(metrics *registry, metrics_collect_func func, void *userdata);
+char*    metrics_render(metrics *registry, size_t *len);
+
+void     metric_add(metric *m, uint64_t n);
+void     metric_set_count(metric *m, uint64_t n);
+void     metric_set(metric *m, double value);
+void     metric_observe(metric *m, double value);
+uint64_t metric_count(const metric *m);
+
+double   metrics_clock(void);
+uint64_t metrics_resident_memory(void);
+
+metrics_server* metrics_server_new(event_loop *loop, uint16_t port, metrics *registry);
+void            metrics_server_free(metrics_server *server);
+void            metrics_server_set_timeout(metrics_server *server, uint32_t timeout_ms);
+uint16_t        metrics_server_port(const metrics_server *server);
+
+#endif /* METRICS_H__ */
@@ -0,0 +1,53 @@
+#ifndef PARTFILE_H__
+#define PARTFILE_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+
+/** Progress of one segment of a segmented download */
+typedef struct part_segment {
+  uint64_t offset;        /**< position of the segment in the file */
+  uint64_t length;        /**< size of the segment */
+  uint64_t written;       /**< number of bytes of the segment that have been stored */
+} part_segment;
+
+/** Information needed to resume an interrupted download */
+typedef struct part_info {
+  char         *url;           /**< URL the partial file was downloaded from */
+  char         *etag;          /**< ETag of the response the data belongs to */
+  char         *last_modified; /**< Last-Modified date of the response the data belongs to */
+  uint64_t      offset;        /**< number of valid bytes in the partial file (0: the file size, unless there are segments) */
+  part_segment *segments;      /**< (optional) segments of a segmented download, in file order */
+  uint16_t      segment_count;
+} part_info;
+
+char* part_file_name(const char *filename);
+int   part_info_load(const char *part_file, part_info *info);
+int   part_info_save(const char *part_file, const part_info *info);
+const char* part_info_validator(const part_info *info, const char *url);
+void  part_info_remove(const char *part_file);
+void  part_info_free(part_info *info);
+
+#endif /* PARTFILE_H__ */
@@ -0,0 +1,55 @@
+#ifndef RATELIMIT_H__
+#define RATELIMIT_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+
+#include "list.h"
+
+/** Token bucket that limits the average rate of a data stream */
+typedef struct token_bucket {
+  uint64_t rate;    /**< tokens (bytes) per second (0: unlimited) */
+  uint64_t burst;   /**< maximum number of tokens the bucket holds */
+  int64_t  tokens;  /**< negative after more data was received than the bucket held */
+  uint64_t last;    /**< time of the last refill (ms) */
+} token_bucket;
+
+/** Bandwidth limit for a time of the day */
+typedef struct rate_window {
+  uint16_t start;   /**< first minute of the day the window applies to */
+  uint16_t end;     /**< first minute of the day the window no longer applies to */
+  uint64_t rate;    /**< limit in bytes per second (0: unlimited) */
+} rate_window;
+
+void     token_bucket_init(token_bucket *b, uint64_t rate, uint64_t now);
+void     token_bucket_set_rate(token_bucket *b, uint64_t rate);
+void     token_bucket_refill(token_bucket *b, uint64_t now);
+void     token_bucket_consume(token_bucket *b, uint64_t amount);
+uint32_t token_bucket_delay(const token_bucket *b);
+
+int      parseTimeOfDay(const char *str, uint16_t *minute);
+uint64_t rate_schedule_lookup(const simple_list windows, uint64_t default_rate, uint16_t minute);
+
+#endif /* RATELIMIT_H__ */
@@ -1,4 +1,16 @@
 #include <stdint.h>
 
+typedef struct am_regex am_regex;
+
 uint8_t isRegExMatch(const char* pattern, const char* str);
 char* getRegExMatch(const char* pattern, const char* str, uint8_t which_result);
+
+am_regex* compileRegEx(const char* pattern);
+uint8_t   matchRegEx(const am_regex *re, const char* str, uint32_t len);
+uint8_t   isTrivialRegEx(const am_regex *re);
+void      freeRegEx(am_regex *re);
+
+am_regex* compileRegExSet(const char * const *patterns, uint32_t count);
+int32_t   matchRegExSet(const am_regex *re, const char* str, uint32_t len);
+
+char*     getRegExLiteral(const char *pattern);
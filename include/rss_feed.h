@@ -24,6 +24,8 @@
 	#include "memwatch.h"
 #endif
 
+#include <time.h>
+
 #include "list.h"
 #include "utils.h"
 
@@ -38,6 +40,22 @@ struct rss_feed {
   char    *cookies;
 	uint32_t ttl;	 /**< Time-To-Live for the specific feed */
   uint16_t id;
+  char    *etag;          /**< ETag of the last response, for conditional requests */
+  char    *last_modified; /**< Last-Modified date of the last response, for conditional requests */
+  uint32_t item_count;    /**< number of items the feed had when it was parsed the last time */
+  uint64_t digest;        /**< hash of the body of the last response, for servers that ignore the validators */
+  uint16_t stop_after_known; /**< stop parsing after this many consecutive known items (0: parse everything) */
+  uint32_t max_items;     /**< maximum number of items that are parsed (0: the global default) */
+  uint64_t *seen_items;   /**< sorted IDs of the items that were dealt with in earlier polls */
+  uint32_t seen_count;
+  uint32_t interval;      /**< check interval in seconds (0: the global check interval) */
+  int32_t  max_age;       /**< freshness lifetime of the last response in seconds, from Cache-Control or Expires (-1: none) */
+  uint32_t skip_hours;    /**< hours (GMT) in which the feed must not be read, one bit per hour */
+  uint8_t  skip_days;     /**< days in which the feed must not be read, one bit per day (bit 0: Sunday) */
+  uint32_t poll_interval; /**< learned check interval in seconds (0: not learned yet) */
+  uint32_t new_gap;       /**< average time in seconds between two checks that found new items (0: unknown) */
+  time_t   last_new;      /**< time of the last check that found new items (0: unknown) */
+  time_t   slot;          /**< time the feed was last scheduled for, without the random delay (0: not yet) */
 	/* int32_t count;*/ /**< Item count? (UNUSED) */
 	/** \{ */
 };
@@ -46,5 +64,7 @@ PUBLIC rss_feed* feed_new(void);
 PUBLIC void feed_free(void* listItem);
 PUBLIC void feed_printList(simple_list list);
 PUBLIC void feed_add(rss_feed* p, NODE **head);
+PUBLIC uint8_t feed_has_seen(const rss_feed *feed, uint64_t item_id);
+PUBLIC uint8_t feed_set_seen(rss_feed *feed, uint64_t *item_ids, uint32_t count);
 
 #endif
@@ -0,0 +1,46 @@
+#ifndef SCHEDULER_H__
+#define SCHEDULER_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+#include <time.h>
+
+#include "rss_feed.h"
+
+typedef struct schedule schedule;
+
+schedule* schedule_new(void);
+void      schedule_free(schedule *s);
+int       schedule_add(schedule *s, void *item, time_t due);
+void*     schedule_pop_due(schedule *s, time_t now);
+int       schedule_remove(schedule *s, const void *item);
+time_t    schedule_due(const schedule *s, const void *item);
+time_t    schedule_next_due(const schedule *s);
+uint32_t  schedule_count(const schedule *s);
+
+time_t    feed_next_check(rss_feed *feed, uint32_t default_interval, time_t now, uint32_t random);
+uint8_t   feed_adapt_interval(rss_feed *feed, uint32_t new_items, time_t now, uint32_t min_interval, uint32_t max_interval);
+
+#endif /* SCHEDULER_H__ */
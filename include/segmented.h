@@ -0,0 +1,39 @@
+#ifndef SEGMENTED_H__
+#define SEGMENTED_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+
+#include "list.h"
+#include "web.h"
+
+typedef struct segmented_download segmented_download;
+
+segmented_download* segmented_download_start(web_multi *engine, const HTTPRequest *req, const simple_list mirrors,
+                                             uint16_t max_segments, uint64_t min_segment_size,
+                                             web_done_func done, void *userdata);
+int segmented_download_cancel(segmented_download *sd);
+
+#endif /* SEGMENTED_H__ */
@@ -1,3 +1,6 @@
+#ifndef STATE_H__
+#define STATE_H__
+
 /*
  * Copyright (C) 2008 Frank Aurich 
  *
@@ -17,7 +20,27 @@
  * 02111-1307, USA.
  */
 
+#include <stdint.h>
+
+#include "downloads.h"
+#include "statedb.h"
+
+/** When records of the state journal are flushed to disk */
+typedef enum {
+  STATE_SYNC_NEVER = 0,  /**< leave it to the operating system */
+  STATE_SYNC_PERIODIC,   /**< at most every few seconds, and once per polling cycle */
+  STATE_SYNC_ALWAYS      /**< after every record */
+} state_sync_policy;
+
+typedef struct state_journal state_journal;
+
+int save_state(const char* state_file, const download_history *downloads);
+int load_state(const char* state_file, download_history *downloads);
+int import_state(const char *text_file, const char *state_file, download_history *history);
 
+state_journal* state_journal_open(const char *state_file, download_history *history, state_sync_policy policy, uint32_t max_size);
+int  state_journal_append(state_journal *j, const char *url, const statedb_meta *meta);
+void state_journal_sync(state_journal *j);
+int  state_journal_close(state_journal *j);
 
-int save_state(const char* state_file, const simple_list const list);
-int load_state(const char* state_file, simple_list *list);
+#endif /* STATE_H__ */
@@ -0,0 +1,62 @@
+#ifndef STATEDB_H__
+#define STATEDB_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+
+#include "hash.h"
+
+/** Current version of the binary state file format */
+#define STATEDB_VERSION     1
+
+/** The file contains a metadata section */
+#define STATEDB_FLAG_META   0x1
+
+/** Metadata of a downloaded file */
+typedef struct statedb_meta {
+  int64_t  time;      /**< time of the download */
+  uint64_t size;      /**< size of the file in bytes */
+  uint32_t feed_id;   /**< ID of the feed the file was found in */
+  uint32_t reserved;
+} statedb_meta;
+
+/** An entry of the state file, as handed to statedb_write() */
+typedef struct statedb_entry {
+  hash128      digest;  /**< digest of the URL */
+  statedb_meta meta;
+} statedb_entry;
+
+typedef struct statedb statedb;
+
+uint8_t             statedb_is_binary(const char *path);
+statedb*            statedb_open(const char *path);
+void                statedb_close(statedb *db);
+uint64_t            statedb_count(const statedb *db);
+int64_t             statedb_find(const statedb *db, const hash128 *digest);
+const hash128*      statedb_digest(const statedb *db, uint64_t i);
+const statedb_meta* statedb_get_meta(const statedb *db, uint64_t i);
+int                 statedb_write(const char *path, statedb_entry *entries, uint64_t count, uint32_t flags);
+
+#endif /* STATEDB_H__ */
@@ -0,0 +1,71 @@
+#ifndef TRACE_H__
+#define TRACE_H__
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#include <stdint.h>
+
+/** A span that has been started with TRACE_BEGIN() */
+typedef struct trace_span {
+  const char *category;
+  const char *name;
+  int64_t     start;    /**< microseconds on the monotonic clock */
+} trace_span;
+
+/** set while a trace file is open */
+extern uint8_t trace_enabled;
+
+/* Spans cost a single test of trace_enabled while tracing is off. The names must be string
+** literals (or otherwise outlive the span); they are written to the trace as they are.
+*/
+
+/** start a span on the stack: trace_span span; TRACE_BEGIN(span, "feed", "processFeed"); */
+#define TRACE_BEGIN(span, cat, title) \
+  do { if(trace_enabled) { trace_span_begin(&(span), cat, title); } } while(0)
+
+/** end a span, with a numeric argument that is shown with it (\a key may be \c NULL) */
+#define TRACE_END_ARG(span, key, value) \
+  do { if(trace_enabled) { trace_span_end(&(span), key, (int64_t)(value)); } } while(0)
+
+#define TRACE_END(span) TRACE_END_ARG(span, NULL, 0)
+
+/** start/end a span that begins in one function and ends in another, e.g. a transfer.
+ * Spans of the same category are told apart by \a id.
+ */
+#define TRACE_ASYNC_BEGIN(cat, title, id) \
+  do { if(trace_enabled) { trace_async(cat, title, (uint64_t)(id), 'b', NULL, 0); } } while(0)
+
+#define TRACE_ASYNC_END_ARG(cat, title, id, key, value) \
+  do { if(trace_enabled) { trace_async(cat, title, (uint64_t)(id), 'e', key, (int64_t)(value)); } } while(0)
+
+#define TRACE_ASYNC_END(cat, title, id) TRACE_ASYNC_END_ARG(cat, title, id, NULL, 0)
+
+int  trace_open(const char *path, uint64_t max_size);
+void trace_close(void);
+void trace_flush(void);
+void trace_span_begin(trace_span *span, const char *category, const char *name);
+void trace_span_end(trace_span *span, const char *key, int64_t value);
+void trace_async(const char *category, const char *name, uint64_t id, char phase, const char *key, int64_t value);
+
+#endif /* TRACE_H__ */
@@ -24,28 +24,115 @@
 	#include "memwatch.h"
 #endif
 #define AM_DEFAULT_INTERVAL			30
+#define AM_DEFAULT_MAXCONNECTIONS	8
+#define AM_DEFAULT_MAXHOSTCONNECTIONS	2
+#define AM_DEFAULT_MAXDOWNLOADS		2
+#define AM_DEFAULT_MAXQUEUEDDOWNLOADS	20
+#define AM_DEFAULT_JOURNALSIZE		256
+#define AM_DEFAULT_DOWNLOADSEGMENTS	1
+#define AM_DEFAULT_MINSEGMENTSIZE	16
+#define AM_DEFAULT_MATCHCACHESIZE	4096
+#define AM_DEFAULT_TRACESIZE		64
 
 #include <stdint.h>
+#include <time.h>
 
 #include "feed_item.h"
 #include "rss_feed.h"
 #include "filters.h"
 
+struct web_multi;
+struct download_queue;
+struct download_history;
+struct state_journal;
+struct schedule;
+struct event_loop;
+struct event_timer;
+struct control_server;
+struct metrics;
+struct metric;
+struct metrics_server;
+
 /** \cond */
+struct am_metrics {
+	struct metrics        *registry;
+	struct metrics_server *server;
+	struct metric *feed_fetch_seconds;
+	struct metric *feed_fetch_errors;
+	struct metric *feed_bytes;
+	struct metric *feed_not_modified;
+	struct metric *feed_unchanged;
+	struct metric *feed_parse_seconds;
+	struct metric *feed_items;
+	struct metric *filter_checks;
+	struct metric *filter_regex_runs;
+	struct metric *filter_matches;
+	struct metric *downloads_done;
+	struct metric *downloads_failed;
+	struct metric *download_bytes;
+	struct metric *download_speed;
+	struct metric *downloads_running;
+	struct metric *downloads_waiting;
+	struct metric *history_entries;
+	struct metric *resident_memory;
+	struct metric *start_time;
+};
+
 struct auto_handle {
 	char *statefile;
 	char *download_folder;
 	char *prowl_key;
 	char *download_done_script;
+	char *feed_cache;
+	char *control_socket;
 	rss_feeds   feeds;
 	am_filters  filters;
-	simple_list downloads;
+	filter_matcher *filter_matcher;
+	match_cache *match_cache;
+	struct download_history *downloads;
+	struct state_journal *journal;
+	struct web_multi *transfers;
+	struct download_queue *download_queue;
+	struct schedule *schedule;
+	struct event_loop *events;
+	struct event_timer *feed_timer;
+	struct control_server *control;
+	struct am_metrics metrics;
 	int8_t      rpc_version;
 	uint8_t     prowl_key_valid;
-	uint16_t    max_bucket_items;
+	uint32_t    max_bucket_items;
 	uint8_t     bucket_changed;
 	uint8_t     check_interval;
+	uint32_t    min_interval;
+	uint32_t    max_interval;
 	uint8_t     match_only;
+	uint8_t     once;
+	uint16_t    max_connections;
+	uint16_t    max_host_connections;
+	uint16_t    max_downloads;
+	uint16_t    max_queued_downloads;
+	uint16_t    download_segments;
+	uint32_t    min_segment_size;
+	uint32_t    download_rate;
+	uint32_t    max_items_per_feed;
+	simple_list rate_windows;
+	uint32_t    feeds_pending;
+	uint8_t     feeds_changed;
+	uint64_t    filter_digest;
+	uint32_t    feeds_processed;
+	uint32_t    feeds_skipped;
+	uint32_t    rounds;          /**< number of completed rounds of feed checks */
+	uint32_t    round_checked;   /**< feeds checked in the current round */
+	uint32_t    round_processed; /**< feeds_processed when the current round started */
+	uint32_t    round_skipped;   /**< feeds_skipped when the current round started */
+	uint8_t     reload_pending;  /**< the configuration is reloaded once no feed is being checked */
+	time_t      started;
+	uint32_t    downloads_done;
+	uint32_t    downloads_failed;
+	filter_matcher_stats filter_totals; /**< counters of the filter matchers that were replaced by a reload */
+	uint16_t    metrics_port;
+	uint8_t     state_sync;
+	uint32_t    journal_size;
 };
 /** \endcond */
 
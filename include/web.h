@@ -21,8 +21,11 @@
  */
 
 #include <unistd.h>
+#include <stdint.h>
 #include <curl/curl.h>
 
+#include "event_loop.h"
+
 #define MAX_URL_LEN 1024
 
 #ifndef FALSE
@@ -38,17 +41,68 @@ struct HTTPResponse {
  long     responseCode;
  size_t   size;
  double   downloadSpeed;
+ double   total_time;       /**< duration of the transfer in seconds */
+ double   namelookup_time;  /**< time it took to resolve the host name, in seconds */
  char    *data;
  char    *content_filename; /**< name of the downloaded file determined through header field "Content-Length" */
+ char    *etag;             /**< value of the header field "ETag" */
+ char    *last_modified;    /**< value of the header field "Last-Modified" */
+ int32_t  max_age;          /**< freshness lifetime in seconds, from "Cache-Control" or "Expires" (-1: not given) */
+ uint64_t digest;           /**< XXH64 hash of the body (only for data received in memory) */
+ uint64_t content_length;   /**< value of the header field "Content-Length" (0 if unknown) */
+ uint8_t  accept_ranges;    /**< the server supports byte ranges ("Accept-Ranges: bytes") */
 };
 
 typedef struct HTTPResponse HTTPResponse;
 
+/** Function that receives the body of a response chunk by chunk, instead of it being kept in memory.
+ *
+ * It returns the number of bytes it has consumed. Any other value than \a len aborts the transfer.
+ */
+typedef size_t (*web_data_func)(const char *data, size_t len, void *userdata);
+
+/** Parameters of a transfer handed to web_multi_add() */
+struct HTTPRequest {
+ const char *url;        /**< URL of the object to download */
+ const char *cookies;    /**< (optional) explicit cookie string */
+ const char *useragent;  /**< (optional) User-Agent string */
+ const char *filename;   /**< (optional) store the body in this file instead of memory */
+ const char *etag;       /**< (optional) validator for a conditional request (If-None-Match) */
+ const char *last_modified; /**< (optional) validator for a conditional request (If-Modified-Since) */
+ web_data_func write_func;  /**< (optional) hand the body to this function instead of keeping it in memory */
+ void       *write_data;    /**< pointer that is handed to \a write_func */
+ const char *range;         /**< (optional) byte range to request, e.g. "0-1023" */
+ const char *if_range;      /**< (optional) validator the range depends on (If-Range) */
+ uint8_t     head_only;     /**< only request the headers (HEAD) */
+ uint8_t     shaped;        /**< the transfer is subject to the bandwidth limit of the web_multi object */
+ uint64_t    max_speed;     /**< (optional) bandwidth limit of this transfer in bytes per second */
+};
+
+typedef struct HTTPRequest HTTPRequest;
+
+typedef struct web_multi web_multi;
+
+/** Function that is called once a transfer of a web_multi object has finished */
+typedef void (*web_done_func)(HTTPResponse *response, void *userdata);
+
 HTTPResponse* getHTTPData(const char  *url, const char *cookies, CURL **curl_handle);
 HTTPResponse* downloadFile(const char *url, const char *filename, const char* useragent);
 HTTPResponse* sendHTTPData(const char *url, const void *data, unsigned int data_size);
+HTTPResponse* HTTPResponse_new(void);
 void     HTTPResponse_free(struct HTTPResponse *response);
 void     SessionID_free(void);
 void     closeCURLSession(CURL* curl_handle);
+void     CURLPool_free(void);
+
+web_multi* web_multi_new(uint16_t max_total, uint16_t max_per_host);
+void       web_multi_free(web_multi *m);
+int        web_multi_attach(web_multi *m, event_loop *loop);
+int        web_multi_add(web_multi *m, const HTTPRequest *req, web_done_func done, void *userdata);
+uint32_t   web_multi_perform(web_multi *m, int timeout_ms);
+uint32_t   web_multi_pending(const web_multi *m);
+uint32_t   web_multi_queued(const web_multi *m);
+int        web_multi_cancel(web_multi *m, void *userdata);
+void       web_multi_set_rate(web_multi *m, uint64_t rate);
+uint64_t   web_multi_get_rate(const web_multi *m);
 
 #endif /* WEB_H_ */
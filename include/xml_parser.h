@@ -2,6 +2,9 @@
 #define XML_PARSER_H__
 
 #include <stdint.h>
+#include <stddef.h>
+
+#include "feed_item.h"
 
 /*
  * Copyright (C) 2008 Frank Aurich 
@@ -22,6 +25,22 @@
  * 02111-1307, USA.
  */
 
+typedef struct feed_parser feed_parser;
+
+/** Function that receives each complete item of a feed_parser. It takes ownership of \a item. */
+typedef void (*feed_item_func)(feed_item item, void *userdata);
+
+feed_parser* feed_parser_new(feed_item_func callback, void *userdata);
+void         feed_parser_free(feed_parser *p);
+void         feed_parser_push(feed_parser *p, const char *data, size_t len);
+void         feed_parser_finish(feed_parser *p);
+void         feed_parser_stop(feed_parser *p);
+uint8_t      feed_parser_stopped(const feed_parser *p);
+uint32_t     feed_parser_item_count(const feed_parser *p);
+uint32_t     feed_parser_ttl(const feed_parser *p);
+uint32_t     feed_parser_skip_hours(const feed_parser *p);
+uint8_t      feed_parser_skip_days(const feed_parser *p);
+
 simple_list parse_xmldata(const char* buffer, uint32_t size, uint32_t *count, uint32_t *ttl);
 
 #endif
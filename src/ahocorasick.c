@@ -0,0 +1,263 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file ahocorasick.c
+ *
+ * Aho-Corasick automaton that finds a set of literals in a text in a single pass.
+ *
+ * Literals are compared without regard to ASCII case. Bytes that don't occur in any literal
+ * share one input class, so the transition table only has as many columns as there are
+ * distinct characters in the literals.
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "ahocorasick.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+/** \cond */
+struct ac_automaton {
+  char     **literals;     /**< lower case copies of the literals */
+  uint32_t  *ids;
+  uint32_t   count;
+  uint8_t    classes[256]; /**< input class of each byte (0: byte doesn't occur in any literal) */
+  uint32_t   class_count;
+  uint32_t   node_count;
+  int32_t   *delta;        /**< transitions: node * class_count + class -> node */
+  int32_t   *output;       /**< first literal that ends in a node (-1: none) */
+  int32_t   *next_output;  /**< next literal that ends in the same node as the given one */
+  int32_t   *dict;         /**< nearest node on the suffix chain that has an output (-1: none) */
+  uint8_t    compiled;
+};
+/** \endcond */
+
+/** \brief Create a new, empty automaton
+ *
+ * \return Pointer to the automaton, or \c NULL in case of an error
+ */
+PUBLIC ac_automaton* ac_new(void) {
+  ac_automaton *ac = am_malloc(sizeof(struct ac_automaton));
+
+  if(ac) {
+    memset(ac, 0, sizeof(struct ac_automaton));
+  }
+  return ac;
+}
+
+/** \brief Free an automaton */
+PUBLIC void ac_free(ac_automaton *ac) {
+  uint32_t i;
+
+  if(ac) {
+    for(i = 0; i < ac->count; ++i) {
+      am_free(ac->literals[i]);
+    }
+    am_free(ac->literals);
+    am_free(ac->ids);
+    am_free(ac->delta);
+    am_free(ac->output);
+    am_free(ac->next_output);
+    am_free(ac->dict);
+    am_free(ac);
+  }
+}
+
+/** \brief Add a literal to an automaton
+ *
+ * \param[in] ac Pointer to an automaton that hasn't been compiled yet
+ * \param[in] literal The literal (must not be empty)
+ * \param[in] id Number that is reported by ac_scan() when the literal is found
+ * \return 0 on success, -1 otherwise
+ */
+PUBLIC int ac_add(ac_automaton *ac, const char *literal, uint32_t id) {
+  char **literals = NULL;
+  uint32_t *ids = NULL;
+  char *copy = NULL;
+  uint32_t i;
+
+  if(!ac || ac->compiled || !literal || !*literal) {
+    return -1;
+  }
+
+  copy = am_strdup(literal);
+  literals = am_realloc(ac->literals, (ac->count + 1) * sizeof(char*));
+  if(literals) {
+    ac->literals = literals;
+  }
+  ids = am_realloc(ac->ids, (ac->count + 1) * sizeof(uint32_t));
+  if(ids) {
+    ac->ids = ids;
+  }
+  if(!copy || !literals || !ids) {
+    am_free(copy);
+    return -1;
+  }
+
+  for(i = 0; copy[i]; ++i) {
+    copy[i] = (char)tolower((unsigned char)copy[i]);
+  }
+  ac->literals[ac->count] = copy;
+  ac->ids[ac->count] = id;
+  ++ac->count;
+  return 0;
+}
+
+/* build the trie of all literals, then turn it into a complete state machine */
+PRIVATE int buildAutomaton(ac_automaton *ac, int32_t *fail, int32_t *queue) {
+  uint32_t i, c, head = 0, tail = 0;
+  int32_t node, next, u, v;
+  const unsigned char *p;
+
+  ac->node_count = 1;
+  for(i = 0; i < ac->count; ++i) {
+    node = 0;
+    for(p = (const unsigned char*)ac->literals[i]; *p; ++p) {
+      next = ac->delta[node * ac->class_count + ac->classes[*p]];
+      if(next < 0) {
+        next = (int32_t)ac->node_count++;
+        ac->delta[node * ac->class_count + ac->classes[*p]] = next;
+      }
+      node = next;
+    }
+    ac->next_output[i] = ac->output[node];
+    ac->output[node] = (int32_t)i;
+  }
+
+  /* breadth-first: the failure links of a node's children depend on the node's own transitions */
+  fail[0] = 0;
+  ac->dict[0] = -1;
+  for(c = 0; c < ac->class_count; ++c) {
+    v = ac->delta[c];
+    if(v < 0) {
+      ac->delta[c] = 0;
+    } else {
+      fail[v] = 0;
+      ac->dict[v] = -1;
+      queue[tail++] = v;
+    }
+  }
+
+  while(head < tail) {
+    u = queue[head++];
+    for(c = 0; c < ac->class_count; ++c) {
+      v = ac->delta[u * ac->class_count + c];
+      if(v < 0) {
+        ac->delta[u * ac->class_count + c] = ac->delta[fail[u] * ac->class_count + c];
+      } else {
+        fail[v] = ac->delta[fail[u] * ac->class_count + c];
+        ac->dict[v] = ac->output[fail[v]] >= 0 ? fail[v] : ac->dict[fail[v]];
+        queue[tail++] = v;
+      }
+    }
+  }
+  return 0;
+}
+
+/** \brief Prepare an automaton for scanning
+ *
+ * \param[in] ac Pointer to an automaton
+ * \return 0 on success, -1 otherwise
+ *
+ * No literals can be added afterwards.
+ */
+PUBLIC int ac_compile(ac_automaton *ac) {
+  uint32_t i, max_nodes = 1;
+  const unsigned char *p;
+  int32_t *fail = NULL, *queue = NULL;
+  int result = -1;
+
+  if(!ac || ac->compiled) {
+    return -1;
+  }
+
+  /* class 0 is reserved for all bytes that don't occur in the literals */
+  ac->class_count = 1;
+  for(i = 0; i < ac->count; ++i) {
+    for(p = (const unsigned char*)ac->literals[i]; *p; ++p) {
+      if(ac->classes[*p] == 0) {
+        if(ac->class_count > UINT8_MAX) {
+          /* too many different bytes for the class table */
+          return -1;
+        }
+        ac->classes[*p] = (uint8_t)ac->class_count;
+        ac->classes[toupper(*p)] = (uint8_t)ac->class_count;
+        ++ac->class_count;
+      }
+      ++max_nodes;
+    }
+  }
+
+  ac->delta = am_malloc(max_nodes * ac->class_count * sizeof(int32_t));
+  ac->output = am_malloc(max_nodes * sizeof(int32_t));
+  ac->dict = am_malloc(max_nodes * sizeof(int32_t));
+  ac->next_output = am_malloc((ac->count > 0 ? ac->count : 1) * sizeof(int32_t));
+  fail = am_malloc(max_nodes * sizeof(int32_t));
+  queue = am_malloc(max_nodes * sizeof(int32_t));
+
+  if(ac->delta && ac->output && ac->dict && ac->next_output && fail && queue) {
+    memset(ac->delta, 0xff, max_nodes * ac->class_count * sizeof(int32_t));
+    memset(ac->output, 0xff, max_nodes * sizeof(int32_t));
+    result = buildAutomaton(ac, fail, queue);
+    ac->compiled = (result == 0);
+  }
+
+  am_free(fail);
+  am_free(queue);
+  return result;
+}
+
+/** \brief Find all literals in a text
+ *
+ * \param[in] ac Pointer to a compiled automaton
+ * \param[in] text The text
+ * \param[in] len Length of the text
+ * \param[in] found Function that is called with the ID of every literal occurrence
+ * \param[in] userdata Pointer that is handed to \a found
+ */
+PUBLIC void ac_scan(const ac_automaton *ac, const char *text, uint32_t len, ac_match_func found, void *userdata) {
+  const unsigned char *p = (const unsigned char*)text;
+  const unsigned char *end = p + len;
+  int32_t state = 0, t, o;
+
+  if(!ac || !ac->compiled || !text || !found) {
+    return;
+  }
+
+  while(p < end) {
+    state = ac->delta[state * ac->class_count + ac->classes[*p++]];
+    for(t = ac->output[state] >= 0 ? state : ac->dict[state]; t >= 0; t = ac->dict[t]) {
+      for(o = ac->output[t]; o >= 0; o = ac->next_output[o]) {
+        found(ac->ids[o], userdata);
+      }
+    }
+  }
+}
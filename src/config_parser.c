@@ -44,8 +44,10 @@
 #include "filters.h"
 #include "list.h"
 #include "output.h"
+#include "ratelimit.h"
 #include "regex.h"
 #include "rss_feed.h"
+#include "state.h"
 #include "utils.h"
 
 
@@ -94,6 +96,18 @@ PRIVATE int parseUInt(const char *str) {
   return -1;
 }
 
+/* bandwidth in kB/s, where 0 means unlimited */
+PRIVATE int parseRate(const char *str) {
+  char *end = NULL;
+  long rate;
+
+  rate = strtol(str, &end, 10);
+  while(end && isspace(*end)) {
+    ++end;
+  }
+  return (end != str && *end == '\0' && rate >= 0 && rate <= INT32_MAX) ? (int)rate : -1;
+}
+
 PRIVATE char* shorten(const char *str) {
 
   int tmp_pos;
@@ -190,6 +204,14 @@ PRIVATE int parseFilter(am_filters *patlist, const char* match) {
         filter->pattern = shorten(param);
       } else if(!strncmp(option, "useragent", 9)) {
         filter->agent = shorten(param);
+      } else if(!strncmp(option, "priority", 8)) {
+        filter->priority = atoi(param);
+      } else if(!strncmp(option, "max-speed", 9)) {
+        if(parseRate(param) >= 0) {
+          filter->max_speed = (uint32_t)parseRate(param);
+        } else {
+          dbg_printf(P_ERROR, "Invalid bandwidth limit: '%s'", param);
+        }
       } else {
         dbg_printf(P_ERROR, "Unknown suboption '%s'!", option);
       }
@@ -202,9 +224,14 @@ PRIVATE int parseFilter(am_filters *patlist, const char* match) {
   }
 
   if(filter && filter->pattern) {
+    filter->regex = compileRegEx(filter->pattern);
+  }
+
+  if(filter && filter->regex) {
     filter_add(filter, patlist);
   } else {
     dbg_printf(P_ERROR, "Invalid filter: '%s'", str);
+    filter_free(filter);
     result = FAILURE;
   }
 
@@ -222,13 +249,42 @@ PRIVATE int addPatterns_old(am_filters *patlist, const char* strlist) {
     am_filter pat = filter_new();
     assert(pat != NULL);
     pat->pattern = strdup(p);
-    filter_add(pat, patlist);
+    pat->regex = compileRegEx(pat->pattern);
+    if(pat->regex) {
+      filter_add(pat, patlist);
+    } else {
+      dbg_printf(P_ERROR, "Invalid pattern: '%s'", p);
+      filter_free(pat);
+    }
     p = strtok(NULL, AM_DELIMITER);
   }
   am_free(str);
   return SUCCESS;
 }
 
+/* time span in seconds: a number with the unit 's', 'm' or 'h' (minutes, if there is none) */
+PRIVATE int32_t parseDuration(const char *str) {
+  char *end = NULL;
+  long value;
+  long unit = 60;
+
+  value = strtol(str, &end, 10);
+  if(end == str) {
+    return -1;
+  }
+  while(isspace(*end)) {
+    ++end;
+  }
+  if(*end == 's' || *end == 'm' || *end == 'h') {
+    unit = *end == 's' ? 1 : (*end == 'm' ? 60 : 3600);
+    ++end;
+  }
+  while(isspace(*end)) {
+    ++end;
+  }
+  return (*end == '\0' && value > 0 && value <= INT32_MAX / unit) ? (int32_t)(value * unit) : -1;
+}
+
 PRIVATE void parseCookiesFromURL(rss_feed* feed) {
   const char* result_regex = ":COOKIE:(.+)";
 
@@ -242,6 +298,7 @@ PRIVATE int parseFeed(rss_feeds *feeds, const char* feedstr) {
   char *saveptr;
   char *str = NULL;
   rss_feed* feed = NULL;
+  int32_t numval;
   int result = SUCCESS; /* be optimistic */
 
   str = shorten(feedstr);
@@ -257,6 +314,27 @@ PRIVATE int parseFeed(rss_feeds *feeds, const char* feedstr) {
         feed->url = shorten(param);
       } else if(!strncmp(option, "cookies", 6)) {
         feed->cookies = shorten(param);
+      } else if(!strncmp(option, "stop-after-known", 16)) {
+        numval = atoi(param);
+        if(numval > 0) {
+          feed->stop_after_known = numval;
+        } else {
+          dbg_printf(P_ERROR, "Invalid value for '%s': %s", option, param);
+        }
+      } else if(!strncmp(option, "interval", 8)) {
+        numval = parseDuration(param);
+        if(numval > 0) {
+          feed->interval = numval;
+        } else {
+          dbg_printf(P_ERROR, "Invalid value for '%s': %s", option, param);
+        }
+      } else if(!strncmp(option, "max-items", 9)) {
+        numval = atoi(param);
+        if(numval > 0) {
+          feed->max_items = numval;
+        } else {
+          dbg_printf(P_ERROR, "Invalid value for '%s': %s", option, param);
+        }
       } else {
         dbg_printf(P_ERROR, "Unknown suboption '%s'!", option);
       }
@@ -285,6 +363,61 @@ PRIVATE int parseFeed(rss_feeds *feeds, const char* feedstr) {
   return result;
 }
 
+PRIVATE int parseRateWindow(simple_list *windows, const char* windowstr) {
+  char *line = NULL, *option = NULL, *param = NULL;
+  char *value = NULL;
+  char *saveptr;
+  char *str = NULL;
+  rate_window *w = NULL;
+  uint8_t have_start = 0, have_end = 0;
+  int rate = -1;
+  int result = SUCCESS;
+
+  w = am_malloc(sizeof(rate_window));
+  if(!w) {
+    return FAILURE;
+  }
+
+  str = shorten(windowstr);
+
+  line = strtok_r(str, AM_DELIMITER, &saveptr);
+  while (line) {
+    if(parseSubOption(line, &option, &param) == 0) {
+      value = shorten(param);
+      if(!strncmp(option, "from", 4)) {
+        have_start = (value && parseTimeOfDay(value, &w->start) == 0);
+      } else if(!strncmp(option, "to", 2)) {
+        have_end = (value && parseTimeOfDay(value, &w->end) == 0);
+      } else if(!strncmp(option, "rate", 4)) {
+        rate = value ? parseRate(value) : -1;
+      } else {
+        dbg_printf(P_ERROR, "Unknown suboption '%s'!", option);
+      }
+      am_free(value);
+      am_free(option);
+      am_free(param);
+    } else {
+      dbg_printf(P_ERROR, "Invalid suboption string: '%s'!", line);
+    }
+    line = strtok_r(NULL, AM_DELIMITER, &saveptr);
+  }
+
+  if(have_start && have_end && rate >= 0) {
+    /* "24:00" is the same as midnight */
+    w->start %= 24 * 60;
+    w->end   %= 24 * 60;
+    w->rate = (uint64_t)rate * 1024;
+    addToTail(w, windows);
+  } else {
+    dbg_printf(P_ERROR, "Invalid download rate window (from, to and rate are required): '%s'", str);
+    am_free(w);
+    result = FAILURE;
+  }
+
+  am_free(str);
+  return result;
+}
+
 PRIVATE int getFeeds(NODE **head, const char* strlist) {
   char *p = NULL;
   char *str;
@@ -336,6 +469,95 @@ PRIVATE int set_option(auto_handle *as, const char *opt, const char *param, opti
     } else {
       dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
     }
+  } else if(!strcmp(opt, "min-interval")) {
+    numval = parseUInt(param);
+    if(numval > 0) {
+      as->min_interval = numval;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
+  } else if(!strcmp(opt, "max-interval")) {
+    numval = parseUInt(param);
+    if(numval > 0) {
+      as->max_interval = numval;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
+  } else if(!strcmp(opt, "max-connections")) {
+    numval = parseUInt(param);
+    if(numval > 0) {
+      as->max_connections = numval;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
+  } else if(!strcmp(opt, "max-host-connections")) {
+    numval = parseUInt(param);
+    if(numval > 0) {
+      as->max_host_connections = numval;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
+  } else if(!strcmp(opt, "max-downloads")) {
+    numval = parseUInt(param);
+    if(numval > 0) {
+      as->max_downloads = numval;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
+  } else if(!strcmp(opt, "max-queued-downloads")) {
+    numval = parseUInt(param);
+    if(numval > 0) {
+      as->max_queued_downloads = numval;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
+  } else if(!strcmp(opt, "download-segments")) {
+    numval = parseUInt(param);
+    if(numval > 0) {
+      as->download_segments = numval;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
+  } else if(!strcmp(opt, "min-segment-size")) {
+    numval = parseUInt(param);
+    if(numval > 0) {
+      as->min_segment_size = numval;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
+  } else if(!strcmp(opt, "max-items-per-feed")) {
+    numval = parseUInt(param);
+    if(numval > 0) {
+      as->max_items_per_feed = numval;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
+  } else if(!strcmp(opt, "download-rate")) {
+    numval = parseRate(param);
+    if(numval >= 0) {
+      as->download_rate = numval;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
+  } else if(!strcmp(opt, "download-rate-window")) {
+    parseRateWindow(&as->rate_windows, param);
+  } else if(!strcmp(opt, "state-sync")) {
+    if(!strcmp(param, "always")) {
+      as->state_sync = STATE_SYNC_ALWAYS;
+    } else if(!strcmp(param, "periodic")) {
+      as->state_sync = STATE_SYNC_PERIODIC;
+    } else if(!strcmp(param, "never")) {
+      as->state_sync = STATE_SYNC_NEVER;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
+  } else if(!strcmp(opt, "journal-size")) {
+    numval = parseUInt(param);
+    if(numval >= 0) {
+      as->journal_size = numval;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
   } else if(!strcmp(opt, "patterns")) {
     addPatterns_old(&as->filters, param);
   } else if(!strcmp(opt, "filter")) {
@@ -344,6 +566,20 @@ PRIVATE int set_option(auto_handle *as, const char *opt, const char *param, opti
     as->prowl_key = am_strdup(param);
   } else if(!strcmp(opt, "download-done-script")) {
     as->download_done_script = am_strdup(param);
+  } else if(!strcmp(opt, "control-socket")) {
+    if(!strcmp(param, "none")) {
+      am_free(as->control_socket);
+      as->control_socket = am_strdup("");
+    } else {
+      set_path(param, &as->control_socket);
+    }
+  } else if(!strcmp(opt, "metrics-port")) {
+    numval = parseUInt(param);
+    if(numval >= 0 && numval <= 65535) {
+      as->metrics_port = numval;
+    } else {
+      dbg_printf(P_ERROR, "Unknown parameter: %s=%s", opt, param);
+    }
   } else {
     dbg_printf(P_ERROR, "Unknown option: %s", opt);
   }
@@ -0,0 +1,552 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file control.c
+ *
+ * Control socket of the daemon: a Unix domain socket that accepts commands, one per line.
+ *
+ * Each command is answered with any number of data lines ("- " followed by the text) and a
+ * final status line, which is either "OK" (optionally followed by a message) or "ERR <message>".
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+#include "output.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+/** maximum number of clients connected at the same time */
+#define CONTROL_MAX_CLIENTS 16
+
+/** time in milliseconds after which a client that neither sends nor receives anything is disconnected */
+#define CONTROL_IDLE_TIMEOUT 10000
+
+/** time in seconds control_send() waits for the answer of the daemon */
+#define CONTROL_TIMEOUT 60
+
+/** \cond */
+struct control_client {
+  control_client *next;
+  control_server *server;
+  int             fd;
+  event_timer    *timer;    /**< closes the connection once the client has been idle for too long */
+  uint32_t        events;   /**< events the event loop watches for */
+  uint8_t         hangup;   /**< the client has sent all its commands and is closed once all output has been sent */
+  char            in[CONTROL_MAX_LINE];
+  size_t          in_len;
+  char           *out;
+  size_t          out_len;
+  size_t          out_size;
+};
+
+struct control_server {
+  event_loop     *loop;
+  int             fd;
+  char           *path;
+  control_client *clients;
+  uint32_t        client_count;
+  uint32_t        timeout;  /**< see CONTROL_IDLE_TIMEOUT */
+  control_func    func;
+  void           *userdata;
+};
+/** \endcond */
+
+PRIVATE void control_client_free(control_client *c) {
+  control_client **pos = NULL;
+
+  if(!c) {
+    return;
+  }
+
+  for(pos = &c->server->clients; *pos; pos = &(*pos)->next) {
+    if(*pos == c) {
+      *pos = c->next;
+      --c->server->client_count;
+      break;
+    }
+  }
+  event_timer_free(c->timer);
+  event_loop_unwatch(c->server->loop, c->fd);
+  close(c->fd);
+  am_free(c->out);
+  am_free(c);
+}
+
+/* append a line to the output of a client. Line breaks and other control characters within the
+** text are replaced, so the text can't be mistaken for a status line.
+*/
+PRIVATE void appendLine(control_client *c, const char *prefix, const char *format, va_list ap) {
+  va_list copy;
+  size_t prefix_len = strlen(prefix);
+  size_t needed, i;
+  char *tmp = NULL;
+  int len = 0;
+
+  if(format) {
+    va_copy(copy, ap);
+    len = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+    if(len < 0) {
+      len = 0;
+    }
+  }
+
+  needed = c->out_len + prefix_len + (size_t)len + 2;
+  if(needed > c->out_size) {
+    tmp = am_realloc(c->out, needed > 2 * c->out_size ? needed : 2 * c->out_size);
+    if(!tmp) {
+      dbg_printf(P_ERROR, "[control] Unable to buffer the answer to a command");
+      return;
+    }
+    c->out = tmp;
+    c->out_size = needed > 2 * c->out_size ? needed : 2 * c->out_size;
+  }
+
+  memcpy(c->out + c->out_len, prefix, prefix_len);
+  c->out_len += prefix_len;
+  if(len > 0) {
+    vsnprintf(c->out + c->out_len, (size_t)len + 1, format, ap);
+    for(i = c->out_len; i < c->out_len + (size_t)len; ++i) {
+      if((unsigned char)c->out[i] < 0x20) {
+        c->out[i] = ' ';
+      }
+    }
+    c->out_len += (size_t)len;
+  }
+  c->out[c->out_len++] = '\n';
+}
+
+/** \brief Send a line of data to a client
+ *
+ * \param[in] client The client that has sent the command
+ * \param[in] format printf-like format string
+ */
+PUBLIC void control_reply(control_client *client, const char *format, ...) {
+  va_list ap;
+
+  va_start(ap, format);
+  appendLine(client, "- ", format, ap);
+  va_end(ap);
+}
+
+/** \brief Report the success of a command
+ *
+ * \param[in] client The client that has sent the command
+ * \param[in] format (Optional) printf-like format string of a message
+ */
+PUBLIC void control_reply_ok(control_client *client, const char *format, ...) {
+  va_list ap;
+
+  va_start(ap, format);
+  appendLine(client, format ? "OK " : "OK", format, ap);
+  va_end(ap);
+}
+
+/** \brief Report the failure of a command
+ *
+ * \param[in] client The client that has sent the command
+ * \param[in] format printf-like format string of the error message
+ */
+PUBLIC void control_reply_error(control_client *client, const char *format, ...) {
+  va_list ap;
+
+  va_start(ap, format);
+  appendLine(client, "ERR ", format, ap);
+  va_end(ap);
+}
+
+/* split a command line into words and hand it to the command function */
+PRIVATE void runCommand(control_client *c, char *line) {
+  char *argv[CONTROL_MAX_ARGS + 1];
+  char *saveptr = NULL;
+  char *word = NULL;
+  int argc = 0;
+
+  for(word = strtok_r(line, " \t\r", &saveptr); word; word = strtok_r(NULL, " \t\r", &saveptr)) {
+    if(argc == CONTROL_MAX_ARGS) {
+      control_reply_error(c, "Too many arguments");
+      return;
+    }
+    argv[argc++] = word;
+  }
+  argv[argc] = NULL;
+
+  if(argc > 0) {
+    dbg_printf(P_INFO2, "[control] Command '%s' (%d arguments)", argv[0], argc - 1);
+    c->server->func(c, argc, argv, c->server->userdata);
+  }
+}
+
+/* carry out all complete command lines received so far */
+PRIVATE void processInput(control_client *c) {
+  char *eol = NULL;
+  size_t line_len;
+
+  while((eol = memchr(c->in, '\n', c->in_len)) != NULL) {
+    *eol = '\0';
+    line_len = (size_t)(eol - c->in) + 1;
+    runCommand(c, c->in);
+    memmove(c->in, c->in + line_len, c->in_len - line_len);
+    c->in_len -= line_len;
+  }
+
+  if(c->in_len == sizeof(c->in)) {
+    control_reply_error(c, "Line too long");
+    c->in_len = 0;
+    c->hangup = 1;
+  }
+}
+
+PRIVATE void onClientReady(int fd, uint32_t events, void *userdata);
+
+/* send as much of the output as the socket takes, and watch for the events the client is waiting for */
+PRIVATE int flushClient(control_client *c) {
+  ssize_t n;
+  uint32_t wanted;
+
+  while(c->out_len > 0) {
+    n = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL);
+    if(n < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      if(errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      return -1;
+    }
+    memmove(c->out, c->out + n, c->out_len - (size_t)n);
+    c->out_len -= (size_t)n;
+  }
+
+  if(c->hangup && c->out_len == 0) {
+    return -1;
+  }
+
+  wanted = (c->hangup ? 0 : EVENT_READ) | (c->out_len > 0 ? EVENT_WRITE : 0);
+  if(wanted != c->events) {
+    if(event_loop_watch(c->server->loop, c->fd, wanted, onClientReady, c) != 0) {
+      return -1;
+    }
+    c->events = wanted;
+  }
+  return 0;
+}
+
+PRIVATE void onClientReady(int fd, uint32_t events, void *userdata) {
+  control_client *c = (control_client*)userdata;
+  ssize_t n;
+
+  if(events & EVENT_READ) {
+    n = recv(fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+    if(n > 0) {
+      c->in_len += (size_t)n;
+      processInput(c);
+    } else if(n == 0) {
+      /* a last command without a line feed */
+      if(c->in_len > 0) {
+        c->in[c->in_len] = '\0';
+        runCommand(c, c->in);
+        c->in_len = 0;
+      }
+      c->hangup = 1;
+    } else if(errno != EAGAIN && errno != EINTR) {
+      control_client_free(c);
+      return;
+    }
+  } else if(events & EVENT_ERROR) {
+    control_client_free(c);
+    return;
+  }
+
+  if(flushClient(c) != 0 || event_timer_after(c->timer, c->server->timeout) != 0) {
+    control_client_free(c);
+  }
+}
+
+/* idle clients would take up the slots of the others */
+PRIVATE void onClientTimeout(event_timer *timer, void *userdata) {
+  control_client *c = (control_client*)userdata;
+
+  (void)timer;
+  dbg_printf(P_INFO2, "[control] Client has been idle for too long, closing the connection");
+  control_client_free(c);
+}
+
+PRIVATE void onAccept(int fd, uint32_t events, void *userdata) {
+  control_server *server = (control_server*)userdata;
+  control_client *c = NULL;
+  int client_fd;
+
+  (void)events;
+
+  while((client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    if(server->client_count >= CONTROL_MAX_CLIENTS) {
+      dbg_printf(P_ERROR, "[control] Too many clients, connection refused");
+      close(client_fd);
+      continue;
+    }
+
+    c = am_malloc(sizeof(struct control_client));
+    if(!c) {
+      close(client_fd);
+      continue;
+    }
+    memset(c, 0, sizeof(struct control_client));
+    c->server = server;
+    c->fd = client_fd;
+    c->events = EVENT_READ;
+    c->timer = event_timer_new(server->loop, onClientTimeout, c);
+    if(!c->timer || event_timer_after(c->timer, server->timeout) != 0 ||
+       event_loop_watch(server->loop, client_fd, EVENT_READ, onClientReady, c) != 0) {
+      event_timer_free(c->timer);
+      close(client_fd);
+      am_free(c);
+      continue;
+    }
+    c->next = server->clients;
+    server->clients = c;
+    ++server->client_count;
+  }
+}
+
+PRIVATE int fillAddress(struct sockaddr_un *addr, const char *path) {
+  if(!path || !*path || strlen(path) >= sizeof(addr->sun_path)) {
+    return -1;
+  }
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+/* check whether a daemon is listening on the socket */
+PRIVATE uint8_t isListening(const struct sockaddr_un *addr) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  uint8_t result = 0;
+
+  if(fd >= 0) {
+    result = connect(fd, (const struct sockaddr*)addr, sizeof(struct sockaddr_un)) == 0 ? 1 : 0;
+    close(fd);
+  }
+  return result;
+}
+
+/** \brief Open the control socket
+ *
+ * \param[in] loop Event loop that serves the clients
+ * \param[in] path Path of the socket file
+ * \param[in] func Function that carries out the commands
+ * \param[in] userdata Pointer that is handed to \a func
+ * \return Pointer to the new server, or \c NULL if the socket couldn't be opened
+ *
+ * The socket file is only accessible to the user the daemon runs as. A socket file that was
+ * left behind by an earlier instance is replaced.
+ */
+PUBLIC control_server* control_server_new(event_loop *loop, const char *path, control_func func, void *userdata) {
+  control_server *server = NULL;
+  struct sockaddr_un addr;
+  struct stat st;
+  mode_t old_mask;
+  int fd, rc;
+
+  if(!loop || !func || fillAddress(&addr, path) != 0) {
+    dbg_printf(P_ERROR, "[control_server_new] Invalid socket path '%s'", path ? path : "");
+    return NULL;
+  }
+
+  if(lstat(path, &st) == 0) {
+    if(!S_ISSOCK(st.st_mode)) {
+      dbg_printf(P_ERROR, "[control_server_new] '%s' exists and is not a socket", path);
+      return NULL;
+    }
+    if(isListening(&addr)) {
+      dbg_printf(P_ERROR, "[control_server_new] Another instance is listening on '%s'", path);
+      return NULL;
+    }
+    unlink(path);
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    dbg_printf(P_ERROR, "[control_server_new] socket: %s", strerror(errno));
+    return NULL;
+  }
+
+  old_mask = umask(077);
+  rc = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+  umask(old_mask);
+  if(rc != 0 || listen(fd, CONTROL_MAX_CLIENTS) != 0) {
+    dbg_printf(P_ERROR, "[control_server_new] Unable to listen on '%s': %s", path, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  server = am_malloc(sizeof(struct control_server));
+  if(server) {
+    server->loop = loop;
+    server->fd = fd;
+    server->path = am_strdup(path);
+    server->clients = NULL;
+    server->client_count = 0;
+    server->timeout = CONTROL_IDLE_TIMEOUT;
+    server->func = func;
+    server->userdata = userdata;
+  }
+  if(!server || !server->path || event_loop_watch(loop, fd, EVENT_READ, onAccept, server) != 0) {
+    if(server) {
+      am_free(server->path);
+      am_free(server);
+    }
+    close(fd);
+    unlink(path);
+    return NULL;
+  }
+  return server;
+}
+
+/** \brief Change the time after which idle clients are disconnected
+ *
+ * \param[in] server Pointer to a control server
+ * \param[in] timeout_ms Time in milliseconds without any data sent or received
+ */
+PUBLIC void control_server_set_timeout(control_server *server, uint32_t timeout_ms) {
+  if(server && timeout_ms > 0) {
+    server->timeout = timeout_ms;
+  }
+}
+
+/** \brief Close the control socket and all client connections, and remove the socket file */
+PUBLIC void control_server_free(control_server *server) {
+  if(server) {
+    while(server->clients) {
+      control_client_free(server->clients);
+    }
+    event_loop_unwatch(server->loop, server->fd);
+    close(server->fd);
+    unlink(server->path);
+    am_free(server->path);
+    am_free(server);
+  }
+}
+
+/** \brief Send a command to a running daemon and print its answer
+ *
+ * \param[in] path Path of the control socket
+ * \param[in] command The command line
+ * \return 0 if the command succeeded, 1 if it failed, -1 if the daemon couldn't be reached.
+ *
+ * Data lines are printed to stdout, error messages to stderr.
+ */
+PUBLIC int control_send(const char *path, const char *command) {
+  struct sockaddr_un addr;
+  struct timeval timeout;
+  FILE *fp = NULL;
+  char *line = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  size_t command_len;
+  int fd, result = -1;
+
+  if(fillAddress(&addr, path) != 0 || !command) {
+    fprintf(stderr, "Invalid control socket '%s'\n", path ? path : "");
+    return -1;
+  }
+
+  command_len = strlen(command);
+  if(command_len + 1 > CONTROL_MAX_LINE) {
+    fprintf(stderr, "Command too long\n");
+    return -1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "Unable to connect to '%s': %s\n", path, strerror(errno));
+    if(fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+
+  timeout.tv_sec = CONTROL_TIMEOUT;
+  timeout.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if(send(fd, command, command_len, MSG_NOSIGNAL) != (ssize_t)command_len ||
+     send(fd, "\n", 1, MSG_NOSIGNAL) != 1) {
+    fprintf(stderr, "Unable to send the command: %s\n", strerror(errno));
+    close(fd);
+    return -1;
+  }
+  shutdown(fd, SHUT_WR);
+
+  fp = fdopen(fd, "r");
+  if(!fp) {
+    close(fd);
+    return -1;
+  }
+
+  while((len = getline(&line, &line_size, fp)) > 0) {
+    while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if(!strncmp(line, "- ", 2)) {
+      printf("%s\n", line + 2);
+    } else if(!strcmp(line, "OK") || !strncmp(line, "OK ", 3)) {
+      if(line[2]) {
+        printf("%s\n", line + 3);
+      }
+      result = 0;
+      break;
+    } else if(!strncmp(line, "ERR ", 4)) {
+      fprintf(stderr, "Error: %s\n", line + 4);
+      result = 1;
+      break;
+    }
+  }
+
+  if(result < 0) {
+    fprintf(stderr, "No answer from the daemon\n");
+  }
+  free(line);
+  fclose(fp);
+  return result;
+}
@@ -0,0 +1,497 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file download_queue.c
+ *
+ * Queue of pending file downloads, processed in the background of the feed polling.
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "download_queue.h"
+#include "output.h"
+#include "partfile.h"
+#include "trace.h"
+#include "utils.h"
+#include "web.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+/** \cond */
+struct download_queue {
+  web_multi          *engine;      /**< transfer engine the downloads are handed to */
+  download_job       *waiting;     /**< jobs sorted by priority (highest first) */
+  download_job       *running;     /**< jobs handed to the transfer engine */
+  uint32_t            waiting_count;
+  uint32_t            running_count;
+  uint32_t            next_id;
+  uint16_t            max_active;  /**< maximum number of parallel downloads */
+  uint16_t            max_queued;  /**< queue length at which the feed polling is throttled */
+  uint16_t            segments;    /**< maximum number of segments of a download (1: no segmented downloads) */
+  uint64_t            min_segment_size;
+  uint8_t             closing;
+  uint8_t             paused;      /**< no downloads are running until the queue is resumed */
+  download_done_func  done;
+  void               *userdata;
+};
+/** \endcond */
+
+PRIVATE void download_job_free(download_job *job) {
+  if(job) {
+    am_free(job->url);
+    am_free(job->filename);
+    am_free(job->useragent);
+    am_free(job->name);
+    freeList(&job->mirrors, NULL);
+    am_free(job);
+  }
+}
+
+PRIVATE void unlinkJob(download_job **head, download_job *job) {
+  while(*head && *head != job) {
+    head = &(*head)->next;
+  }
+  if(*head) {
+    *head = job->next;
+  }
+  job->next = NULL;
+}
+
+/* keep the waiting jobs sorted: behind all jobs with a higher priority, and behind (or, if \a ahead
+** is set, in front of) the jobs with the same priority
+*/
+PRIVATE void insertJob(download_queue *q, download_job *job, uint8_t ahead) {
+  download_job **pos = &q->waiting;
+
+  while(*pos && ((*pos)->priority > job->priority || (!ahead && (*pos)->priority == job->priority))) {
+    pos = &(*pos)->next;
+  }
+  job->next = *pos;
+  *pos = job;
+  ++q->waiting_count;
+}
+
+/* a cancelled download won't be resumed */
+PRIVATE void removePartialFile(const char *filename) {
+  char *part_file = part_file_name(filename);
+
+  if(part_file) {
+    unlink(part_file);
+    part_info_remove(part_file);
+    am_free(part_file);
+  }
+}
+
+PRIVATE void download_queue_dispatch(download_queue *q);
+
+/* completion callback of the transfer engine */
+PRIVATE void jobFinished(HTTPResponse *response, void *userdata) {
+  download_job   *job = (download_job*)userdata;
+  download_queue *q = job->queue;
+
+  TRACE_ASYNC_END_ARG("download", "download", job->id, "bytes", response ? response->size : 0);
+  job->segmented = NULL;
+  unlinkJob(&q->running, job);
+  --q->running_count;
+
+  /* stopped by download_queue_pause(): the download is resumed from the partial file later on */
+  if(job->requeue && !q->closing) {
+    HTTPResponse_free(response);
+    job->requeue = 0;
+    insertJob(q, job, 1);
+    return;
+  }
+
+  if(q->closing || job->cancelled) {
+    HTTPResponse_free(response);
+  } else if(q->done) {
+    q->done(job, response, q->userdata);
+  } else {
+    HTTPResponse_free(response);
+  }
+
+  if(job->cancelled) {
+    removePartialFile(job->filename);
+  }
+  download_job_free(job);
+
+  if(!q->closing) {
+    download_queue_dispatch(q);
+  }
+}
+
+/* hand the jobs with the highest priority to the transfer engine until all slots are taken */
+PRIVATE void download_queue_dispatch(download_queue *q) {
+  download_job *job = NULL;
+  HTTPRequest req;
+
+  while(!q->paused && q->waiting && q->running_count < q->max_active) {
+    job = q->waiting;
+    q->waiting = job->next;
+    --q->waiting_count;
+
+    job->next = q->running;
+    q->running = job;
+    ++q->running_count;
+
+    memset(&req, 0, sizeof(req));
+    req.url       = job->url;
+    req.filename  = job->filename;
+    req.useragent = job->useragent;
+    req.shaped    = 1;
+    req.max_speed = job->max_speed;
+
+    dbg_printf(P_INFO, "[%d] Starting download #%d: %s", job->feed_id, job->id, job->url);
+    TRACE_ASYNC_BEGIN("download", "download", job->id);
+    if(q->segments > 1) {
+      job->segmented = segmented_download_start(q->engine, &req, job->mirrors, q->segments, q->min_segment_size,
+                                                jobFinished, job);
+      if(!job->segmented) {
+        dbg_printf(P_ERROR, "[download_queue_dispatch] Unable to start download of '%s'", job->url);
+        jobFinished(NULL, job);
+        return;
+      }
+    } else if(web_multi_add(q->engine, &req, jobFinished, job) != 0) {
+      dbg_printf(P_ERROR, "[download_queue_dispatch] Unable to start download of '%s'", job->url);
+      jobFinished(NULL, job);
+      return;
+    }
+  }
+}
+
+/* stop the transfer of a running job. The transfer engine reports back through jobFinished() */
+PRIVATE void stopJob(download_queue *q, download_job *job) {
+  if(job->segmented) {
+    segmented_download_cancel(job->segmented);
+  } else if(web_multi_cancel(q->engine, job) != 0) {
+    /* the transfer engine doesn't know about the job (anymore) */
+    jobFinished(NULL, job);
+  }
+}
+
+/** \brief Create a new download queue
+ *
+ * \param[in] engine Transfer engine that carries out the downloads
+ * \param[in] max_active Maximum number of downloads running in parallel
+ * \param[in] max_queued Number of waiting jobs at which download_queue_throttled() reports back-pressure
+ * \param[in] done Function that is called whenever a download has finished
+ * \param[in] userdata Pointer that is handed to \a done
+ * \return Pointer to the new queue
+ */
+PUBLIC download_queue* download_queue_new(web_multi *engine, uint16_t max_active, uint16_t max_queued,
+                                          download_done_func done, void *userdata) {
+  download_queue *q = NULL;
+
+  assert(engine);
+
+  q = am_malloc(sizeof(struct download_queue));
+  if(q) {
+    q->engine        = engine;
+    q->waiting       = NULL;
+    q->running       = NULL;
+    q->waiting_count = 0;
+    q->running_count = 0;
+    q->next_id       = 1;
+    q->max_active    = max_active > 0 ? max_active : 1;
+    q->max_queued    = max_queued;
+    q->segments      = 1;
+    q->min_segment_size = 0;
+    q->closing       = 0;
+    q->paused        = 0;
+    q->done          = done;
+    q->userdata      = userdata;
+  }
+  return q;
+}
+
+/** \brief Free a download queue
+ *
+ * \param[in] q Pointer to a download queue
+ *
+ * Running downloads are aborted, waiting jobs are dropped. The completion function is not called.
+ */
+PUBLIC void download_queue_free(download_queue *q) {
+  download_job *job = NULL;
+
+  if(!q) {
+    return;
+  }
+
+  q->closing = 1;
+  while(q->running) {
+    stopJob(q, q->running);
+  }
+
+  while((job = q->waiting) != NULL) {
+    q->waiting = job->next;
+    download_job_free(job);
+  }
+
+  am_free(q);
+}
+
+/** \brief Download large files over several connections
+ *
+ * \param[in] q Pointer to a download queue
+ * \param[in] segments Maximum number of segments a download is split into (1 disables segmented downloads)
+ * \param[in] min_segment_size Minimum size of a segment in bytes
+ */
+PUBLIC void download_queue_set_segments(download_queue *q, uint16_t segments, uint64_t min_segment_size) {
+  if(q) {
+    q->segments = segments > 0 ? segments : 1;
+    q->min_segment_size = min_segment_size;
+  }
+}
+
+/** \brief Change the number of parallel downloads and the queue length at which the feed polling is throttled
+ *
+ * \param[in] q Pointer to a download queue
+ * \param[in] max_active Maximum number of downloads running in parallel
+ * \param[in] max_queued Number of waiting jobs at which download_queue_throttled() reports back-pressure
+ *
+ * Running downloads are not interrupted if the new limit is lower.
+ */
+PUBLIC void download_queue_set_limits(download_queue *q, uint16_t max_active, uint16_t max_queued) {
+  if(q) {
+    q->max_active = max_active > 0 ? max_active : 1;
+    q->max_queued = max_queued;
+    download_queue_dispatch(q);
+  }
+}
+
+/** \brief Add a new download to the queue
+ *
+ * \param[in] q Pointer to a download queue
+ * \param[in] url URL of the file
+ * \param[in] filename Full path where the file shall be stored
+ * \param[in] useragent (Optional) User-Agent string
+ * \param[in] name Title of the RSS item
+ * \param[in] priority Jobs with a higher priority are started first
+ * \param[in] feed_id ID of the feed the item belongs to
+ * \param[in] mirrors (Optional) all URLs of the RSS item, used as alternate sources of segmented downloads
+ * \param[in] max_speed Bandwidth limit of the download in bytes per second (0 means no limit of its own)
+ * \return 0 if the job was queued, -1 otherwise.
+ *
+ * The function returns immediately. Jobs with the same priority are started in the order they were added.
+ * All downloads are subject to the bandwidth limit of the transfer engine.
+ */
+PUBLIC int download_queue_add(download_queue *q, const char *url, const char *filename, const char *useragent,
+                              const char *name, int16_t priority, uint16_t feed_id, const simple_list mirrors,
+                              uint64_t max_speed) {
+  download_job *job = NULL;
+  simple_list current = NULL;
+
+  if(!q || !url || !filename) {
+    return -1;
+  }
+
+  job = am_malloc(sizeof(struct download_job));
+  if(!job) {
+    return -1;
+  }
+
+  job->next      = NULL;
+  job->queue     = q;
+  job->id        = q->next_id++;
+  job->url       = am_strdup(url);
+  job->filename  = am_strdup(filename);
+  job->useragent = am_strdup(useragent);
+  job->name      = am_strdup(name);
+  job->priority  = priority;
+  job->feed_id   = feed_id;
+  job->max_speed = max_speed;
+  job->mirrors   = NULL;
+  job->segmented = NULL;
+  job->cancelled = 0;
+  job->requeue   = 0;
+
+  for(current = mirrors; current && current->data; current = current->next) {
+    if(strcmp((const char*)current->data, url) != 0) {
+      addItem(am_strdup((const char*)current->data), &job->mirrors);
+    }
+  }
+
+  insertJob(q, job, 0);
+
+  dbg_printf(P_INFO2, "[download_queue_add] Queued download #%d (priority %d, %d waiting)", job->id, priority, q->waiting_count);
+
+  download_queue_dispatch(q);
+  return 0;
+}
+
+/** \brief Check whether a file is already waiting in or being downloaded by the queue
+ *
+ * \param[in] q Pointer to a download queue
+ * \param[in] filename Full path of the file
+ * \return 1 if the queue knows the file, 0 otherwise
+ */
+PUBLIC uint8_t download_queue_contains(const download_queue *q, const char *filename) {
+  const download_job *job = NULL;
+
+  if(!q || !filename) {
+    return 0;
+  }
+
+  for(job = q->running; job; job = job->next) {
+    if(strcmp(job->filename, filename) == 0) {
+      return 1;
+    }
+  }
+
+  for(job = q->waiting; job; job = job->next) {
+    if(strcmp(job->filename, filename) == 0) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/** \brief Check whether the feed polling should hold back until the queue has drained a bit */
+PUBLIC uint8_t download_queue_throttled(const download_queue *q) {
+  return (q && q->max_queued > 0 && q->waiting_count >= q->max_queued) ? 1 : 0;
+}
+
+/** \brief Number of jobs waiting for a free download slot */
+PUBLIC uint32_t download_queue_length(const download_queue *q) {
+  return q ? q->waiting_count : 0;
+}
+
+/** \brief Number of downloads currently in progress */
+PUBLIC uint32_t download_queue_active(const download_queue *q) {
+  return q ? q->running_count : 0;
+}
+
+/** \brief Cancel a waiting or running download
+ *
+ * \param[in] q Pointer to a download queue
+ * \param[in] id ID of the job
+ * \return 0 if the job was found and cancelled, -1 otherwise.
+ *
+ * The partial file is deleted. The completion function is not called for a cancelled job.
+ */
+PUBLIC int download_queue_cancel(download_queue *q, uint32_t id) {
+  download_job **pos = NULL;
+  download_job *job = NULL;
+
+  if(!q) {
+    return -1;
+  }
+
+  for(pos = &q->waiting; *pos; pos = &(*pos)->next) {
+    if((*pos)->id == id) {
+      job = *pos;
+      *pos = job->next;
+      --q->waiting_count;
+      dbg_printf(P_INFO, "[%d] Cancelled download #%d: %s", job->feed_id, job->id, job->url);
+      removePartialFile(job->filename);
+      download_job_free(job);
+      return 0;
+    }
+  }
+
+  for(job = q->running; job; job = job->next) {
+    if(job->id == id) {
+      dbg_printf(P_INFO, "[%d] Cancelled download #%d: %s", job->feed_id, job->id, job->url);
+      job->cancelled = 1;
+      stopJob(q, job);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/** \brief Stop or restart all downloads
+ *
+ * \param[in] q Pointer to a download queue
+ * \param[in] pause 1 to stop the running downloads and keep new ones from starting, 0 to start them again
+ *
+ * Stopped downloads go back into the queue and are resumed from their partial files (if the
+ * server supports it), segmented downloads with all their segments. New jobs can still be added
+ * while the queue is paused.
+ */
+PUBLIC void download_queue_pause(download_queue *q, uint8_t pause) {
+  if(!q || q->paused == (pause ? 1 : 0)) {
+    return;
+  }
+
+  q->paused = pause ? 1 : 0;
+  if(q->paused) {
+    while(q->running) {
+      q->running->requeue = 1;
+      stopJob(q, q->running);
+    }
+    dbg_printf(P_INFO, "Downloads paused (%d waiting)", q->waiting_count);
+  } else {
+    dbg_printf(P_INFO, "Downloads resumed (%d waiting)", q->waiting_count);
+    download_queue_dispatch(q);
+  }
+}
+
+/** \brief Check whether the queue has been paused with download_queue_pause() */
+PUBLIC uint8_t download_queue_paused(const download_queue *q) {
+  return q ? q->paused : 0;
+}
+
+PRIVATE void remapJobs(download_job *job, const uint16_t *ids, uint32_t count) {
+  for(; job; job = job->next) {
+    if(job->feed_id < count) {
+      job->feed_id = ids[job->feed_id];
+    }
+  }
+}
+
+/** \brief Hand the jobs of each feed over to the new ID of the feed
+ *
+ * \param[in] q Pointer to a download queue
+ * \param[in] ids New ID of each feed (or DOWNLOAD_NO_FEED), indexed by its old ID
+ * \param[in] count Number of entries in \a ids
+ *
+ * Used when the configuration has been reloaded and the feeds have been numbered anew. Waiting
+ * and running jobs are both updated.
+ */
+PUBLIC void download_queue_remap_feeds(download_queue *q, const uint16_t *ids, uint32_t count) {
+  if(q && ids) {
+    remapJobs(q->waiting, ids, count);
+    remapJobs(q->running, ids, count);
+  }
+}
+
+/** \brief First of the jobs waiting for a free download slot, in the order they are started (\c NULL if there is none) */
+PUBLIC const download_job* download_queue_waiting(const download_queue *q) {
+  return q ? q->waiting : NULL;
+}
+
+/** \brief First of the downloads currently in progress (\c NULL if there is none) */
+PUBLIC const download_job* download_queue_running(const download_queue *q) {
+  return q ? q->running : NULL;
+}
@@ -36,7 +36,10 @@
 #include <string.h>
 #include <stdint.h>
 
-#include "list.h"
+#include "downloads.h"
+#include "hash.h"
+#include "hashring.h"
+#include "statedb.h"
 #include "utils.h"
 #include "output.h"
 
@@ -45,48 +48,169 @@
 #endif
 
 
-static uint8_t bucket_hasURL(const char *url, NODE *head) {
-	NODE *p = head;
-	char *x;
+/** \brief Create a new, empty download history
+ *
+ * \return Pointer to the history, or \c NULL if there's not enough memory
+ */
+download_history* history_new(void) {
+	download_history *history = am_malloc(sizeof(struct download_history));
 
-	while (p != NULL) {
-		x = (char*)p->data;
-		if(strcmp(x, url) == 0) {
-			return 1;
+	if(history) {
+		history->snapshot  = NULL;
+		history->recent    = hashring_new(sizeof(statedb_meta));
+		history->added     = 0;
+		history->max_items = 0;
+		if(!history->recent) {
+			am_free(history);
+			history = NULL;
 		}
-		p = p->next;
 	}
-	return 0;
+	return history;
+}
+
+/** \brief Free a download history
+ *
+ * \param history Pointer to a download history
+ */
+void history_free(download_history *history) {
+	if(history) {
+		statedb_close(history->snapshot);
+		hashring_free(history->recent);
+		am_free(history);
+	}
 }
 
+/** \brief Add a URL to the download history
+ *
+ * \param history Pointer to a download history
+ * \param url URL of the downloaded file
+ * \param meta (Optional) metadata of the download
+ * \return 0 if the URL was added, 1 if it already was part of the history, -1 on error
+ */
+int history_add(download_history *history, const char *url, const statedb_meta *meta) {
+	hash128 digest;
+	int result;
+
+	if(!history || !url) {
+		return -1;
+	}
+
+	hash128_string(url, &digest);
+	if(statedb_find(history->snapshot, &digest) >= 0) {
+		return 1;
+	}
+
+	result = hashring_add(history->recent, digest.h1, url);
+	if(result == 0) {
+		if(meta) {
+			memcpy(hashring_payload(history->recent, 0), meta, sizeof(statedb_meta));
+		}
+		++history->added;
+	}
+	return result;
+}
+
+/** \brief Add a URL to the download history as its oldest entry
+ *
+ * \param history Pointer to a download history
+ * \param url URL of the downloaded file
+ * \param meta (Optional) metadata of the download
+ * \return 0 if the URL was added, 1 if it already was part of the history, -1 on error
+ *
+ * Useful to import a list that is sorted from newest to oldest.
+ */
+int history_append(download_history *history, const char *url, const statedb_meta *meta) {
+	hash128 digest;
+	int result;
+
+	if(!history || !url) {
+		return -1;
+	}
+
+	hash128_string(url, &digest);
+	if(statedb_find(history->snapshot, &digest) >= 0) {
+		return 1;
+	}
+
+	result = hashring_append(history->recent, digest.h1, url);
+	if(result == 0 && meta) {
+		memcpy(hashring_payload(history->recent, hashring_count(history->recent) - 1), meta, sizeof(statedb_meta));
+	}
+	return result;
+}
+
+/** \brief Number of entries in the download history */
+uint64_t history_count(const download_history *history) {
+	return history ? statedb_count(history->snapshot) + hashring_count(history->recent) : 0;
+}
+
+/** \brief Replace the state file snapshot of a download history
+ *
+ * \param history Pointer to a download history
+ * \param snapshot The new snapshot. The history takes ownership.
+ * \param keep_recent Number of recent entries that are not part of the new snapshot
+ *
+ * Called after a new state file has been written: all but the newest \a keep_recent entries are
+ * dropped from memory, they can be found in the snapshot from now on.
+ */
+void history_set_snapshot(download_history *history, statedb *snapshot, uint64_t keep_recent) {
+	if(!history) {
+		statedb_close(snapshot);
+		return;
+	}
+
+	statedb_close(history->snapshot);
+	history->snapshot = snapshot;
+	if(keep_recent < hashring_count(history->recent)) {
+		hashring_trim(history->recent, (uint32_t)keep_recent);
+	}
+}
 
 /** \brief Checks if a file has been downloaded before
  *
- * \param bucket Bucket list that stores the URLS of previously downloaded files
+ * \param bucket Bucket that stores the URLS of previously downloaded files
  * \param url URL of the file that should be checked
  * \return 0 if it's a new file, 1 if it has been downloaded before
+ *
+ * Recent downloads are looked up in a hash table, older ones by a binary search in the
+ * memory-mapped state file. Neither allocates memory.
  */
 
-uint8_t has_been_downloaded(const simple_list bucket, const char *url) {
-	return bucket_hasURL(url, bucket);
+uint8_t has_been_downloaded(const download_history *bucket, const char *url) {
+	hash128 digest;
+
+	if(!bucket || !url) {
+		return 0;
+	}
+
+	hash128_string(url, &digest);
+	if(hashring_contains(bucket->recent, digest.h1, url)) {
+		return 1;
+	}
+	return statedb_find(bucket->snapshot, &digest) >= 0 ? 1 : 0;
 }
 
-/** \brief add new item to bucket list
+/** \brief add new item to bucket
  *
  * \param[in] identifier Unique identifier for a bucket item (e.g. a URL)
- * \param[in,out] head pointer to the bucket list
- * \param[in] maxBucketItems number of maximum items in bucket list
- * \return always returns 0
+ * \param[in,out] bucket the bucket
+ * \param[in] maxBucketItems number of maximum items in bucket
+ * \param[in] meta (Optional) metadata of the download
+ * \return 0 if the item was added, -1 otherwise
  *
- * The size of the provided bucket list is kept to maxBucketItems.
- * If it gets larger than the specified value, the oldest element is removed from the list.
+ * The size of the provided bucket is kept to maxBucketItems.
+ * If it gets larger than the specified value, the oldest elements are removed from the bucket
+ * (those in the state file the next time it is written).
  */
-int addToBucket(const char* identifier, NODE **head, const int maxBucketItems) {
+int addToBucket(const char* identifier, download_history *bucket, const uint32_t maxBucketItems, const statedb_meta *meta) {
 
-	addToHead(am_strdup(identifier), head);
-	if(maxBucketItems > 0 && listCount(*head) > (uint32_t)maxBucketItems) {
-		dbg_printf(P_INFO2, "[add_to_bucket] bucket gets too large, deleting last item...\n");
-		removeLast(*head, NULL);
+	if(!bucket || history_add(bucket, identifier, meta) != 0) {
+		return -1;
+	}
+	bucket->max_items = maxBucketItems;
+	if(maxBucketItems > 0 && hashring_count(bucket->recent) > maxBucketItems) {
+		dbg_printf(P_INFO2, "[add_to_bucket] bucket gets too large, deleting oldest items...");
+		hashring_trim(bucket->recent, maxBucketItems);
 	}
 	return 0;
 }
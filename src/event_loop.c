@@ -0,0 +1,426 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file event_loop.c
+ *
+ * Single-threaded event loop on top of epoll, with timers (timerfd) and signals (signalfd).
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "event_loop.h"
+#include "output.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+/** maximum number of events handled per call of epoll_wait() */
+#define MAX_EVENTS 32
+
+/** \cond */
+typedef struct event_watch event_watch;
+
+struct event_watch {
+  event_watch *next;
+  int          fd;       /**< -1 once the watch has been removed */
+  event_func   func;
+  void        *userdata;
+};
+
+struct event_loop {
+  int                epfd;
+  event_watch       *watches;
+  event_watch       *removed;     /**< watches removed while events were dispatched, freed afterwards */
+  uint32_t           dispatching;
+  int                sigfd;       /**< -1 if no signals are handled */
+  sigset_t           sigmask;     /**< signals that are blocked and read from sigfd */
+  event_signal_func  on_signal;
+  void              *signal_data;
+};
+
+struct event_timer {
+  event_loop        *loop;
+  int                fd;
+  event_timer_func   func;
+  void              *userdata;
+};
+/** \endcond */
+
+PRIVATE uint32_t getEpollEvents(uint32_t events) {
+  return ((events & EVENT_READ) ? EPOLLIN : 0) | ((events & EVENT_WRITE) ? EPOLLOUT : 0);
+}
+
+PRIVATE event_watch* findWatch(const event_loop *loop, int fd) {
+  event_watch *w = NULL;
+
+  for(w = loop->watches; w; w = w->next) {
+    if(w->fd == fd) {
+      return w;
+    }
+  }
+  return NULL;
+}
+
+PRIVATE void freeRemovedWatches(event_loop *loop) {
+  event_watch *w = NULL;
+
+  while((w = loop->removed) != NULL) {
+    loop->removed = w->next;
+    am_free(w);
+  }
+}
+
+/** \brief Create a new event loop
+ *
+ * \return Pointer to the new event loop, or \c NULL on error
+ */
+PUBLIC event_loop* event_loop_new(void) {
+  event_loop *loop = am_malloc(sizeof(struct event_loop));
+
+  if(!loop) {
+    return NULL;
+  }
+
+  memset(loop, 0, sizeof(struct event_loop));
+  loop->sigfd = -1;
+  sigemptyset(&loop->sigmask);
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if(loop->epfd < 0) {
+    dbg_printf(P_ERROR, "[event_loop_new] epoll_create1: %s", strerror(errno));
+    am_free(loop);
+    return NULL;
+  }
+  return loop;
+}
+
+/** \brief Free an event loop
+ *
+ * \param[in] loop Pointer to an event loop
+ *
+ * The watched file descriptors are not closed, but the signals handled by the loop are unblocked.
+ * Timers have to be freed before the loop.
+ */
+PUBLIC void event_loop_free(event_loop *loop) {
+  event_watch *w = NULL;
+
+  if(!loop) {
+    return;
+  }
+
+  if(loop->sigfd >= 0) {
+    close(loop->sigfd);
+    sigprocmask(SIG_UNBLOCK, &loop->sigmask, NULL);
+  }
+  while((w = loop->watches) != NULL) {
+    loop->watches = w->next;
+    am_free(w);
+  }
+  freeRemovedWatches(loop);
+  close(loop->epfd);
+  am_free(loop);
+}
+
+/** \brief Watch a file descriptor
+ *
+ * \param[in] loop Pointer to an event loop
+ * \param[in] fd The file descriptor
+ * \param[in] events Events of interest (EVENT_READ, EVENT_WRITE)
+ * \param[in] func Function that is called when the file descriptor is ready
+ * \param[in] userdata Pointer that is handed to \a func
+ * \return 0 on success, -1 otherwise
+ *
+ * Watching a file descriptor a second time replaces the events and the function.
+ */
+PUBLIC int event_loop_watch(event_loop *loop, int fd, uint32_t events, event_func func, void *userdata) {
+  event_watch *w = NULL;
+  struct epoll_event ev;
+  int op = EPOLL_CTL_MOD;
+
+  if(!loop || fd < 0 || !func) {
+    return -1;
+  }
+
+  w = findWatch(loop, fd);
+  if(!w) {
+    w = am_malloc(sizeof(event_watch));
+    if(!w) {
+      return -1;
+    }
+    w->fd = fd;
+    w->next = loop->watches;
+    loop->watches = w;
+    op = EPOLL_CTL_ADD;
+  }
+  w->func = func;
+  w->userdata = userdata;
+
+  memset(&ev, 0, sizeof(ev));
+  ev.events = getEpollEvents(events);
+  ev.data.ptr = w;
+  if(epoll_ctl(loop->epfd, op, fd, &ev) != 0) {
+    dbg_printf(P_ERROR, "[event_loop_watch] epoll_ctl(%d): %s", fd, strerror(errno));
+    event_loop_unwatch(loop, fd);
+    return -1;
+  }
+  return 0;
+}
+
+/** \brief Stop watching a file descriptor
+ *
+ * \param[in] loop Pointer to an event loop
+ * \param[in] fd The file descriptor
+ *
+ * Must be called before the file descriptor is closed. May be called from within an event function.
+ */
+PUBLIC void event_loop_unwatch(event_loop *loop, int fd) {
+  event_watch **p = NULL;
+  event_watch *w = NULL;
+
+  if(!loop) {
+    return;
+  }
+
+  for(p = &loop->watches; *p; p = &(*p)->next) {
+    if((*p)->fd == fd) {
+      w = *p;
+      *p = w->next;
+      break;
+    }
+  }
+  if(!w) {
+    return;
+  }
+
+  epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+  if(loop->dispatching) {
+    /* a later event of the same batch might still refer to the watch */
+    w->fd = -1;
+    w->next = loop->removed;
+    loop->removed = w;
+  } else {
+    am_free(w);
+  }
+}
+
+PRIVATE void readSignals(int fd, uint32_t events, void *userdata) {
+  event_loop *loop = (event_loop*)userdata;
+  struct signalfd_siginfo info;
+
+  (void)events;
+
+  while(read(fd, &info, sizeof(info)) == sizeof(info)) {
+    loop->on_signal((int)info.ssi_signo, loop->signal_data);
+  }
+}
+
+/** \brief Handle signals through the event loop
+ *
+ * \param[in] loop Pointer to an event loop
+ * \param[in] signals The signals
+ * \param[in] count Number of signals
+ * \param[in] func Function that is called for each delivered signal
+ * \param[in] userdata Pointer that is handed to \a func
+ * \return 0 on success, -1 otherwise
+ *
+ * The signals are blocked, so they no longer interrupt the process. Child processes inherit
+ * the signal mask and should reset it before they call exec().
+ */
+PUBLIC int event_loop_signals(event_loop *loop, const int *signals, uint32_t count, event_signal_func func, void *userdata) {
+  uint32_t i;
+  int fd;
+
+  if(!loop || !signals || !func) {
+    return -1;
+  }
+
+  for(i = 0; i < count; ++i) {
+    sigaddset(&loop->sigmask, signals[i]);
+  }
+  if(sigprocmask(SIG_BLOCK, &loop->sigmask, NULL) != 0) {
+    return -1;
+  }
+
+  fd = signalfd(loop->sigfd, &loop->sigmask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if(fd < 0) {
+    dbg_printf(P_ERROR, "[event_loop_signals] signalfd: %s", strerror(errno));
+    return -1;
+  }
+  loop->sigfd = fd;
+  loop->on_signal = func;
+  loop->signal_data = userdata;
+  return event_loop_watch(loop, fd, EVENT_READ, readSignals, loop);
+}
+
+/** \brief Wait for events and dispatch them
+ *
+ * \param[in] loop Pointer to an event loop
+ * \param[in] timeout_ms Maximum time to wait (-1: until something happens)
+ * \return number of handled events, or -1 on error
+ */
+PUBLIC int event_loop_run(event_loop *loop, int timeout_ms) {
+  struct epoll_event events[MAX_EVENTS];
+  event_watch *w = NULL;
+  uint32_t flags;
+  int count, i;
+
+  if(!loop) {
+    return -1;
+  }
+
+  count = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout_ms);
+  if(count < 0) {
+    return errno == EINTR ? 0 : -1;
+  }
+
+  ++loop->dispatching;
+  for(i = 0; i < count; ++i) {
+    w = (event_watch*)events[i].data.ptr;
+    if(w->fd < 0) {
+      continue;
+    }
+    flags = ((events[i].events & EPOLLIN) ? EVENT_READ : 0) |
+            ((events[i].events & EPOLLOUT) ? EVENT_WRITE : 0) |
+            ((events[i].events & (EPOLLERR | EPOLLHUP)) ? EVENT_ERROR : 0);
+    w->func(w->fd, flags, w->userdata);
+  }
+  if(--loop->dispatching == 0) {
+    freeRemovedWatches(loop);
+  }
+  return count;
+}
+
+PRIVATE void timerExpired(int fd, uint32_t events, void *userdata) {
+  event_timer *timer = (event_timer*)userdata;
+  uint64_t expirations;
+
+  (void)events;
+
+  if(read(fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+    timer->func(timer, timer->userdata);
+  }
+}
+
+/** \brief Create a new timer
+ *
+ * \param[in] loop Pointer to an event loop
+ * \param[in] func Function that is called when the timer expires
+ * \param[in] userdata Pointer that is handed to \a func
+ * \return Pointer to the new timer (which is stopped), or \c NULL on error
+ */
+PUBLIC event_timer* event_timer_new(event_loop *loop, event_timer_func func, void *userdata) {
+  event_timer *timer = NULL;
+
+  if(!loop || !func) {
+    return NULL;
+  }
+
+  timer = am_malloc(sizeof(struct event_timer));
+  if(!timer) {
+    return NULL;
+  }
+
+  timer->loop = loop;
+  timer->func = func;
+  timer->userdata = userdata;
+  /* the wall clock, so a timer set to a point in time fires at that time even after the clock was changed */
+  timer->fd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+  if(timer->fd < 0) {
+    dbg_printf(P_ERROR, "[event_timer_new] timerfd_create: %s", strerror(errno));
+    am_free(timer);
+    return NULL;
+  }
+  if(event_loop_watch(loop, timer->fd, EVENT_READ, timerExpired, timer) != 0) {
+    close(timer->fd);
+    am_free(timer);
+    return NULL;
+  }
+  return timer;
+}
+
+/** \brief Free a timer */
+PUBLIC void event_timer_free(event_timer *timer) {
+  if(timer) {
+    event_loop_unwatch(timer->loop, timer->fd);
+    close(timer->fd);
+    am_free(timer);
+  }
+}
+
+/** \brief Let a timer expire at a given time
+ *
+ * \param[in] timer Pointer to a timer
+ * \param[in] when The time (a time in the past lets the timer expire right away)
+ * \return 0 on success, -1 otherwise
+ */
+PUBLIC int event_timer_at(event_timer *timer, time_t when) {
+  struct itimerspec spec;
+
+  if(!timer) {
+    return -1;
+  }
+
+  memset(&spec, 0, sizeof(spec));
+  /* a value of 0 would stop the timer */
+  spec.it_value.tv_sec = when > 0 ? when : 1;
+  return timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+/** \brief Let a timer expire after a given number of milliseconds (0: as soon as possible) */
+PUBLIC int event_timer_after(event_timer *timer, uint32_t ms) {
+  struct itimerspec spec;
+
+  if(!timer) {
+    return -1;
+  }
+
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = ms / 1000;
+  spec.it_value.tv_nsec = (ms % 1000) * 1000000L;
+  if(ms == 0) {
+    spec.it_value.tv_nsec = 1;
+  }
+  return timerfd_settime(timer->fd, 0, &spec, NULL);
+}
+
+/** \brief Stop a timer */
+PUBLIC void event_timer_stop(event_timer *timer) {
+  struct itimerspec spec;
+
+  if(timer) {
+    memset(&spec, 0, sizeof(spec));
+    timerfd_settime(timer->fd, 0, &spec, NULL);
+  }
+}
@@ -0,0 +1,279 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file feed_cache.c
+ *
+ * Per-feed data that is kept across restarts (e.g. the validators for conditional requests).
+ *
+ * The file consists of one section per feed, started by the feed URL in square brackets,
+ * followed by "key = value" lines. Unknown keys and feeds are ignored.
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "feed_cache.h"
+#include "list.h"
+#include "output.h"
+#include "rss_feed.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+PRIVATE rss_feed* findFeed(rss_feeds feeds, const char *url) {
+  NODE *current = feeds;
+  rss_feed *feed = NULL;
+
+  while(current && current->data) {
+    feed = (rss_feed*)current->data;
+    if(feed->url && strcmp(feed->url, url) == 0) {
+      return feed;
+    }
+    current = current->next;
+  }
+  return NULL;
+}
+
+PRIVATE void setFeedValue(rss_feed *feed, const char *key, const char *value, uint8_t validators) {
+  if(!strcmp(key, "items")) {
+    feed->item_count = strtoul(value, NULL, 10);
+  } else if(!strcmp(key, "ttl")) {
+    feed->ttl = strtoul(value, NULL, 10);
+  } else if(!strcmp(key, "skip-hours")) {
+    feed->skip_hours = strtoul(value, NULL, 16);
+  } else if(!strcmp(key, "skip-days")) {
+    feed->skip_days = strtoul(value, NULL, 16);
+  } else if(!strcmp(key, "poll-interval")) {
+    feed->poll_interval = strtoul(value, NULL, 10);
+  } else if(!strcmp(key, "new-gap")) {
+    feed->new_gap = strtoul(value, NULL, 10);
+  } else if(!strcmp(key, "last-new")) {
+    feed->last_new = (time_t)strtoll(value, NULL, 10);
+  } else if(!validators) {
+    /* the filters have changed, the feeds have to be fetched and parsed completely */
+    return;
+  } else if(!strcmp(key, "etag")) {
+    am_free(feed->etag);
+    feed->etag = am_strdup(value);
+  } else if(!strcmp(key, "last-modified")) {
+    am_free(feed->last_modified);
+    feed->last_modified = am_strdup(value);
+  } else if(!strcmp(key, "digest")) {
+    feed->digest = strtoull(value, NULL, 16);
+  }
+}
+
+/* collects the IDs of the known items of a feed while the cache is read */
+typedef struct seen_buffer {
+  uint64_t *ids;
+  uint32_t  count;
+  uint32_t  size;
+} seen_buffer;
+
+PRIVATE void addSeenItems(seen_buffer *buf, const char *value) {
+  uint64_t *tmp = NULL;
+  char *end = NULL;
+  uint64_t id;
+
+  for(;;) {
+    id = strtoull(value, &end, 16);
+    if(end == value) {
+      break;
+    }
+    value = end;
+
+    if(buf->count == buf->size) {
+      tmp = am_realloc(buf->ids, (buf->size > 0 ? buf->size * 2 : 64) * sizeof(uint64_t));
+      if(!tmp) {
+        return;
+      }
+      buf->ids = tmp;
+      buf->size = buf->size > 0 ? buf->size * 2 : 64;
+    }
+    buf->ids[buf->count++] = id;
+  }
+}
+
+/* hand the collected IDs over to their feed */
+PRIVATE void flushSeenItems(seen_buffer *buf, rss_feed *feed) {
+  if(feed && buf->count > 0) {
+    feed_set_seen(feed, buf->ids, buf->count);
+  } else {
+    am_free(buf->ids);
+  }
+  buf->ids = NULL;
+  buf->count = buf->size = 0;
+}
+
+/** \brief Restore the cached data of the configured feeds
+ *
+ * \param path Path to the cache file
+ * \param feeds List of feeds
+ * \param filter_digest Hash of the current filter patterns
+ * \return 0 on success, -1 if the file couldn't be read
+ *
+ * The validators, body digests and known items are only restored if the cache was written with
+ * the same filters, as items of an unchanged feed could match a new filter.
+ */
+PUBLIC int feed_cache_load(const char *path, rss_feeds feeds, uint64_t filter_digest) {
+  FILE *fp;
+  char *line = NULL;
+  char *value = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+  rss_feed *feed = NULL;
+  uint8_t validators = 0;
+  seen_buffer seen = { NULL, 0, 0 };
+
+  if(!path || (fp = fopen(path, "rb")) == NULL) {
+    return -1;
+  }
+
+  while((len = getline(&line, &line_size, fp)) > 0) {
+    while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if(len == 0 || line[0] == '#') {
+      continue;
+    }
+
+    if(line[0] == '[' && line[len - 1] == ']') {
+      line[len - 1] = '\0';
+      flushSeenItems(&seen, feed);
+      feed = findFeed(feeds, line + 1);
+    } else if((value = strstr(line, " = ")) != NULL) {
+      *value = '\0';
+      if(feed && validators && !strcmp(line, "seen")) {
+        addSeenItems(&seen, value + 3);
+      } else if(feed) {
+        setFeedValue(feed, line, value + 3, validators);
+      } else if(!strcmp(line, "filters")) {
+        validators = (strtoull(value + 3, NULL, 16) == filter_digest) ? 1 : 0;
+      }
+    }
+  }
+
+  flushSeenItems(&seen, feed);
+  free(line);
+  fclose(fp);
+  return 0;
+}
+
+/** \brief Store the cached data of all feeds
+ *
+ * \param path Path to the cache file
+ * \param feeds List of feeds
+ * \param filter_digest Hash of the current filter patterns
+ * \return 0 on success, -1 on error
+ *
+ * The data is written to a temporary file first, which then replaces the cache file.
+ */
+PUBLIC int feed_cache_save(const char *path, const rss_feeds feeds, uint64_t filter_digest) {
+  FILE *fp;
+  char *tmp_file;
+  NODE *current = feeds;
+  rss_feed *feed = NULL;
+  uint32_t i;
+  int result = 0;
+
+  if(!path) {
+    return -1;
+  }
+
+  tmp_file = am_malloc(strlen(path) + 5);
+  if(!tmp_file) {
+    return -1;
+  }
+  sprintf(tmp_file, "%s.tmp", path);
+
+  if((fp = fopen(tmp_file, "wb")) == NULL) {
+    dbg_printf(P_ERROR, "Error: Unable to open feed cache '%s' for writing: %s", tmp_file, strerror(errno));
+    am_free(tmp_file);
+    return -1;
+  }
+
+  fprintf(fp, "# Trailermatic feed cache, generated automatically\n");
+  fprintf(fp, "filters = %016llx\n", (unsigned long long)filter_digest);
+  while(current && current->data) {
+    feed = (rss_feed*)current->data;
+    fprintf(fp, "\n[%s]\n", feed->url);
+    if(feed->etag) {
+      fprintf(fp, "etag = %s\n", feed->etag);
+    }
+    if(feed->last_modified) {
+      fprintf(fp, "last-modified = %s\n", feed->last_modified);
+    }
+    if(feed->digest) {
+      fprintf(fp, "digest = %016llx\n", (unsigned long long)feed->digest);
+    }
+    fprintf(fp, "items = %u\n", feed->item_count);
+    if(feed->ttl) {
+      fprintf(fp, "ttl = %u\n", feed->ttl);
+    }
+    if(feed->skip_hours) {
+      fprintf(fp, "skip-hours = %06x\n", feed->skip_hours);
+    }
+    if(feed->skip_days) {
+      fprintf(fp, "skip-days = %02x\n", feed->skip_days);
+    }
+    if(feed->poll_interval) {
+      fprintf(fp, "poll-interval = %u\n", feed->poll_interval);
+    }
+    if(feed->new_gap) {
+      fprintf(fp, "new-gap = %u\n", feed->new_gap);
+    }
+    if(feed->last_new) {
+      fprintf(fp, "last-new = %lld\n", (long long)feed->last_new);
+    }
+    for(i = 0; i < feed->seen_count; ++i) {
+      fprintf(fp, "%s%016llx%s", i % 8 == 0 ? "seen = " : " ", (unsigned long long)feed->seen_items[i],
+              (i % 8 == 7 || i + 1 == feed->seen_count) ? "\n" : "");
+    }
+    current = current->next;
+  }
+
+  result = ferror(fp) ? -1 : 0;
+  if(fclose(fp) != 0 || result != 0) {
+    dbg_printf(P_ERROR, "Error: Unable to write feed cache '%s': %s", tmp_file, strerror(errno));
+    result = -1;
+  }
+
+  if(result == 0 && rename(tmp_file, path) != 0) {
+    dbg_printf(P_ERROR, "Error: Unable to replace feed cache '%s': %s", path, strerror(errno));
+    result = -1;
+  }
+  if(result != 0) {
+    unlink(tmp_file);
+  }
+
+  am_free(tmp_file);
+  return result;
+}
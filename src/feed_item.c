@@ -37,8 +37,10 @@
 
 #include "feed_item.h"
 #include "filters.h"
+#include "hash.h"
 #include "output.h"
 #include "regex.h"
+#include "trace.h"
 #include "utils.h"
 
 #ifdef MEMWATCH
@@ -48,28 +50,54 @@
 
 /** \brief Check if the provided rss item is a match for any of the given filters
  *
- * \param[in]  filters List of regular expressions to check against a given feed item
- * \param[in]  string  The string to be checked by the regular expression.
- * \param[out] filter  The particular filter that matches.
+ * \param[in]  matcher The filters to check against a given feed item
+ * \param[in]  string  The string to be checked by the regular expressions. Must be valid UTF-8.
+ * \param[out] filter  The particular filter that matches (the first one of the list, if several do).
  * \return 1 if a filter matched, 0 otherwise.
  *
  */
-uint8_t isMatch(const am_filters filters, const char* string, am_filter *out_filter) {
-	am_filters current_regex = NULL;
-   am_filter filter;
+uint8_t isMatch(filter_matcher *matcher, const char* string, am_filter *out_filter) {
+  am_filter filter;
+  trace_span span;
 
   assert(out_filter != NULL);
 
-	current_regex = filters;
-	while (current_regex != NULL && current_regex->data != NULL) {
-		filter = (am_filter) current_regex->data;
-    if(isRegExMatch(filter->pattern, string) == 1) {
-      *out_filter = filter;
-			return 1;
-		}
-		current_regex = current_regex->next;
-	}
-	return 0;
+  if(!string || !*string) {
+    return 0;
+  }
+
+  TRACE_BEGIN(span, "filter", "isMatch");
+  filter = filter_matcher_match(matcher, string, strlen(string));
+  TRACE_END_ARG(span, "match", filter != NULL);
+  if(filter) {
+    *out_filter = filter;
+    return 1;
+  }
+  return 0;
+}
+
+/** \brief Compute a number that identifies an RSS item across several versions of a feed
+ *
+ * \param[in] item Pointer to a feed item
+ * \return Hash of the item's guid, or of its URLs if it has none
+ */
+uint64_t getFeedItemID(const feed_item item) {
+  simple_list current = NULL;
+  xxh64_state state;
+
+  if(!item) {
+    return 0;
+  }
+
+  if(item->guid) {
+    return xxh64(item->guid, strlen(item->guid), 0);
+  }
+
+  xxh64_reset(&state, 0);
+  for(current = item->urls; current && current->data; current = current->next) {
+    xxh64_update(&state, current->data, strlen((const char*)current->data) + 1);
+  }
+  return xxh64_digest(&state);
 }
 
 /** \brief Create a new RSS feed item
@@ -82,6 +110,7 @@ feed_item newFeedItem(void) {
 		i->name     = NULL;
 		i->urls     = NULL;
     i->category = NULL;
+    i->guid     = NULL;
 	}
 	return i;
 }
@@ -105,6 +134,8 @@ void freeFeedItem(void *data) {
 			am_free(item->category);
 			item->category = NULL;
 		}
+		am_free(item->guid);
+		item->guid = NULL;
 		am_free(item);
 		item = NULL;
 	}
@@ -35,7 +35,9 @@
 #include <string.h>
 #include <stdint.h>
 
+#include "ahocorasick.h"
 #include "filters.h"
+#include "hash.h"
 #include "list.h"
 #include "utils.h"
 #include "output.h"
@@ -53,6 +55,9 @@ PUBLIC am_filter filter_new(void) {
 	if(i != NULL) {
 		i->pattern = NULL;
 		i->agent = NULL;
+		i->priority = 0;
+		i->max_speed = 0;
+		i->regex = NULL;
 	}
 	return i;
 }
@@ -112,7 +117,328 @@ PUBLIC void filter_free(void* listItem) {
 	  x->pattern = NULL;
 	  am_free(x->agent);
 	  x->agent = NULL;
+	  freeRegEx(x->regex);
+	  x->regex = NULL;
 	  am_free(x);
 	  x = NULL;
 	}
 }
+
+/** \cond */
+struct filter_matcher {
+  am_filter     *filters;     /**< the filters in the order of the list */
+  uint32_t       count;
+  am_regex      *combined;    /**< all patterns in one expression (NULL: the filters are tried one after another) */
+  ac_automaton  *prefilter;   /**< literals the patterns require (NULL: no filter has one) */
+  uint8_t       *has_literal; /**< whether a filter is part of the prefilter */
+  uint32_t      *seen;        /**< scan in which the literal of a filter was last found */
+  uint32_t       scan;        /**< number of prefilter scans, marks the literals found by the current one */
+  uint32_t       set_generation; /**< identifies this filter set in the match cache */
+  match_cache   *cache;       /**< results of earlier calls (may be NULL) */
+  filter_matcher_stats stats;
+};
+
+typedef struct match_cache_entry {
+  hash128  digest;      /**< digest of the string */
+  uint32_t generation;  /**< filter set the result belongs to (0: unused entry) */
+  int32_t  result;      /**< index of the matching filter, or -1 */
+} match_cache_entry;
+
+struct match_cache {
+  match_cache_entry *entries;
+  uint32_t           mask;  /**< number of entries - 1 */
+};
+/** \endcond */
+
+/* every filter set gets a new generation number, so cached results of an old one are never used */
+static uint32_t last_set_generation = 0;
+
+/* literals shorter than this match too often to be worth the scan */
+#define MIN_LITERAL_LENGTH 3
+
+/* callback of ac_scan() */
+PRIVATE void literalFound(uint32_t id, void *userdata) {
+  filter_matcher *m = (filter_matcher*)userdata;
+
+  m->seen[id] = m->scan;
+}
+
+PRIVATE void buildPrefilter(filter_matcher *m) {
+  char *literal = NULL;
+  uint32_t i, added = 0;
+
+  m->prefilter = ac_new();
+  m->has_literal = am_malloc(m->count);
+  m->seen = am_malloc(m->count * sizeof(uint32_t));
+  if(!m->prefilter || !m->has_literal || !m->seen) {
+    ac_free(m->prefilter);
+    m->prefilter = NULL;
+    return;
+  }
+
+  for(i = 0; i < m->count; ++i) {
+    m->has_literal[i] = 0;
+    m->seen[i] = 0;
+    literal = getRegExLiteral(m->filters[i]->pattern);
+    if(literal && strlen(literal) >= MIN_LITERAL_LENGTH && ac_add(m->prefilter, literal, i) == 0) {
+      dbg_printf(P_INFO2, "[buildPrefilter] Filter '%s' requires '%s'", m->filters[i]->pattern, literal);
+      m->has_literal[i] = 1;
+      ++added;
+    }
+    am_free(literal);
+  }
+
+  if(added == 0 || ac_compile(m->prefilter) != 0) {
+    ac_free(m->prefilter);
+    m->prefilter = NULL;
+  } else {
+    dbg_printf(P_INFO2, "[buildPrefilter] %d of %d filters are checked for literals first", added, m->count);
+  }
+}
+
+/** \brief Prepare a list of filters for matching
+ *
+ * \param filters List of filters
+ * \return Pointer to the new matcher, or \c NULL in case of an error
+ *
+ * The patterns of all filters are compiled into a single expression, so a string that doesn't
+ * match any filter is rejected in one pass. In addition, the literal text each pattern requires
+ * is looked up before any regular expression is evaluated, and filters whose literal is missing
+ * are skipped. The list must not be changed while the matcher exists.
+ */
+PUBLIC filter_matcher* filter_matcher_new(const am_filters filters) {
+  filter_matcher *m = NULL;
+  const char **patterns = NULL;
+  NODE *cur = NULL;
+  uint32_t i = 0;
+
+  m = am_malloc(sizeof(struct filter_matcher));
+  if(!m) {
+    return NULL;
+  }
+
+  memset(m, 0, sizeof(struct filter_matcher));
+  if(++last_set_generation == 0) {
+    last_set_generation = 1;
+  }
+  m->set_generation = last_set_generation;
+  m->count = listCount(filters);
+  m->filters = am_malloc((m->count > 0 ? m->count : 1) * sizeof(am_filter));
+  patterns = am_malloc((m->count > 0 ? m->count : 1) * sizeof(const char*));
+  if(!m->filters || !patterns) {
+    am_free(patterns);
+    filter_matcher_free(m);
+    return NULL;
+  }
+
+  for(cur = filters; cur && cur->data; cur = cur->next) {
+    m->filters[i] = (am_filter)cur->data;
+    patterns[i] = m->filters[i]->pattern;
+    ++i;
+  }
+  m->count = i;
+
+  if(m->count > 1) {
+    m->combined = compileRegExSet(patterns, m->count);
+    if(m->combined) {
+      dbg_printf(P_INFO2, "[filter_matcher_new] Combined %d filters into a single expression", m->count);
+    } else {
+      dbg_printf(P_INFO, "Filters can't be combined, they are matched one after another");
+    }
+  }
+
+  if(m->count > 0) {
+    buildPrefilter(m);
+  }
+
+  am_free(patterns);
+  return m;
+}
+
+/** \brief Free a filter matcher (but not the filters) */
+PUBLIC void filter_matcher_free(filter_matcher *m) {
+  if(m) {
+    freeRegEx(m->combined);
+    ac_free(m->prefilter);
+    am_free(m->has_literal);
+    am_free(m->seen);
+    am_free(m->filters);
+    am_free(m);
+  }
+}
+
+PRIVATE uint8_t isASCII(const char *str, uint32_t len) {
+  uint32_t i;
+
+  for(i = 0; i < len; ++i) {
+    if(str[i] & 0x80) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* run the regular expression of a single filter */
+PRIVATE uint8_t filterMatches(filter_matcher *m, uint32_t i, const char *str, uint32_t len) {
+  ++m->stats.regex_runs;
+  return matchRegEx(m->filters[i]->regex, str, len) == 1 ? 1 : 0;
+}
+
+/* index of the first filter that matches a string, or -1 */
+PRIVATE int32_t findMatch(filter_matcher *m, const char *str, uint32_t len) {
+  int32_t first;
+  uint32_t i, candidates;
+
+  candidates = m->count;
+
+  /* caseless matching of non-ASCII text may fold characters to ASCII, so such strings skip the prefilter */
+  if(m->prefilter && isASCII(str, len)) {
+    if(++m->scan == 0) {
+      memset(m->seen, 0, m->count * sizeof(uint32_t));
+      m->scan = 1;
+    }
+    ac_scan(m->prefilter, str, len, literalFound, m);
+
+    candidates = 0;
+    for(i = 0; i < m->count; ++i) {
+      if(!m->has_literal[i] || m->seen[i] == m->scan) {
+        ++candidates;
+      }
+    }
+
+    if(candidates == 0) {
+      ++m->stats.prefilter_rejects;
+      return -1;
+    } else if(candidates < m->count) {
+      /* cheaper to evaluate the remaining filters on their own */
+      for(i = 0; i < m->count; ++i) {
+        if((!m->has_literal[i] || m->seen[i] == m->scan) && filterMatches(m, i, str, len)) {
+          return (int32_t)i;
+        }
+      }
+      return -1;
+    }
+  }
+
+  if(m->combined) {
+    ++m->stats.regex_runs;
+    first = matchRegExSet(m->combined, str, len);
+  } else {
+    first = -2;
+  }
+
+  if(first == -1) {
+    return -1;
+  } else if(first < 0 || (uint32_t)first >= m->count) {
+    /* try all of them */
+    first = (int32_t)m->count;
+  }
+
+  /* the combined expression reports the leftmost match, but an earlier filter might match, too */
+  for(i = 0; i < (uint32_t)first; ++i) {
+    if(filterMatches(m, i, str, len)) {
+      return (int32_t)i;
+    }
+  }
+
+  return (uint32_t)first < m->count ? first : -1;
+}
+
+/** \brief Find the first filter of the list that matches a string
+ *
+ * \param m Pointer to a filter matcher
+ * \param str The string (valid UTF-8)
+ * \param len Length of the string
+ * \return The matching filter, or \c NULL if none matches
+ *
+ * If the matcher has a cache, strings that have been checked against the same filters before are
+ * answered from it.
+ */
+PUBLIC am_filter filter_matcher_match(filter_matcher *m, const char *str, uint32_t len) {
+  match_cache_entry *entry = NULL;
+  hash128 digest;
+  int32_t result;
+
+  if(!m || !str) {
+    return NULL;
+  }
+
+  ++m->stats.urls;
+
+  if(m->cache) {
+    hash128_data(str, len, &digest);
+    entry = &m->cache->entries[digest.h1 & m->cache->mask];
+    if(entry->generation == m->set_generation && hash128_cmp(&entry->digest, &digest) == 0) {
+      ++m->stats.cache_hits;
+      return entry->result >= 0 ? m->filters[entry->result] : NULL;
+    }
+  }
+
+  result = findMatch(m, str, len);
+
+  if(entry) {
+    /* replaces whatever was stored in the slot before */
+    entry->digest = digest;
+    entry->generation = m->set_generation;
+    entry->result = result;
+  }
+
+  return result >= 0 ? m->filters[result] : NULL;
+}
+
+/** \brief Counters of a filter matcher
+ *
+ * \param m Pointer to a filter matcher
+ * \return Pointer to the counters, which stay valid as long as the matcher does
+ */
+PUBLIC const filter_matcher_stats* filter_matcher_get_stats(const filter_matcher *m) {
+  return m ? &m->stats : NULL;
+}
+
+/** \brief Let a filter matcher remember its results
+ *
+ * \param m Pointer to a filter matcher
+ * \param cache The cache (may be \c NULL). It can be shared by consecutive matchers, e.g. when the
+ * filters are reloaded: results of other filter sets are ignored.
+ */
+PUBLIC void filter_matcher_set_cache(filter_matcher *m, match_cache *cache) {
+  if(m) {
+    m->cache = cache;
+  }
+}
+
+/** \brief Create a cache of match results
+ *
+ * \param size Maximum number of results (rounded up to a power of 2)
+ * \return Pointer to the new cache, or \c NULL in case of an error
+ *
+ * The cache has a fixed size: a new result replaces an older one that falls into the same slot.
+ */
+PUBLIC match_cache* match_cache_new(uint32_t size) {
+  match_cache *c = NULL;
+  uint32_t count = 1;
+
+  while(count < size && count < (1u << 24)) {
+    count <<= 1;
+  }
+
+  c = am_malloc(sizeof(struct match_cache));
+  if(c) {
+    c->mask = count - 1;
+    c->entries = am_malloc(count * sizeof(match_cache_entry));
+    if(!c->entries) {
+      am_free(c);
+      return NULL;
+    }
+    memset(c->entries, 0, count * sizeof(match_cache_entry));
+  }
+  return c;
+}
+
+/** \brief Free a cache of match results */
+PUBLIC void match_cache_free(match_cache *c) {
+  if(c) {
+    am_free(c->entries);
+    am_free(c);
+  }
+}
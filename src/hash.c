@@ -0,0 +1,277 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file hash.c
+ *
+ * Non-cryptographic hash functions.
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+/** \cond */
+#define XXH_PRIME64_1  11400714785074694791ULL
+#define XXH_PRIME64_2  14029467366897019727ULL
+#define XXH_PRIME64_3   1609587929392839161ULL
+#define XXH_PRIME64_4   9650029242287828579ULL
+#define XXH_PRIME64_5   2870177450012600261ULL
+
+/** seed of the second half of a hash128 */
+#define HASH128_SEED2   0x9E3779B97F4A7C15ULL
+/** \endcond */
+
+PRIVATE uint64_t rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+/* little-endian reads, independent of host byte order and alignment */
+PRIVATE uint64_t read64(const uint8_t *p) {
+  return  (uint64_t)p[0]        | ((uint64_t)p[1] << 8)  |
+         ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+         ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+         ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+PRIVATE uint32_t read32(const uint8_t *p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+PRIVATE uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+  acc += input * XXH_PRIME64_2;
+  acc  = rotl64(acc, 31);
+  return acc * XXH_PRIME64_1;
+}
+
+PRIVATE uint64_t xxh64_merge(uint64_t acc, uint64_t val) {
+  acc ^= xxh64_round(0, val);
+  return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+/* process the remaining (less than 32) bytes and mix the result */
+PRIVATE uint64_t xxh64_finalize(uint64_t h64, const uint8_t *p, const uint8_t *end) {
+  while(p + 8 <= end) {
+    h64 ^= xxh64_round(0, read64(p));
+    h64  = rotl64(h64, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    p += 8;
+  }
+
+  if(p + 4 <= end) {
+    h64 ^= (uint64_t)read32(p) * XXH_PRIME64_1;
+    h64  = rotl64(h64, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+    p += 4;
+  }
+
+  while(p < end) {
+    h64 ^= (*p) * XXH_PRIME64_5;
+    h64  = rotl64(h64, 11) * XXH_PRIME64_1;
+    ++p;
+  }
+
+  h64 ^= h64 >> 33;
+  h64 *= XXH_PRIME64_2;
+  h64 ^= h64 >> 29;
+  h64 *= XXH_PRIME64_3;
+  h64 ^= h64 >> 32;
+
+  return h64;
+}
+
+/** \brief Compute the XXH64 hash of a block of memory
+ *
+ * \param data Pointer to the data
+ * \param len Length of the data in bytes
+ * \param seed Seed value
+ * \return 64-bit hash value
+ *
+ * The result is identical to the reference implementation of xxHash, on any platform.
+ */
+PUBLIC uint64_t xxh64(const void *data, size_t len, uint64_t seed) {
+  const uint8_t *p = (const uint8_t*)data;
+  const uint8_t *end = p + len;
+  uint64_t h64;
+  uint64_t v1, v2, v3, v4;
+
+  if(len >= 32) {
+    const uint8_t *limit = end - 32;
+
+    v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    v2 = seed + XXH_PRIME64_2;
+    v3 = seed;
+    v4 = seed - XXH_PRIME64_1;
+
+    do {
+      v1 = xxh64_round(v1, read64(p));
+      v2 = xxh64_round(v2, read64(p + 8));
+      v3 = xxh64_round(v3, read64(p + 16));
+      v4 = xxh64_round(v4, read64(p + 24));
+      p += 32;
+    } while(p <= limit);
+
+    h64 = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+    h64 = xxh64_merge(h64, v1);
+    h64 = xxh64_merge(h64, v2);
+    h64 = xxh64_merge(h64, v3);
+    h64 = xxh64_merge(h64, v4);
+  } else {
+    h64 = seed + XXH_PRIME64_5;
+  }
+
+  return xxh64_finalize(h64 + (uint64_t)len, p, end);
+}
+
+/** \brief Start an incremental XXH64 computation
+ *
+ * \param state The state
+ * \param seed Seed value
+ */
+PUBLIC void xxh64_reset(xxh64_state *state, uint64_t seed) {
+  memset(state, 0, sizeof(xxh64_state));
+  state->seed = seed;
+  state->v[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+  state->v[1] = seed + XXH_PRIME64_2;
+  state->v[2] = seed;
+  state->v[3] = seed - XXH_PRIME64_1;
+}
+
+/** \brief Add data to an incremental XXH64 computation
+ *
+ * \param state The state
+ * \param data Pointer to the data
+ * \param len Length of the data in bytes
+ *
+ * The data may be handed over in chunks of any size, the result is the same as for xxh64().
+ */
+PUBLIC void xxh64_update(xxh64_state *state, const void *data, size_t len) {
+  const uint8_t *p = (const uint8_t*)data;
+  const uint8_t *end = p + len;
+  uint32_t fill;
+
+  state->total_len += len;
+
+  if(state->mem_size + len < 32) {
+    memcpy(state->mem + state->mem_size, p, len);
+    state->mem_size += len;
+    return;
+  }
+
+  if(state->mem_size > 0) {
+    fill = 32 - state->mem_size;
+    memcpy(state->mem + state->mem_size, p, fill);
+    state->v[0] = xxh64_round(state->v[0], read64(state->mem));
+    state->v[1] = xxh64_round(state->v[1], read64(state->mem + 8));
+    state->v[2] = xxh64_round(state->v[2], read64(state->mem + 16));
+    state->v[3] = xxh64_round(state->v[3], read64(state->mem + 24));
+    p += fill;
+    state->mem_size = 0;
+  }
+
+  while(p + 32 <= end) {
+    state->v[0] = xxh64_round(state->v[0], read64(p));
+    state->v[1] = xxh64_round(state->v[1], read64(p + 8));
+    state->v[2] = xxh64_round(state->v[2], read64(p + 16));
+    state->v[3] = xxh64_round(state->v[3], read64(p + 24));
+    p += 32;
+  }
+
+  if(p < end) {
+    memcpy(state->mem, p, end - p);
+    state->mem_size = end - p;
+  }
+}
+
+/** \brief Result of an incremental XXH64 computation
+ *
+ * \param state The state
+ * \return The hash of all data handed to xxh64_update() so far
+ */
+PUBLIC uint64_t xxh64_digest(const xxh64_state *state) {
+  uint64_t h64;
+
+  if(state->total_len >= 32) {
+    h64 = rotl64(state->v[0], 1) + rotl64(state->v[1], 7) + rotl64(state->v[2], 12) + rotl64(state->v[3], 18);
+    h64 = xxh64_merge(h64, state->v[0]);
+    h64 = xxh64_merge(h64, state->v[1]);
+    h64 = xxh64_merge(h64, state->v[2]);
+    h64 = xxh64_merge(h64, state->v[3]);
+  } else {
+    h64 = state->seed + XXH_PRIME64_5;
+  }
+
+  return xxh64_finalize(h64 + state->total_len, state->mem, state->mem + state->mem_size);
+}
+
+/** \brief Hash a zero-terminated string
+ *
+ * \param str The string
+ * \return 64-bit hash value of \a str (0 for a \c NULL pointer)
+ */
+PUBLIC uint64_t hash_string(const char *str) {
+  return str ? xxh64(str, strlen(str), 0) : 0;
+}
+
+/** \brief Compute the 128-bit digest of a block of data
+ *
+ * \param[in] data The data
+ * \param[in] len Length of the data
+ * \param[out] digest The digest. Both halves are 0 for a \c NULL pointer.
+ */
+PUBLIC void hash128_data(const void *data, size_t len, hash128 *digest) {
+  if(!data) {
+    digest->h1 = digest->h2 = 0;
+    return;
+  }
+  digest->h1 = xxh64(data, len, 0);
+  digest->h2 = xxh64(data, len, HASH128_SEED2);
+}
+
+/** \brief Compute the 128-bit digest of a zero-terminated string
+ *
+ * \param[in] str The string
+ * \param[out] digest The digest. Both halves are 0 for a \c NULL pointer.
+ */
+PUBLIC void hash128_string(const char *str, hash128 *digest) {
+  hash128_data(str, str ? strlen(str) : 0, digest);
+}
+
+/** \brief Compare two 128-bit digests
+ *
+ * \return <0, 0 or >0, like memcmp()
+ */
+PUBLIC int hash128_cmp(const hash128 *a, const hash128 *b) {
+  if(a->h1 != b->h1) {
+    return a->h1 < b->h1 ? -1 : 1;
+  }
+  if(a->h2 != b->h2) {
+    return a->h2 < b->h2 ? -1 : 1;
+  }
+  return 0;
+}
@@ -0,0 +1,336 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file hashring.c
+ *
+ * Hash-indexed ring buffer of 64-bit keys.
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hashring.h"
+#include "output.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+/** \cond */
+#define HASHRING_INITIAL_SIZE 16
+
+struct hashring_entry {
+  uint64_t  key;
+  char     *value;
+};
+
+struct hashring {
+  struct hashring_entry *ring;   /**< entries, ordered from oldest to newest (cyclic) */
+  uint32_t  ring_size;           /**< number of slots in the ring, always a power of 2 */
+  uint32_t  head;                /**< ring slot the next newest entry is stored in */
+  uint32_t  count;               /**< number of entries */
+  uint32_t *index;               /**< hash slots holding (ring slot + 1), 0 marks a free slot */
+  uint32_t  index_size;          /**< twice the ring size, so the load factor stays below 0.5 */
+  uint8_t  *payload;             /**< payload_size bytes per ring slot */
+  size_t    payload_size;
+};
+/** \endcond */
+
+PRIVATE uint32_t ring_slot(const hashring *h, uint32_t offset) {
+  return offset & (h->ring_size - 1);
+}
+
+/* linear probing: find the index slot of the entry with the given key (and value), or -1 */
+PRIVATE int64_t index_find(const hashring *h, uint64_t key, const char *value) {
+  uint32_t mask = h->index_size - 1;
+  uint32_t s = (uint32_t)key & mask;
+  const struct hashring_entry *e = NULL;
+
+  while(h->index[s]) {
+    e = &h->ring[h->index[s] - 1];
+    if(e->key == key && (!value || !e->value || strcmp(e->value, value) == 0)) {
+      return s;
+    }
+    s = (s + 1) & mask;
+  }
+  return -1;
+}
+
+PRIVATE void index_insert(hashring *h, uint32_t pos) {
+  uint32_t mask = h->index_size - 1;
+  uint32_t s = (uint32_t)h->ring[pos].key & mask;
+
+  while(h->index[s]) {
+    s = (s + 1) & mask;
+  }
+  h->index[s] = pos + 1;
+}
+
+/* remove the index slot of the given ring slot; uses backward-shift deletion so no tombstones are needed */
+PRIVATE void index_remove(hashring *h, uint32_t pos) {
+  uint32_t mask = h->index_size - 1;
+  uint32_t i = (uint32_t)h->ring[pos].key & mask;
+  uint32_t j, k;
+
+  while(h->index[i] != pos + 1) {
+    i = (i + 1) & mask;
+  }
+
+  j = i;
+  for(;;) {
+    j = (j + 1) & mask;
+    if(!h->index[j]) {
+      break;
+    }
+    k = (uint32_t)h->ring[h->index[j] - 1].key & mask;
+    /* move the entry into the gap unless its home slot lies cyclically within (i, j] */
+    if((i <= j) ? (k <= i || k > j) : (k <= i && k > j)) {
+      h->index[i] = h->index[j];
+      i = j;
+    }
+  }
+  h->index[i] = 0;
+}
+
+PRIVATE int hashring_grow(hashring *h) {
+  struct hashring_entry *ring = NULL;
+  uint32_t *index = NULL;
+  uint8_t *payload = NULL;
+  uint32_t size = h->ring_size ? h->ring_size * 2 : HASHRING_INITIAL_SIZE;
+  uint32_t i, oldest;
+
+  ring  = am_malloc(size * sizeof(struct hashring_entry));
+  index = am_malloc(size * 2 * sizeof(uint32_t));
+  if(h->payload_size > 0) {
+    payload = am_malloc(size * h->payload_size);
+  }
+  if(!ring || !index || (h->payload_size > 0 && !payload)) {
+    dbg_printf(P_ERROR, "[hashring_grow] Out of memory (%d entries)", size);
+    am_free(ring);
+    am_free(index);
+    am_free(payload);
+    return -1;
+  }
+
+  /* linearize the ring: the oldest entry moves to slot 0 */
+  oldest = h->head - h->count;
+  for(i = 0; i < h->count; ++i) {
+    ring[i] = h->ring[ring_slot(h, oldest + i)];
+    if(payload) {
+      memcpy(payload + i * h->payload_size, h->payload + ring_slot(h, oldest + i) * h->payload_size, h->payload_size);
+    }
+  }
+
+  am_free(h->ring);
+  am_free(h->index);
+  am_free(h->payload);
+  h->payload    = payload;
+  h->ring       = ring;
+  h->ring_size  = size;
+  h->head       = h->count;
+  h->index      = index;
+  h->index_size = size * 2;
+
+  memset(h->index, 0, h->index_size * sizeof(uint32_t));
+  for(i = 0; i < h->count; ++i) {
+    index_insert(h, i);
+  }
+  return 0;
+}
+
+PRIVATE void hashring_store(hashring *h, uint32_t pos, uint64_t key, const char *value) {
+  h->ring[pos].key   = key;
+  h->ring[pos].value = value ? am_strdup(value) : NULL;
+  if(h->payload) {
+    memset(h->payload + pos * h->payload_size, 0, h->payload_size);
+  }
+  ++h->count;
+  index_insert(h, pos);
+}
+
+PRIVATE void hashring_remove_oldest(hashring *h) {
+  uint32_t pos = ring_slot(h, h->head - h->count);
+
+  index_remove(h, pos);
+  am_free(h->ring[pos].value);
+  h->ring[pos].value = NULL;
+  --h->count;
+}
+
+/** \brief Create a new, empty hashring
+ *
+ * \param payload_size Size (in bytes) of the payload of each entry, may be 0
+ * \return Pointer to the new hashring, or \c NULL if there's not enough memory
+ */
+PUBLIC hashring* hashring_new(size_t payload_size) {
+  hashring *h = am_malloc(sizeof(struct hashring));
+
+  if(h) {
+    h->payload      = NULL;
+    h->payload_size = payload_size;
+    h->ring       = NULL;
+    h->ring_size  = 0;
+    h->head       = 0;
+    h->count      = 0;
+    h->index      = NULL;
+    h->index_size = 0;
+    if(hashring_grow(h) != 0) {
+      am_free(h);
+      h = NULL;
+    }
+  }
+  return h;
+}
+
+/** \brief Free a hashring and all its entries
+ *
+ * \param h Pointer to a hashring
+ */
+PUBLIC void hashring_free(hashring *h) {
+  if(h) {
+    hashring_clear(h);
+    am_free(h->ring);
+    am_free(h->index);
+    am_free(h->payload);
+    am_free(h);
+  }
+}
+
+/** \brief Add a new entry as the newest one
+ *
+ * \param h Pointer to a hashring
+ * \param key Key of the entry (e.g. a hash of \a value)
+ * \param value (Optional) String stored alongside the key. A copy is made.
+ * \return 0 if the entry was added, 1 if it already was present, -1 on error.
+ *
+ * The payload of the new entry is zeroed, hashring_payload(h, 0) returns a pointer to it.
+ */
+PUBLIC int hashring_add(hashring *h, uint64_t key, const char *value) {
+  if(!h) {
+    return -1;
+  }
+
+  if(index_find(h, key, value) >= 0) {
+    return 1;
+  }
+
+  if(h->count == h->ring_size && hashring_grow(h) != 0) {
+    return -1;
+  }
+
+  hashring_store(h, ring_slot(h, h->head), key, value);
+  h->head = ring_slot(h, h->head + 1);
+  return 0;
+}
+
+/** \brief Add a new entry as the oldest one
+ *
+ * \param h Pointer to a hashring
+ * \param key Key of the entry
+ * \param value (Optional) String stored alongside the key. A copy is made.
+ * \return 0 if the entry was added, 1 if it already was present, -1 on error.
+ *
+ * Useful to restore a hashring from a list that is sorted from newest to oldest.
+ */
+PUBLIC int hashring_append(hashring *h, uint64_t key, const char *value) {
+  if(!h) {
+    return -1;
+  }
+
+  if(index_find(h, key, value) >= 0) {
+    return 1;
+  }
+
+  if(h->count == h->ring_size && hashring_grow(h) != 0) {
+    return -1;
+  }
+
+  hashring_store(h, ring_slot(h, h->head - h->count - 1), key, value);
+  return 0;
+}
+
+/** \brief Check whether an entry is present
+ *
+ * \param h Pointer to a hashring
+ * \param key Key of the entry
+ * \param value (Optional) If given, the stored value must match as well. This rules out false
+ * positives caused by hash collisions.
+ * \return 1 if the entry is present, 0 otherwise
+ */
+PUBLIC uint8_t hashring_contains(const hashring *h, uint64_t key, const char *value) {
+  return (h && index_find(h, key, value) >= 0) ? 1 : 0;
+}
+
+/** \brief Evict the oldest entries until at most \a max_entries are left
+ *
+ * \param h Pointer to a hashring
+ * \param max_entries Maximum number of entries to keep
+ */
+PUBLIC void hashring_trim(hashring *h, uint32_t max_entries) {
+  if(h) {
+    while(h->count > max_entries) {
+      hashring_remove_oldest(h);
+    }
+  }
+}
+
+/** \brief Remove all entries
+ *
+ * \param h Pointer to a hashring
+ */
+PUBLIC void hashring_clear(hashring *h) {
+  hashring_trim(h, 0);
+}
+
+/** \brief Number of entries in the hashring */
+PUBLIC uint32_t hashring_count(const hashring *h) {
+  return h ? h->count : 0;
+}
+
+/** \brief Key of the i-th newest entry (0 is the newest) */
+PUBLIC uint64_t hashring_key(const hashring *h, uint32_t i) {
+  if(!h || i >= h->count) {
+    return 0;
+  }
+  return h->ring[ring_slot(h, h->head - 1 - i)].key;
+}
+
+/** \brief Value of the i-th newest entry (0 is the newest), or \c NULL */
+PUBLIC const char* hashring_value(const hashring *h, uint32_t i) {
+  if(!h || i >= h->count) {
+    return NULL;
+  }
+  return h->ring[ring_slot(h, h->head - 1 - i)].value;
+}
+
+/** \brief Payload of the i-th newest entry (0 is the newest), or \c NULL */
+PUBLIC void* hashring_payload(const hashring *h, uint32_t i) {
+  if(!h || !h->payload || i >= h->count) {
+    return NULL;
+  }
+  return h->payload + ring_slot(h, h->head - 1 - i) * h->payload_size;
+}
@@ -0,0 +1,655 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file metrics.c
+ *
+ * Registry of counters, gauges and histograms, rendered in the OpenMetrics text format.
+ *
+ * All memory of a metric is allocated when it is registered, so updating it is a plain store
+ * into memory that belongs to the metric: no allocation and no lock. The registry is only used
+ * from the thread that runs the event loop.
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+#include "output.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+/** maximum number of HTTP clients connected at the same time */
+#define METRICS_MAX_CLIENTS 8
+
+/** time in milliseconds a client has to send its request and take the response */
+#define METRICS_CLIENT_TIMEOUT 5000
+
+/** maximum size of an HTTP request (request line and header fields) */
+#define METRICS_MAX_REQUEST 4096
+
+#define METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/** \cond */
+typedef enum {
+  METRIC_COUNTER,
+  METRIC_GAUGE,
+  METRIC_HISTOGRAM
+} metric_type;
+
+struct metric {
+  metric      *next;
+  metric_type  type;
+  char        *name;
+  char        *help;
+  uint64_t     count;    /**< value of a counter, number of observations of a histogram */
+  double       value;    /**< value of a gauge, sum of the observations of a histogram */
+  uint32_t     bucket_count;
+  double       bounds[METRICS_MAX_BUCKETS];
+  uint64_t     buckets[METRICS_MAX_BUCKETS + 1]; /**< observations per bucket (not cumulative), the last one is +Inf */
+};
+
+struct metrics {
+  metric              *first;
+  metric              *last;
+  metrics_collect_func collect;
+  void                *collect_data;
+};
+
+struct output_buffer {
+  char   *data;
+  size_t  len;
+  size_t  size;
+  uint8_t failed;
+};
+/** \endcond */
+
+/** \brief Create an empty registry
+ *
+ * \return Pointer to the new registry, or \c NULL if it couldn't be allocated
+ */
+PUBLIC metrics* metrics_new(void) {
+  metrics *registry = am_malloc(sizeof(struct metrics));
+
+  if(registry) {
+    memset(registry, 0, sizeof(struct metrics));
+  }
+  return registry;
+}
+
+/** \brief Free a registry and all its metrics */
+PUBLIC void metrics_free(metrics *registry) {
+  metric *m = NULL;
+
+  if(registry) {
+    while(registry->first) {
+      m = registry->first;
+      registry->first = m->next;
+      am_free(m->name);
+      am_free(m->help);
+      am_free(m);
+    }
+    am_free(registry);
+  }
+}
+
+PRIVATE metric* addMetric(metrics *registry, metric_type type, const char *name, const char *help) {
+  metric *m = NULL;
+
+  if(!registry || !name || !*name) {
+    return NULL;
+  }
+
+  m = am_malloc(sizeof(struct metric));
+  if(!m) {
+    return NULL;
+  }
+  memset(m, 0, sizeof(struct metric));
+  m->type = type;
+  m->name = am_strdup(name);
+  m->help = am_strdup(help ? help : "");
+  if(!m->name || !m->help) {
+    am_free(m->name);
+    am_free(m->help);
+    am_free(m);
+    return NULL;
+  }
+
+  /* metrics are rendered in the order they were registered */
+  if(registry->last) {
+    registry->last->next = m;
+  } else {
+    registry->first = m;
+  }
+  registry->last = m;
+  return m;
+}
+
+/** \brief Register a counter
+ *
+ * \param[in] registry The registry
+ * \param[in] name Name of the metric family, without the suffix "_total"
+ * \param[in] help Description of the metric
+ * \return Handle of the counter, or \c NULL if it couldn't be allocated
+ */
+PUBLIC metric* metrics_counter(metrics *registry, const char *name, const char *help) {
+  return addMetric(registry, METRIC_COUNTER, name, help);
+}
+
+/** \brief Register a gauge
+ *
+ * \param[in] registry The registry
+ * \param[in] name Name of the metric
+ * \param[in] help Description of the metric
+ * \return Handle of the gauge, or \c NULL if it couldn't be allocated
+ */
+PUBLIC metric* metrics_gauge(metrics *registry, const char *name, const char *help) {
+  return addMetric(registry, METRIC_GAUGE, name, help);
+}
+
+/** \brief Register a histogram
+ *
+ * \param[in] registry The registry
+ * \param[in] name Name of the metric
+ * \param[in] help Description of the metric
+ * \param[in] bounds Upper bounds of the buckets, in ascending order
+ * \param[in] count Number of bounds (at most METRICS_MAX_BUCKETS)
+ * \return Handle of the histogram, or \c NULL if it couldn't be allocated or the bounds are invalid
+ */
+PUBLIC metric* metrics_histogram(metrics *registry, const char *name, const char *help, const double *bounds, uint32_t count) {
+  metric *m = NULL;
+  uint32_t i;
+
+  if(!bounds || count == 0 || count > METRICS_MAX_BUCKETS) {
+    return NULL;
+  }
+  for(i = 1; i < count; ++i) {
+    if(bounds[i] <= bounds[i - 1]) {
+      return NULL;
+    }
+  }
+
+  m = addMetric(registry, METRIC_HISTOGRAM, name, help);
+  if(m) {
+    memcpy(m->bounds, bounds, count * sizeof(double));
+    m->bucket_count = count;
+  }
+  return m;
+}
+
+/** \brief Set the function that updates the gauges before the registry is rendered */
+PUBLIC void metrics_set_collect(metrics *registry, metrics_collect_func func, void *userdata) {
+  if(registry) {
+    registry->collect = func;
+    registry->collect_data = userdata;
+  }
+}
+
+/** \brief Increase a counter
+ *
+ * \param[in] m Handle of the counter (may be \c NULL)
+ * \param[in] n Amount to add
+ */
+PUBLIC void metric_add(metric *m, uint64_t n) {
+  if(m) {
+    m->count += n;
+  }
+}
+
+/** \brief Set a counter that is kept elsewhere
+ *
+ * \param[in] m Handle of the counter (may be \c NULL)
+ * \param[in] n Current value
+ */
+PUBLIC void metric_set_count(metric *m, uint64_t n) {
+  if(m) {
+    m->count = n;
+  }
+}
+
+/** \brief Set a gauge
+ *
+ * \param[in] m Handle of the gauge (may be \c NULL)
+ * \param[in] value Current value
+ */
+PUBLIC void metric_set(metric *m, double value) {
+  if(m) {
+    m->value = value;
+  }
+}
+
+/** \brief Add an observation to a histogram
+ *
+ * \param[in] m Handle of the histogram (may be \c NULL)
+ * \param[in] value The observed value
+ */
+PUBLIC void metric_observe(metric *m, double value) {
+  uint32_t i;
+
+  if(m) {
+    i = 0;
+    while(i < m->bucket_count && value > m->bounds[i]) {
+      ++i;
+    }
+    ++m->buckets[i];
+    ++m->count;
+    m->value += value;
+  }
+}
+
+/** \brief Value of a counter, or the number of observations of a histogram */
+PUBLIC uint64_t metric_count(const metric *m) {
+  return m ? m->count : 0;
+}
+
+/** \brief Seconds on a monotonic clock, to measure durations with */
+PUBLIC double metrics_clock(void) {
+  struct timespec ts;
+
+  if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0) {
+    return 0;
+  }
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/** \brief Resident set size of the process in bytes (0 if unknown) */
+PUBLIC uint64_t metrics_resident_memory(void) {
+  FILE *fp = fopen("/proc/self/statm", "r");
+  unsigned long long size = 0, resident = 0;
+  long page_size = sysconf(_SC_PAGESIZE);
+
+  if(!fp) {
+    return 0;
+  }
+  if(fscanf(fp, "%llu %llu", &size, &resident) != 2 || page_size <= 0) {
+    resident = 0;
+  }
+  fclose(fp);
+  return (uint64_t)resident * (uint64_t)page_size;
+}
+
+PRIVATE void appendf(struct output_buffer *buf, const char *format, ...) {
+  va_list ap;
+  char *tmp = NULL;
+  size_t size;
+  int len;
+
+  if(buf->failed) {
+    return;
+  }
+
+  va_start(ap, format);
+  len = vsnprintf(buf->data ? buf->data + buf->len : NULL, buf->data ? buf->size - buf->len : 0, format, ap);
+  va_end(ap);
+  if(len < 0) {
+    buf->failed = 1;
+    return;
+  }
+
+  if(!buf->data || buf->len + (size_t)len >= buf->size) {
+    size = buf->size > 0 ? buf->size : 4096;
+    while(buf->len + (size_t)len >= size) {
+      size *= 2;
+    }
+    tmp = am_realloc(buf->data, size);
+    if(!tmp) {
+      buf->failed = 1;
+      return;
+    }
+    buf->data = tmp;
+    buf->size = size;
+    va_start(ap, format);
+    vsnprintf(buf->data + buf->len, buf->size - buf->len, format, ap);
+    va_end(ap);
+  }
+  buf->len += (size_t)len;
+}
+
+/** \brief Render all metrics of a registry in the OpenMetrics text format
+ *
+ * \param[in] registry The registry
+ * \param[out] len (Optional) Length of the text
+ * \return The text (to be freed with am_free()), or \c NULL if it couldn't be allocated
+ */
+PUBLIC char* metrics_render(metrics *registry, size_t *len) {
+  struct output_buffer buf;
+  const metric *m = NULL;
+  uint64_t cumulative;
+  uint32_t i;
+
+  if(!registry) {
+    return NULL;
+  }
+
+  if(registry->collect) {
+    registry->collect(registry, registry->collect_data);
+  }
+
+  memset(&buf, 0, sizeof(buf));
+  for(m = registry->first; m; m = m->next) {
+    switch(m->type) {
+      case METRIC_COUNTER:
+        appendf(&buf, "# TYPE %s counter\n# HELP %s %s\n", m->name, m->name, m->help);
+        appendf(&buf, "%s_total %llu\n", m->name, (unsigned long long)m->count);
+        break;
+      case METRIC_GAUGE:
+        appendf(&buf, "# TYPE %s gauge\n# HELP %s %s\n", m->name, m->name, m->help);
+        appendf(&buf, "%s %.15g\n", m->name, m->value);
+        break;
+      case METRIC_HISTOGRAM:
+        appendf(&buf, "# TYPE %s histogram\n# HELP %s %s\n", m->name, m->name, m->help);
+        cumulative = 0;
+        for(i = 0; i < m->bucket_count; ++i) {
+          cumulative += m->buckets[i];
+          appendf(&buf, "%s_bucket{le=\"%.15g\"} %llu\n", m->name, m->bounds[i], (unsigned long long)cumulative);
+        }
+        appendf(&buf, "%s_bucket{le=\"+Inf\"} %llu\n", m->name, (unsigned long long)m->count);
+        appendf(&buf, "%s_sum %.15g\n%s_count %llu\n", m->name, m->value, m->name, (unsigned long long)m->count);
+        break;
+    }
+  }
+  appendf(&buf, "# EOF\n");
+
+  if(buf.failed) {
+    am_free(buf.data);
+    return NULL;
+  }
+  if(len) {
+    *len = buf.len;
+  }
+  return buf.data;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** \cond */
+typedef struct metrics_client metrics_client;
+
+struct metrics_client {
+  metrics_client *next;
+  metrics_server *server;
+  int             fd;
+  event_timer    *timer;    /**< closes the connection if the client takes too long */
+  char            in[METRICS_MAX_REQUEST];
+  size_t          in_len;
+  char           *out;      /**< the response, once the request is complete */
+  size_t          out_len;
+  size_t          out_pos;
+};
+
+struct metrics_server {
+  event_loop     *loop;
+  int             fd;
+  metrics        *registry;
+  metrics_client *clients;
+  uint32_t        client_count;
+  uint32_t        timeout;  /**< see METRICS_CLIENT_TIMEOUT */
+};
+/** \endcond */
+
+PRIVATE void metrics_client_free(metrics_client *c) {
+  metrics_client **pos = NULL;
+
+  for(pos = &c->server->clients; *pos; pos = &(*pos)->next) {
+    if(*pos == c) {
+      *pos = c->next;
+      --c->server->client_count;
+      break;
+    }
+  }
+  event_timer_free(c->timer);
+  event_loop_unwatch(c->server->loop, c->fd);
+  close(c->fd);
+  am_free(c->out);
+  am_free(c);
+}
+
+/* put together the response to a complete request */
+PRIVATE void answerRequest(metrics_client *c, uint8_t complete) {
+  struct output_buffer buf;
+  const char *status = "200 OK";
+  char *body = NULL;
+  size_t body_len = 0;
+  char *path = NULL, *end = NULL;
+  uint8_t head = 0;
+
+  head = strncmp(c->in, "HEAD ", 5) == 0 ? 1 : 0;
+  if(!complete) {
+    status = "431 Request Header Fields Too Large";
+  } else if(head || !strncmp(c->in, "GET ", 4)) {
+    path = c->in + (head ? 5 : 4);
+    end = path + strcspn(path, " ?\r\n");
+    if(end - path != 8 || strncmp(path, "/metrics", 8) != 0) {
+      status = "404 Not Found";
+    } else if((body = metrics_render(c->server->registry, &body_len)) == NULL) {
+      status = "500 Internal Server Error";
+    }
+  } else {
+    status = "405 Method Not Allowed";
+  }
+
+  memset(&buf, 0, sizeof(buf));
+  appendf(&buf, "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %lu\r\nConnection: close\r\n\r\n",
+          status, body ? METRICS_CONTENT_TYPE : "text/plain", (unsigned long)body_len);
+  if(body && !head) {
+    appendf(&buf, "%s", body);
+  }
+  am_free(body);
+
+  if(buf.failed) {
+    am_free(buf.data);
+    return;
+  }
+  c->out = buf.data;
+  c->out_len = buf.len;
+  c->out_pos = 0;
+}
+
+PRIVATE void onClientReady(int fd, uint32_t events, void *userdata) {
+  metrics_client *c = (metrics_client*)userdata;
+  ssize_t n;
+
+  if(!c->out && (events & EVENT_READ)) {
+    n = recv(fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len, 0);
+    if(n <= 0) {
+      if(n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        metrics_client_free(c);
+      }
+      return;
+    }
+    c->in_len += (size_t)n;
+    c->in[c->in_len] = '\0';
+    /* the request ends with an empty line */
+    if(strstr(c->in, "\r\n\r\n") || strstr(c->in, "\n\n")) {
+      answerRequest(c, 1);
+    } else if(c->in_len == sizeof(c->in) - 1) {
+      answerRequest(c, 0);
+    } else {
+      return;
+    }
+    if(!c->out || event_loop_watch(c->server->loop, fd, EVENT_WRITE, onClientReady, c) != 0) {
+      metrics_client_free(c);
+    }
+    return;
+  }
+
+  if(c->out && (events & (EVENT_WRITE | EVENT_ERROR))) {
+    n = send(fd, c->out + c->out_pos, c->out_len - c->out_pos, MSG_NOSIGNAL);
+    if(n > 0) {
+      c->out_pos += (size_t)n;
+    }
+    if(c->out_pos == c->out_len || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+      metrics_client_free(c);
+    }
+    return;
+  }
+
+  if(events & EVENT_ERROR) {
+    metrics_client_free(c);
+  }
+}
+
+/* idle clients would keep the others from connecting */
+PRIVATE void onClientTimeout(event_timer *timer, void *userdata) {
+  metrics_client *c = (metrics_client*)userdata;
+
+  (void)timer;
+  dbg_printf(P_INFO2, "[metrics] Client timed out, closing the connection");
+  metrics_client_free(c);
+}
+
+PRIVATE void onAccept(int fd, uint32_t events, void *userdata) {
+  metrics_server *server = (metrics_server*)userdata;
+  metrics_client *c = NULL;
+  int client_fd;
+
+  (void)events;
+
+  while((client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    if(server->client_count >= METRICS_MAX_CLIENTS) {
+      dbg_printf(P_ERROR, "[metrics] Too many clients, connection refused");
+      close(client_fd);
+      continue;
+    }
+
+    c = am_malloc(sizeof(struct metrics_client));
+    if(!c) {
+      close(client_fd);
+      continue;
+    }
+    memset(c, 0, sizeof(struct metrics_client));
+    c->server = server;
+    c->fd = client_fd;
+    c->timer = event_timer_new(server->loop, onClientTimeout, c);
+    if(!c->timer || event_timer_after(c->timer, server->timeout) != 0 ||
+       event_loop_watch(server->loop, client_fd, EVENT_READ, onClientReady, c) != 0) {
+      event_timer_free(c->timer);
+      close(client_fd);
+      am_free(c);
+      continue;
+    }
+    c->next = server->clients;
+    server->clients = c;
+    ++server->client_count;
+  }
+}
+
+/** \brief Serve the metrics of a registry over HTTP ("GET /metrics")
+ *
+ * \param[in] loop Event loop that serves the clients
+ * \param[in] port TCP port on the loopback interface (0: any free port)
+ * \param[in] registry The registry
+ * \return Pointer to the new server, or \c NULL if the port couldn't be opened
+ */
+PUBLIC metrics_server* metrics_server_new(event_loop *loop, uint16_t port, metrics *registry) {
+  metrics_server *server = NULL;
+  struct sockaddr_in addr;
+  int fd, on = 1;
+
+  if(!loop || !registry) {
+    return NULL;
+  }
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    dbg_printf(P_ERROR, "[metrics_server_new] socket: %s", strerror(errno));
+    return NULL;
+  }
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, METRICS_MAX_CLIENTS) != 0) {
+    dbg_printf(P_ERROR, "[metrics_server_new] Unable to listen on port %d: %s", port, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  server = am_malloc(sizeof(struct metrics_server));
+  if(server) {
+    memset(server, 0, sizeof(struct metrics_server));
+    server->loop = loop;
+    server->fd = fd;
+    server->registry = registry;
+    server->timeout = METRICS_CLIENT_TIMEOUT;
+  }
+  if(!server || event_loop_watch(loop, fd, EVENT_READ, onAccept, server) != 0) {
+    am_free(server);
+    close(fd);
+    return NULL;
+  }
+  return server;
+}
+
+/** \brief Close the metrics port and all client connections */
+PUBLIC void metrics_server_free(metrics_server *server) {
+  if(server) {
+    while(server->clients) {
+      metrics_client_free(server->clients);
+    }
+    event_loop_unwatch(server->loop, server->fd);
+    close(server->fd);
+    am_free(server);
+  }
+}
+
+/** \brief Change the time a client has to send its request and take the response
+ *
+ * \param[in] server Pointer to a metrics server
+ * \param[in] timeout_ms Time in milliseconds, counted from the moment the client connects.
+ * Applies to clients that connect later on.
+ */
+PUBLIC void metrics_server_set_timeout(metrics_server *server, uint32_t timeout_ms) {
+  if(server && timeout_ms > 0) {
+    server->timeout = timeout_ms;
+  }
+}
+
+/** \brief TCP port the server listens on (0 if unknown) */
+PUBLIC uint16_t metrics_server_port(const metrics_server *server) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+
+  if(!server || getsockname(server->fd, (struct sockaddr*)&addr, &len) != 0) {
+    return 0;
+  }
+  return ntohs(addr.sin_port);
+}
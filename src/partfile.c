@@ -0,0 +1,232 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file partfile.c
+ *
+ * Bookkeeping of partial downloads.
+ *
+ * A file is downloaded into "<filename>.part" and only renamed to its final name once it is
+ * complete. The sidecar "<filename>.part.info" stores the URL, the validators of the response
+ * and the number of valid bytes as "key = value" lines, so that a later attempt can pick up
+ * where the previous one stopped.
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "partfile.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+PRIVATE char* getInfoFileName(const char *part_file) {
+  char *info_file = am_malloc(strlen(part_file) + 6);
+
+  if(info_file) {
+    sprintf(info_file, "%s.info", part_file);
+  }
+  return info_file;
+}
+
+/* parse "<offset> <length> <written>" and append it to the segments of \a info */
+PRIVATE void addSegment(part_info *info, const char *value) {
+  unsigned long long offset, length, written;
+  part_segment *segments = NULL;
+
+  if(sscanf(value, "%llu %llu %llu", &offset, &length, &written) != 3 || written > length) {
+    return;
+  }
+  segments = am_realloc(info->segments, (info->segment_count + 1) * sizeof(part_segment));
+  if(!segments) {
+    return;
+  }
+  info->segments = segments;
+  info->segments[info->segment_count].offset = offset;
+  info->segments[info->segment_count].length = length;
+  info->segments[info->segment_count].written = written;
+  ++info->segment_count;
+}
+
+/** \brief Name of the file a download is stored in until it is complete
+ *
+ * \param filename Final name of the file
+ * \return Newly allocated string
+ */
+PUBLIC char* part_file_name(const char *filename) {
+  char *part_file = am_malloc(strlen(filename) + 6);
+
+  if(part_file) {
+    sprintf(part_file, "%s.part", filename);
+  }
+  return part_file;
+}
+
+/** \brief Read the information about a partial download
+ *
+ * \param part_file Name of the partial file
+ * \param info Receives the information, must be freed with part_info_free()
+ * \return 0 on success, -1 if there's no information
+ */
+PUBLIC int part_info_load(const char *part_file, part_info *info) {
+  FILE *fp;
+  char *info_file;
+  char *line = NULL;
+  char *value = NULL;
+  size_t line_size = 0;
+  ssize_t len;
+
+  memset(info, 0, sizeof(part_info));
+
+  info_file = getInfoFileName(part_file);
+  if(!info_file) {
+    return -1;
+  }
+  fp = fopen(info_file, "rb");
+  am_free(info_file);
+  if(!fp) {
+    return -1;
+  }
+
+  while((len = getline(&line, &line_size, fp)) > 0) {
+    while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+      line[--len] = '\0';
+    }
+    if((value = strstr(line, " = ")) == NULL) {
+      continue;
+    }
+    *value = '\0';
+    value += 3;
+
+    if(!strcmp(line, "url") && !info->url) {
+      info->url = am_strdup(value);
+    } else if(!strcmp(line, "etag") && !info->etag) {
+      info->etag = am_strdup(value);
+    } else if(!strcmp(line, "last-modified") && !info->last_modified) {
+      info->last_modified = am_strdup(value);
+    } else if(!strcmp(line, "offset")) {
+      info->offset = strtoull(value, NULL, 10);
+    } else if(!strcmp(line, "segment") && info->segment_count < UINT16_MAX) {
+      addSegment(info, value);
+    }
+  }
+
+  free(line);
+  fclose(fp);
+  return info->url ? 0 : -1;
+}
+
+/** \brief Store the information about a partial download
+ *
+ * \param part_file Name of the partial file
+ * \param info The information
+ * \return 0 on success, -1 on error
+ */
+PUBLIC int part_info_save(const char *part_file, const part_info *info) {
+  FILE *fp;
+  char *info_file;
+  int result = 0;
+  uint16_t i;
+
+  info_file = getInfoFileName(part_file);
+  if(!info_file) {
+    return -1;
+  }
+
+  if((fp = fopen(info_file, "wb")) == NULL) {
+    dbg_printf(P_ERROR, "Error: Unable to open '%s' for writing: %s", info_file, strerror(errno));
+    am_free(info_file);
+    return -1;
+  }
+
+  fprintf(fp, "url = %s\n", info->url);
+  if(info->etag) {
+    fprintf(fp, "etag = %s\n", info->etag);
+  }
+  if(info->last_modified) {
+    fprintf(fp, "last-modified = %s\n", info->last_modified);
+  }
+  fprintf(fp, "offset = %llu\n", (unsigned long long)info->offset);
+  for(i = 0; i < info->segment_count; ++i) {
+    fprintf(fp, "segment = %llu %llu %llu\n", (unsigned long long)info->segments[i].offset,
+            (unsigned long long)info->segments[i].length, (unsigned long long)info->segments[i].written);
+  }
+
+  result = ferror(fp) ? -1 : 0;
+  if(fclose(fp) != 0 || result != 0) {
+    dbg_printf(P_ERROR, "Error: Unable to write '%s': %s", info_file, strerror(errno));
+    result = -1;
+  }
+
+  am_free(info_file);
+  return result;
+}
+
+/** \brief Validator that lets a partial download be continued with If-Range
+ *
+ * \param info Information about the partial download
+ * \param url URL that is about to be downloaded
+ * \return The ETag or Last-Modified date, or \c NULL if the partial file belongs to another URL or
+ * has no validator (weak ETags don't qualify)
+ */
+PUBLIC const char* part_info_validator(const part_info *info, const char *url) {
+  if(!info || !info->url || !url || strcmp(info->url, url) != 0) {
+    return NULL;
+  }
+  if(info->etag && *info->etag && strncmp(info->etag, "W/", 2) != 0) {
+    return info->etag;
+  }
+  if(info->last_modified && *info->last_modified) {
+    return info->last_modified;
+  }
+  return NULL;
+}
+
+/** \brief Remove the information about a partial download */
+PUBLIC void part_info_remove(const char *part_file) {
+  char *info_file = getInfoFileName(part_file);
+
+  if(info_file) {
+    unlink(info_file);
+    am_free(info_file);
+  }
+}
+
+/** \brief Free the members of a part_info object */
+PUBLIC void part_info_free(part_info *info) {
+  if(info) {
+    am_free(info->url);
+    am_free(info->etag);
+    am_free(info->last_modified);
+    am_free(info->segments);
+    memset(info, 0, sizeof(part_info));
+  }
+}
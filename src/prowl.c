@@ -30,6 +30,7 @@
 #include "prowl.h"
 #include "web.h"
 #include "output.h"
+#include "trace.h"
 #include "utils.h"
 
 #define PROWL_URL "https://prowlapp.com"
@@ -130,10 +131,13 @@ int16_t verifyProwlAPIKey(const char* apikey) {
   char url[128];
   HTTPResponse *response = NULL;
   CURL *curl_session = NULL;
+  trace_span span;
 
   if(apikey) {
     snprintf(url, 128, "%s%s?apikey=%s", PROWL_URL, PROWL_VERIFY, apikey);
+    TRACE_BEGIN(span, "prowl", "verifyProwlAPIKey");
     response = getHTTPData(url, NULL, &curl_session);
+    TRACE_END(span);
     if(response) {
       if(response->responseCode == 200) {
         dbg_printf(P_INFO, "Prowl API key '%s' is valid", apikey);
@@ -157,6 +161,7 @@ int8_t prowl_sendNotification(enum prowl_event event, const char* apikey, const
   int8_t result;
   char desc[500];
   char *event_str = NULL;
+  trace_span span;
 
   switch(event) {
     case PROWL_NEW_TRAILER:
@@ -174,10 +179,12 @@ int8_t prowl_sendNotification(enum prowl_event event, const char* apikey, const
 
   dbg_printf(P_INFO, "[prowl_sendNotification] I: %d E: %s\tD: %s", event, event_str, desc);
 
+  TRACE_BEGIN(span, "prowl", "prowl_sendNotification");
   if(sendProwlNotification(apikey, event_str, desc) == 1) {
     result = 1;
   } else {
     result = 0;
   }
+  TRACE_END_ARG(span, "event", event);
   return result;
 }
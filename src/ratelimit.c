@@ -0,0 +1,194 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file ratelimit.c
+ *
+ * Token buckets and time-of-day windows for bandwidth shaping.
+ *
+ * The bucket is filled at the configured rate, up to a quarter of a second worth of data.
+ * Received data is taken out of it afterwards, so the bucket may run into debt; transfers
+ * are held back until the debt has been paid off.
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <ctype.h>
+
+#include "list.h"
+#include "ratelimit.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+#define MIN_BURST 16384
+
+PRIVATE uint64_t getBurst(uint64_t rate) {
+  return (rate / 4 > MIN_BURST) ? rate / 4 : MIN_BURST;
+}
+
+/** \brief Initialize a token bucket
+ *
+ * \param[in] b Pointer to a token bucket
+ * \param[in] rate Rate in bytes per second (0 means unlimited)
+ * \param[in] now Current time in milliseconds
+ */
+PUBLIC void token_bucket_init(token_bucket *b, uint64_t rate, uint64_t now) {
+  b->rate   = rate;
+  b->burst  = getBurst(rate);
+  b->tokens = (int64_t)b->burst;
+  b->last   = now;
+}
+
+/** \brief Change the rate of a token bucket
+ *
+ * \param[in] b Pointer to a token bucket
+ * \param[in] rate New rate in bytes per second (0 means unlimited)
+ *
+ * A debt from the old rate is kept, saved up tokens are capped to the new burst size.
+ */
+PUBLIC void token_bucket_set_rate(token_bucket *b, uint64_t rate) {
+  b->rate  = rate;
+  b->burst = getBurst(rate);
+  if(rate == 0 || b->tokens > (int64_t)b->burst) {
+    b->tokens = (int64_t)b->burst;
+  }
+}
+
+/** \brief Add the tokens that have accumulated since the last refill
+ *
+ * \param[in] b Pointer to a token bucket
+ * \param[in] now Current time in milliseconds
+ */
+PUBLIC void token_bucket_refill(token_bucket *b, uint64_t now) {
+  uint64_t elapsed;
+
+  if(now <= b->last) {
+    /* the clock went backwards */
+    b->last = now;
+    return;
+  }
+
+  elapsed = now - b->last;
+  if(b->rate == 0) {
+    b->tokens = (int64_t)b->burst;
+    b->last = now;
+  } else if(elapsed * b->rate >= 1000) {
+    b->tokens += (int64_t)(elapsed * b->rate / 1000);
+    if(b->tokens > (int64_t)b->burst) {
+      b->tokens = (int64_t)b->burst;
+    }
+    /* keep the remainder of the division for the next refill */
+    b->last = now - (elapsed * b->rate % 1000) / b->rate;
+  }
+}
+
+/** \brief Take received data out of the bucket */
+PUBLIC void token_bucket_consume(token_bucket *b, uint64_t amount) {
+  if(b->rate > 0) {
+    b->tokens -= (int64_t)amount;
+  }
+}
+
+/** \brief Time until the bucket holds tokens again
+ *
+ * \param[in] b Pointer to a token bucket
+ * \return time in milliseconds (0 if data may be received right away)
+ */
+PUBLIC uint32_t token_bucket_delay(const token_bucket *b) {
+  uint64_t delay;
+
+  if(b->rate == 0 || b->tokens > 0) {
+    return 0;
+  }
+
+  delay = ((uint64_t)(-b->tokens) + 1) * 1000 / b->rate + 1;
+  return delay > 1000 ? 1000 : (uint32_t)delay;
+}
+
+/** \brief Parse a time of the day
+ *
+ * \param[in] str Time in the form "HH:MM"
+ * \param[out] minute Minutes since midnight
+ * \return 0 on success, -1 if the string is no valid time
+ */
+PUBLIC int parseTimeOfDay(const char *str, uint16_t *minute) {
+  int hours = 0, minutes = 0;
+  uint8_t digits = 0;
+
+  while(isspace((unsigned char)*str)) {
+    ++str;
+  }
+  while(isdigit((unsigned char)*str) && digits < 2) {
+    hours = hours * 10 + (*str++ - '0');
+    ++digits;
+  }
+  if(digits == 0 || *str++ != ':') {
+    return -1;
+  }
+  for(digits = 0; digits < 2; ++digits) {
+    if(!isdigit((unsigned char)*str)) {
+      return -1;
+    }
+    minutes = minutes * 10 + (*str++ - '0');
+  }
+  while(isspace((unsigned char)*str)) {
+    ++str;
+  }
+
+  /* "24:00" denotes the end of the day */
+  if(*str != '\0' || minutes > 59 || hours > 24 || (hours == 24 && minutes > 0)) {
+    return -1;
+  }
+  *minute = (uint16_t)(hours * 60 + minutes);
+  return 0;
+}
+
+/** \brief Bandwidth limit that applies at a given time of the day
+ *
+ * \param[in] windows List of rate_window items
+ * \param[in] default_rate Limit outside of all windows
+ * \param[in] minute Minutes since midnight
+ * \return limit in bytes per second (0 means unlimited)
+ *
+ * The first window that covers \a minute wins. A window whose end lies before its start spans
+ * midnight, a window that ends where it starts covers the whole day.
+ */
+PUBLIC uint64_t rate_schedule_lookup(const simple_list windows, uint64_t default_rate, uint16_t minute) {
+  const NODE *current = windows;
+  const rate_window *w = NULL;
+
+  while(current && current->data) {
+    w = (const rate_window*)current->data;
+    if((w->start < w->end && minute >= w->start && minute < w->end) ||
+       (w->start > w->end && (minute >= w->start || minute < w->end)) ||
+       w->start == w->end) {
+      return w->rate;
+    }
+    current = current->next;
+  }
+  return default_rate;
+}
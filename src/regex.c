@@ -1,4 +1,7 @@
 #include <pcre.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
 
@@ -10,6 +13,17 @@
 #include "memwatch.h"
 #endif
 
+/** \cond */
+struct am_regex {
+  pcre       *code;
+  pcre_extra *extra;  /**< result of pcre_study(), may be NULL */
+  char      **parts;  /**< literals of a trivial pattern, in lower case (NULL: the pattern needs PCRE) */
+  uint32_t    part_count;
+  uint8_t     anchor_start; /**< the first literal must start the string */
+  uint8_t     anchor_end;   /**< the last literal must end the string */
+};
+/** \endcond */
+
 PRIVATE int32_t getPCRECaptureCount(const pcre * code) {
    int32_t count = 0;
    int32_t result;
@@ -171,3 +185,596 @@ char* getRegExMatch(const char* pattern, const char* str, uint8_t which_result)
 
   return strstrip(result_str);
 }
+
+PRIVATE void freeParts(am_regex *re) {
+  uint32_t i;
+
+  if(re->parts) {
+    for(i = 0; i < re->part_count; ++i) {
+      am_free(re->parts[i]);
+    }
+    am_free(re->parts);
+    re->parts = NULL;
+  }
+  re->part_count = 0;
+}
+
+/* finish the literal collected so far as the next part of a trivial pattern */
+PRIVATE int addPart(am_regex *re, char *buf, uint32_t *len) {
+  char **parts = NULL;
+
+  if(*len == 0) {
+    return 0;
+  }
+
+  parts = am_realloc(re->parts, (re->part_count + 1) * sizeof(char*));
+  if(!parts) {
+    return -1;
+  }
+  re->parts = parts;
+  buf[*len] = '\0';
+  re->parts[re->part_count] = am_strdup(buf);
+  if(!re->parts[re->part_count]) {
+    return -1;
+  }
+  ++re->part_count;
+  *len = 0;
+  return 0;
+}
+
+/* recognize patterns that are nothing but ASCII literals, optionally anchored, joined by ".*"
+** (e.g. "trailer", "^http://a\.com/", "\.mov$" or "apple.*tlr.*h1080p"), and store their literals
+*/
+PRIVATE void classifyPattern(am_regex *re, const char *pattern) {
+  const char *p = pattern;
+  char *buf = NULL;
+  uint32_t len = 0;
+  uint8_t wildcard = 1; /* whether the last element was ".*" (or the start of the pattern) */
+  uint8_t trivial = 1;
+  char c;
+
+  buf = am_malloc(strlen(pattern) + 1);
+  if(!buf) {
+    return;
+  }
+
+  re->anchor_start = 0;
+  re->anchor_end = 0;
+  if(*p == '^') {
+    re->anchor_start = 1;
+    ++p;
+  }
+
+  while(trivial && *p) {
+    c = 0;
+    if(isspace((unsigned char)*p)) {
+      /* ignored (PCRE_EXTENDED) */
+      ++p;
+      continue;
+    } else if(*p == '.' && p[1] == '*' && p[2] != '?' && p[2] != '+') {
+      if(len == 0 && re->part_count == 0) {
+        /* "^.*" doesn't anchor anything */
+        re->anchor_start = 0;
+      }
+      trivial = (addPart(re, buf, &len) == 0);
+      wildcard = 1;
+      p += 2;
+      continue;
+    } else if(*p == '$' && p[1] == '\0') {
+      re->anchor_end = !wildcard;
+      ++p;
+      continue;
+    } else if(*p == '\\' && p[1] && !isalnum((unsigned char)p[1]) && !(p[1] & 0x80) && !isspace((unsigned char)p[1])) {
+      c = p[1];
+      p += 2;
+    } else if(*p > ' ' && !(*p & 0x80) && strchr("\\.^$|()[]{}*+?#", *p) == NULL) {
+      c = *p++;
+    } else {
+      trivial = 0;
+      break;
+    }
+
+    /* a quantifier turns the character into something else than a literal */
+    while(isspace((unsigned char)*p)) {
+      ++p;
+    }
+    if(*p == '*' || *p == '+' || *p == '?' || *p == '{') {
+      trivial = 0;
+    } else {
+      buf[len++] = (char)tolower((unsigned char)c);
+      wildcard = 0;
+    }
+  }
+
+  if(trivial) {
+    trivial = (addPart(re, buf, &len) == 0);
+  }
+
+  if(!trivial || re->part_count == 0) {
+    freeParts(re);
+  }
+  am_free(buf);
+}
+
+/* case insensitive search for a lower case needle in a haystack (ASCII only) */
+PRIVATE const char* findCaseless(const char *hay, uint32_t hay_len, const char *needle, uint32_t needle_len) {
+  const char *last;
+  uint32_t i;
+
+  if(needle_len > hay_len) {
+    return NULL;
+  }
+
+  for(last = hay + hay_len - needle_len; hay <= last; ++hay) {
+    if(tolower((unsigned char)*hay) == needle[0]) {
+      for(i = 1; i < needle_len && tolower((unsigned char)hay[i]) == needle[i]; ++i) {
+        ;
+      }
+      if(i == needle_len) {
+        return hay;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* match a trivial pattern: its literals have to appear in order, without overlapping */
+PRIVATE uint8_t matchParts(const am_regex *re, const char *str, uint32_t len) {
+  const char *pos = str, *end = str + len, *found = NULL;
+  uint32_t i, part_len;
+
+  for(i = 0; i < re->part_count; ++i) {
+    part_len = strlen(re->parts[i]);
+    if(i == re->part_count - 1 && re->anchor_end) {
+      /* the last literal has to end the string, after the previous ones */
+      if((uint32_t)(end - pos) < part_len || (i == 0 && re->anchor_start && end - part_len != str)) {
+        return 0;
+      }
+      found = findCaseless(end - part_len, part_len, re->parts[i], part_len);
+    } else if(i == 0 && re->anchor_start) {
+      found = findCaseless(pos, part_len <= len ? part_len : len, re->parts[i], part_len);
+    } else {
+      found = findCaseless(pos, end - pos, re->parts[i], part_len);
+    }
+
+    if(!found) {
+      return 0;
+    }
+    pos = found + part_len;
+  }
+
+  return 1;
+}
+
+/* check whether a string can be handled by matchParts(): ASCII only (PCRE folds some non-ASCII
+** characters onto ASCII letters, e.g. the Kelvin sign onto 'k'), and without line breaks (which "."
+** and "$" treat specially)
+*/
+PRIVATE uint8_t isPlainText(const char *str, uint32_t len) {
+  uint32_t i;
+
+  for(i = 0; i < len; ++i) {
+    if((str[i] & 0x80) || str[i] == '\n' || str[i] == '\r') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/** \brief Compile a regular expression for repeated use
+ *
+ * \param pattern The regular expression
+ * \return The compiled expression, or \c NULL if the pattern is invalid
+ *
+ * The expression is studied (and JIT-compiled where PCRE supports it) so that
+ * matchRegEx() can run it as fast as possible. Free it with freeRegEx().
+ */
+am_regex* compileRegEx(const char* pattern) {
+  am_regex *re = NULL;
+  pcre *code = NULL;
+  const char *errbuf = NULL;
+  int study_options = 0;
+
+  code = init_regex(pattern);
+  if(!code) {
+    return NULL;
+  }
+
+  re = am_malloc(sizeof(struct am_regex));
+  if(!re) {
+    pcre_free(code);
+    return NULL;
+  }
+
+#ifdef PCRE_STUDY_JIT_COMPILE
+  study_options |= PCRE_STUDY_JIT_COMPILE;
+#endif
+
+  re->code = code;
+  re->parts = NULL;
+  re->part_count = 0;
+  classifyPattern(re, pattern);
+  if(re->parts) {
+    dbg_printf(P_DBG, "[compileRegEx] '%s' is matched by plain substring search", pattern);
+  }
+
+  re->extra = pcre_study(code, study_options, &errbuf);
+  if(errbuf) {
+    /* not fatal: the expression still works, only slower */
+    dbg_printf(P_INFO, "[compileRegEx] Unable to study pattern '%s': %s", pattern, errbuf);
+    re->extra = NULL;
+  }
+
+  return re;
+}
+
+/** \brief Check whether a string matches a compiled regular expression
+ *
+ * \param re The expression, as returned by compileRegEx()
+ * \param str The string
+ * \param len Length of the string
+ * \return 1 if the string matches, 0 otherwise.
+ *
+ * \a str must be valid UTF-8 (as is all text extracted by libxml2), since PCRE's
+ * UTF-8 check is skipped. Trivial patterns (literals joined by ".*") are matched without PCRE.
+ */
+uint8_t matchRegEx(const am_regex *re, const char* str, uint32_t len) {
+  int err;
+
+  if(!re || !str) {
+    return 0;
+  }
+
+  if(re->parts && isPlainText(str, len)) {
+    return matchParts(re, str, len);
+  }
+
+  err = pcre_exec(re->code, re->extra, str, len, 0, PCRE_NO_UTF8_CHECK, NULL, 0);
+  if(err >= 0) {
+    return 1;
+  } else if(err != PCRE_ERROR_NOMATCH) {
+    dbg_printf(P_ERROR, "[matchRegEx] PCRE error: %d", err);
+  }
+
+  return 0;
+}
+
+/** \brief Check whether a compiled expression is matched by plain substring search
+ *
+ * \param re The expression, as returned by compileRegEx()
+ * \return 1 if the pattern consists of literals only (optionally anchored, and joined by ".*"), 0 otherwise
+ */
+uint8_t isTrivialRegEx(const am_regex *re) {
+  return (re && re->parts) ? 1 : 0;
+}
+
+/** \brief Free a compiled regular expression
+ *
+ * \param re The expression, as returned by compileRegEx()
+ */
+void freeRegEx(am_regex *re) {
+  if(re) {
+    if(re->extra) {
+#ifdef PCRE_STUDY_JIT_COMPILE
+      pcre_free_study(re->extra);
+#else
+      pcre_free(re->extra);
+#endif
+    }
+    pcre_free(re->code);
+    freeParts(re);
+    am_free(re);
+  }
+}
+
+/* check whether a pattern keeps its meaning when it is embedded in a larger expression: back
+** references and recursions refer to group numbers, verbs and \Q affect the surrounding expression,
+** and a comment ("#" in extended mode) would swallow the rest of it.
+*/
+PRIVATE uint8_t isEmbeddable(const char *pattern) {
+  const char *p;
+
+  for(p = pattern; *p; ++p) {
+    if(*p == '#') {
+      return 0;
+    } else if(*p == '\\' && p[1]) {
+      ++p;
+      if(strchr("123456789gkQ", *p)) {
+        return 0;
+      }
+    } else if(*p == '(' && p[1] == '*') {
+      return 0;
+    } else if(*p == '(' && p[1] == '?' && p[2] &&
+              (strchr("PR&|(0123456789", p[2]) || ((p[2] == '-' || p[2] == '+') && p[3] >= '0' && p[3] <= '9'))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/** \brief Compile several regular expressions into a single one
+ *
+ * \param patterns The regular expressions
+ * \param count Number of expressions
+ * \return The combined expression, or \c NULL if one of the patterns can't be combined with the others
+ *
+ * The result matches a string if any of the patterns does. matchRegExSet() reports which one it was.
+ */
+am_regex* compileRegExSet(const char * const *patterns, uint32_t count) {
+  am_regex *re = NULL;
+  char *combined = NULL, *pos = NULL;
+  size_t len = 1;
+  uint32_t i;
+
+  if(!patterns || count == 0) {
+    return NULL;
+  }
+
+  for(i = 0; i < count; ++i) {
+    if(!patterns[i] || !isEmbeddable(patterns[i])) {
+      dbg_printf(P_INFO2, "[compileRegExSet] Pattern '%s' can't be combined with others", patterns[i] ? patterns[i] : "");
+      return NULL;
+    }
+    len += strlen(patterns[i]) + 32;
+  }
+
+  combined = am_malloc(len);
+  if(!combined) {
+    return NULL;
+  }
+
+  /* the mark at the start of each branch tells which one matched */
+  pos = combined;
+  for(i = 0; i < count; ++i) {
+    pos += sprintf(pos, "%s(*MARK:%u)(?:%s)", i > 0 ? "|" : "", i, patterns[i]);
+  }
+
+  re = compileRegEx(combined);
+  am_free(combined);
+  return re;
+}
+
+/** \brief Check which expression of a combined regular expression matches a string
+ *
+ * \param re The expression, as returned by compileRegExSet()
+ * \param str The string (valid UTF-8, see matchRegEx())
+ * \param len Length of the string
+ * \return Index of the pattern that matched, -1 if none did, or -2 in case of an error.
+ *
+ * If several patterns match, the one matching at the leftmost position is reported, which is not
+ * necessarily the one with the lowest index.
+ */
+int32_t matchRegExSet(const am_regex *re, const char* str, uint32_t len) {
+  pcre_extra extra;
+  unsigned char *mark = NULL;
+  int err;
+
+  if(!re || !str) {
+    return -1;
+  }
+
+  if(re->extra) {
+    extra = *re->extra;
+  } else {
+    memset(&extra, 0, sizeof(extra));
+  }
+  extra.flags |= PCRE_EXTRA_MARK;
+  extra.mark = &mark;
+
+  err = pcre_exec(re->code, &extra, str, len, 0, PCRE_NO_UTF8_CHECK, NULL, 0);
+  if(err >= 0) {
+    if(mark) {
+      return atoi((const char*)mark);
+    }
+    dbg_printf(P_ERROR, "[matchRegExSet] Match without a mark");
+  } else if(err != PCRE_ERROR_NOMATCH) {
+    dbg_printf(P_ERROR, "[matchRegExSet] PCRE error: %d", err);
+  } else {
+    return -1;
+  }
+
+  return -2;
+}
+
+/* skip a character class, p points to its opening '[' */
+PRIVATE const char* skipClass(const char *p) {
+  char terminator[3];
+  const char *end = NULL;
+
+  ++p;
+  if(*p == '^') {
+    ++p;
+  }
+  /* a ']' right after the opening bracket (or "[^") is a literal */
+  if(*p == ']') {
+    ++p;
+  }
+  for(; *p && *p != ']'; ++p) {
+    if(*p == '\\' && p[1]) {
+      ++p;
+    } else if(*p == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+      /* POSIX classes ([:digit:]), equivalence classes ([=a=]) and collating elements ([.a.])
+      ** have a ']' of their own
+      */
+      terminator[0] = p[1];
+      terminator[1] = ']';
+      terminator[2] = '\0';
+      end = strstr(p + 2, terminator);
+      if(end) {
+        p = end + 1;
+      }
+    }
+  }
+  return *p ? p + 1 : p;
+}
+
+/* skip a character class or a group, including everything nested in it */
+PRIVATE const char* skipBracket(const char *p) {
+  uint32_t depth = 0;
+
+  while(*p) {
+    if(*p == '\\' && p[1]) {
+      p += 2;
+    } else if(*p == '[') {
+      p = skipClass(p);
+      if(depth == 0) {
+        return p;
+      }
+    } else if(*p == '(') {
+      ++depth;
+      ++p;
+    } else if(*p == ')') {
+      ++p;
+      if(--depth == 0) {
+        return p;
+      }
+    } else {
+      ++p;
+    }
+  }
+  return p;
+}
+
+/* skip a quantifier (and the whitespace in front of it), and tell whether it permits zero repetitions */
+PRIVATE const char* skipQuantifier(const char *p, uint8_t *quantified, uint8_t *optional) {
+  while(isspace((unsigned char)*p)) {
+    ++p;
+  }
+
+  *quantified = 1;
+  *optional = 0;
+  if(*p == '*' || *p == '?') {
+    *optional = 1;
+    ++p;
+  } else if(*p == '+') {
+    ++p;
+  } else if(*p == '{') {
+    /* anything but {n...} with n > 0 might permit zero repetitions */
+    *optional = !isdigit((unsigned char)p[1]) || atoi(p + 1) == 0;
+    while(*p && *p != '}') {
+      ++p;
+    }
+    if(*p) {
+      ++p;
+    }
+  } else {
+    *quantified = 0;
+    return p;
+  }
+
+  /* lazy or possessive */
+  if(*p == '?' || *p == '+') {
+    ++p;
+  }
+  return p;
+}
+
+/* check whether a group sets inline options that change the meaning of whitespace, e.g. "(?-x)" */
+PRIVATE uint8_t setsExtendedOption(const char *p) {
+  if(p[0] != '(' || p[1] != '?') {
+    return 0;
+  }
+  for(p += 2; isalpha((unsigned char)*p) || *p == '-'; ++p) {
+    if(*p == 'x') {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** \brief Find the longest literal that every string matching a pattern contains
+ *
+ * \param pattern The regular expression (compiled with PCRE_EXTENDED, as compileRegEx() does)
+ * \return The literal in lower case (to be freed by the caller), or \c NULL if none was found
+ *
+ * Only the top level of the pattern is analyzed, groups and character classes are skipped. The
+ * analysis stops at constructs it doesn't understand, keeping what it found up to there. The
+ * result is only meant for case insensitive comparisons of ASCII text.
+ */
+char* getRegExLiteral(const char *pattern) {
+  const char *p = pattern;
+  char *run = NULL, *best = NULL;
+  uint32_t run_len = 0, best_len = 0;
+  uint8_t quantified, optional;
+  char c;
+
+  if(!pattern) {
+    return NULL;
+  }
+
+  run = am_malloc(strlen(pattern) + 1);
+  best = am_malloc(strlen(pattern) + 1);
+  if(!run || !best) {
+    am_free(run);
+    am_free(best);
+    return NULL;
+  }
+
+  for(;;) {
+    /* whitespace is ignored (PCRE_EXTENDED) */
+    while(isspace((unsigned char)*p)) {
+      ++p;
+    }
+
+    c = 0;
+    if(*p == '\\' && p[1] && !isalnum((unsigned char)p[1]) && !(p[1] & 0x80)) {
+      /* escaped punctuation */
+      c = p[1];
+      p += 2;
+    } else if(*p > ' ' && !(*p & 0x80) && strchr("\\.^$|()[]{}*+?#", *p) == NULL) {
+      c = *p++;
+    }
+
+    if(c) {
+      p = skipQuantifier(p, &quantified, &optional);
+      if(!optional) {
+        run[run_len++] = (char)tolower((unsigned char)c);
+      }
+      if(!quantified) {
+        continue;
+      }
+    }
+
+    /* anything else ends the current literal */
+    if(run_len > best_len) {
+      memcpy(best, run, run_len);
+      best_len = run_len;
+    }
+    run_len = 0;
+
+    if(c) {
+      /* a repeated character */
+      continue;
+    } else if(*p == '\0' || *p == '#') {
+      break;
+    } else if(*p == '|') {
+      /* alternatives don't have a common literal */
+      best_len = 0;
+      break;
+    } else if(setsExtendedOption(p)) {
+      break;
+    } else if(*p == '(' || *p == '[') {
+      p = skipBracket(p);
+    } else if(*p == '\\') {
+      /* character types and assertions are fine, all other escapes (\x41, \p{L}, \Q, ...) aren't */
+      if(!p[1] || !strchr("dDwWsSbBAzZGhHvVRXN", p[1])) {
+        break;
+      }
+      p += 2;
+    } else if(*p == '.' || *p == '^' || *p == '$') {
+      ++p;
+    } else {
+      /* bytes beyond ASCII, or a quantifier without an atom */
+      ++p;
+    }
+    p = skipQuantifier(p, &quantified, &optional);
+  }
+
+  am_free(run);
+  if(best_len == 0) {
+    am_free(best);
+    return NULL;
+  }
+  best[best_len] = '\0';
+  return best;
+}
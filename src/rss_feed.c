@@ -56,7 +56,23 @@ PUBLIC rss_feed* feed_new(void) {
 	if(i != NULL) {
 		i->url  = NULL;
 		i->cookies = NULL;
-		i->ttl = -1;
+		i->ttl = 0;
+		i->etag = NULL;
+		i->last_modified = NULL;
+		i->item_count = 0;
+		i->digest = 0;
+		i->stop_after_known = 0;
+		i->max_items = 0;
+		i->seen_items = NULL;
+		i->seen_count = 0;
+		i->interval = 0;
+		i->max_age = -1;
+		i->skip_hours = 0;
+		i->skip_days = 0;
+		i->poll_interval = 0;
+		i->new_gap = 0;
+		i->last_new = 0;
+		i->slot = 0;
 	}
 	return i;
 }
@@ -100,6 +116,63 @@ PUBLIC void feed_add(rss_feed* p, NODE **head) {
 }
 
 
+static int compareItemIDs(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/** \brief Check whether an item was dealt with in an earlier poll of a feed
+ *
+ * \param feed Pointer to a feed
+ * \param item_id ID of the item, as returned by getFeedItemID()
+ * \return 1 if the item is known, 0 otherwise
+ */
+PUBLIC uint8_t feed_has_seen(const rss_feed *feed, uint64_t item_id) {
+	if(!feed || feed->seen_count == 0) {
+		return 0;
+	}
+	return bsearch(&item_id, feed->seen_items, feed->seen_count, sizeof(uint64_t), compareItemIDs) ? 1 : 0;
+}
+
+/** \brief Replace the set of known items of a feed
+ *
+ * \param feed Pointer to a feed
+ * \param item_ids IDs of the items (in any order). The feed takes ownership of the array.
+ * \param count Number of IDs
+ * \return 1 if the set has changed, 0 otherwise
+ *
+ * Items that have disappeared from the feed are forgotten this way, so the set never grows
+ * larger than the feed itself.
+ */
+PUBLIC uint8_t feed_set_seen(rss_feed *feed, uint64_t *item_ids, uint32_t count) {
+	uint32_t i, unique = 0;
+	uint8_t changed;
+
+	assert(feed);
+
+	if(count > 0) {
+		qsort(item_ids, count, sizeof(uint64_t), compareItemIDs);
+		for(i = 0; i < count; ++i) {
+			if(unique == 0 || item_ids[i] != item_ids[unique - 1]) {
+				item_ids[unique++] = item_ids[i];
+			}
+		}
+	}
+
+	changed = (unique != feed->seen_count ||
+	           (unique > 0 && memcmp(item_ids, feed->seen_items, unique * sizeof(uint64_t)) != 0)) ? 1 : 0;
+
+	am_free(feed->seen_items);
+	feed->seen_items = unique > 0 ? item_ids : NULL;
+	feed->seen_count = unique;
+	if(unique == 0) {
+		am_free(item_ids);
+	}
+	return changed;
+}
+
 /** \brief Free the memory associated with the given feed-list item
  *
  * \param listItem Pointer to a feed-list item
@@ -113,6 +186,9 @@ void feed_free(void* listItem) {
 	if(x != NULL) {
 		am_free(x->url);
 		am_free(x->cookies);
+		am_free(x->etag);
+		am_free(x->last_modified);
+		am_free(x->seen_items);
 		am_free(x);
 	}
 }
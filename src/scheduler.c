@@ -0,0 +1,349 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file scheduler.c
+ *
+ * Time at which each feed is checked next.
+ *
+ * The feeds are kept in a binary min-heap ordered by their due time, so the main loop only
+ * has to look at the top of the heap to know how long it may wait.
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "rss_feed.h"
+#include "scheduler.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+/** upper bound for intervals requested by the feed (ttl, Cache-Control) */
+#define MAX_FEED_INTERVAL (24 * 60 * 60)
+
+/** upper bound for the random delay of a check */
+#define MAX_JITTER 300
+
+/** \cond */
+typedef struct schedule_entry {
+  time_t   due;
+  uint32_t seq;   /**< insertion order, keeps entries with the same due time in FIFO order */
+  void    *item;
+} schedule_entry;
+
+struct schedule {
+  schedule_entry *entries;
+  uint32_t        count;
+  uint32_t        size;
+  uint32_t        next_seq;
+};
+/** \endcond */
+
+PRIVATE int isEarlier(const schedule_entry *a, const schedule_entry *b) {
+  return a->due < b->due || (a->due == b->due && (int32_t)(a->seq - b->seq) < 0);
+}
+
+PRIVATE void swapEntries(schedule_entry *a, schedule_entry *b) {
+  schedule_entry tmp = *a;
+
+  *a = *b;
+  *b = tmp;
+}
+
+/* restore the heap order after the entry at position i has moved to an earlier due time */
+PRIVATE void siftUp(schedule *s, uint32_t i) {
+  uint32_t parent;
+
+  while(i > 0) {
+    parent = (i - 1) / 2;
+    if(!isEarlier(&s->entries[i], &s->entries[parent])) {
+      break;
+    }
+    swapEntries(&s->entries[i], &s->entries[parent]);
+    i = parent;
+  }
+}
+
+/* restore the heap order after the entry at position i has moved to a later due time */
+PRIVATE void siftDown(schedule *s, uint32_t i) {
+  uint32_t child;
+
+  for(;;) {
+    child = 2 * i + 1;
+    if(child >= s->count) {
+      break;
+    }
+    if(child + 1 < s->count && isEarlier(&s->entries[child + 1], &s->entries[child])) {
+      ++child;
+    }
+    if(!isEarlier(&s->entries[child], &s->entries[i])) {
+      break;
+    }
+    swapEntries(&s->entries[i], &s->entries[child]);
+    i = child;
+  }
+}
+
+/** \brief Create a new, empty schedule */
+PUBLIC schedule* schedule_new(void) {
+  schedule *s = am_malloc(sizeof(struct schedule));
+
+  if(s) {
+    memset(s, 0, sizeof(struct schedule));
+  }
+  return s;
+}
+
+/** \brief Free a schedule (but not the items in it) */
+PUBLIC void schedule_free(schedule *s) {
+  if(s) {
+    am_free(s->entries);
+    am_free(s);
+  }
+}
+
+/** \brief Add an item to a schedule
+ *
+ * \param[in] s Pointer to a schedule
+ * \param[in] item The item
+ * \param[in] due Time at which the item is due
+ * \return 0 on success, -1 otherwise
+ */
+PUBLIC int schedule_add(schedule *s, void *item, time_t due) {
+  schedule_entry *tmp = NULL;
+  uint32_t i;
+
+  if(!s) {
+    return -1;
+  }
+
+  if(s->count == s->size) {
+    tmp = am_realloc(s->entries, (s->size > 0 ? s->size * 2 : 16) * sizeof(schedule_entry));
+    if(!tmp) {
+      return -1;
+    }
+    s->entries = tmp;
+    s->size = s->size > 0 ? s->size * 2 : 16;
+  }
+
+  i = s->count++;
+  s->entries[i].due = due;
+  s->entries[i].seq = s->next_seq++;
+  s->entries[i].item = item;
+  siftUp(s, i);
+  return 0;
+}
+
+/** \brief Take the next item out of a schedule, if it is due
+ *
+ * \param[in] s Pointer to a schedule
+ * \param[in] now The current time
+ * \return The item that has been due for the longest time, or \c NULL if none is due
+ */
+PUBLIC void* schedule_pop_due(schedule *s, time_t now) {
+  void *item = NULL;
+
+  if(!s || s->count == 0 || s->entries[0].due > now) {
+    return NULL;
+  }
+
+  item = s->entries[0].item;
+  s->entries[0] = s->entries[--s->count];
+  siftDown(s, 0);
+  return item;
+}
+
+PRIVATE int32_t findEntry(const schedule *s, const void *item) {
+  uint32_t i;
+
+  for(i = 0; s && i < s->count; ++i) {
+    if(s->entries[i].item == item) {
+      return (int32_t)i;
+    }
+  }
+  return -1;
+}
+
+/** \brief Take an item out of a schedule, whether it is due or not
+ *
+ * \param[in] s Pointer to a schedule
+ * \param[in] item The item
+ * \return 0 if the item was removed, -1 if it wasn't in the schedule
+ */
+PUBLIC int schedule_remove(schedule *s, const void *item) {
+  int32_t i = findEntry(s, item);
+
+  if(i < 0) {
+    return -1;
+  }
+
+  s->entries[i] = s->entries[--s->count];
+  if((uint32_t)i < s->count) {
+    siftUp(s, (uint32_t)i);
+    siftDown(s, (uint32_t)i);
+  }
+  return 0;
+}
+
+/** \brief Time at which an item is due, or 0 if it isn't in the schedule */
+PUBLIC time_t schedule_due(const schedule *s, const void *item) {
+  int32_t i = findEntry(s, item);
+
+  return i >= 0 ? s->entries[i].due : 0;
+}
+
+/** \brief Time at which the next item is due, or 0 if the schedule is empty */
+PUBLIC time_t schedule_next_due(const schedule *s) {
+  return (s && s->count > 0) ? s->entries[0].due : 0;
+}
+
+/** \brief Number of items in a schedule */
+PUBLIC uint32_t schedule_count(const schedule *s) {
+  return s ? s->count : 0;
+}
+
+/* check whether the feed asks not to be read at the given time (skipHours and skipDays are in GMT) */
+PRIVATE uint8_t isSkipped(const rss_feed *feed, time_t t) {
+  struct tm tm;
+
+  if(feed->skip_hours == 0 && feed->skip_days == 0) {
+    return 0;
+  }
+  gmtime_r(&t, &tm);
+  return ((feed->skip_hours & (1u << tm.tm_hour)) || (feed->skip_days & (1u << tm.tm_wday))) ? 1 : 0;
+}
+
+/** \brief Compute the time at which a feed should be checked next
+ *
+ * \param[in,out] feed Pointer to a feed
+ * \param[in] default_interval Global check interval in seconds
+ * \param[in] now The current time
+ * \param[in] random A random number, which delays the check by up to a tenth of the interval (at most 5 minutes)
+ * \return The time of the next check
+ *
+ * A feed's own interval (from the configuration) is used as is. Otherwise the global interval
+ * is extended if the feed's time-to-live or the freshness lifetime of the last response
+ * (Cache-Control or Expires) is longer. The check is then moved out of the feed's skipHours
+ * and skipDays.
+ *
+ * The interval counts from the time the feed was scheduled for last (feed->slot), not from the
+ * end of the check, so the checks don't drift by the time each one takes. Only if that time has
+ * already passed, it counts from \a now.
+ */
+PUBLIC time_t feed_next_check(rss_feed *feed, uint32_t default_interval, time_t now, uint32_t random) {
+  uint32_t interval = default_interval;
+  uint32_t jitter;
+  time_t slot, due;
+  uint32_t i;
+
+  if(feed->interval > 0) {
+    interval = feed->interval;
+  } else {
+    if(feed->ttl > 0 && feed->ttl * 60 > interval) {
+      interval = feed->ttl < MAX_FEED_INTERVAL / 60 ? feed->ttl * 60 : MAX_FEED_INTERVAL;
+    }
+    if(feed->max_age > 0 && (uint32_t)feed->max_age > interval) {
+      interval = feed->max_age < MAX_FEED_INTERVAL ? (uint32_t)feed->max_age : MAX_FEED_INTERVAL;
+    }
+  }
+
+  slot = (feed->slot > 0 && feed->slot + (time_t)interval > now) ? feed->slot + interval : now + interval;
+
+  /* a week has 168 hours: if all of them are skipped, the feed is checked anyway */
+  for(i = 0; i < 7 * 24 && isSkipped(feed, slot); ++i) {
+    slot = slot - slot % 3600 + 3600;
+  }
+  feed->slot = slot;
+
+  jitter = interval / 10 < MAX_JITTER ? interval / 10 : MAX_JITTER;
+  due = slot + (jitter > 0 ? random % (jitter + 1) : 0);
+  if(due != slot && isSkipped(feed, due)) {
+    due = slot;
+  }
+  return due;
+}
+
+/** \brief Learn how often a feed needs to be checked
+ *
+ * \param[in] feed Pointer to a feed
+ * \param[in] new_items Number of items that were new in the last check
+ * \param[in] now Time of the last check
+ * \param[in] min_interval Shortest interval in seconds
+ * \param[in] max_interval Longest interval in seconds
+ * \return 1 if the learned data of the feed has changed, 0 otherwise
+ *
+ * The interval (feed->poll_interval) is halved whenever a check finds new items, and doubled
+ * whenever a check finds none. It is limited to half of the typical time between new items,
+ * or half of the time since the last new items, whichever is longer: a feed that has always been
+ * busy is not left alone for long, but one that has gone quiet backs off up to \a max_interval.
+ */
+PUBLIC uint8_t feed_adapt_interval(rss_feed *feed, uint32_t new_items, time_t now, uint32_t min_interval, uint32_t max_interval) {
+  uint32_t old_interval = feed->poll_interval;
+  uint32_t interval = feed->poll_interval > 0 ? feed->poll_interval : min_interval;
+  time_t quiet = 0;
+  time_t span;
+
+  if(max_interval < min_interval) {
+    max_interval = min_interval;
+  }
+
+  if(new_items > 0) {
+    if(feed->last_new > 0 && now > feed->last_new) {
+      quiet = now - feed->last_new;
+      if(quiet > UINT32_MAX / 4) {
+        quiet = UINT32_MAX / 4;
+      }
+      feed->new_gap = feed->new_gap > 0 ? (uint32_t)((3 * (uint64_t)feed->new_gap + quiet) / 4) : (uint32_t)quiet;
+    }
+    feed->last_new = now;
+    quiet = 0;
+    interval /= 2;
+  } else {
+    interval = interval < max_interval / 2 ? interval * 2 : max_interval;
+    if(feed->last_new > 0 && now > feed->last_new) {
+      quiet = now - feed->last_new;
+    }
+  }
+
+  if(feed->new_gap > 0) {
+    span = (time_t)feed->new_gap > quiet ? (time_t)feed->new_gap : quiet;
+    if((time_t)interval > span / 2) {
+      interval = (uint32_t)(span / 2);
+    }
+  }
+
+  if(interval < min_interval) {
+    interval = min_interval;
+  } else if(interval > max_interval) {
+    interval = max_interval;
+  }
+
+  feed->poll_interval = interval;
+  return (interval != old_interval || new_items > 0) ? 1 : 0;
+}
@@ -0,0 +1,609 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file segmented.c
+ *
+ * Download a large file over several connections in parallel.
+ *
+ * The object is probed with HEAD requests first, both at its URL and at the alternate URLs of the
+ * item. If the server supports byte ranges, the file is split into segments, which are requested
+ * with Range/If-Range from all URLs that serve the very same object (same size and validator).
+ * Each segment is written at its offset into a preallocated file. If the object isn't suitable,
+ * or any segment fails, the file is downloaded over a single connection instead.
+ *
+ * The progress of the segments is stored next to the partial file when a download is cancelled,
+ * so the next attempt continues the segments where they stopped.
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "list.h"
+#include "output.h"
+#include "partfile.h"
+#include "segmented.h"
+#include "utils.h"
+#include "web.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+/** \cond */
+enum segmented_state {
+  SEGMENTED_PROBING,
+  SEGMENTED_RANGES,
+  SEGMENTED_SINGLE
+};
+
+struct probe {
+  segmented_download *sd;
+  char               *url;
+  HTTPResponse       *response;
+};
+
+struct segment {
+  segmented_download *sd;
+  const char         *url;
+  uint64_t            offset;
+  uint64_t            length;
+  uint64_t            written;
+};
+
+struct segmented_download {
+  web_multi            *engine;
+  char                 *filename;
+  char                 *part_file;
+  char                 *useragent;
+  uint8_t               shaped;
+  uint64_t              max_speed;    /**< bandwidth limit of the whole download */
+  struct probe         *probes;       /**< the first probe is the one of the actual URL */
+  uint16_t              probe_count;
+  struct segment       *segments;
+  uint16_t              segment_count;
+  uint16_t              max_segments;
+  uint64_t              min_segment_size;
+  uint64_t              size;
+  const char           *validator;    /**< strong validator of the object, for If-Range */
+  int                   fd;
+  uint32_t              pending;      /**< transfers in flight (plus one while transfers are started or cancelled) */
+  enum segmented_state  state;
+  uint8_t               failed;
+  uint8_t               cancelled;
+  HTTPResponse         *result;       /**< response of the single-connection download */
+  struct timeval        started;
+  web_done_func         done;
+  void                 *userdata;
+};
+/** \endcond */
+
+PRIVATE void stageFinished(segmented_download *sd);
+
+PRIVATE void segmented_download_free(segmented_download *sd) {
+  uint16_t i;
+
+  if(sd) {
+    for(i = 0; i < sd->probe_count; ++i) {
+      am_free(sd->probes[i].url);
+      HTTPResponse_free(sd->probes[i].response);
+    }
+    am_free(sd->probes);
+    am_free(sd->segments);
+    if(sd->fd >= 0) {
+      close(sd->fd);
+    }
+    am_free(sd->filename);
+    am_free(sd->part_file);
+    am_free(sd->useragent);
+    am_free(sd);
+  }
+}
+
+/* hand the result over to the owner, which ends the life of the object */
+PRIVATE void complete(segmented_download *sd, HTTPResponse *response) {
+  sd->done(response, sd->userdata);
+  segmented_download_free(sd);
+}
+
+PRIVATE void release(segmented_download *sd) {
+  if(--sd->pending == 0) {
+    stageFinished(sd);
+  }
+}
+
+PRIVATE void cancelTransfers(segmented_download *sd) {
+  uint16_t i;
+
+  ++sd->pending;
+  for(i = 0; i < sd->probe_count; ++i) {
+    web_multi_cancel(sd->engine, &sd->probes[i]);
+  }
+  for(i = 0; i < sd->segment_count; ++i) {
+    web_multi_cancel(sd->engine, &sd->segments[i]);
+  }
+  web_multi_cancel(sd->engine, sd);
+  release(sd);
+}
+
+PRIVATE const char* getStrongValidator(const HTTPResponse *resp) {
+  if(resp->etag && *resp->etag && strncmp(resp->etag, "W/", 2) != 0) {
+    return resp->etag;
+  }
+  if(resp->last_modified && *resp->last_modified) {
+    return resp->last_modified;
+  }
+  return NULL;
+}
+
+/* check whether an alternate URL serves the same object as the original one */
+PRIVATE uint8_t isSameObject(const HTTPResponse *original, const HTTPResponse *other) {
+  const char *validator = getStrongValidator(original);
+
+  if(!other || other->responseCode != 200 || other->content_length != original->content_length) {
+    return 0;
+  }
+  if(validator == original->etag) {
+    return (other->etag && !strcmp(other->etag, validator)) ? 1 : 0;
+  }
+  return (other->last_modified && !strcmp(other->last_modified, validator)) ? 1 : 0;
+}
+
+PRIVATE int preallocate(int fd, uint64_t size) {
+#ifdef HAVE_POSIX_FALLOCATE
+  if(posix_fallocate(fd, 0, (off_t)size) == 0) {
+    return 0;
+  }
+#endif
+  /* a sparse file of the final size will do as well */
+  return ftruncate(fd, (off_t)size);
+}
+
+PRIVATE void singleDone(HTTPResponse *response, void *userdata) {
+  segmented_download *sd = (segmented_download*)userdata;
+
+  sd->result = response;
+  release(sd);
+}
+
+PRIVATE void startSingle(segmented_download *sd) {
+  HTTPRequest req;
+
+  memset(&req, 0, sizeof(req));
+  req.url       = sd->probes[0].url;
+  req.filename  = sd->filename;
+  req.useragent = sd->useragent;
+  req.shaped    = sd->shaped;
+  req.max_speed = sd->max_speed;
+
+  sd->state = SEGMENTED_SINGLE;
+  if(web_multi_add(sd->engine, &req, singleDone, sd) != 0) {
+    complete(sd, NULL);
+    return;
+  }
+  ++sd->pending;
+}
+
+PRIVATE size_t segmentWrite(const char *data, size_t len, void *userdata) {
+  struct segment *seg = (struct segment*)userdata;
+  size_t done = 0;
+  ssize_t n;
+
+  if(seg->written + len > seg->length) {
+    /* most likely the server ignored the range */
+    dbg_printf(P_ERROR, "Error: Received more data than requested for '%s'", seg->url);
+    return 0;
+  }
+
+  while(done < len) {
+    n = pwrite(seg->sd->fd, data + done, len - done, (off_t)(seg->offset + seg->written + done));
+    if(n < 0 && errno == EINTR) {
+      continue;
+    } else if(n <= 0) {
+      dbg_printf(P_ERROR, "Error: Unable to write to '%s': %s", seg->sd->part_file, strerror(errno));
+      return 0;
+    }
+    done += n;
+  }
+
+  seg->written += len;
+  return len;
+}
+
+PRIVATE void segmentDone(HTTPResponse *response, void *userdata) {
+  struct segment *seg = (struct segment*)userdata;
+  segmented_download *sd = seg->sd;
+  uint8_t ok;
+
+  ok = (response && response->responseCode == 206 && seg->written == seg->length) ? 1 : 0;
+  HTTPResponse_free(response);
+
+  if(!ok && !sd->failed && !sd->cancelled) {
+    dbg_printf(P_INFO, "Segment at byte %llu of '%s' failed", (unsigned long long)seg->offset, sd->filename);
+    sd->failed = 1;
+    cancelTransfers(sd);
+  }
+  release(sd);
+}
+
+/* store the progress of the segments next to the partial file, so the download can be resumed */
+PRIVATE void saveProgress(segmented_download *sd) {
+  const HTTPResponse *original = sd->probes[0].response;
+  part_info info;
+  uint16_t i;
+
+  memset(&info, 0, sizeof(info));
+  info.segments = am_malloc(sd->segment_count * sizeof(part_segment));
+  if(!info.segments) {
+    return;
+  }
+  info.url           = sd->probes[0].url;
+  info.etag          = original->etag;
+  info.last_modified = original->last_modified;
+  info.segment_count = sd->segment_count;
+  for(i = 0; i < sd->segment_count; ++i) {
+    info.segments[i].offset  = sd->segments[i].offset;
+    info.segments[i].length  = sd->segments[i].length;
+    info.segments[i].written = sd->segments[i].written;
+  }
+  /* a single connection can continue at the first gap */
+  for(i = 0; i < sd->segment_count; ++i) {
+    info.offset = sd->segments[i].offset + sd->segments[i].written;
+    if(sd->segments[i].written < sd->segments[i].length) {
+      break;
+    }
+  }
+  part_info_save(sd->part_file, &info);
+  am_free(info.segments);
+}
+
+/* create the partial file and split it into \a count segments */
+PRIVATE int createSegments(segmented_download *sd, uint16_t count) {
+  uint64_t chunk;
+  uint16_t i;
+
+  sd->fd = open(sd->part_file, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if(sd->fd < 0 || preallocate(sd->fd, sd->size) != 0 ||
+     (sd->segments = am_malloc(count * sizeof(struct segment))) == NULL) {
+    dbg_printf(P_ERROR, "Error: Unable to create '%s': %s", sd->part_file, strerror(errno));
+    if(sd->fd >= 0) {
+      close(sd->fd);
+      sd->fd = -1;
+      unlink(sd->part_file);
+    }
+    return -1;
+  }
+
+  sd->segment_count = count;
+  chunk = sd->size / count;
+  for(i = 0; i < count; ++i) {
+    sd->segments[i].offset  = i * chunk;
+    sd->segments[i].length  = (i == count - 1) ? sd->size - i * chunk : chunk;
+    sd->segments[i].written = 0;
+  }
+  return 0;
+}
+
+/* take over the segments of an interrupted download of the same object */
+PRIVATE int resumeSegments(segmented_download *sd, const part_info *info) {
+  const char *validator = part_info_validator(info, sd->probes[0].url);
+  struct stat st;
+  uint64_t end = 0;
+  uint16_t i;
+
+  if(info->segment_count == 0 || !validator || strcmp(validator, sd->validator) != 0) {
+    return -1;
+  }
+  for(i = 0; i < info->segment_count; ++i) {
+    if(info->segments[i].offset != end || info->segments[i].length == 0) {
+      return -1;
+    }
+    end += info->segments[i].length;
+  }
+  if(end != sd->size) {
+    return -1;
+  }
+
+  sd->fd = open(sd->part_file, O_WRONLY);
+  if(sd->fd < 0 || fstat(sd->fd, &st) != 0 || (uint64_t)st.st_size != sd->size ||
+     (sd->segments = am_malloc(info->segment_count * sizeof(struct segment))) == NULL) {
+    if(sd->fd >= 0) {
+      close(sd->fd);
+      sd->fd = -1;
+    }
+    return -1;
+  }
+
+  sd->segment_count = info->segment_count;
+  for(i = 0; i < sd->segment_count; ++i) {
+    sd->segments[i].offset  = info->segments[i].offset;
+    sd->segments[i].length  = info->segments[i].length;
+    sd->segments[i].written = info->segments[i].written;
+  }
+  return 0;
+}
+
+/* split the file into segments once all probes are back, or fall back to a single connection */
+PRIVATE void startRanges(segmented_download *sd) {
+  const HTTPResponse *original = sd->probes[0].response;
+  const char **sources = NULL;
+  uint16_t source_count = 0;
+  uint16_t i, count, active = 0;
+  int result;
+  char range[48];
+  HTTPRequest req;
+  part_info info;
+
+  if(!original || original->responseCode != 200 || !original->accept_ranges || original->content_length == 0 ||
+     (sd->validator = getStrongValidator(original)) == NULL) {
+    dbg_printf(P_INFO2, "Server doesn't support segmented downloads of '%s'", sd->probes[0].url);
+    startSingle(sd);
+    return;
+  }
+
+  sd->size = original->content_length;
+  count = (uint16_t)((sd->size / sd->min_segment_size < sd->max_segments) ? sd->size / sd->min_segment_size : sd->max_segments);
+  sources = am_malloc(sd->probe_count * sizeof(const char*));
+  if(!sources) {
+    startSingle(sd);
+    return;
+  }
+
+  /* an interrupted download is resumed, over a single connection unless its segments can be continued */
+  if(part_info_load(sd->part_file, &info) == 0) {
+    result = resumeSegments(sd, &info);
+    part_info_free(&info);
+  } else {
+    result = count < 2 ? -1 : createSegments(sd, count);
+  }
+  if(result != 0) {
+    am_free(sources);
+    startSingle(sd);
+    return;
+  }
+
+  for(i = 0; i < sd->probe_count; ++i) {
+    if(i == 0 || isSameObject(original, sd->probes[i].response)) {
+      sources[source_count++] = sd->probes[i].url;
+    }
+  }
+  for(i = 0; i < sd->segment_count; ++i) {
+    sd->segments[i].sd  = sd;
+    sd->segments[i].url = sources[i % source_count];
+    if(sd->segments[i].written < sd->segments[i].length) {
+      ++active;
+    }
+  }
+  am_free(sources);
+
+  dbg_printf(P_INFO, "Downloading '%s' (%lluMB) in %d segments (%d left) from %d source(s)", sd->filename,
+             (unsigned long long)(sd->size / 1024 / 1024), sd->segment_count, active, source_count);
+  saveProgress(sd);
+
+  sd->state = SEGMENTED_RANGES;
+  ++sd->pending;
+  for(i = 0; i < sd->segment_count && !sd->failed; ++i) {
+    if(sd->segments[i].written == sd->segments[i].length) {
+      continue;
+    }
+    sprintf(range, "%llu-%llu", (unsigned long long)(sd->segments[i].offset + sd->segments[i].written),
+            (unsigned long long)(sd->segments[i].offset + sd->segments[i].length - 1));
+    memset(&req, 0, sizeof(req));
+    req.url        = sd->segments[i].url;
+    req.useragent  = sd->useragent;
+    req.range      = range;
+    req.if_range   = sd->validator;
+    req.write_func = segmentWrite;
+    req.write_data = &sd->segments[i];
+    req.shaped     = sd->shaped;
+    /* the segments share the limit of the download */
+    req.max_speed  = sd->max_speed > 0 ? (sd->max_speed / active > 0 ? sd->max_speed / active : 1) : 0;
+    if(web_multi_add(sd->engine, &req, segmentDone, &sd->segments[i]) == 0) {
+      ++sd->pending;
+    } else {
+      sd->failed = 1;
+      cancelTransfers(sd);
+    }
+  }
+  release(sd);
+}
+
+PRIVATE void finishRanges(segmented_download *sd) {
+  HTTPResponse *resp = NULL;
+  struct timeval now;
+  double elapsed;
+  int result;
+
+  result = close(sd->fd);
+  sd->fd = -1;
+  if(result != 0 || rename(sd->part_file, sd->filename) != 0) {
+    dbg_printf(P_ERROR, "Error: Unable to store '%s': %s", sd->filename, strerror(errno));
+    unlink(sd->part_file);
+    part_info_remove(sd->part_file);
+    complete(sd, NULL);
+    return;
+  }
+  part_info_remove(sd->part_file);
+
+  gettimeofday(&now, NULL);
+  elapsed = (now.tv_sec - sd->started.tv_sec) + (now.tv_usec - sd->started.tv_usec) / 1000000.0;
+
+  resp = HTTPResponse_new();
+  if(resp) {
+    resp->responseCode  = 200;
+    resp->size          = (size_t)sd->size;
+    resp->downloadSpeed = elapsed > 0 ? sd->size / elapsed : sd->size;
+    resp->total_time    = elapsed;
+  }
+  complete(sd, resp);
+}
+
+/* all transfers of the current stage have finished */
+PRIVATE void stageFinished(segmented_download *sd) {
+  if(sd->cancelled) {
+    if(sd->state == SEGMENTED_RANGES) {
+      saveProgress(sd);
+    }
+    HTTPResponse_free(sd->result);
+    complete(sd, NULL);
+    return;
+  }
+
+  switch(sd->state) {
+    case SEGMENTED_PROBING:
+      startRanges(sd);
+      break;
+    case SEGMENTED_RANGES:
+      if(!sd->failed) {
+        finishRanges(sd);
+      } else {
+        /* the single connection continues at the first gap */
+        dbg_printf(P_INFO, "Retrying '%s' over a single connection", sd->filename);
+        saveProgress(sd);
+        close(sd->fd);
+        sd->fd = -1;
+        startSingle(sd);
+      }
+      break;
+    case SEGMENTED_SINGLE:
+      complete(sd, sd->result);
+      break;
+  }
+}
+
+PRIVATE void probeDone(HTTPResponse *response, void *userdata) {
+  struct probe *probe = (struct probe*)userdata;
+
+  probe->response = response;
+  release(probe->sd);
+}
+
+/** \brief Start a (possibly) segmented download
+ *
+ * \param[in] engine Transfer engine that carries out the transfers
+ * \param[in] req The download (URL, file name and User-Agent are used)
+ * \param[in] mirrors (Optional) list of alternate URLs that might serve the same file
+ * \param[in] max_segments Maximum number of segments
+ * \param[in] min_segment_size Minimum size of a segment in bytes
+ * \param[in] done Function that is called once the download has finished
+ * \param[in] userdata Pointer that is handed to \a done
+ * \return Pointer to the download, or \c NULL if it couldn't be started.
+ *
+ * \a done is called exactly once, just like for a transfer started with web_multi_add(). A download
+ * that has been split into segments finishes with response code 200. All segments are subject to the
+ * connection limits of \a engine.
+ */
+PUBLIC segmented_download* segmented_download_start(web_multi *engine, const HTTPRequest *req, const simple_list mirrors,
+                                                    uint16_t max_segments, uint64_t min_segment_size,
+                                                    web_done_func done, void *userdata) {
+  segmented_download *sd = NULL;
+  simple_list current = NULL;
+  HTTPRequest probe_req;
+  uint16_t count = 1;
+  uint16_t i;
+
+  if(!engine || !req || !req->url || !req->filename || !done) {
+    return NULL;
+  }
+
+  for(current = mirrors; current && current->data && count < max_segments; current = current->next) {
+    if(strcmp((const char*)current->data, req->url) != 0) {
+      ++count;
+    }
+  }
+
+  sd = am_malloc(sizeof(struct segmented_download));
+  if(!sd) {
+    return NULL;
+  }
+  memset(sd, 0, sizeof(struct segmented_download));
+  sd->fd = -1;
+  sd->engine = engine;
+  sd->max_segments = max_segments;
+  sd->min_segment_size = min_segment_size > 0 ? min_segment_size : 1;
+  sd->done = done;
+  sd->userdata = userdata;
+  sd->state = SEGMENTED_PROBING;
+  sd->filename = am_strdup(req->filename);
+  sd->part_file = part_file_name(req->filename);
+  sd->useragent = am_strdup(req->useragent);
+  sd->shaped = req->shaped;
+  sd->max_speed = req->max_speed;
+  sd->probes = am_malloc(count * sizeof(struct probe));
+  if(!sd->filename || !sd->part_file || !sd->probes) {
+    segmented_download_free(sd);
+    return NULL;
+  }
+  memset(sd->probes, 0, count * sizeof(struct probe));
+  sd->probe_count = count;
+  gettimeofday(&sd->started, NULL);
+
+  sd->probes[0].url = am_strdup(req->url);
+  for(i = 1, current = mirrors; current && current->data && i < count; current = current->next) {
+    if(strcmp((const char*)current->data, req->url) != 0) {
+      sd->probes[i++].url = am_strdup((const char*)current->data);
+    }
+  }
+
+  for(i = 0; i < count; ++i) {
+    sd->probes[i].sd = sd;
+    memset(&probe_req, 0, sizeof(probe_req));
+    probe_req.url       = sd->probes[i].url;
+    probe_req.useragent = sd->useragent;
+    probe_req.head_only = 1;
+    if(web_multi_add(engine, &probe_req, probeDone, &sd->probes[i]) == 0) {
+      ++sd->pending;
+    } else if(i == 0) {
+      segmented_download_free(sd);
+      return NULL;
+    }
+  }
+
+  return sd;
+}
+
+/** \brief Abort a segmented download
+ *
+ * \param[in] sd Pointer to a segmented download
+ * \return 0 on success
+ *
+ * The completion function is called with a \c NULL response. Like a transfer that is cancelled
+ * with web_multi_cancel(), the partial file is kept along with the progress of its segments, and
+ * the next download of the same file continues where this one stopped.
+ */
+PUBLIC int segmented_download_cancel(segmented_download *sd) {
+  if(!sd) {
+    return -1;
+  }
+  sd->cancelled = 1;
+  cancelTransfers(sd);
+  return 0;
+}
@@ -7,6 +7,9 @@
  * @file state.c
  *
  * Load and save the download history for Trailermatic.
+ *
+ * The history is kept in a binary state file (see statedb.c) plus a text journal of the
+ * downloads since the state file was written.
  */
 
 /*
@@ -34,81 +37,540 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
+#include "downloads.h"
+#include "hash.h"
+#include "hashring.h"
 #include "output.h"
+#include "state.h"
+#include "statedb.h"
+#include "trace.h"
 #include "utils.h"
-#include "list.h"
 
 #ifdef MEMWATCH
 	#include "memwatch.h"
 #endif
 
 /** \cond */
-#define MAX_LINE_LEN	300
+/** seconds between two fsync() calls with the STATE_SYNC_PERIODIC policy */
+#define STATE_SYNC_INTERVAL	30
+
+/** seconds to wait for a running compaction on shutdown */
+#define STATE_COMPACT_TIMEOUT	10
+
+struct state_journal {
+	char              *state_file;
+	char              *path;         /**< <statefile>.journal, the records are appended here */
+	char              *old_path;     /**< <statefile>.journal.old, the journal that is being compacted */
+	download_history  *history;
+	int                fd;
+	state_sync_policy  policy;
+	uint32_t           max_size;     /**< journal size (in bytes) that triggers a compaction */
+	uint32_t           size;
+	time_t             last_sync;
+	uint8_t            unsynced;
+	pid_t              compactor;    /**< PID of a running compaction process, or 0 */
+	uint64_t           fork_mark;    /**< history->added at the time the compaction started */
+};
 /** \endcond */
 
-/** \brief Store the URLs of the downloaded files on disk for later retrieval
+PRIVATE char* journal_path(const char *state_file, const char *suffix) {
+	char *path = am_malloc(strlen(state_file) + strlen(suffix) + 1);
+
+	if(path) {
+		strcpy(path, state_file);
+		strcat(path, suffix);
+	}
+	return path;
+}
+
+PRIVATE int meta_time_cmp(const void *a, const void *b) {
+	int64_t ta = ((const statedb_entry*)a)->meta.time;
+	int64_t tb = ((const statedb_entry*)b)->meta.time;
+
+	/* newest first */
+	return ta < tb ? 1 : (ta > tb ? -1 : 0);
+}
+
+/* write the bucket to the state file */
+PRIVATE int writeState(const char* state_file, const download_history *downloads) {
+	statedb_entry *entries = NULL;
+	const statedb_meta *meta;
+	uint64_t i, n = 0, count;
+	uint32_t r;
+	int result;
+
+	if(!state_file || !downloads) {
+		return 0;
+	}
+
+	count = history_count(downloads);
+	dbg_printf(P_MSG, "Saving state (%" PRIu64 " downloaded files) to disk", count);
+
+	if(count > 0) {
+		entries = am_malloc(count * sizeof(statedb_entry));
+		if(!entries) {
+			dbg_printf(P_ERROR, "Error: Unable to save state: Out of memory");
+			return -1;
+		}
+	}
+
+	for(i = 0; i < statedb_count(downloads->snapshot); ++i) {
+		entries[n].digest = *statedb_digest(downloads->snapshot, i);
+		if((meta = statedb_get_meta(downloads->snapshot, i)) != NULL) {
+			entries[n].meta = *meta;
+		} else {
+			memset(&entries[n].meta, 0, sizeof(statedb_meta));
+		}
+		++n;
+	}
+
+	for(r = 0; r < hashring_count(downloads->recent); ++r) {
+		hash128_string(hashring_value(downloads->recent, r), &entries[n].digest);
+		memcpy(&entries[n].meta, hashring_payload(downloads->recent, r), sizeof(statedb_meta));
+		++n;
+	}
+
+	if(downloads->max_items > 0 && n > downloads->max_items) {
+		qsort(entries, n, sizeof(statedb_entry), meta_time_cmp);
+		n = downloads->max_items;
+	}
+
+	result = statedb_write(state_file, entries, n, STATEDB_FLAG_META);
+	am_free(entries);
+	return result;
+}
+
+/** \brief Store the downloaded files on disk for later retrieval
  *
  * \param state_file Name of the file to save to
- * \param downloads (bucket)list containing the URLs of all downloaded file
+ * \param downloads bucket containing the URLs of all downloaded file
  *
- * save_state() stores the content of the file bucket list on disk so Trailermatic won't
+ * save_state() stores the content of the file bucket on disk so Trailermatic won't
  * download old files after a restart.
+ *
+ * The file is a binary state file (see statedb.c). If the bucket holds more than its maximum
+ * number of entries, the oldest ones are dropped.
  */
-int save_state(const char* state_file, const simple_list const downloads) {
+int save_state(const char* state_file, const download_history *downloads) {
+	trace_span span;
+	int result;
+
+	TRACE_BEGIN(span, "state", "save_state");
+	result = writeState(state_file, downloads);
+	TRACE_END_ARG(span, "entries", downloads ? history_count(downloads) : 0);
+	return result;
+}
+
+/* split a text record "URL[\ttime\tsize\tfeed id]" */
+PRIVATE void parse_record(char *line, statedb_meta *meta) {
+	char *field;
+
+	memset(meta, 0, sizeof(statedb_meta));
+	if((field = strchr(line, '\t')) != NULL) {
+		*field++ = '\0';
+		meta->time = strtoll(field, &field, 10);
+		if(*field == '\t') {
+			meta->size = strtoull(field + 1, &field, 10);
+		}
+		if(*field == '\t') {
+			meta->feed_id = strtoul(field + 1, &field, 10);
+		}
+	}
+}
+
+/* add the records of a text file to the history.
+ * Journals are sorted oldest first, old text state files newest first. */
+PRIVATE uint32_t read_text_state(const char *path, download_history *history, uint8_t is_journal) {
 	FILE *fp;
-	char tmp[MAX_LINE_LEN + 1];
-	NODE *current = NULL;
-
-	if(state_file) {
-		current = downloads;
-		dbg_printf(P_MSG, "Saving state (%d downloaded files) to disk", listCount(current));
-		if((fp = fopen(state_file, "wb")) == NULL) {
-			dbg_printf(P_ERROR, "Error: Unable to open statefile '%s' for writing: %s", state_file, strerror(errno));
-			return -1;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	statedb_meta meta;
+	struct stat st;
+	uint32_t count = 0;
+	time_t mtime;
+
+	if((fp = fopen(path, "rb")) == NULL) {
+		return 0;
+	}
+	mtime = (fstat(fileno(fp), &st) == 0) ? st.st_mtime : time(NULL);
+
+	while ((len = getline(&line, &line_size, fp)) > 0) {
+		if(line[len-1] != '\n') {
+			/* incomplete record, cut off by a crash */
+			continue;
 		}
-		while (current != NULL && current->data != NULL) {
-			sprintf(tmp, "%s\n", (char*)current->data);
-			if(!fwrite(tmp, strlen(tmp), 1, fp)){
-				dbg_printf(P_ERROR, "Error: Unable to write to statefile '%s': %s", state_file, strerror(errno));
-				fclose(fp);
-				return -1;
-			}
-			current = current->next;
+		line[--len] = '\0';
+		parse_record(line, &meta);
+		if(strlen(line) <= 20) {  /* arbitrary threshold for the length of a URL */
+			continue;
+		}
+		if(!is_journal) {
+			/* the old format has no timestamps: keep the order by counting down from the file's mtime */
+			meta.time = (int64_t)mtime - count;
+		}
+		if((is_journal ? history_add(history, line, &meta) : history_append(history, line, &meta)) == 0) {
+			++count;
 		}
-		fclose(fp);
 	}
-	return 0;
+	free(line);
+	fclose(fp);
+	return count;
+}
+
+/** \brief Import a state file in the text format of older versions
+ *
+ * \param text_file Path to the text file (one URL per line, newest first)
+ * \param state_file Path to the binary state file the URLs are added to
+ * \param history The download history that belongs to \a state_file
+ * \return Number of imported URLs, or -1 on error
+ */
+int import_state(const char *text_file, const char *state_file, download_history *history) {
+	uint32_t count;
+
+	if(!text_file || !state_file || !history) {
+		return -1;
+	}
+
+	if(statedb_is_binary(text_file)) {
+		dbg_printf(P_ERROR, "Error: '%s' is not a text state file", text_file);
+		return -1;
+	}
+
+	count = read_text_state(text_file, history, 0);
+	dbg_printf(P_MSG, "Imported %d entries from '%s'", count, text_file);
+	if(save_state(state_file, history) != 0) {
+		return -1;
+	}
+	history_set_snapshot(history, statedb_open(state_file), 0);
+	return count;
 }
 
 /** \brief Load an old state from disk.
  *
  * \param state_file Path to the state file
- * \param head Pointer to a (bucket-)list
+ * \param downloads Pointer to a bucket
+ *
+ * load_state() maps the state file into memory, so Trailermatic won't download old files again
+ * after, e.g. a restart. Records from the state journal (see state_journal_open()) are replayed
+ * on top of it.
  *
- * load_state() reads the URLs from state_file and stores them in a bucket list.
- * This way Trailermatic won't download old files again after, e.g. a restart.
+ * A state file in the text format of older versions is converted; the original is kept as
+ * <state_file>.txt.
  */
-int load_state(const char* state_file, NODE **head) {
-	FILE *fp;
-	int len;
-	char line[MAX_LINE_LEN];
-	char *data;
+int load_state(const char* state_file, download_history *downloads) {
+	char *path;
+	uint32_t replayed = 0;
+	int result = 0;
 
-	if((fp = fopen(state_file, "rb")) == NULL) {
+	if(access(state_file, F_OK) != 0) {
 		dbg_printf(P_ERROR, "[load_state] Error: Unable to open statefile '%s' for reading: %s", state_file, strerror(errno));
+		result = -1;
+	} else if(statedb_is_binary(state_file)) {
+		history_set_snapshot(downloads, statedb_open(state_file), 0);
+		if(!downloads->snapshot) {
+			result = -1;
+		}
+	} else if((path = journal_path(state_file, ".txt")) != NULL) {
+		dbg_printf(P_MSG, "Converting statefile '%s' to the binary format", state_file);
+		if(rename(state_file, path) != 0) {
+			dbg_printf(P_ERROR, "Error: Unable to rename '%s': %s", state_file, strerror(errno));
+			result = -1;
+		} else if(import_state(path, state_file, downloads) < 0) {
+			rename(path, state_file);
+			result = -1;
+		}
+		am_free(path);
+	}
+
+	/* a journal left over from an unfinished compaction is older than the current one */
+	if((path = journal_path(state_file, ".journal.old")) != NULL) {
+		replayed += read_text_state(path, downloads, 1);
+		am_free(path);
+	}
+	if((path = journal_path(state_file, ".journal")) != NULL) {
+		replayed += read_text_state(path, downloads, 1);
+		am_free(path);
+	}
+	if(replayed > 0) {
+		dbg_printf(P_INFO, "Replayed %d entries from the state journal", replayed);
+		result = 0;
+	}
+
+	dbg_printf(P_MSG, "Restored %" PRIu64 " old entries", history_count(downloads));
+	return result;
+}
+
+PRIVATE int journal_open_fd(state_journal *j) {
+	struct stat st;
+	char c;
+
+	j->fd = open(j->path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if(j->fd == -1) {
+		dbg_printf(P_ERROR, "Error: Unable to open state journal '%s': %s", j->path, strerror(errno));
 		return -1;
 	}
-	while (fgets(line, MAX_LINE_LEN, fp)) {
-		len = strlen(line);
-		if(len > 20) {  /* arbitrary threshold for the length of a URL */
-			data = am_strndup(line, len-1);  /* len-1 to get rid of the \n at the end of each line */
-			addToTail(data, head);
+
+	j->size = 0;
+	if(fstat(j->fd, &st) == 0 && st.st_size > 0) {
+		j->size = st.st_size;
+		/* terminate a record that was cut off by a crash, so the next one starts on a fresh line */
+		if(pread(j->fd, &c, 1, st.st_size - 1) == 1 && c != '\n') {
+			if(write(j->fd, "\n", 1) == 1) {
+				++j->size;
+			}
+		}
+	}
+	return 0;
+}
+
+PRIVATE void journal_sync(state_journal *j) {
+	if(j->unsynced && j->fd != -1) {
+		fsync(j->fd);
+		j->unsynced = 0;
+		j->last_sync = time(NULL);
+	}
+}
+
+PRIVATE uint8_t compaction_running(state_journal *j) {
+	pid_t rc;
+	struct stat st;
+
+	if(j->compactor > 0) {
+		rc = waitpid(j->compactor, NULL, WNOHANG);
+		/* ECHILD: someone else (e.g. an ignored SIGCHLD) reaped the process already */
+		if(rc == 0 || (rc == -1 && errno != ECHILD && kill(j->compactor, 0) == 0)) {
+			return 1;
+		}
+		j->compactor = 0;
+
+		/* the compaction removes the old journal once the new state file is in place */
+		if(stat(j->old_path, &st) != 0) {
+			history_set_snapshot(j->history, statedb_open(j->state_file), j->history->added - j->fork_mark);
+			dbg_printf(P_INFO2, "State compaction finished (%" PRIu64 " entries)", history_count(j->history));
 		}
 	}
-	fclose(fp);
-	dbg_printf(P_MSG, "Restored %d old entries", listCount(*head));
 	return 0;
 }
 
+/* write a new state file in a child process. New records go to a fresh journal in the meantime. */
+PRIVATE void journal_compact(state_journal *j) {
+	pid_t pid;
+	struct stat st;
+
+	if(compaction_running(j)) {
+		return;
+	}
+
+	journal_sync(j);
+
+	if(stat(j->old_path, &st) == 0) {
+		/* a previous compaction didn't finish. Its records are in memory, so write the state file directly. */
+		dbg_printf(P_INFO, "Found unfinished state compaction, saving state in the foreground");
+		if(save_state(j->state_file, j->history) == 0) {
+			unlink(j->old_path);
+			if(ftruncate(j->fd, 0) == 0) {
+				j->size = 0;
+			}
+			history_set_snapshot(j->history, statedb_open(j->state_file), 0);
+		}
+		return;
+	}
+
+	if(rename(j->path, j->old_path) != 0) {
+		dbg_printf(P_ERROR, "Error: Unable to rotate state journal '%s': %s", j->path, strerror(errno));
+		return;
+	}
+	close(j->fd);
+	if(journal_open_fd(j) != 0) {
+		/* try to put the old journal back */
+		rename(j->old_path, j->path);
+		journal_open_fd(j);
+		return;
+	}
+
+	j->fork_mark = j->history->added;
+	pid = fork();
+	if(pid == 0) {
+		/* child: the history is a snapshot of the parent's memory at the time of the fork */
+		if(save_state(j->state_file, j->history) == 0) {
+			unlink(j->old_path);
+			_exit(EXIT_SUCCESS);
+		}
+		_exit(EXIT_FAILURE);
+	} else if(pid < 0) {
+		dbg_printf(P_ERROR, "Error: Unable to start state compaction: %s", strerror(errno));
+	} else {
+		dbg_printf(P_INFO2, "Compacting state journal in the background (pid %d)", pid);
+		j->compactor = pid;
+	}
+}
+
+/** \brief Open the state journal that belongs to a state file
+ *
+ * \param state_file Path to the state file
+ * \param history The download history that was loaded from \a state_file
+ * \param policy Durability policy of the journal
+ * \param max_size Journal size (in bytes) at which the journal is compacted into the state file
+ * \return Pointer to the journal, or \c NULL on error
+ *
+ * Instead of rewriting the state file after every download, new URLs are appended to the
+ * file <state_file>.journal. Once the journal grows beyond max_size bytes, a background process
+ * writes a new state file and the journal starts over.
+ */
+state_journal* state_journal_open(const char *state_file, download_history *history, state_sync_policy policy, uint32_t max_size) {
+	state_journal *j = NULL;
+
+	if(!state_file || !history) {
+		return NULL;
+	}
+
+	j = am_malloc(sizeof(struct state_journal));
+	if(!j) {
+		return NULL;
+	}
+
+	j->state_file = am_strdup(state_file);
+	j->path       = journal_path(state_file, ".journal");
+	j->old_path   = journal_path(state_file, ".journal.old");
+	j->history    = history;
+	j->fd         = -1;
+	j->policy     = policy;
+	j->max_size   = max_size;
+	j->size       = 0;
+	j->last_sync  = time(NULL);
+	j->unsynced   = 0;
+	j->compactor  = 0;
+	j->fork_mark  = 0;
+
+	if(!j->state_file || !j->path || !j->old_path || journal_open_fd(j) != 0) {
+		am_free(j->state_file);
+		am_free(j->path);
+		am_free(j->old_path);
+		am_free(j);
+		return NULL;
+	}
+	return j;
+}
+
+/** \brief Append a download to the state journal
+ *
+ * \param j Pointer to a state journal
+ * \param url URL of the downloaded file. It must have been added to the history already.
+ * \param meta (Optional) metadata of the download
+ * \return 0 on success, -1 on error
+ */
+int state_journal_append(state_journal *j, const char *url, const statedb_meta *meta) {
+	char *record;
+	int len;
+	ssize_t written;
+	statedb_meta none;
+
+	if(!j || !url || j->fd == -1) {
+		return -1;
+	}
+
+	if(!meta) {
+		memset(&none, 0, sizeof(none));
+		meta = &none;
+	}
+
+	record = am_malloc(strlen(url) + 64);
+	if(!record) {
+		return -1;
+	}
+	len = sprintf(record, "%s\t%" PRId64 "\t%" PRIu64 "\t%u\n", url, meta->time, meta->size, meta->feed_id);
+
+	/* a single write() per record, so records of an O_APPEND file never interleave */
+	written = write(j->fd, record, len);
+	am_free(record);
+	if(written != (ssize_t)len) {
+		dbg_printf(P_ERROR, "Error: Unable to write to state journal '%s': %s", j->path, strerror(errno));
+		return -1;
+	}
+	j->size += len;
+	j->unsynced = 1;
+
+	if(j->policy == STATE_SYNC_ALWAYS ||
+	  (j->policy == STATE_SYNC_PERIODIC && time(NULL) - j->last_sync >= STATE_SYNC_INTERVAL)) {
+		journal_sync(j);
+	}
+
+	if(j->max_size > 0 && j->size >= j->max_size) {
+		journal_compact(j);
+	}
+	return 0;
+}
+
+/** \brief Flush outstanding journal records to disk, according to the durability policy
+ *
+ * \param j Pointer to a state journal
+ *
+ * Should be called regularly (e.g. once per polling cycle). It also picks up the result of a
+ * finished background compaction.
+ */
+void state_journal_sync(state_journal *j) {
+	if(j) {
+		compaction_running(j);
+		if(j->policy != STATE_SYNC_NEVER) {
+			journal_sync(j);
+		}
+	}
+}
+
+/** \brief Close the state journal
+ *
+ * \param j Pointer to a state journal
+ * \return 0 on success, -1 if the state couldn't be saved
+ *
+ * If the journal contains any records, the history is written to the state file.
+ * After a successful close, the state file is complete and the journal files are gone.
+ */
+int state_journal_close(state_journal *j) {
+	struct stat st;
+	int result = 0;
+	int i;
+
+	if(!j) {
+		return 0;
+	}
+
+	/* let a running compaction finish, so it can't replace the state file written below */
+	for(i = 0; i < STATE_COMPACT_TIMEOUT * 10 && compaction_running(j); ++i) {
+		usleep(100 * 1000);
+	}
+	if(compaction_running(j)) {
+		kill(j->compactor, SIGKILL);
+		j->compactor = 0;
+	}
+
+	journal_sync(j);
+	if(j->fd != -1) {
+		close(j->fd);
+		j->fd = -1;
+	}
+
+	if(j->size > 0 || stat(j->old_path, &st) == 0) {
+		result = save_state(j->state_file, j->history);
+	}
+	if(result == 0) {
+		unlink(j->path);
+		unlink(j->old_path);
+	}
+
+	am_free(j->state_file);
+	am_free(j->path);
+	am_free(j->old_path);
+	am_free(j);
+	return result;
+}
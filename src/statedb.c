@@ -0,0 +1,290 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file statedb.c
+ *
+ * Binary, memory-mapped state file.
+ *
+ * Layout (all numbers in host byte order):
+ *  - header: 8 byte magic "TMSTATE\0", uint32 version, uint32 flags, uint64 count, uint64 reserved
+ *  - count 128-bit URL digests, sorted in ascending order
+ *  - if STATEDB_FLAG_META is set: count statedb_meta records, in the same order as the digests
+ *
+ * Lookups are a binary search directly on the mapped file, no per-entry memory is allocated.
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "hash.h"
+#include "output.h"
+#include "statedb.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+/** \cond */
+#define STATEDB_MAGIC       "TMSTATE"
+
+struct statedb_header {
+  char     magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t count;
+  uint64_t reserved;
+};
+
+struct statedb {
+  void                *map;
+  size_t               map_size;
+  uint64_t             count;
+  const hash128       *digests;
+  const statedb_meta  *meta;     /**< NULL if the file has no metadata section */
+};
+/** \endcond */
+
+/** \brief Check whether a file is a binary state file
+ *
+ * \param path Path to the file
+ * \return 1 if the file starts with the magic of a binary state file, 0 otherwise
+ */
+PUBLIC uint8_t statedb_is_binary(const char *path) {
+  char magic[8];
+  uint8_t result = 0;
+  FILE *fp = fopen(path, "rb");
+
+  if(fp) {
+    if(fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, STATEDB_MAGIC, sizeof(magic)) == 0) {
+      result = 1;
+    }
+    fclose(fp);
+  }
+  return result;
+}
+
+/** \brief Map a binary state file into memory
+ *
+ * \param path Path to the file
+ * \return Pointer to the state database, or \c NULL if the file doesn't exist or is invalid
+ */
+PUBLIC statedb* statedb_open(const char *path) {
+  statedb *db = NULL;
+  const struct statedb_header *hdr = NULL;
+  struct stat st;
+  void *map;
+  uint64_t entry_size;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if(fd == -1) {
+    return NULL;
+  }
+
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct statedb_header)) {
+    dbg_printf(P_ERROR, "[statedb_open] '%s' is not a valid state file", path);
+    close(fd);
+    return NULL;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED) {
+    dbg_printf(P_ERROR, "[statedb_open] Unable to map '%s': %s", path, strerror(errno));
+    return NULL;
+  }
+
+  hdr = (const struct statedb_header*)map;
+  entry_size = sizeof(hash128);
+  if(hdr->flags & STATEDB_FLAG_META) {
+    entry_size += sizeof(statedb_meta);
+  }
+
+  /* compare by division: a corrupt count would overflow the size of the entries */
+  if(memcmp(hdr->magic, STATEDB_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != STATEDB_VERSION ||
+     hdr->count > ((uint64_t)st.st_size - sizeof(struct statedb_header)) / entry_size) {
+    dbg_printf(P_ERROR, "[statedb_open] '%s' is not a valid state file (version %u)", path, hdr->version);
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  db = am_malloc(sizeof(struct statedb));
+  if(!db) {
+    munmap(map, st.st_size);
+    return NULL;
+  }
+
+  db->map      = map;
+  db->map_size = st.st_size;
+  db->count    = hdr->count;
+  db->digests  = (const hash128*)((const char*)map + sizeof(struct statedb_header));
+  db->meta     = (hdr->flags & STATEDB_FLAG_META) ? (const statedb_meta*)(db->digests + db->count) : NULL;
+
+  return db;
+}
+
+/** \brief Unmap a state file
+ *
+ * \param db Pointer to a state database
+ */
+PUBLIC void statedb_close(statedb *db) {
+  if(db) {
+    munmap(db->map, db->map_size);
+    am_free(db);
+  }
+}
+
+/** \brief Number of entries in the state database */
+PUBLIC uint64_t statedb_count(const statedb *db) {
+  return db ? db->count : 0;
+}
+
+/** \brief Look up a digest
+ *
+ * \param db Pointer to a state database
+ * \param digest The digest
+ * \return Index of the entry, or -1 if the digest is not in the database
+ */
+PUBLIC int64_t statedb_find(const statedb *db, const hash128 *digest) {
+  uint64_t lo = 0, hi, mid;
+  int cmp;
+
+  if(!db || !digest) {
+    return -1;
+  }
+
+  hi = db->count;
+  while(lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    cmp = hash128_cmp(&db->digests[mid], digest);
+    if(cmp == 0) {
+      return (int64_t)mid;
+    } else if(cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return -1;
+}
+
+/** \brief Digest of the i-th entry, or \c NULL */
+PUBLIC const hash128* statedb_digest(const statedb *db, uint64_t i) {
+  return (db && i < db->count) ? &db->digests[i] : NULL;
+}
+
+/** \brief Metadata of the i-th entry, or \c NULL if the file has no metadata */
+PUBLIC const statedb_meta* statedb_get_meta(const statedb *db, uint64_t i) {
+  return (db && db->meta && i < db->count) ? &db->meta[i] : NULL;
+}
+
+PRIVATE int entry_cmp(const void *a, const void *b) {
+  return hash128_cmp(&((const statedb_entry*)a)->digest, &((const statedb_entry*)b)->digest);
+}
+
+/** \brief Write a binary state file
+ *
+ * \param path Path to the file
+ * \param entries The entries. The array is sorted in place.
+ * \param count Number of entries
+ * \param flags STATEDB_FLAG_META to include the metadata section
+ * \return 0 on success, -1 on error
+ *
+ * Duplicate digests are written only once. The file is written to a temporary file first,
+ * which then atomically replaces \a path.
+ */
+PUBLIC int statedb_write(const char *path, statedb_entry *entries, uint64_t count, uint32_t flags) {
+  struct statedb_header hdr;
+  char *tmp_file = NULL;
+  FILE *fp = NULL;
+  uint64_t i, n = 0;
+  uint8_t ok;
+  int result = -1;
+
+  if(!path) {
+    return -1;
+  }
+
+  /* sort and remove duplicates */
+  if(count > 0) {
+    qsort(entries, count, sizeof(statedb_entry), entry_cmp);
+    n = 1;
+    for(i = 1; i < count; ++i) {
+      if(hash128_cmp(&entries[i].digest, &entries[n - 1].digest) != 0) {
+        entries[n++] = entries[i];
+      }
+    }
+  }
+
+  tmp_file = am_malloc(strlen(path) + 5);
+  if(!tmp_file) {
+    return -1;
+  }
+  sprintf(tmp_file, "%s.tmp", path);
+
+  if((fp = fopen(tmp_file, "wb")) == NULL) {
+    dbg_printf(P_ERROR, "Error: Unable to open statefile '%s' for writing: %s", tmp_file, strerror(errno));
+    am_free(tmp_file);
+    return -1;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, STATEDB_MAGIC, sizeof(hdr.magic));
+  hdr.version = STATEDB_VERSION;
+  hdr.flags   = flags & STATEDB_FLAG_META;
+  hdr.count   = n;
+
+  ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1);
+  for(i = 0; ok && i < n; ++i) {
+    ok = (fwrite(&entries[i].digest, sizeof(hash128), 1, fp) == 1);
+  }
+  if(hdr.flags & STATEDB_FLAG_META) {
+    for(i = 0; ok && i < n; ++i) {
+      ok = (fwrite(&entries[i].meta, sizeof(statedb_meta), 1, fp) == 1);
+    }
+  }
+  if(ok) {
+    ok = (fflush(fp) == 0 && fsync(fileno(fp)) == 0);
+  }
+  fclose(fp);
+
+  if(ok && rename(tmp_file, path) == 0) {
+    result = 0;
+  } else {
+    dbg_printf(P_ERROR, "Error: Unable to write statefile '%s': %s", path, strerror(errno));
+    unlink(tmp_file);
+  }
+  am_free(tmp_file);
+  return result;
+}
@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+#include "event_loop.h"
+#include "utils.h"
+#include "output.h"
+
+#ifdef MEMWATCH
+  #include "memwatch.h"
+#endif
+
+int8_t verbose = P_NONE;
+
+static int test = 0;
+
+#define check( A ) \
+  { \
+      ++test; \
+      if( !( A ) ){ \
+          fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+          return test; \
+      } \
+  }
+
+static char answer[4096];
+
+static void onCommand(control_client *client, int argc, char **argv, void *userdata) {
+  int *commands = (int*)userdata;
+  int i;
+
+  ++*commands;
+  if(!strcmp(argv[0], "echo")) {
+    for(i = 1; i < argc; ++i) {
+      control_reply(client, "%s", argv[i]);
+    }
+    control_reply_ok(client, "%d", argc - 1);
+  } else if(!strcmp(argv[0], "ping")) {
+    control_reply_ok(client, NULL);
+  } else {
+    control_reply_error(client, "unknown\ncommand");
+  }
+}
+
+static int connectTo(const char *path) {
+  struct sockaddr_un addr;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  if(fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+static uint32_t countStatusLines(const char *str) {
+  uint32_t count = 0;
+  const char *line = str;
+
+  while(line && *line) {
+    if(!strncmp(line, "OK", 2) || !strncmp(line, "ERR ", 4)) {
+      ++count;
+    }
+    line = strchr(line, '\n');
+    if(line) {
+      ++line;
+    }
+  }
+  return count;
+}
+
+/* send a request and run the event loop until the expected number of answers has arrived.
+** Returns 1 if the server has closed the connection.
+*/
+static int exchange(event_loop *loop, int fd, const char *request, uint32_t answers) {
+  size_t len = 0;
+  ssize_t n = -1;
+  int rounds;
+
+  if(request) {
+    send(fd, request, strlen(request), 0);
+  }
+  answer[0] = '\0';
+  for(rounds = 0; rounds < 100; ++rounds) {
+    event_loop_run(loop, 10);
+    while((n = recv(fd, answer + len, sizeof(answer) - len - 1, MSG_DONTWAIT)) > 0) {
+      len += (size_t)n;
+    }
+    answer[len] = '\0';
+    if(n == 0 || (answers > 0 && countStatusLines(answer) >= answers)) {
+      break;
+    }
+  }
+  return n == 0 ? 1 : 0;
+}
+
+int testControl(void) {
+  event_loop *loop = event_loop_new();
+  control_server *server = NULL;
+  char path[64];
+  char line[CONTROL_MAX_LINE + 16];
+  struct stat st;
+  int commands = 0;
+  int fd, fd2, stale;
+  struct sockaddr_un addr;
+
+  check(loop != NULL);
+  snprintf(path, sizeof(path), "/tmp/control_test.%d.sock", (int)getpid());
+  unlink(path);
+
+  server = control_server_new(loop, path, onCommand, &commands);
+  check(server != NULL);
+  check(stat(path, &st) == 0 && (st.st_mode & 077) == 0);
+
+  /* only one daemon may listen on a socket */
+  check(control_server_new(loop, path, onCommand, &commands) == NULL);
+
+  fd = connectTo(path);
+  check(fd >= 0);
+  exchange(loop, fd, "echo a  b\n", 1);
+  check(!strcmp(answer, "- a\n- b\nOK 2\n"));
+  check(commands == 1);
+
+  /* several commands in one piece, a command spread over two pieces, empty lines */
+  exchange(loop, fd, "ping\r\nfoo\n\n  \nech", 2);
+  check(!strcmp(answer, "OK\nERR unknown command\n"));
+  exchange(loop, fd, "o x\n", 1);
+  check(!strcmp(answer, "- x\nOK 1\n"));
+  check(commands == 4);
+
+  /* two clients at the same time */
+  fd2 = connectTo(path);
+  check(fd2 >= 0);
+  exchange(loop, fd2, "ping\n", 1);
+  check(!strcmp(answer, "OK\n"));
+
+  /* a last command without a line feed is answered before the connection is closed */
+  send(fd2, "echo last", 9, 0);
+  shutdown(fd2, SHUT_WR);
+  check(exchange(loop, fd2, NULL, 0) == 1);
+  check(!strcmp(answer, "- last\nOK 1\n"));
+  close(fd2);
+
+  /* overlong lines end the connection */
+  memset(line, 'x', sizeof(line) - 1);
+  line[sizeof(line) - 1] = '\0';
+  check(exchange(loop, fd, line, 0) == 1);
+  check(!strcmp(answer, "ERR Line too long\n"));
+  close(fd);
+
+  control_server_free(server);
+  check(stat(path, &st) != 0);
+
+  /* the socket file of a daemon that didn't exit cleanly is replaced */
+  stale = socket(AF_UNIX, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  check(bind(stale, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+  close(stale);
+  server = control_server_new(loop, path, onCommand, &commands);
+  check(server != NULL);
+  control_server_free(server);
+
+  /* ... but nothing else */
+  fd = open(path, O_CREAT | O_WRONLY, 0600);
+  close(fd);
+  check(control_server_new(loop, path, onCommand, &commands) == NULL);
+  unlink(path);
+
+  event_loop_free(loop);
+  return 0;
+}
+
+int testIdleClients(void) {
+  event_loop *loop = event_loop_new();
+  control_server *server = NULL;
+  char path[64];
+  int commands = 0;
+  int fd, fd2, rounds;
+
+  check(loop != NULL);
+  snprintf(path, sizeof(path), "/tmp/control_test.%d.sock", (int)getpid());
+  unlink(path);
+  server = control_server_new(loop, path, onCommand, &commands);
+  check(server != NULL);
+  control_server_set_timeout(server, 300);
+
+  fd = connectTo(path);
+  fd2 = connectTo(path);
+  check(fd >= 0 && fd2 >= 0);
+
+  /* a client that keeps talking stays connected, one that doesn't is closed */
+  send(fd2, "pi", 2, 0);
+  for(rounds = 0; rounds < 6; ++rounds) {
+    check(exchange(loop, fd, "ping\n", 1) == 0);
+    check(!strcmp(answer, "OK\n"));
+    usleep(100000);
+  }
+  check(exchange(loop, fd2, NULL, 0) == 1);
+  check(answer[0] == '\0');
+  check(exchange(loop, fd, NULL, 0) == 1);
+  close(fd);
+  close(fd2);
+  check(commands == 6);
+
+  control_server_free(server);
+  event_loop_free(loop);
+  return 0;
+}
+
+int main(void) {
+  int i;
+  i = testControl();
+
+  if(!i) {
+    i = testIdleClients();
+  }
+
+  return i;
+}
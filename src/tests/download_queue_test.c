@@ -0,0 +1,333 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "download_queue.h"
+#include "event_loop.h"
+#include "partfile.h"
+#include "test_server.h"
+#include "utils.h"
+#include "output.h"
+#include "web.h"
+
+#ifdef MEMWATCH
+  #include "memwatch.h"
+#endif
+
+int8_t verbose = P_NONE;
+
+#define SIZE 1000
+
+static int test = 0;
+
+#define check( A ) \
+  { \
+      ++test; \
+      if( !( A ) ){ \
+          fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+          return test; \
+      } \
+  }
+
+static char body[SIZE];
+static char content[SIZE + 16];
+
+/* the first 400 bytes arrive right away, the rest only after test_server_release() */
+static test_object stalled = { "/stalled.mov", body, SIZE, "\"v1\"", 1, 400 };
+static test_object quick   = { "/quick.mov", body, SIZE, "\"v1\"", 1, 0 };
+/* every segment stops after 50 bytes */
+static test_object segments = { "/segments.mov", body, SIZE, "\"v1\"", 1, 50 };
+
+static event_loop  *loop = NULL;
+static web_multi   *engine = NULL;
+static test_server *server = NULL;
+
+static uint32_t finished = 0;
+static long     last_code = 0;
+
+static void onDone(const download_job *job, HTTPResponse *response, void *userdata) {
+  (void)job;
+  (void)userdata;
+  ++finished;
+  last_code = response ? response->responseCode : 0;
+  HTTPResponse_free(response);
+}
+
+static void url(char *buf, const char *path) {
+  sprintf(buf, "http://127.0.0.1:%d%s", test_server_port(server), path);
+}
+
+static uint8_t exists(const char *path) {
+  return access(path, F_OK) == 0 ? 1 : 0;
+}
+
+/* size of a file, or -1 if it doesn't exist */
+static long fileSize(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  long size = -1;
+
+  if(fp) {
+    size = (long)fread(content, 1, sizeof(content), fp);
+    fclose(fp);
+  }
+  return size;
+}
+
+/* run the event loop until the server has answered a request for the stalled file and has sent
+** all it may send of it
+*/
+static void waitForStall(void) {
+  int rounds;
+
+  for(rounds = 0; rounds < 500 && !strstr(test_server_log(server), "GET /stalled.mov"); ++rounds) {
+    event_loop_run(loop, 10);
+  }
+  for(rounds = 0; rounds < 20; ++rounds) {
+    event_loop_run(loop, 10);
+  }
+}
+
+static void waitForJobs(download_queue *q) {
+  int rounds;
+
+  for(rounds = 0; rounds < 500 && (download_queue_active(q) > 0 || download_queue_length(q) > 0); ++rounds) {
+    event_loop_run(loop, 10);
+  }
+}
+
+int testPauseRequeue(void) {
+  download_queue *q = NULL;
+  const download_job *job = NULL;
+  char buf[64];
+
+  q = download_queue_new(engine, 1, 0, onDone, NULL);
+  check(q != NULL);
+  unlink("queue_a.mov");
+  test_server_clear_log(server);
+  finished = 0;
+
+  url(buf, "/stalled.mov");
+  check(download_queue_add(q, buf, "queue_a.mov", NULL, "A", 0, 3, NULL, 0) == 0);
+  check(download_queue_active(q) == 1);
+  waitForStall();
+
+  /* the running job goes back to the front of the queue, its partial file is kept */
+  url(buf, "/quick.mov");
+  check(download_queue_add(q, buf, "queue_b.mov", NULL, "B", 0, 3, NULL, 0) == 0);
+  download_queue_pause(q, 1);
+  check(download_queue_paused(q) == 1);
+  check(download_queue_active(q) == 0);
+  check(download_queue_length(q) == 2);
+  job = download_queue_waiting(q);
+  check(job != NULL && !strcmp(job->name, "A") && job->feed_id == 3);
+  check(job->next != NULL && !strcmp(job->next->name, "B"));
+  check(finished == 0);
+  check(fileSize("queue_a.mov.part") == 400 && exists("queue_a.mov.part.info"));
+
+  /* nothing starts while the queue is paused */
+  event_loop_run(loop, 10);
+  check(download_queue_active(q) == 0);
+
+  /* after resuming, the download continues where it stopped */
+  test_server_release(server);
+  test_server_clear_log(server);
+  download_queue_pause(q, 0);
+  check(download_queue_active(q) == 1);
+  waitForJobs(q);
+  check(finished == 2 && last_code == 200);
+  check(strstr(test_server_log(server), "GET /stalled.mov 400- 206\n") != NULL);
+  check(fileSize("queue_a.mov") == SIZE && !memcmp(content, body, SIZE));
+  check(!exists("queue_a.mov.part") && !exists("queue_a.mov.part.info"));
+  check(fileSize("queue_b.mov") == SIZE);
+
+  download_queue_free(q);
+  unlink("queue_a.mov");
+  unlink("queue_b.mov");
+  return 0;
+}
+
+int testPauseSegmented(void) {
+  download_queue *q = NULL;
+  part_info info;
+  const char *log = NULL;
+  char buf[64];
+  int rounds;
+
+  q = download_queue_new(engine, 1, 0, onDone, NULL);
+  check(q != NULL);
+  download_queue_set_segments(q, 4, 100);
+  unlink("queue_s.mov");
+  test_server_hold(server);
+  test_server_clear_log(server);
+  finished = 0;
+
+  url(buf, "/segments.mov");
+  check(download_queue_add(q, buf, "queue_s.mov", NULL, "S", 0, 0, NULL, 0) == 0);
+  for(rounds = 0; rounds < 500 && !strstr(test_server_log(server), "750-999"); ++rounds) {
+    event_loop_run(loop, 10);
+  }
+  for(rounds = 0; rounds < 20; ++rounds) {
+    event_loop_run(loop, 10);
+  }
+
+  /* pausing keeps the segments and what they have received so far */
+  download_queue_pause(q, 1);
+  check(download_queue_active(q) == 0 && download_queue_length(q) == 1);
+  check(finished == 0);
+  check(fileSize("queue_s.mov.part") == SIZE);
+  check(part_info_load("queue_s.mov.part", &info) == 0);
+  check(info.segment_count == 4 && info.segments[2].written == 50);
+  part_info_free(&info);
+
+  /* after resuming, each segment continues where it stopped */
+  test_server_release(server);
+  test_server_clear_log(server);
+  download_queue_pause(q, 0);
+  waitForJobs(q);
+  check(finished == 1 && last_code == 200);
+  log = test_server_log(server);
+  check(strstr(log, "GET /segments.mov 50-249 206\n") != NULL);
+  check(strstr(log, "GET /segments.mov 300-499 206\n") != NULL);
+  check(strstr(log, "GET /segments.mov 550-749 206\n") != NULL);
+  check(strstr(log, "GET /segments.mov 800-999 206\n") != NULL);
+  check(fileSize("queue_s.mov") == SIZE && !memcmp(content, body, SIZE));
+  check(!exists("queue_s.mov.part") && !exists("queue_s.mov.part.info"));
+
+  download_queue_free(q);
+  unlink("queue_s.mov");
+  return 0;
+}
+
+int testCancel(void) {
+  download_queue *q = NULL;
+  const download_job *job = NULL;
+  uint32_t running_id, waiting_id;
+  char buf[64];
+  FILE *fp = NULL;
+
+  q = download_queue_new(engine, 1, 0, onDone, NULL);
+  check(q != NULL);
+  test_server_clear_log(server);
+  finished = 0;
+
+  url(buf, "/stalled.mov");
+  check(download_queue_add(q, buf, "queue_c.mov", NULL, "C", 0, 1, NULL, 0) == 0);
+  url(buf, "/quick.mov");
+  check(download_queue_add(q, buf, "queue_d.mov", NULL, "D", 0, 1, NULL, 0) == 0);
+  running_id = download_queue_running(q)->id;
+  waiting_id = download_queue_waiting(q)->id;
+  check(running_id != waiting_id);
+  waitForStall();
+
+  /* a waiting job is dropped right away, along with a partial file from an earlier attempt */
+  fp = fopen("queue_d.mov.part", "wb");
+  check(fp != NULL);
+  fputs("partial", fp);
+  fclose(fp);
+  check(download_queue_contains(q, "queue_d.mov") == 1);
+  check(download_queue_cancel(q, waiting_id) == 0);
+  check(download_queue_length(q) == 0);
+  check(download_queue_contains(q, "queue_d.mov") == 0);
+  check(!exists("queue_d.mov.part"));
+  check(download_queue_cancel(q, waiting_id) == -1);
+
+  /* a running job is stopped, and its partial file is removed without calling the completion function */
+  check(exists("queue_c.mov.part") && exists("queue_c.mov.part.info"));
+  check(download_queue_cancel(q, running_id) == 0);
+  waitForJobs(q);
+  check(download_queue_active(q) == 0);
+  check(download_queue_contains(q, "queue_c.mov") == 0);
+  check(finished == 0);
+  check(!exists("queue_c.mov.part") && !exists("queue_c.mov.part.info") && !exists("queue_c.mov"));
+  check(download_queue_cancel(q, running_id) == -1);
+
+  /* the queue keeps working */
+  url(buf, "/quick.mov");
+  check(download_queue_add(q, buf, "queue_d.mov", NULL, "D", 0, 1, NULL, 0) == 0);
+  job = download_queue_running(q);
+  check(job != NULL && !strcmp(job->name, "D"));
+  waitForJobs(q);
+  check(finished == 1 && fileSize("queue_d.mov") == SIZE);
+
+  download_queue_free(q);
+  unlink("queue_d.mov");
+  return 0;
+}
+
+int testRemapFeeds(void) {
+  download_queue *q = NULL;
+  const download_job *job = NULL;
+  const uint16_t ids[] = { 2, 0, DOWNLOAD_NO_FEED };
+  char buf[64];
+
+  q = download_queue_new(engine, 1, 0, onDone, NULL);
+  check(q != NULL);
+  download_queue_pause(q, 1);
+  url(buf, "/quick.mov");
+  check(download_queue_add(q, buf, "queue_e.mov", NULL, "E", 3, 0, NULL, 0) == 0);
+  check(download_queue_add(q, buf, "queue_f.mov", NULL, "F", 2, 1, NULL, 0) == 0);
+  check(download_queue_add(q, buf, "queue_g.mov", NULL, "G", 1, 2, NULL, 0) == 0);
+  check(download_queue_add(q, buf, "queue_h.mov", NULL, "H", 0, 5, NULL, 0) == 0);
+
+  /* feeds 0 and 1 swap their IDs, feed 2 has been removed, IDs beyond the map stay */
+  download_queue_remap_feeds(q, ids, 3);
+  job = download_queue_waiting(q);
+  check(job != NULL && !strcmp(job->name, "E") && job->feed_id == 2);
+  job = job->next;
+  check(job != NULL && !strcmp(job->name, "F") && job->feed_id == 0);
+  job = job->next;
+  check(job != NULL && !strcmp(job->name, "G") && job->feed_id == DOWNLOAD_NO_FEED);
+  job = job->next;
+  check(job != NULL && !strcmp(job->name, "H") && job->feed_id == 5);
+
+  /* running jobs follow as well */
+  download_queue_pause(q, 0);
+  check(download_queue_running(q) != NULL && download_queue_running(q)->feed_id == 2);
+  download_queue_remap_feeds(q, ids, 3);
+  check(download_queue_running(q)->feed_id == DOWNLOAD_NO_FEED);
+  check(download_queue_waiting(q)->feed_id == 2);
+
+  download_queue_free(q);
+  unlink("queue_e.mov");
+  return 0;
+}
+
+int main(void) {
+  int i;
+
+  for(i = 0; i < SIZE; ++i) {
+    body[i] = (char)('a' + i % 26);
+  }
+
+  loop = event_loop_new();
+  engine = web_multi_new(8, 0);
+  if(!loop || !engine || web_multi_attach(engine, loop) != 0 || (server = test_server_new(loop)) == NULL) {
+    fprintf(stderr, "FAIL: Unable to set up the test server\n");
+    return 1;
+  }
+  test_server_add(server, &stalled);
+  test_server_add(server, &quick);
+  test_server_add(server, &segments);
+
+  i = testCancel();
+
+  if(!i) {
+    i = testPauseRequeue();
+  }
+
+  if(!i) {
+    i = testRemapFeeds();
+  }
+
+  if(!i) {
+    i = testPauseSegmented();
+  }
+
+  web_multi_free(engine);
+  test_server_free(server);
+  event_loop_free(loop);
+  CURLPool_free();
+  return i;
+}
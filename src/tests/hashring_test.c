@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+#include "hashring.h"
+#include "utils.h"
+#include "output.h"
+
+#ifdef MEMWATCH
+  #include "memwatch.h"
+#endif
+
+int8_t verbose = P_NONE;
+
+#define RING_SIZE 5000
+
+static int test = 0;
+
+#define check( A ) \
+  { \
+      ++test; \
+      if( !( A ) ){ \
+          fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+          return test; \
+      } \
+  }
+
+int testHash(void) {
+  const char *str = "Nobody inspects the spammish repetition";
+
+  /* reference values of xxHash */
+  check(xxh64("", 0, 0) == 0xEF46DB3751D8E999ULL);
+  check(xxh64("abc", 3, 0) == 0x44BC2CF5AD770999ULL);
+  check(xxh64(str, strlen(str), 0) == 0xFBCEA83C8A378BF1ULL);
+  check(hash_string(str) == 0xFBCEA83C8A378BF1ULL);
+  check(hash_string(NULL) == 0);
+  return 0;
+}
+
+int testHashStream(void) {
+  char buf[1000];
+  xxh64_state state;
+  uint32_t i, pos, chunk;
+
+  for(i = 0; i < sizeof(buf); ++i) {
+    buf[i] = (char)(i * 7 + 3);
+  }
+
+  xxh64_reset(&state, 0);
+  check(xxh64_digest(&state) == 0xEF46DB3751D8E999ULL);
+  xxh64_update(&state, "abc", 3);
+  check(xxh64_digest(&state) == 0x44BC2CF5AD770999ULL);
+
+  /* hand over the data in chunks of varying size */
+  for(chunk = 1; chunk < 70; chunk += 3) {
+    xxh64_reset(&state, 42);
+    for(pos = 0; pos < sizeof(buf); pos += chunk) {
+      xxh64_update(&state, buf + pos, pos + chunk <= sizeof(buf) ? chunk : sizeof(buf) - pos);
+    }
+    check(xxh64_digest(&state) == xxh64(buf, sizeof(buf), 42));
+  }
+  return 0;
+}
+
+int testHashRing(void) {
+  hashring *h = NULL;
+  char url[64];
+  uint32_t i;
+
+  check(hashring_count(NULL) == 0);
+  check(hashring_contains(NULL, 1, NULL) == 0);
+  check(hashring_add(NULL, 1, NULL) == -1);
+
+  h = hashring_new(0);
+  check(h != NULL);
+  check(hashring_payload(h, 0) == NULL);
+  check(hashring_count(h) == 0);
+  check(hashring_value(h, 0) == NULL);
+
+  for(i = 0; i < RING_SIZE; ++i) {
+    sprintf(url, "http://www.example.com/file_%u.mov", i);
+    check(hashring_add(h, hash_string(url), url) == 0);
+  }
+  check(hashring_count(h) == RING_SIZE);
+  check(hashring_add(h, hash_string(url), url) == 1);
+  check(strcmp(hashring_value(h, 0), url) == 0);
+  check(strcmp(hashring_value(h, RING_SIZE - 1), "http://www.example.com/file_0.mov") == 0);
+
+  for(i = 0; i < RING_SIZE; ++i) {
+    sprintf(url, "http://www.example.com/file_%u.mov", i);
+    check(hashring_contains(h, hash_string(url), url) == 1);
+  }
+
+  /* same key, different value: a hash collision must not produce a false positive */
+  check(hashring_contains(h, hash_string(url), "http://www.example.com/other.mov") == 0);
+  check(hashring_contains(h, hash_string(url), NULL) == 1);
+
+  /* evict the oldest half */
+  hashring_trim(h, RING_SIZE / 2);
+  check(hashring_count(h) == RING_SIZE / 2);
+  for(i = 0; i < RING_SIZE; ++i) {
+    sprintf(url, "http://www.example.com/file_%u.mov", i);
+    check(hashring_contains(h, hash_string(url), url) == (i >= RING_SIZE / 2));
+  }
+
+  /* keep a fixed size while adding, like the download history does */
+  for(i = RING_SIZE; i < 3 * RING_SIZE; ++i) {
+    sprintf(url, "http://www.example.com/file_%u.mov", i);
+    check(hashring_add(h, hash_string(url), url) == 0);
+    hashring_trim(h, RING_SIZE / 2);
+  }
+  check(hashring_count(h) == RING_SIZE / 2);
+  for(i = 0; i < 3 * RING_SIZE; ++i) {
+    sprintf(url, "http://www.example.com/file_%u.mov", i);
+    check(hashring_contains(h, hash_string(url), url) == (i >= 3 * RING_SIZE - RING_SIZE / 2));
+  }
+
+  hashring_clear(h);
+  check(hashring_count(h) == 0);
+
+  /* entries appended as oldest keep the order of a newest-first list */
+  check(hashring_append(h, 3, "c") == 0);
+  check(hashring_append(h, 2, "b") == 0);
+  check(hashring_append(h, 1, "a") == 0);
+  check(hashring_add(h, 4, "d") == 0);
+  check(strcmp(hashring_value(h, 0), "d") == 0);
+  check(strcmp(hashring_value(h, 1), "c") == 0);
+  check(strcmp(hashring_value(h, 3), "a") == 0);
+  check(hashring_key(h, 3) == 1);
+  hashring_trim(h, 2);
+  check(hashring_contains(h, 1, "a") == 0);
+  check(hashring_contains(h, 2, "b") == 0);
+  check(hashring_contains(h, 3, "c") == 1);
+
+  hashring_free(h);
+
+  /* payloads move along when the ring grows */
+  h = hashring_new(sizeof(uint32_t));
+  check(h != NULL);
+  for(i = 0; i < RING_SIZE; ++i) {
+    check(hashring_add(h, i + 1, NULL) == 0);
+    check(*(uint32_t*)hashring_payload(h, 0) == 0);
+    *(uint32_t*)hashring_payload(h, 0) = i;
+  }
+  for(i = 0; i < RING_SIZE; ++i) {
+    check(hashring_key(h, i) == RING_SIZE - i);
+    check(*(uint32_t*)hashring_payload(h, i) == RING_SIZE - 1 - i);
+  }
+  check(hashring_payload(h, RING_SIZE) == NULL);
+  hashring_free(h);
+  return 0;
+}
+
+int main(void) {
+  int i;
+  i = testHash();
+
+  if(!i) {
+    i = testHashStream();
+  }
+
+  if(!i) {
+    i = testHashRing();
+  }
+
+  return i;
+}
@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+#include "event_loop.h"
+#include "utils.h"
+#include "output.h"
+
+#ifdef MEMWATCH
+  #include "memwatch.h"
+#endif
+
+int8_t verbose = P_NONE;
+
+static int test = 0;
+
+#define check( A ) \
+  { \
+      ++test; \
+      if( !( A ) ){ \
+          fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+          return test; \
+      } \
+  }
+
+static const char expected[] =
+  "# TYPE test_requests counter\n"
+  "# HELP test_requests Requests\n"
+  "test_requests_total 3\n"
+  "# TYPE test_queue gauge\n"
+  "# HELP test_queue Queue depth\n"
+  "test_queue 7\n"
+  "# TYPE test_duration_seconds histogram\n"
+  "# HELP test_duration_seconds Duration\n"
+  "test_duration_seconds_bucket{le=\"0.1\"} 1\n"
+  "test_duration_seconds_bucket{le=\"1\"} 3\n"
+  "test_duration_seconds_bucket{le=\"+Inf\"} 4\n"
+  "test_duration_seconds_sum 7.75\n"
+  "test_duration_seconds_count 4\n"
+  "# EOF\n";
+
+static void collect(metrics *registry, void *userdata) {
+  (void)registry;
+  metric_set((metric*)userdata, 7);
+}
+
+int testRegistry(void) {
+  metrics *registry = metrics_new();
+  metric *requests = NULL, *queue = NULL, *duration = NULL;
+  const double bounds[] = { 0.1, 1 };
+  const double unsorted[] = { 1, 0.1 };
+  char *text = NULL;
+  size_t len = 0;
+
+  check(registry != NULL);
+  requests = metrics_counter(registry, "test_requests", "Requests");
+  queue = metrics_gauge(registry, "test_queue", "Queue depth");
+  duration = metrics_histogram(registry, "test_duration_seconds", "Duration", bounds, 2);
+  check(requests != NULL && queue != NULL && duration != NULL);
+  check(metrics_histogram(registry, "test_invalid", "Invalid", unsorted, 2) == NULL);
+
+  metric_add(requests, 1);
+  metric_add(requests, 2);
+  check(metric_count(requests) == 3);
+  metric_observe(duration, 0.05);
+  metric_observe(duration, 0.2);
+  metric_observe(duration, 1);
+  metric_observe(duration, 6.5);
+  check(metric_count(duration) == 4);
+
+  /* handles of metrics that couldn't be registered are ignored */
+  metric_add(NULL, 1);
+  metric_observe(NULL, 1);
+
+  metrics_set_collect(registry, collect, queue);
+  text = metrics_render(registry, &len);
+  check(text != NULL);
+  check(len == strlen(expected));
+  check(!strcmp(text, expected));
+  am_free(text);
+
+  metrics_free(registry);
+  return 0;
+}
+
+/* send a request to the server and run the event loop until the response is complete */
+static int request(event_loop *loop, uint16_t port, const char *req, char *answer, size_t size) {
+  struct sockaddr_in addr;
+  size_t len = 0;
+  ssize_t n = -1;
+  int fd, rounds;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    return -1;
+  }
+  send(fd, req, strlen(req), 0);
+  for(rounds = 0; rounds < 100; ++rounds) {
+    event_loop_run(loop, 10);
+    while((n = recv(fd, answer + len, size - len - 1, MSG_DONTWAIT)) > 0) {
+      len += (size_t)n;
+    }
+    if(n == 0) {
+      break;
+    }
+  }
+  answer[len] = '\0';
+  close(fd);
+  return n == 0 ? 0 : -1;
+}
+
+int testServer(void) {
+  event_loop *loop = event_loop_new();
+  metrics *registry = metrics_new();
+  metrics_server *server = NULL;
+  metric *requests = metrics_counter(registry, "test_requests", "Requests");
+  char answer[4096];
+  uint16_t port;
+
+  check(loop != NULL && requests != NULL);
+  server = metrics_server_new(loop, 0, registry);
+  check(server != NULL);
+  port = metrics_server_port(server);
+  check(port > 0);
+
+  metric_add(requests, 5);
+  check(request(loop, port, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n", answer, sizeof(answer)) == 0);
+  check(!strncmp(answer, "HTTP/1.0 200 OK\r\n", 17));
+  check(strstr(answer, "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n") != NULL);
+  check(strstr(answer, "\r\n\r\n# TYPE test_requests counter\n") != NULL);
+  check(strstr(answer, "\ntest_requests_total 5\n# EOF\n") != NULL);
+
+  /* HEAD only gets the header fields, the query string is ignored */
+  check(request(loop, port, "HEAD /metrics?x=1 HTTP/1.0\n\n", answer, sizeof(answer)) == 0);
+  check(!strncmp(answer, "HTTP/1.0 200 OK\r\n", 17));
+  check(strstr(answer, "# EOF") == NULL);
+
+  check(request(loop, port, "GET / HTTP/1.0\r\n\r\n", answer, sizeof(answer)) == 0);
+  check(!strncmp(answer, "HTTP/1.0 404 ", 13));
+  check(request(loop, port, "POST /metrics HTTP/1.0\r\n\r\n", answer, sizeof(answer)) == 0);
+  check(!strncmp(answer, "HTTP/1.0 405 ", 13));
+
+  metrics_server_free(server);
+  metrics_free(registry);
+  event_loop_free(loop);
+  return 0;
+}
+
+static int connectTo(uint16_t port) {
+  struct sockaddr_in addr;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+int testIdleClients(void) {
+  event_loop *loop = event_loop_new();
+  metrics *registry = metrics_new();
+  metrics_server *server = NULL;
+  char answer[4096];
+  int fds[8];
+  uint16_t port;
+  int i, rounds, closed = 0;
+
+  check(loop != NULL && registry != NULL);
+  server = metrics_server_new(loop, 0, registry);
+  check(server != NULL);
+  metrics_server_set_timeout(server, 500);
+  port = metrics_server_port(server);
+
+  /* as many clients as the server takes, which never complete their requests */
+  for(i = 0; i < 8; ++i) {
+    fds[i] = connectTo(port);
+    check(fds[i] >= 0);
+  }
+  send(fds[0], "GET /metrics HTTP/1.0\r\n", 24, 0);
+  for(rounds = 0; rounds < 5; ++rounds) {
+    event_loop_run(loop, 10);
+  }
+  check(recv(fds[0], answer, sizeof(answer), MSG_DONTWAIT) < 0);
+
+  /* they are closed once their time is up, which lets the scraper in again */
+  for(rounds = 0; rounds < 300 && closed < 8; ++rounds) {
+    event_loop_run(loop, 10);
+    for(closed = 0, i = 0; i < 8; ++i) {
+      if(recv(fds[i], answer, sizeof(answer), MSG_DONTWAIT | MSG_PEEK) == 0) {
+        ++closed;
+      }
+    }
+  }
+  check(closed == 8);
+  for(i = 0; i < 8; ++i) {
+    close(fds[i]);
+  }
+  check(request(loop, port, "GET /metrics HTTP/1.0\r\n\r\n", answer, sizeof(answer)) == 0);
+  check(!strncmp(answer, "HTTP/1.0 200 OK\r\n", 17));
+
+  metrics_server_free(server);
+  metrics_free(registry);
+  event_loop_free(loop);
+  return 0;
+}
+
+int main(void) {
+  int i;
+  i = testRegistry();
+
+  if(!i) {
+    i = testServer();
+  }
+
+  if(!i) {
+    i = testIdleClients();
+  }
+
+  return i;
+}
@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "partfile.h"
+#include "utils.h"
+#include "output.h"
+
+#ifdef MEMWATCH
+  #include "memwatch.h"
+#endif
+
+int8_t verbose = P_NONE;
+
+#define PART_FILE "partfile_test.mov.part"
+#define INFO_FILE "partfile_test.mov.part.info"
+#define URL       "http://www.example.com/trailer_h1080p.mov"
+
+static int test = 0;
+
+#define check( A ) \
+  { \
+      ++test; \
+      if( !( A ) ){ \
+          fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+          return test; \
+      } \
+  }
+
+int testPartFileName(void) {
+  char *name = part_file_name("/tmp/trailer.mov");
+
+  check(name != NULL && !strcmp(name, "/tmp/trailer.mov.part"));
+  am_free(name);
+  return 0;
+}
+
+int testSaveLoad(void) {
+  part_info info, loaded;
+  FILE *fp = NULL;
+
+  unlink(INFO_FILE);
+  check(part_info_load(PART_FILE, &loaded) == -1);
+  check(loaded.url == NULL && loaded.offset == 0);
+
+  memset(&info, 0, sizeof(info));
+  info.url = URL;
+  info.etag = "\"abc-123\"";
+  info.last_modified = "Wed, 21 Oct 2026 07:28:00 GMT";
+  info.offset = 5000000000ULL;
+  check(part_info_save(PART_FILE, &info) == 0);
+  check(access(INFO_FILE, F_OK) == 0);
+
+  check(part_info_load(PART_FILE, &loaded) == 0);
+  check(loaded.url != NULL && !strcmp(loaded.url, URL));
+  check(loaded.etag != NULL && !strcmp(loaded.etag, info.etag));
+  check(loaded.last_modified != NULL && !strcmp(loaded.last_modified, info.last_modified));
+  check(loaded.offset == 5000000000ULL);
+  part_info_free(&loaded);
+  check(loaded.url == NULL && loaded.etag == NULL);
+
+  /* the validators are optional, the URL is not */
+  info.etag = NULL;
+  info.last_modified = NULL;
+  info.offset = 0;
+  check(part_info_save(PART_FILE, &info) == 0);
+  check(part_info_load(PART_FILE, &loaded) == 0);
+  check(loaded.etag == NULL && loaded.last_modified == NULL && loaded.offset == 0);
+  part_info_free(&loaded);
+
+  fp = fopen(INFO_FILE, "wb");
+  check(fp != NULL);
+  fputs("garbage\netag = \"abc\"\r\n", fp);
+  fclose(fp);
+  check(part_info_load(PART_FILE, &loaded) == -1);
+  part_info_free(&loaded);
+
+  part_info_remove(PART_FILE);
+  check(access(INFO_FILE, F_OK) != 0);
+  check(part_info_load(PART_FILE, &loaded) == -1);
+  /* removing it twice does no harm */
+  part_info_remove(PART_FILE);
+  return 0;
+}
+
+int testSegments(void) {
+  part_segment segments[3] = { { 0, 400, 400 }, { 400, 400, 17 }, { 800, 403, 0 } };
+  part_info info, loaded;
+  FILE *fp = NULL;
+
+  memset(&info, 0, sizeof(info));
+  info.url = URL;
+  info.etag = "\"abc\"";
+  info.offset = 417;
+  info.segments = segments;
+  info.segment_count = 3;
+  check(part_info_save(PART_FILE, &info) == 0);
+  check(part_info_load(PART_FILE, &loaded) == 0);
+  check(loaded.offset == 417 && loaded.segment_count == 3 && loaded.segments != NULL);
+  check(loaded.segments[1].offset == 400 && loaded.segments[1].length == 400 && loaded.segments[1].written == 17);
+  check(loaded.segments[2].offset == 800 && loaded.segments[2].length == 403 && loaded.segments[2].written == 0);
+  part_info_free(&loaded);
+  check(loaded.segments == NULL && loaded.segment_count == 0);
+
+  /* malformed segments are ignored */
+  fp = fopen(INFO_FILE, "wb");
+  check(fp != NULL);
+  fputs("url = " URL "\nsegment = 0 100\nsegment = 0 100 101\nsegment = 100 50 50\n", fp);
+  fclose(fp);
+  check(part_info_load(PART_FILE, &loaded) == 0);
+  check(loaded.segment_count == 1 && loaded.segments[0].offset == 100 && loaded.segments[0].written == 50);
+  part_info_free(&loaded);
+
+  part_info_remove(PART_FILE);
+  return 0;
+}
+
+int testValidator(void) {
+  part_info info;
+
+  memset(&info, 0, sizeof(info));
+  info.url = URL;
+  info.etag = "\"abc\"";
+  info.last_modified = "Wed, 21 Oct 2026 07:28:00 GMT";
+  check(part_info_validator(&info, URL) == info.etag);
+
+  /* the partial file of another URL is of no use */
+  check(part_info_validator(&info, "http://www.example.com/trailer_h720p.mov") == NULL);
+  check(part_info_validator(&info, NULL) == NULL);
+  check(part_info_validator(NULL, URL) == NULL);
+
+  /* weak ETags can't be used with If-Range */
+  info.etag = "W/\"abc\"";
+  check(part_info_validator(&info, URL) == info.last_modified);
+  info.last_modified = NULL;
+  check(part_info_validator(&info, URL) == NULL);
+  info.etag = "";
+  check(part_info_validator(&info, URL) == NULL);
+
+  /* the validators survive a round trip through the file */
+  info.etag = "\"def\"";
+  check(part_info_save(PART_FILE, &info) == 0);
+  check(part_info_load(PART_FILE, &info) == 0);
+  check(part_info_validator(&info, URL) != NULL && !strcmp(part_info_validator(&info, URL), "\"def\""));
+  check(part_info_validator(&info, "http://www.example.com/other.mov") == NULL);
+  part_info_free(&info);
+
+  part_info_remove(PART_FILE);
+  return 0;
+}
+
+int main(void) {
+  int i;
+  i = testPartFileName();
+
+  if(!i) {
+    i = testSaveLoad();
+  }
+
+  if(!i) {
+    i = testSegments();
+  }
+
+  if(!i) {
+    i = testValidator();
+  }
+
+  return i;
+}
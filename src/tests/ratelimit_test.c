@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "list.h"
+#include "ratelimit.h"
+#include "utils.h"
+#include "output.h"
+
+#ifdef MEMWATCH
+  #include "memwatch.h"
+#endif
+
+int8_t verbose = P_NONE;
+
+static int test = 0;
+
+#define check( A ) \
+  { \
+      ++test; \
+      if( !( A ) ){ \
+          fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+          return test; \
+      } \
+  }
+
+static void keepItem(void *item) {
+  (void)item;
+}
+
+int testTokenBucket(void) {
+  token_bucket b;
+  uint64_t now = 1000000;
+  uint64_t received = 0;
+  uint32_t i;
+
+  /* unlimited */
+  token_bucket_init(&b, 0, now);
+  token_bucket_consume(&b, 100000000);
+  check(token_bucket_delay(&b) == 0);
+
+  /* 100kB/s: the bucket starts with a quarter of a second worth of data */
+  token_bucket_init(&b, 102400, now);
+  check(b.tokens == 25600);
+  token_bucket_consume(&b, 25600);
+  check(token_bucket_delay(&b) > 0);
+  token_bucket_consume(&b, 10240);
+  check(token_bucket_delay(&b) >= 100);
+  token_bucket_refill(&b, now + 101);
+  check(token_bucket_delay(&b) == 0);
+
+  /* the bucket doesn't save up more than its burst size */
+  token_bucket_refill(&b, now + 60000);
+  check(b.tokens == 25600);
+
+  /* a receiver that takes whatever the bucket permits, in steps of 10ms, gets the configured rate */
+  now += 60000;
+  for(i = 0; i < 1000; ++i) {
+    now += 10;
+    token_bucket_refill(&b, now);
+    if(token_bucket_delay(&b) == 0) {
+      token_bucket_consume(&b, 16384);
+      received += 16384;
+    }
+  }
+  check(received >= 10 * 102400 - 16384 && received <= 10 * 102400 + 25600 + 16384);
+
+  /* the clock going backwards doesn't add tokens */
+  token_bucket_consume(&b, 1000000);
+  token_bucket_refill(&b, now - 5000);
+  check(token_bucket_delay(&b) == 1000);
+
+  /* lifting the limit forgives the debt */
+  token_bucket_set_rate(&b, 0);
+  check(token_bucket_delay(&b) == 0);
+  return 0;
+}
+
+int testRateSchedule(void) {
+  simple_list windows = NULL;
+  rate_window night = { 60, 7 * 60, 0 };
+  rate_window late = { 22 * 60, 30, 512 };
+  uint16_t minute = 0;
+
+  check(parseTimeOfDay("01:00", &minute) == 0 && minute == 60);
+  check(parseTimeOfDay(" 7:05 ", &minute) == 0 && minute == 425);
+  check(parseTimeOfDay("24:00", &minute) == 0 && minute == 1440);
+  check(parseTimeOfDay("24:01", &minute) == -1);
+  check(parseTimeOfDay("12:60", &minute) == -1);
+  check(parseTimeOfDay("12", &minute) == -1);
+  check(parseTimeOfDay("12:3", &minute) == -1);
+  check(parseTimeOfDay("123:00", &minute) == -1);
+
+  check(rate_schedule_lookup(NULL, 2048, 0) == 2048);
+
+  addToTail(&night, &windows);
+  addToTail(&late, &windows);
+  check(rate_schedule_lookup(windows, 2048, 59) == 2048);
+  check(rate_schedule_lookup(windows, 2048, 60) == 0);
+  check(rate_schedule_lookup(windows, 2048, 7 * 60 - 1) == 0);
+  check(rate_schedule_lookup(windows, 2048, 7 * 60) == 2048);
+  /* windows across midnight */
+  check(rate_schedule_lookup(windows, 2048, 23 * 60) == 512);
+  check(rate_schedule_lookup(windows, 2048, 10) == 512);
+  check(rate_schedule_lookup(windows, 2048, 30) == 2048);
+
+  /* a window that ends where it starts covers the whole day */
+  late.start = late.end = 0;
+  check(rate_schedule_lookup(windows, 2048, 12 * 60) == 512);
+  check(rate_schedule_lookup(windows, 2048, 120) == 0);
+
+  freeList(&windows, keepItem);
+  return 0;
+}
+
+int main(void) {
+  int i;
+  i = testTokenBucket();
+
+  if(!i) {
+    i = testRateSchedule();
+  }
+
+  return i;
+}
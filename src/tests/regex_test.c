@@ -3,6 +3,9 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "ahocorasick.h"
+#include "filters.h"
+#include "list.h"
 #include "regex.h"
 #include "utils.h"
 #include "output.h"
@@ -110,6 +113,410 @@ int testGetMatch(void) {
   return 0;
 }
 
+int testCompiledRegEx(void) {
+  am_regex *re = NULL;
+  const char *str1 = "def xyz (abc - ghi - rst)";
+  const char *str2 = "DEF xyz";
+
+  check(compileRegEx(NULL) == NULL);
+  check(compileRegEx("(a|b") == NULL);
+  check(matchRegEx(NULL, str1, strlen(str1)) == 0);
+
+  re = compileRegEx("def.*abc");
+  check(re != NULL);
+  check(matchRegEx(re, NULL, 0) == 0);
+  check(matchRegEx(re, str1, strlen(str1)) == 1);
+  check(matchRegEx(re, str2, strlen(str2)) == 0);
+  /* only the first len bytes are considered */
+  check(matchRegEx(re, str1, 5) == 0);
+  freeRegEx(re);
+
+  re = compileRegEx("^def");
+  check(re != NULL);
+  check(matchRegEx(re, str2, strlen(str2)) == 1);
+  freeRegEx(re);
+
+  re = compileRegEx("(?!.*abc)def.*");
+  check(re != NULL);
+  check(matchRegEx(re, "def abc", 7) == 0);
+  check(matchRegEx(re, "def ghi", 7) == 1);
+  freeRegEx(re);
+
+  freeRegEx(NULL);
+  return 0;
+}
+
+int testRegExSet(void) {
+  am_regex *re = NULL;
+  const char *patterns[] = { "apple.*tlr.*h1080p", "^http://a\\.com/", "(abc)+x # comment", "(a)\\1" };
+  const char *url1 = "http://b.com/apple_tlr1_h1080p.mov";
+  const char *url2 = "http://a.com/apple_tlr1_h1080p.mov";
+
+  check(compileRegExSet(NULL, 0) == NULL);
+  check(matchRegExSet(NULL, url1, strlen(url1)) == -1);
+
+  re = compileRegExSet(patterns, 2);
+  check(re != NULL);
+  check(matchRegExSet(re, url1, strlen(url1)) == 0);
+  check(matchRegExSet(re, "http://a.com/x", 14) == 1);
+  /* the leftmost match wins */
+  check(matchRegExSet(re, url2, strlen(url2)) == 1);
+  check(matchRegExSet(re, "http://c.com/", 13) == -1);
+  freeRegEx(re);
+
+  /* the patterns are compiled with the same options as a single one (caseless) */
+  re = compileRegExSet(patterns, 1);
+  check(re != NULL);
+  check(matchRegExSet(re, "APPLE_TLR_H1080P", 16) == 0);
+  freeRegEx(re);
+
+  /* comments and back references can't be combined */
+  check(compileRegExSet(patterns + 1, 2) == NULL);
+  check(compileRegExSet(patterns + 3, 1) == NULL);
+  return 0;
+}
+
+int testFilterMatcher(void) {
+  am_filters filters = NULL;
+  filter_matcher *m = NULL;
+  am_filter f1, f2, f3;
+  const char *url1 = "http://a.com/apple_tlr1_h1080p.mov";
+  const char *url2 = "http://b.com/other_h720p.mov";
+
+  /* filter_add() puts new filters in front: f1 comes first */
+  f3 = filter_new();
+  f3->pattern = am_strdup("h720p");
+  f3->regex = compileRegEx(f3->pattern);
+  filter_add(f3, &filters);
+  f2 = filter_new();
+  f2->pattern = am_strdup("^http://a\\.com/");
+  f2->regex = compileRegEx(f2->pattern);
+  filter_add(f2, &filters);
+  f1 = filter_new();
+  f1->pattern = am_strdup("apple.*h1080p");
+  f1->regex = compileRegEx(f1->pattern);
+  filter_add(f1, &filters);
+
+  m = filter_matcher_new(filters);
+  check(m != NULL);
+  /* f2 matches further to the left, but f1 is first in the list */
+  check(filter_matcher_match(m, url1, strlen(url1)) == f1);
+  check(filter_matcher_match(m, url2, strlen(url2)) == f3);
+  check(filter_matcher_match(m, "http://c.com/", 13) == NULL);
+  filter_matcher_free(m);
+
+  /* a filter that can't be combined makes the matcher try them one after another */
+  am_free(f2->pattern);
+  freeRegEx(f2->regex);
+  f2->pattern = am_strdup("(a)\\1");
+  f2->regex = compileRegEx(f2->pattern);
+  m = filter_matcher_new(filters);
+  check(m != NULL);
+  check(filter_matcher_match(m, "xaax", 4) == f2);
+  check(filter_matcher_match(m, url1, strlen(url1)) == f1);
+  check(filter_matcher_match(m, url2, strlen(url2)) == f3);
+  filter_matcher_free(m);
+
+  freeList(&filters, filter_free);
+  return 0;
+}
+
+static int literalIs(const char *pattern, const char *expected) {
+  char *literal = getRegExLiteral(pattern);
+  int result;
+
+  if(!literal || !expected) {
+    result = (literal == NULL && expected == NULL);
+  } else {
+    result = (strcmp(literal, expected) == 0);
+  }
+  am_free(literal);
+  return result;
+}
+
+int testRegExLiteral(void) {
+  check(literalIs("apple.*tlr.*h1080p", "h1080p"));
+  check(literalIs("^http://a\\.com/", "http://a.com/"));
+  check(literalIs("Trailer", "trailer"));
+  check(literalIs("h1080p\\.mov$", "h1080p.mov"));
+  /* optional and repeated characters */
+  check(literalIs("abc?d", "ab"));
+  check(literalIs("abb+cd", "abb"));
+  check(literalIs("xy{0,2}z", "x"));
+  check(literalIs("xyy{2}", "xyy"));
+  /* groups and classes are skipped */
+  check(literalIs("(foo|bar)bazz", "bazz"));
+  check(literalIs("[abc]def\\d+", "def"));
+  check(literalIs("(?i)Apple", "apple"));
+  check(literalIs("[[:digit:]abcd]", NULL));
+  check(literalIs("[[:space:]abc]def", "def"));
+  check(literalIs("[]a]bcd", "bcd"));
+  check(literalIs("[^]a]bcd", "bcd"));
+  check(literalIs("[[=e=][.-.]x]yz", "yz"));
+  check(literalIs("([[:alpha:])]+)trailer", "trailer"));
+  /* whitespace and comments are ignored */
+  check(literalIs("trailer \\. mov", "trailer.mov"));
+  check(literalIs("tlr *x", "tl"));
+  check(literalIs("abc # comment xyzxyz", "abc"));
+  /* no common literal, or too complicated */
+  check(literalIs("apple|trailer", NULL));
+  check(literalIs("(?-x)apple tlr", NULL));
+  check(literalIs("\\Qa.b\\E", NULL));
+  check(literalIs("apple\\x41bcdefg", "apple"));
+  check(literalIs(".*", NULL));
+  return 0;
+}
+
+static void countLiteral(uint32_t id, void *userdata) {
+  uint32_t *found = (uint32_t*)userdata;
+
+  ++found[id];
+}
+
+int testAhoCorasick(void) {
+  ac_automaton *ac = NULL;
+  uint32_t found[4];
+
+  ac = ac_new();
+  check(ac != NULL);
+  check(ac_add(ac, "he", 0) == 0);
+  check(ac_add(ac, "she", 1) == 0);
+  check(ac_add(ac, "His", 2) == 0);
+  check(ac_add(ac, "hers", 3) == 0);
+  check(ac_add(ac, "", 4) == -1);
+  check(ac_compile(ac) == 0);
+  check(ac_add(ac, "late", 4) == -1);
+
+  memset(found, 0, sizeof(found));
+  ac_scan(ac, "ushers", 6, countLiteral, found);
+  check(found[0] == 1 && found[1] == 1 && found[2] == 0 && found[3] == 1);
+
+  memset(found, 0, sizeof(found));
+  ac_scan(ac, "HIS HEHE", 8, countLiteral, found);
+  check(found[0] == 2 && found[1] == 0 && found[2] == 1 && found[3] == 0);
+
+  memset(found, 0, sizeof(found));
+  ac_scan(ac, "xyz", 3, countLiteral, found);
+  check(found[0] == 0 && found[1] == 0 && found[2] == 0 && found[3] == 0);
+
+  ac_free(ac);
+  return 0;
+}
+
+int testLiteralPrefilter(void) {
+  am_filters filters = NULL;
+  filter_matcher *m = NULL;
+  const filter_matcher_stats *stats = NULL;
+  am_filter f1, f2;
+  const char *url = NULL;
+
+  f2 = filter_new();
+  f2->pattern = am_strdup("disney.*h720p");
+  f2->regex = compileRegEx(f2->pattern);
+  filter_add(f2, &filters);
+  f1 = filter_new();
+  f1->pattern = am_strdup("apple.*h1080p");
+  f1->regex = compileRegEx(f1->pattern);
+  filter_add(f1, &filters);
+
+  m = filter_matcher_new(filters);
+  check(m != NULL);
+  stats = filter_matcher_get_stats(m);
+  check(stats != NULL && stats->urls == 0);
+
+  /* neither literal occurs: no regular expression is evaluated */
+  url = "http://c.com/movie_h480p.mov";
+  check(filter_matcher_match(m, url, strlen(url)) == NULL);
+  check(stats->urls == 1 && stats->prefilter_rejects == 1 && stats->regex_runs == 0);
+
+  /* only the filter whose literal was found is evaluated */
+  url = "http://A.COM/APPLE_TLR_H1080P.mov";
+  check(filter_matcher_match(m, url, strlen(url)) == f1);
+  check(stats->prefilter_rejects == 1 && stats->regex_runs == 1);
+
+  url = "http://a.com/h1080p_apple.mov";
+  check(filter_matcher_match(m, url, strlen(url)) == NULL);
+  check(stats->prefilter_rejects == 1 && stats->regex_runs == 2);
+
+  url = "http://d.com/disney_h720p.mov";
+  check(filter_matcher_match(m, url, strlen(url)) == f2);
+
+  /* non-ASCII strings bypass the prefilter */
+  url = "http://c.com/f\xc3\xbcnf.mov";
+  check(filter_matcher_match(m, url, strlen(url)) == NULL);
+  check(stats->urls == 5 && stats->prefilter_rejects == 1);
+
+  filter_matcher_free(m);
+  freeList(&filters, filter_free);
+  return 0;
+}
+
+/* the prefilter must never reject a string that the regular expression matches */
+int testPrefilterAgreesWithRegEx(void) {
+  const char *patterns[] = {
+    "[[:digit:]abcd]", "[[:space:]abc]def", "[[:alpha:]]+_h1080p", "[^[:space:]]+\\.mov$",
+    "[]x]tlr", "[^]x]tlr", "[[:punct:]b]pple", "(apple|[[:upper:]])_tlr", "apple.*h(720|1080)p",
+    "[\\]]trailer", "abc?def", NULL
+  };
+  const char *urls[] = {
+    "http://a.com/7.mov", "http://a.com/abcd.mov", "http://a.com/ def.mov", "http://a.com/xdef.mov",
+    "http://a.com/trailer_h1080p.mov", "http://a.com/x]tlr", "http://a.com/ytlr", "http://a.com/bpple",
+    "http://a.com/X_tlr", "http://a.com/apple_h720p.mov", "http://a.com/]trailer", "http://a.com/abdef",
+    "http://a.com/", NULL
+  };
+  am_filters filters = NULL;
+  filter_matcher *m = NULL;
+  am_filter f = NULL;
+  uint8_t expected;
+  int i, j;
+
+  for(i = 0; patterns[i]; ++i) {
+    f = filter_new();
+    f->pattern = am_strdup(patterns[i]);
+    f->regex = compileRegEx(f->pattern);
+    check(f->regex != NULL);
+    filter_add(f, &filters);
+    m = filter_matcher_new(filters);
+    check(m != NULL);
+    for(j = 0; urls[j]; ++j) {
+      expected = isRegExMatch(patterns[i], urls[j]) ? 1 : 0;
+      if((filter_matcher_match(m, urls[j], strlen(urls[j])) == f) != expected) {
+        fprintf(stderr, "prefilter disagrees with PCRE: '%s' on '%s'\n", patterns[i], urls[j]);
+        check(0);
+      }
+    }
+    filter_matcher_free(m);
+    freeList(&filters, filter_free);
+  }
+  return 0;
+}
+
+int testTrivialRegEx(void) {
+  const char *trivial[] = {
+    "trailer", "h1080p", "^http://", "^http://a\\.com/", "\\.mov$", "h1080p\\.mov$", "^http://a\\.com/apple_tlr1_h1080p\\.mov$",
+    "apple.*tlr.*h1080p", "apple .* h1080p", "^.*apple", "apple.*$", ".*Tlr.*", "^http.*apple.*\\.mov$",
+    "tlr.*tlr", "p.*p.*p", "^h.*p$", "mov$", "^a", "a\\-b", "KELVIN", "long_s"
+  };
+  const char *regex[] = {
+    "apple|disney", "h(720|1080)p", "tlr\\d", "tlr[0-9]", "ab+c", "h1080p?", "^$", ".*", "apple.+mov", "a.*?b",
+    "\\Qa.b\\E", "a # comment", "a{2}", "(?i)apple", "tl r*", "a\\x41"
+  };
+  const char *subjects[] = {
+    "http://a.com/apple_tlr1_h1080p.mov",
+    "HTTP://A.COM/APPLE_TLR1_H1080P.MOV",
+    "http://b.com/apple_tlr1_h720p.mov?x=1",
+    "http://a.com/h1080p_apple.mov",
+    "http://a.com/trailer.mov\n",
+    "apple\ntlr h1080p",
+    "http://a.com/tlrtlr_ppp.mov",
+    "http://a.com/a-b_aab_aaa.mov",
+    "\xe2\x84\xaa" "elvin_lon\xc5\xbf" "_s",
+    "movmov",
+    "x",
+    "a"
+  };
+  am_regex *re = NULL;
+  uint32_t i, j;
+
+  for(i = 0; i < sizeof(trivial) / sizeof(trivial[0]); ++i) {
+    re = compileRegEx(trivial[i]);
+    check(re != NULL);
+    check(isTrivialRegEx(re));
+    for(j = 0; j < sizeof(subjects) / sizeof(subjects[0]); ++j) {
+      check(matchRegEx(re, subjects[j], strlen(subjects[j])) == isRegExMatch(trivial[i], subjects[j]));
+    }
+    freeRegEx(re);
+  }
+
+  for(i = 0; i < sizeof(regex) / sizeof(regex[0]); ++i) {
+    re = compileRegEx(regex[i]);
+    check(re != NULL);
+    check(!isTrivialRegEx(re));
+    freeRegEx(re);
+  }
+
+  /* spot checks against the expected result, in case PCRE and the fast path agree on the wrong one */
+  re = compileRegEx("^http.*apple.*\\.mov$");
+  check(matchRegEx(re, subjects[0], strlen(subjects[0])) == 1);
+  check(matchRegEx(re, subjects[1], strlen(subjects[1])) == 1);
+  check(matchRegEx(re, subjects[2], strlen(subjects[2])) == 0);
+  freeRegEx(re);
+  re = compileRegEx("p.*p.*p");
+  check(matchRegEx(re, "pp", 2) == 0);
+  check(matchRegEx(re, "ppp", 3) == 1);
+  freeRegEx(re);
+  re = compileRegEx("^mov$");
+  check(matchRegEx(re, "movmov", 6) == 0);
+  check(matchRegEx(re, "MOV", 3) == 1);
+  freeRegEx(re);
+  return 0;
+}
+
+int testMatchCache(void) {
+  am_filters filters = NULL;
+  filter_matcher *m = NULL;
+  match_cache *cache = NULL;
+  const filter_matcher_stats *stats = NULL;
+  am_filter f1, f2;
+  const char *url1 = "http://a.com/apple_tlr1_h1080p.mov";
+  const char *url2 = "http://b.com/other_h720p.mov";
+  uint64_t runs;
+
+  f2 = filter_new();
+  f2->pattern = am_strdup("h720p");
+  f2->regex = compileRegEx(f2->pattern);
+  filter_add(f2, &filters);
+  f1 = filter_new();
+  f1->pattern = am_strdup("apple.*h1080p");
+  f1->regex = compileRegEx(f1->pattern);
+  filter_add(f1, &filters);
+
+  /* a cache with room for a single result */
+  cache = match_cache_new(1);
+  check(cache != NULL);
+  m = filter_matcher_new(filters);
+  check(m != NULL);
+  filter_matcher_set_cache(m, cache);
+  stats = filter_matcher_get_stats(m);
+
+  check(filter_matcher_match(m, url1, strlen(url1)) == f1);
+  runs = stats->regex_runs;
+  check(stats->cache_hits == 0);
+  check(filter_matcher_match(m, url1, strlen(url1)) == f1);
+  check(stats->cache_hits == 1 && stats->regex_runs == runs);
+
+  /* the second URL takes the only slot */
+  check(filter_matcher_match(m, url2, strlen(url2)) == f2);
+  check(filter_matcher_match(m, url1, strlen(url1)) == f1);
+  check(stats->cache_hits == 1);
+
+  /* results that didn't match are cached, too */
+  check(filter_matcher_match(m, "http://c.com/", 13) == NULL);
+  check(filter_matcher_match(m, "http://c.com/", 13) == NULL);
+  check(stats->cache_hits == 2);
+  check(filter_matcher_match(m, url1, strlen(url1)) == f1);
+  filter_matcher_free(m);
+
+  /* a new filter set doesn't see the results of the old one */
+  am_free(f1->pattern);
+  freeRegEx(f1->regex);
+  f1->pattern = am_strdup("disney");
+  f1->regex = compileRegEx(f1->pattern);
+  m = filter_matcher_new(filters);
+  check(m != NULL);
+  filter_matcher_set_cache(m, cache);
+  stats = filter_matcher_get_stats(m);
+  check(filter_matcher_match(m, url1, strlen(url1)) == NULL);
+  check(stats->cache_hits == 0);
+  check(filter_matcher_match(m, url1, strlen(url1)) == NULL);
+  check(stats->cache_hits == 1);
+
+  filter_matcher_free(m);
+  match_cache_free(cache);
+  freeList(&filters, filter_free);
+  return 0;
+}
+
 int main(void) {
   int i;
   i = testIsRegexMatch();
@@ -117,6 +524,42 @@ int main(void) {
   if(!i) {
     i = testGetMatch();
   }
+
+  if(!i) {
+    i = testCompiledRegEx();
+  }
+
+  if(!i) {
+    i = testTrivialRegEx();
+  }
+
+  if(!i) {
+    i = testRegExSet();
+  }
+
+  if(!i) {
+    i = testFilterMatcher();
+  }
+
+  if(!i) {
+    i = testRegExLiteral();
+  }
+
+  if(!i) {
+    i = testAhoCorasick();
+  }
+
+  if(!i) {
+    i = testLiteralPrefilter();
+  }
+
+  if(!i) {
+    i = testPrefilterAgreesWithRegEx();
+  }
+
+  if(!i) {
+    i = testMatchCache();
+  }
   
   return i;
 }
@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "rss_feed.h"
+#include "scheduler.h"
+#include "utils.h"
+#include "output.h"
+
+#ifdef MEMWATCH
+  #include "memwatch.h"
+#endif
+
+int8_t verbose = P_NONE;
+
+static int test = 0;
+
+#define check( A ) \
+  { \
+      ++test; \
+      if( !( A ) ){ \
+          fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+          return test; \
+      } \
+  }
+
+/* Monday, 2024-01-01 00:00:00 GMT */
+#define MONDAY 1704067200
+
+int testSchedule(void) {
+  schedule *s = schedule_new();
+  int items[100];
+  int *item = NULL;
+  time_t last = 0;
+  uint32_t i;
+
+  check(s != NULL);
+  check(schedule_count(s) == 0);
+  check(schedule_next_due(s) == 0);
+  check(schedule_pop_due(s, MONDAY) == NULL);
+
+  for(i = 0; i < 100; ++i) {
+    items[i] = i;
+    check(schedule_add(s, &items[i], MONDAY + (i * 37) % 100) == 0);
+  }
+  check(schedule_count(s) == 100);
+  check(schedule_next_due(s) == MONDAY);
+
+  /* only the items that are due come out, earliest first */
+  check(schedule_pop_due(s, MONDAY - 1) == NULL);
+  for(i = 0; i < 50; ++i) {
+    item = schedule_pop_due(s, MONDAY + 49);
+    check(item != NULL);
+    check(MONDAY + (*item * 37) % 100 >= last);
+    last = MONDAY + (*item * 37) % 100;
+  }
+  check(schedule_pop_due(s, MONDAY + 49) == NULL);
+  check(schedule_next_due(s) == MONDAY + 50);
+  check(schedule_count(s) == 50);
+  schedule_free(s);
+
+  /* items that are due at the same time come out in the order they were added */
+  s = schedule_new();
+  for(i = 0; i < 10; ++i) {
+    schedule_add(s, &items[i], MONDAY);
+  }
+  for(i = 0; i < 10; ++i) {
+    check(schedule_pop_due(s, MONDAY) == &items[i]);
+  }
+  schedule_free(s);
+
+  /* items can be taken out anywhere, and the rest still comes out in order */
+  s = schedule_new();
+  for(i = 0; i < 100; ++i) {
+    schedule_add(s, &items[i], MONDAY + (i * 37) % 100);
+  }
+  check(schedule_due(s, &items[3]) == MONDAY + 11);
+  for(i = 0; i < 100; i += 3) {
+    check(schedule_remove(s, &items[i]) == 0);
+  }
+  check(schedule_remove(s, &items[0]) == -1);
+  check(schedule_due(s, &items[3]) == 0);
+  check(schedule_count(s) == 66);
+  last = 0;
+  while((item = schedule_pop_due(s, MONDAY + 100)) != NULL) {
+    check(*item % 3 != 0);
+    check(MONDAY + (*item * 37) % 100 >= last);
+    last = MONDAY + (*item * 37) % 100;
+  }
+  check(schedule_count(s) == 0);
+  schedule_free(s);
+  return 0;
+}
+
+/* the next check of a feed that hasn't been scheduled before */
+static time_t firstCheck(rss_feed *feed, uint32_t interval, time_t now, uint32_t random) {
+  feed->slot = 0;
+  return feed_next_check(feed, interval, now, random);
+}
+
+int testNextCheck(void) {
+  rss_feed *feed = feed_new();
+  time_t due;
+
+  check(feed != NULL);
+
+  /* the global interval, with a delay of up to a tenth of it */
+  check(firstCheck(feed, 1800, MONDAY, 0) == MONDAY + 1800);
+  check(firstCheck(feed, 1800, MONDAY, 180) == MONDAY + 1980);
+  check(firstCheck(feed, 1800, MONDAY, 181) == MONDAY + 1800);
+  /* ... but never more than 5 minutes */
+  check(firstCheck(feed, 7200, MONDAY, 300) == MONDAY + 7500);
+  check(firstCheck(feed, 7200, MONDAY, 301) == MONDAY + 7200);
+
+  /* ttl and Cache-Control can only make the interval longer */
+  feed->ttl = 10;
+  check(firstCheck(feed, 1800, MONDAY, 0) == MONDAY + 1800);
+  feed->ttl = 60;
+  check(firstCheck(feed, 1800, MONDAY, 0) == MONDAY + 3600);
+  feed->max_age = 5400;
+  check(firstCheck(feed, 1800, MONDAY, 0) == MONDAY + 5400);
+  feed->max_age = 0;
+  check(firstCheck(feed, 1800, MONDAY, 0) == MONDAY + 3600);
+  feed->ttl = 100000;
+  check(firstCheck(feed, 1800, MONDAY, 0) == MONDAY + 86400);
+  feed->ttl = 0;
+  feed->max_age = -1;
+
+  /* the interval of the feed overrides everything else */
+  feed->interval = 90;
+  feed->ttl = 60;
+  check(firstCheck(feed, 1800, MONDAY, 9) == MONDAY + 99);
+  feed->ttl = 0;
+
+  /* skipHours: 1:00 to 5:59 GMT */
+  feed->skip_hours = (1u << 1) | (1u << 2) | (1u << 3) | (1u << 4) | (1u << 5);
+  check(firstCheck(feed, 1800, MONDAY, 0) == MONDAY + 90);
+  check(firstCheck(feed, 1800, MONDAY + 3600 - 30, 0) == MONDAY + 6 * 3600);
+
+  /* skipDays: Monday and Tuesday */
+  feed->skip_hours = 0;
+  feed->skip_days = (1u << 1) | (1u << 2);
+  due = firstCheck(feed, 1800, MONDAY, 0);
+  check(due == MONDAY + 2 * 86400);
+
+  /* a feed that skips everything is checked anyway */
+  feed->skip_days = 0x7f;
+  due = firstCheck(feed, 1800, MONDAY, 0);
+  check(due > MONDAY && due <= MONDAY + 8 * 86400);
+
+  /* the checks keep their cadence, regardless of how long each one takes */
+  feed->skip_days = 0;
+  feed->interval = 0;
+  feed->slot = 0;
+  check(feed_next_check(feed, 600, MONDAY, 0) == MONDAY + 600);
+  check(feed_next_check(feed, 600, MONDAY + 600 + 45, 0) == MONDAY + 1200);
+  check(feed_next_check(feed, 600, MONDAY + 1200 + 599, 7) == MONDAY + 1807);
+  check(feed->slot == MONDAY + 1800);
+  /* ... unless a check took longer than the interval */
+  check(feed_next_check(feed, 600, MONDAY + 3000, 0) == MONDAY + 3600);
+
+  feed_free(feed);
+  return 0;
+}
+
+int testAdaptInterval(void) {
+  rss_feed *feed = feed_new();
+  time_t now = MONDAY;
+  uint32_t checks = 0;
+  uint32_t i;
+
+  check(feed != NULL);
+
+  /* a quiet feed backs off exponentially, up to the longest interval */
+  check(feed_adapt_interval(feed, 0, now, 300, 43200) == 1);
+  check(feed->poll_interval == 600);
+  feed_adapt_interval(feed, 0, now, 300, 43200);
+  check(feed->poll_interval == 1200);
+  for(i = 0; i < 10; ++i) {
+    feed_adapt_interval(feed, 0, now, 300, 43200);
+  }
+  check(feed->poll_interval == 43200);
+  check(feed_adapt_interval(feed, 0, now, 300, 43200) == 0);
+
+  /* new items tighten the interval again */
+  check(feed_adapt_interval(feed, 3, now, 300, 43200) == 1);
+  check(feed->poll_interval == 21600);
+  check(feed->last_new == now);
+  check(feed->new_gap == 0);
+
+  /* a feed with new items every hour is checked at least twice an hour */
+  for(i = 0; i < 24; ++i) {
+    now += 3600;
+    feed_adapt_interval(feed, 1, now, 300, 43200);
+  }
+  check(feed->new_gap == 3600);
+  check(feed->poll_interval == 300);
+  now += 600;
+  feed_adapt_interval(feed, 0, now, 300, 43200);
+  check(feed->poll_interval == 600);
+  now += 600;
+  feed_adapt_interval(feed, 0, now, 300, 43200);
+  check(feed->poll_interval == 1200);
+  now += 1200;
+  feed_adapt_interval(feed, 0, now, 300, 43200);
+  check(feed->poll_interval == 1800);
+
+  /* ... until it goes quiet */
+  while(feed->poll_interval < 43200 && checks < 100) {
+    now += feed->poll_interval;
+    feed_adapt_interval(feed, 0, now, 300, 43200);
+    ++checks;
+  }
+  check(feed->poll_interval == 43200);
+  check(checks < 20);
+
+  feed_free(feed);
+  return 0;
+}
+
+int main(void) {
+  int i;
+  i = testSchedule();
+
+  if(!i) {
+    i = testNextCheck();
+  }
+
+  if(!i) {
+    i = testAdaptInterval();
+  }
+
+  return i;
+}
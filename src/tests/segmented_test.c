@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "event_loop.h"
+#include "list.h"
+#include "partfile.h"
+#include "segmented.h"
+#include "test_server.h"
+#include "utils.h"
+#include "output.h"
+#include "web.h"
+
+#ifdef MEMWATCH
+  #include "memwatch.h"
+#endif
+
+int8_t verbose = P_NONE;
+
+#define FILENAME "segmented_test.mov"
+#define SIZE     1003
+
+static int test = 0;
+
+#define check( A ) \
+  { \
+      ++test; \
+      if( !( A ) ){ \
+          fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+          return test; \
+      } \
+  }
+
+static char body[SIZE];
+static char content[SIZE + 16];
+
+static test_object big      = { "/big.mov", body, SIZE, "\"v1\"", 1, 0 };
+static test_object mirror   = { "/mirror.mov", body, SIZE, "\"v1\"", 1, 0 };
+static test_object other    = { "/other.mov", body, SIZE, "\"v2\"", 1, 0 };
+static test_object shorter  = { "/shorter.mov", body, SIZE - 1, "\"v1\"", 1, 0 };
+static test_object small    = { "/small.mov", body, 150, "\"v1\"", 1, 0 };
+static test_object noranges = { "/noranges.mov", body, SIZE, "\"v1\"", 0, 0 };
+static test_object weak     = { "/weak.mov", body, SIZE, "W/\"v1\"", 1, 0 };
+static test_object stalled  = { "/stalled.mov", body, SIZE, "\"v1\"", 1, 10 };
+
+static event_loop   *loop = NULL;
+static web_multi    *engine = NULL;
+static test_server  *server = NULL;
+
+struct result {
+  uint8_t       done;
+  HTTPResponse *response;
+};
+
+static void onDone(HTTPResponse *response, void *userdata) {
+  struct result *r = (struct result*)userdata;
+
+  r->done = 1;
+  r->response = response;
+}
+
+static void url(char *buf, const char *path) {
+  sprintf(buf, "http://127.0.0.1:%d%s", test_server_port(server), path);
+}
+
+/* download a file in up to 4 segments of at least 100 bytes, and check that it arrived completely */
+static int download(const char *path, simple_list mirrors, long *code) {
+  struct result r;
+  HTTPRequest req;
+  char buf[64];
+  FILE *fp = NULL;
+  size_t len = 0;
+  int rounds;
+
+  memset(&r, 0, sizeof(r));
+  memset(&req, 0, sizeof(req));
+  url(buf, path);
+  req.url = buf;
+  req.filename = FILENAME;
+  unlink(FILENAME);
+  test_server_clear_log(server);
+
+  if(!segmented_download_start(engine, &req, mirrors, 4, 100, onDone, &r)) {
+    return -1;
+  }
+  for(rounds = 0; rounds < 500 && !r.done; ++rounds) {
+    event_loop_run(loop, 10);
+  }
+  if(!r.done || !r.response) {
+    return -1;
+  }
+  *code = r.response->responseCode;
+  HTTPResponse_free(r.response);
+
+  if((fp = fopen(FILENAME, "rb")) != NULL) {
+    len = fread(content, 1, sizeof(content), fp);
+    fclose(fp);
+  }
+  unlink(FILENAME);
+  return (len == SIZE && !memcmp(content, body, SIZE)) ? 0 : -1;
+}
+
+int testSegmented(void) {
+  simple_list mirrors = NULL;
+  const char *log = NULL;
+  char buf[64];
+  long code = 0;
+
+  /* 4 segments, the last one takes the remainder */
+  check(download("/big.mov", NULL, &code) == 0);
+  check(code == 200);
+  log = test_server_log(server);
+  check(strstr(log, "HEAD /big.mov - 200\n") != NULL);
+  check(strstr(log, "GET /big.mov 0-249 206\n") != NULL);
+  check(strstr(log, "GET /big.mov 250-499 206\n") != NULL);
+  check(strstr(log, "GET /big.mov 500-749 206\n") != NULL);
+  check(strstr(log, "GET /big.mov 750-1002 206\n") != NULL);
+
+  /* mirrors share the segments if they serve the same object */
+  url(buf, "/mirror.mov");
+  addItem(am_strdup(buf), &mirrors);
+  url(buf, "/other.mov");
+  addItem(am_strdup(buf), &mirrors);
+  url(buf, "/shorter.mov");
+  addItem(am_strdup(buf), &mirrors);
+  check(download("/big.mov", mirrors, &code) == 0);
+  check(code == 200);
+  log = test_server_log(server);
+  check(strstr(log, "HEAD /mirror.mov - 200\n") != NULL);
+  check(strstr(log, "HEAD /other.mov - 200\n") != NULL);
+  check(strstr(log, "HEAD /shorter.mov - 200\n") != NULL);
+  check(strstr(log, "GET /big.mov 0-249 206\n") != NULL);
+  check(strstr(log, "GET /mirror.mov 250-499 206\n") != NULL);
+  check(strstr(log, "GET /big.mov 500-749 206\n") != NULL);
+  check(strstr(log, "GET /mirror.mov 750-1002 206\n") != NULL);
+  /* a different ETag or size means a different object */
+  check(strstr(log, "GET /other.mov") == NULL);
+  check(strstr(log, "GET /shorter.mov") == NULL);
+  freeList(&mirrors, NULL);
+
+  /* files that are too small, servers without byte ranges and weak validators get a single connection */
+  check(download("/noranges.mov", NULL, &code) == 0);
+  check(code == 200);
+  check(strstr(test_server_log(server), "GET /noranges.mov - 200\n") != NULL);
+  check(download("/weak.mov", NULL, &code) == 0);
+  check(strstr(test_server_log(server), "GET /weak.mov - 200\n") != NULL);
+  return 0;
+}
+
+int testSmallFile(void) {
+  struct result r;
+  HTTPRequest req;
+  char buf[64];
+  int rounds;
+
+  /* 150 bytes make only one segment of at least 100 bytes */
+  memset(&r, 0, sizeof(r));
+  memset(&req, 0, sizeof(req));
+  url(buf, "/small.mov");
+  req.url = buf;
+  req.filename = FILENAME;
+  test_server_clear_log(server);
+  check(segmented_download_start(engine, &req, NULL, 4, 100, onDone, &r) != NULL);
+  for(rounds = 0; rounds < 500 && !r.done; ++rounds) {
+    event_loop_run(loop, 10);
+  }
+  check(r.done && r.response && r.response->responseCode == 200);
+  check(!strcmp(test_server_log(server), "HEAD /small.mov - 200\nGET /small.mov - 200\n"));
+  HTTPResponse_free(r.response);
+  unlink(FILENAME);
+  return 0;
+}
+
+int testCancel(void) {
+  struct result r;
+  segmented_download *sd = NULL;
+  HTTPRequest req;
+  part_info info;
+  const char *log = NULL;
+  char buf[64];
+  long code = 0;
+  int rounds;
+
+  memset(&r, 0, sizeof(r));
+  memset(&req, 0, sizeof(req));
+  url(buf, "/stalled.mov");
+  req.url = buf;
+  req.filename = FILENAME;
+  test_server_clear_log(server);
+  sd = segmented_download_start(engine, &req, NULL, 4, 100, onDone, &r);
+  check(sd != NULL);
+  /* wait until the segments have received all the server sends before it stalls */
+  for(rounds = 0; rounds < 500 && !strstr(test_server_log(server), "750-1002"); ++rounds) {
+    event_loop_run(loop, 10);
+  }
+  for(rounds = 0; rounds < 20; ++rounds) {
+    event_loop_run(loop, 10);
+  }
+  check(access(FILENAME ".part", F_OK) == 0);
+  check(segmented_download_cancel(sd) == 0);
+  for(rounds = 0; rounds < 500 && !r.done; ++rounds) {
+    event_loop_run(loop, 10);
+  }
+  check(r.done && r.response == NULL);
+  check(web_multi_pending(engine) == 0);
+  check(access(FILENAME, F_OK) != 0);
+
+  /* the partial file is kept along with the progress of each segment */
+  check(part_info_load(FILENAME ".part", &info) == 0);
+  check(info.segment_count == 4 && info.offset == 10);
+  check(info.segments[1].offset == 250 && info.segments[1].length == 250 && info.segments[1].written == 10);
+  check(info.segments[3].offset == 750 && info.segments[3].length == 253 && info.segments[3].written == 10);
+  part_info_free(&info);
+
+  /* the next attempt continues every segment where it stopped */
+  test_server_release(server);
+  check(download("/stalled.mov", NULL, &code) == 0);
+  check(code == 200);
+  log = test_server_log(server);
+  check(strstr(log, "GET /stalled.mov 10-249 206\n") != NULL);
+  check(strstr(log, "GET /stalled.mov 260-499 206\n") != NULL);
+  check(strstr(log, "GET /stalled.mov 510-749 206\n") != NULL);
+  check(strstr(log, "GET /stalled.mov 760-1002 206\n") != NULL);
+  check(access(FILENAME ".part", F_OK) != 0 && access(FILENAME ".part.info", F_OK) != 0);
+  return 0;
+}
+
+int testResumeSingle(void) {
+  part_segment segments[2] = { { 0, 500, 100 }, { 500, 500, 0 } };
+  part_info info;
+  char buf[64];
+  FILE *fp = NULL;
+  long code = 0;
+
+  /* segments that don't match the object can't be continued, but the data before the first gap can */
+  fp = fopen(FILENAME ".part", "wb");
+  check(fp != NULL);
+  check(fwrite(body, 1, 100, fp) == 100);
+  check(fwrite(body, 1, 900, fp) == 900);
+  fclose(fp);
+  memset(&info, 0, sizeof(info));
+  url(buf, "/big.mov");
+  info.url = buf;
+  info.etag = "\"v1\"";
+  info.offset = 100;
+  info.segments = segments;
+  info.segment_count = 2;
+  check(part_info_save(FILENAME ".part", &info) == 0);
+
+  check(download("/big.mov", NULL, &code) == 0);
+  check(code == 206);
+  check(!strcmp(test_server_log(server), "HEAD /big.mov - 200\nGET /big.mov 100- 206\n"));
+  check(access(FILENAME ".part", F_OK) != 0 && access(FILENAME ".part.info", F_OK) != 0);
+  return 0;
+}
+
+int main(void) {
+  int i;
+
+  for(i = 0; i < SIZE; ++i) {
+    body[i] = (char)('a' + i % 26);
+  }
+
+  loop = event_loop_new();
+  engine = web_multi_new(8, 0);
+  if(!loop || !engine || web_multi_attach(engine, loop) != 0 || (server = test_server_new(loop)) == NULL) {
+    fprintf(stderr, "FAIL: Unable to set up the test server\n");
+    return 1;
+  }
+  test_server_add(server, &big);
+  test_server_add(server, &mirror);
+  test_server_add(server, &other);
+  test_server_add(server, &shorter);
+  test_server_add(server, &small);
+  test_server_add(server, &noranges);
+  test_server_add(server, &weak);
+  test_server_add(server, &stalled);
+
+  i = testSegmented();
+
+  if(!i) {
+    i = testSmallFile();
+  }
+
+  if(!i) {
+    i = testCancel();
+  }
+
+  if(!i) {
+    i = testResumeSingle();
+  }
+
+  web_multi_free(engine);
+  test_server_free(server);
+  event_loop_free(loop);
+  CURLPool_free();
+  return i;
+}
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "statedb.h"
+#include "utils.h"
+#include "output.h"
+
+#ifdef MEMWATCH
+  #include "memwatch.h"
+#endif
+
+int8_t verbose = P_NONE;
+
+#define ENTRIES 1000
+#define STATE_FILE "statedb_test.state"
+
+static int test = 0;
+
+#define check( A ) \
+  { \
+      ++test; \
+      if( !( A ) ){ \
+          fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+          return test; \
+      } \
+  }
+
+int testStateDB(void) {
+  statedb_entry *entries = NULL;
+  statedb *db = NULL;
+  hash128 digest;
+  char url[64];
+  int64_t idx;
+  uint32_t i;
+
+  check(statedb_open("does-not-exist.state") == NULL);
+  check(statedb_count(NULL) == 0);
+  check(statedb_find(NULL, &digest) == -1);
+
+  entries = am_malloc((ENTRIES + 1) * sizeof(statedb_entry));
+  check(entries != NULL);
+  for(i = 0; i < ENTRIES; ++i) {
+    sprintf(url, "http://www.example.com/file_%u.mov", i);
+    hash128_string(url, &entries[i].digest);
+    memset(&entries[i].meta, 0, sizeof(statedb_meta));
+    entries[i].meta.time    = 1000 + i;
+    entries[i].meta.size    = i * 1024;
+    entries[i].meta.feed_id = i % 7;
+  }
+  /* duplicates are written only once */
+  entries[ENTRIES] = entries[0];
+
+  check(statedb_write(STATE_FILE, entries, ENTRIES + 1, STATEDB_FLAG_META) == 0);
+  am_free(entries);
+  check(statedb_is_binary(STATE_FILE) == 1);
+
+  db = statedb_open(STATE_FILE);
+  check(db != NULL);
+  check(statedb_count(db) == ENTRIES);
+  for(i = 1; i < ENTRIES; ++i) {
+    check(hash128_cmp(statedb_digest(db, i - 1), statedb_digest(db, i)) < 0);
+  }
+
+  for(i = 0; i < ENTRIES; ++i) {
+    sprintf(url, "http://www.example.com/file_%u.mov", i);
+    hash128_string(url, &digest);
+    idx = statedb_find(db, &digest);
+    check(idx >= 0);
+    check(statedb_get_meta(db, idx)->time == 1000 + i);
+    check(statedb_get_meta(db, idx)->size == i * 1024);
+    check(statedb_get_meta(db, idx)->feed_id == i % 7);
+  }
+  hash128_string("http://www.example.com/other.mov", &digest);
+  check(statedb_find(db, &digest) == -1);
+  check(statedb_digest(db, ENTRIES) == NULL);
+  statedb_close(db);
+
+  /* without metadata */
+  check(statedb_write(STATE_FILE, NULL, 0, 0) == 0);
+  db = statedb_open(STATE_FILE);
+  check(db != NULL);
+  check(statedb_count(db) == 0);
+  check(statedb_find(db, &digest) == -1);
+  check(statedb_get_meta(db, 0) == NULL);
+  statedb_close(db);
+
+  unlink(STATE_FILE);
+  return 0;
+}
+
+/* overwrite the entry count in the header of a state file */
+static int setCount(const char *path, uint64_t count) {
+  FILE *fp = fopen(path, "r+b");
+  int result = -1;
+
+  if(fp) {
+    /* magic, version and flags come first */
+    if(fseek(fp, 16, SEEK_SET) == 0 && fwrite(&count, sizeof(count), 1, fp) == 1) {
+      result = 0;
+    }
+    fclose(fp);
+  }
+  return result;
+}
+
+int testBadHeader(void) {
+  statedb_entry entries[2];
+  statedb *db = NULL;
+  FILE *fp = NULL;
+
+  memset(entries, 0, sizeof(entries));
+  hash128_string("http://www.example.com/a.mov", &entries[0].digest);
+  hash128_string("http://www.example.com/b.mov", &entries[1].digest);
+  check(statedb_write(STATE_FILE, entries, 2, STATEDB_FLAG_META) == 0);
+  db = statedb_open(STATE_FILE);
+  check(db != NULL && statedb_count(db) == 2);
+  statedb_close(db);
+
+  /* more entries than the file holds */
+  check(setCount(STATE_FILE, 3) == 0);
+  check(statedb_open(STATE_FILE) == NULL);
+
+  /* counts whose size overflows 64 bits (2^61 entries of 40 bytes wrap around to 0) */
+  check(setCount(STATE_FILE, UINT64_MAX) == 0);
+  check(statedb_open(STATE_FILE) == NULL);
+  check(setCount(STATE_FILE, UINT64_C(1) << 61) == 0);
+  check(statedb_open(STATE_FILE) == NULL);
+
+  /* truncated header */
+  fp = fopen(STATE_FILE, "wb");
+  check(fp != NULL);
+  fputs("TMSTATE", fp);
+  fclose(fp);
+  check(statedb_open(STATE_FILE) == NULL);
+
+  unlink(STATE_FILE);
+  return 0;
+}
+
+int main(void) {
+  int i;
+  i = testStateDB();
+
+  if(!i) {
+    i = testBadHeader();
+  }
+
+  return i;
+}
@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "test_server.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+  #include "memwatch.h"
+#endif
+
+#define MAX_OBJECTS 16
+#define MAX_REQUEST 4096
+#define MAX_LOG     8192
+
+typedef struct test_client test_client;
+
+struct test_client {
+  test_client *next;
+  test_server *server;
+  int          fd;
+  char         in[MAX_REQUEST];
+  size_t       in_len;
+  char        *out;
+  size_t       out_len;
+  size_t       out_pos;
+  size_t       out_limit;  /* bytes that may be sent before the server is released */
+};
+
+struct test_server {
+  event_loop        *loop;
+  int                fd;
+  uint16_t           port;
+  const test_object *objects[MAX_OBJECTS];
+  uint32_t           object_count;
+  test_client       *clients;
+  uint8_t            released;
+  char               log[MAX_LOG];
+};
+
+static void onClientReady(int fd, uint32_t events, void *userdata);
+
+static void test_client_free(test_client *c) {
+  test_client **pos = &c->server->clients;
+
+  while(*pos && *pos != c) {
+    pos = &(*pos)->next;
+  }
+  if(*pos) {
+    *pos = c->next;
+  }
+  event_loop_unwatch(c->server->loop, c->fd);
+  close(c->fd);
+  am_free(c->out);
+  am_free(c);
+}
+
+/* value of a header field of the request, copied to \a value */
+static int getHeader(const char *request, const char *name, char *value, size_t size) {
+  const char *line = strchr(request, '\n');
+  size_t len = strlen(name);
+  size_t i = 0;
+
+  while(line && *++line) {
+    if(!strncasecmp(line, name, len) && line[len] == ':') {
+      line += len + 1;
+      while(*line == ' ') {
+        ++line;
+      }
+      while(line[i] && line[i] != '\r' && line[i] != '\n' && i < size - 1) {
+        value[i] = line[i];
+        ++i;
+      }
+      value[i] = '\0';
+      return 0;
+    }
+    line = strchr(line, '\n');
+  }
+  return -1;
+}
+
+static const test_object* findObject(const test_server *server, const char *path) {
+  uint32_t i;
+
+  for(i = 0; i < server->object_count; ++i) {
+    if(!strcmp(server->objects[i]->path, path)) {
+      return server->objects[i];
+    }
+  }
+  return NULL;
+}
+
+static void answer(test_client *c) {
+  test_server *server = c->server;
+  const test_object *obj = NULL;
+  char method[8], path[256], range[64], if_range[128];
+  char header[512];
+  unsigned long long first = 0, last = 0;
+  size_t body_size = 0;
+  int status = 404, header_len, has_range = 0;
+
+  if(sscanf(c->in, "%7s %255s", method, path) != 2) {
+    strcpy(method, "?");
+    strcpy(path, "?");
+  }
+  obj = findObject(server, path);
+
+  has_range = (getHeader(c->in, "Range", range, sizeof(range)) == 0 && !strncmp(range, "bytes=", 6)) ? 1 : 0;
+
+  if(obj) {
+    status = 200;
+    first = 0;
+    last = obj->size - 1;
+    /* a range that depends on another version of the object is ignored */
+    if(has_range && obj->ranges &&
+       (getHeader(c->in, "If-Range", if_range, sizeof(if_range)) != 0 || (obj->etag && !strcmp(if_range, obj->etag)))) {
+      sscanf(range, "bytes=%llu-%llu", &first, &last);
+      if(last >= obj->size) {
+        last = obj->size - 1;
+      }
+      status = first <= last ? 206 : 416;
+    }
+  }
+
+  if(status == 200 || status == 206) {
+    body_size = (size_t)(last - first + 1);
+    header_len = snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\nContent-Length: %lu\r\n%s%s%s%s",
+                          status, status == 200 ? "OK" : "Partial Content", (unsigned long)body_size,
+                          obj->ranges ? "Accept-Ranges: bytes\r\n" : "",
+                          obj->etag ? "ETag: " : "", obj->etag ? obj->etag : "", obj->etag ? "\r\n" : "");
+    if(status == 206) {
+      header_len += snprintf(header + header_len, sizeof(header) - header_len, "Content-Range: bytes %llu-%llu/%lu\r\n",
+                             first, last, (unsigned long)obj->size);
+    }
+  } else {
+    header_len = snprintf(header, sizeof(header), "HTTP/1.1 %d Error\r\nContent-Length: 0\r\n", status);
+  }
+  header_len += snprintf(header + header_len, sizeof(header) - header_len, "Connection: close\r\n\r\n");
+
+  if(!strcmp(method, "HEAD")) {
+    body_size = 0;
+  }
+
+  snprintf(server->log + strlen(server->log), sizeof(server->log) - strlen(server->log), "%s %s %s %d\n",
+           method, path, has_range ? range + 6 : "-", status);
+
+  c->out = am_malloc(header_len + body_size);
+  if(c->out) {
+    memcpy(c->out, header, header_len);
+    if(body_size > 0) {
+      memcpy(c->out + header_len, obj->body + first, body_size);
+    }
+    c->out_len = header_len + body_size;
+    c->out_limit = c->out_len;
+    if(obj && obj->stall_at > 0 && obj->stall_at < body_size) {
+      c->out_limit = header_len + obj->stall_at;
+    }
+  }
+}
+
+/* keep sending the response, or wait for the peer to close the connection while the server holds back data */
+static void watchClient(test_client *c) {
+  uint32_t events = EVENT_WRITE;
+
+  if(c->out_pos == c->out_limit && !c->server->released) {
+    events = EVENT_READ;
+  }
+  if(event_loop_watch(c->server->loop, c->fd, events, onClientReady, c) != 0) {
+    test_client_free(c);
+  }
+}
+
+static void onClientReady(int fd, uint32_t events, void *userdata) {
+  test_client *c = (test_client*)userdata;
+  char buf[256];
+  size_t limit;
+  ssize_t n;
+
+  if(!c->out) {
+    n = recv(fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len, 0);
+    if(n <= 0) {
+      if(n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        test_client_free(c);
+      }
+      return;
+    }
+    c->in_len += (size_t)n;
+    c->in[c->in_len] = '\0';
+    if(!strstr(c->in, "\r\n\r\n")) {
+      return;
+    }
+    answer(c);
+    if(!c->out) {
+      test_client_free(c);
+      return;
+    }
+    watchClient(c);
+    return;
+  }
+
+  if(events & EVENT_READ) {
+    /* only the end of the connection is of interest while the response is stalled */
+    n = recv(fd, buf, sizeof(buf), 0);
+    if(n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+      test_client_free(c);
+    }
+    return;
+  }
+
+  limit = c->server->released ? c->out_len : c->out_limit;
+  n = send(fd, c->out + c->out_pos, limit - c->out_pos, MSG_NOSIGNAL);
+  if(n > 0) {
+    c->out_pos += (size_t)n;
+  }
+  if(c->out_pos == c->out_len || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+    test_client_free(c);
+  } else if(c->out_pos == limit) {
+    watchClient(c);
+  }
+}
+
+static void onAccept(int fd, uint32_t events, void *userdata) {
+  test_server *server = (test_server*)userdata;
+  test_client *c = NULL;
+  int client_fd;
+
+  (void)events;
+
+  while((client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    c = am_malloc(sizeof(test_client));
+    if(!c) {
+      close(client_fd);
+      continue;
+    }
+    memset(c, 0, sizeof(test_client));
+    c->server = server;
+    c->fd = client_fd;
+    if(event_loop_watch(server->loop, client_fd, EVENT_READ, onClientReady, c) != 0) {
+      close(client_fd);
+      am_free(c);
+      continue;
+    }
+    c->next = server->clients;
+    server->clients = c;
+  }
+}
+
+/* start a server on any free port of the loopback interface */
+test_server* test_server_new(event_loop *loop) {
+  test_server *server = NULL;
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  int fd;
+
+  fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    return NULL;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0 ||
+     getsockname(fd, (struct sockaddr*)&addr, &addr_len) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  server = am_malloc(sizeof(test_server));
+  if(!server) {
+    close(fd);
+    return NULL;
+  }
+  memset(server, 0, sizeof(test_server));
+  server->loop = loop;
+  server->fd = fd;
+  server->port = ntohs(addr.sin_port);
+  if(event_loop_watch(loop, fd, EVENT_READ, onAccept, server) != 0) {
+    close(fd);
+    am_free(server);
+    return NULL;
+  }
+  return server;
+}
+
+void test_server_free(test_server *server) {
+  if(server) {
+    while(server->clients) {
+      test_client_free(server->clients);
+    }
+    event_loop_unwatch(server->loop, server->fd);
+    close(server->fd);
+    am_free(server);
+  }
+}
+
+uint16_t test_server_port(const test_server *server) {
+  return server->port;
+}
+
+/* serve a file; the object must outlive the server */
+int test_server_add(test_server *server, const test_object *obj) {
+  if(server->object_count == MAX_OBJECTS || !obj->path || obj->size == 0) {
+    return -1;
+  }
+  server->objects[server->object_count++] = obj;
+  return 0;
+}
+
+/* send the rest of the responses that have been held back */
+void test_server_release(test_server *server) {
+  test_client *c = NULL, *next = NULL;
+
+  server->released = 1;
+  for(c = server->clients; c; c = next) {
+    next = c->next;
+    if(c->out) {
+      watchClient(c);
+    }
+  }
+}
+
+/* hold back the bodies of further responses again, the ones that are being sent are completed */
+void test_server_hold(test_server *server) {
+  test_client *c = NULL;
+
+  server->released = 0;
+  for(c = server->clients; c; c = c->next) {
+    c->out_limit = c->out_len;
+  }
+}
+
+/* one line per request: "<method> <path> <range or -> <status>" */
+const char* test_server_log(const test_server *server) {
+  return server->log;
+}
+
+void test_server_clear_log(test_server *server) {
+  server->log[0] = '\0';
+}
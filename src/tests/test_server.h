@@ -0,0 +1,34 @@
+#ifndef TEST_SERVER_H__
+#define TEST_SERVER_H__
+
+/* A small HTTP server on the loopback interface, driven by an event loop, that lets the
+** tests of the transfer code run without network access.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "event_loop.h"
+
+/** A file served by the test server */
+typedef struct test_object {
+  const char *path;      /**< path of the URL, e.g. "/trailer.mov" */
+  const char *body;
+  size_t      size;
+  const char *etag;      /**< (optional) value of the header field "ETag" */
+  uint8_t     ranges;    /**< answer requests for byte ranges */
+  size_t      stall_at;  /**< (optional) hold back the body after this many bytes until test_server_release() */
+} test_object;
+
+typedef struct test_server test_server;
+
+test_server* test_server_new(event_loop *loop);
+void         test_server_free(test_server *server);
+uint16_t     test_server_port(const test_server *server);
+int          test_server_add(test_server *server, const test_object *obj);
+void         test_server_release(test_server *server);
+void         test_server_hold(test_server *server);
+const char*  test_server_log(const test_server *server);
+void         test_server_clear_log(test_server *server);
+
+#endif /* TEST_SERVER_H__ */
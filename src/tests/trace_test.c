@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "utils.h"
+#include "output.h"
+
+#ifdef MEMWATCH
+  #include "memwatch.h"
+#endif
+
+int8_t verbose = P_NONE;
+
+static int test = 0;
+
+#define check( A ) \
+  { \
+      ++test; \
+      if( !( A ) ){ \
+          fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+          return test; \
+      } \
+  }
+
+static char content[65536];
+
+static size_t readFile(const char *path) {
+  FILE *fp = fopen(path, "r");
+  size_t len = 0;
+
+  content[0] = '\0';
+  if(fp) {
+    len = fread(content, 1, sizeof(content) - 1, fp);
+    content[len] = '\0';
+    fclose(fp);
+  }
+  return len;
+}
+
+static uint32_t countEvents(const char *phase) {
+  char needle[16];
+  const char *pos = content;
+  uint32_t count = 0;
+
+  snprintf(needle, sizeof(needle), "\"ph\":\"%s\"", phase);
+  while((pos = strstr(pos, needle)) != NULL) {
+    ++count;
+    ++pos;
+  }
+  return count;
+}
+
+int testTrace(void) {
+  char path[64], old_path[64];
+  trace_span span, inner;
+  uint32_t i;
+
+  snprintf(path, sizeof(path), "/tmp/trace_test.%d.json", (int)getpid());
+  snprintf(old_path, sizeof(old_path), "%s.1", path);
+  unlink(path);
+  unlink(old_path);
+
+  /* nothing is written while tracing is off */
+  check(trace_enabled == 0);
+  TRACE_BEGIN(span, "test", "disabled");
+  TRACE_END(span);
+  check(access(path, F_OK) != 0);
+
+  check(trace_open(path, 0) == 0);
+  check(trace_enabled == 1);
+  TRACE_BEGIN(span, "test", "outer");
+  TRACE_BEGIN(inner, "test", "inner");
+  TRACE_END_ARG(inner, "items", 42);
+  TRACE_END(span);
+  TRACE_ASYNC_BEGIN("fetch", "fetch", 7);
+  TRACE_ASYNC_END_ARG("fetch", "fetch", 7, "dns_us", 120);
+  trace_close();
+  check(trace_enabled == 0);
+
+  readFile(path);
+  check(strstr(content, "[\n{\"name\":\"process_name\",\"ph\":\"M\"") == content);
+  check(!strcmp(content + strlen(content) - 3, "\n]\n"));
+  check(countEvents("M") == 2);
+  check(countEvents("X") == 2);
+  check(strstr(content, "{\"name\":\"inner\",\"cat\":\"test\",\"ph\":\"X\",\"ts\":") != NULL);
+  check(strstr(content, ",\"args\":{\"items\":42}}") != NULL);
+  check(strstr(content, "\"ph\":\"b\",\"id\":\"0x7\"") != NULL);
+  check(strstr(content, ",\"args\":{\"dns_us\":120}}") != NULL);
+
+  /* the previous trace is kept, and the file is rotated once it reaches its maximum size */
+  check(trace_open(path, 2048) == 0);
+  readFile(old_path);
+  check(countEvents("X") == 2);
+  for(i = 0; i < 100; ++i) {
+    TRACE_BEGIN(span, "test", "loop");
+    TRACE_END(span);
+  }
+  trace_close();
+  check(readFile(old_path) >= 2048 && readFile(old_path) < 2048 + 256);
+  check(!strcmp(content + strlen(content) - 3, "\n]\n"));
+  check(countEvents("M") == 2);
+  readFile(path);
+  check(!strncmp(content, "[\n", 2));
+  check(!strcmp(content + strlen(content) - 3, "\n]\n"));
+
+  unlink(path);
+  unlink(old_path);
+  return 0;
+}
+
+int main(void) {
+  return testTrace();
+}
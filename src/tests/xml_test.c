@@ -0,0 +1,217 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "feed_item.h"
+#include "list.h"
+#include "output.h"
+#include "rss_feed.h"
+#include "utils.h"
+#include "xml_parser.h"
+
+#ifdef MEMWATCH
+  #include "memwatch.h"
+#endif
+
+int8_t verbose = P_NONE;
+
+static int test = 0;
+
+#define check( A ) \
+  { \
+      ++test; \
+      if( !( A ) ){ \
+          fprintf( stderr, "FAIL test #%d (%s, %d)\n", test, __FILE__, __LINE__ ); \
+          return test; \
+      } \
+  }
+
+static const char *feed =
+  "<?xml version=\"1.0\"?>\n"
+  "<rss version=\"2.0\"><channel><title>Trailers</title><ttl>15</ttl>\n"
+  "<skipHours><hour>0</hour><hour> 3 </hour><hour>24</hour><hour>25</hour></skipHours>\n"
+  "<skipDays><day>Saturday</day><day>Sunday</day><day>Someday</day></skipDays>\n"
+  "<item><title>Movie A</title><link>http://example.com/a_h720p.mov</link><guid isPermaLink=\"false\">tt-a</guid></item>\n"
+  "<item><title><![CDATA[Movie B & Co]]></title>"
+  "<enclosure url=\"http://example.com/b.mov?x=1&amp;y=2\" type=\"video/quicktime\"/></item>\n"
+  "<item><title>Audio</title><enclosure url=\"http://example.com/c.mp3\" type=\"audio/mpeg\"/></item>\n"
+  "<item><link>http://example.com/no_title.mov</link></item>\n"
+  "</channel></rss>\n";
+
+static void collect(feed_item item, void *userdata) {
+  addItem(item, (simple_list*)userdata);
+}
+
+int testChunkedParsing(void) {
+  simple_list items = NULL;
+  feed_parser *p = NULL;
+  feed_item item = NULL;
+  size_t pos, len = strlen(feed);
+
+  p = feed_parser_new(collect, &items);
+  check(p != NULL);
+  /* hand over the data in tiny chunks */
+  for(pos = 0; pos < len; pos += 3) {
+    feed_parser_push(p, feed + pos, len - pos < 3 ? len - pos : 3);
+  }
+  feed_parser_finish(p);
+
+  check(feed_parser_item_count(p) == 4);
+  check(feed_parser_ttl(p) == 15);
+  check(feed_parser_skip_hours(p) == ((1u << 0) | (1u << 3)));
+  check(feed_parser_skip_days(p) == ((1u << 0) | (1u << 6)));
+  check(listCount(items) == 2);
+
+  /* items are prepended to the list */
+  item = (feed_item)items->data;
+  check(strcmp(item->name, "Movie B & Co") == 0);
+  check(strcmp((char*)item->urls->data, "http://example.com/b.mov?x=1&y=2") == 0);
+  check(item->guid == NULL);
+  check(getFeedItemID(item) != 0);
+  item = (feed_item)items->next->data;
+  check(strcmp(item->name, "Movie A") == 0);
+  check(strcmp((char*)item->urls->data, "http://example.com/a_h720p.mov") == 0);
+  check(item->guid && strcmp(item->guid, "tt-a") == 0);
+  check(getFeedItemID(item) != getFeedItemID((feed_item)items->data));
+
+  feed_parser_free(p);
+  freeList(&items, freeFeedItem);
+  return 0;
+}
+
+int testRecovery(void) {
+  const char *broken =
+    "<rss><channel>"
+    "<item><title>Movie &nbsp; A</title><link>http://example.com/a.mov</link></item>"
+    "<item><title>Movie B</title><link>http://example.com/b.mov</link></item>"
+    "<item><title>Movie C</title><link>http://example.com/c";
+  simple_list items = NULL;
+  uint32_t count = 0;
+  uint32_t ttl = 0;
+
+  items = parse_xmldata(broken, strlen(broken), &count, &ttl);
+  check(count == 3);
+  /* the truncated item is dropped */
+  check(listCount(items) == 2);
+  check(strcmp(((feed_item)items->data)->name, "Movie B") == 0);
+  freeList(&items, freeFeedItem);
+  return 0;
+}
+
+int testEmptyLinks(void) {
+  const char *data =
+    "<rss><channel>"
+    "<item><title>Empty</title><link></link><link> \n\t</link><enclosure url=\"\" type=\"video/mp4\"/></item>"
+    "<item><title>Padded</title><link></link><link>\n  http://example.com/padded.mov \n</link></item>"
+    "</channel></rss>";
+  simple_list items = NULL;
+  feed_item item = NULL;
+  uint32_t count = 0;
+  uint32_t ttl = 0;
+
+  items = parse_xmldata(data, strlen(data), &count, &ttl);
+  check(count == 2);
+  /* an item with nothing but empty links has no URL */
+  check(listCount(items) == 1);
+  item = (feed_item)items->data;
+  check(strcmp(item->name, "Padded") == 0);
+  check(listCount(item->urls) == 1);
+  check(strcmp((char*)item->urls->data, "http://example.com/padded.mov") == 0);
+  freeList(&items, freeFeedItem);
+  return 0;
+}
+
+struct stop_data {
+  simple_list  items;
+  feed_parser *p;
+};
+
+static void collectTwo(feed_item item, void *userdata) {
+  struct stop_data *data = (struct stop_data*)userdata;
+
+  addItem(item, &data->items);
+  if(listCount(data->items) == 2) {
+    feed_parser_stop(data->p);
+  }
+}
+
+int testStop(void) {
+  struct stop_data data = { NULL, NULL };
+  size_t len = strlen(feed);
+
+  data.p = feed_parser_new(collectTwo, &data);
+  check(data.p != NULL);
+  check(!feed_parser_stopped(data.p));
+  feed_parser_push(data.p, feed, len / 2);
+  feed_parser_push(data.p, feed + len / 2, len - len / 2);
+  feed_parser_finish(data.p);
+
+  check(feed_parser_stopped(data.p));
+  check(listCount(data.items) == 2);
+  /* nothing after the second complete item has been looked at */
+  check(feed_parser_item_count(data.p) == 2);
+
+  feed_parser_free(data.p);
+  freeList(&data.items, freeFeedItem);
+  return 0;
+}
+
+int testSeenItems(void) {
+  rss_feed *feed = feed_new();
+  uint64_t *ids = NULL;
+
+  check(feed != NULL);
+  check(feed_has_seen(feed, 1) == 0);
+
+  ids = am_malloc(4 * sizeof(uint64_t));
+  ids[0] = 30;
+  ids[1] = 10;
+  ids[2] = 30;
+  ids[3] = 20;
+  check(feed_set_seen(feed, ids, 4) == 1);
+  check(feed->seen_count == 3);
+  check(feed_has_seen(feed, 10) && feed_has_seen(feed, 20) && feed_has_seen(feed, 30));
+  check(!feed_has_seen(feed, 15));
+
+  /* the same set in another order */
+  ids = am_malloc(3 * sizeof(uint64_t));
+  ids[0] = 20;
+  ids[1] = 30;
+  ids[2] = 10;
+  check(feed_set_seen(feed, ids, 3) == 0);
+
+  /* items that have disappeared are forgotten */
+  ids = am_malloc(sizeof(uint64_t));
+  ids[0] = 40;
+  check(feed_set_seen(feed, ids, 1) == 1);
+  check(!feed_has_seen(feed, 10) && feed_has_seen(feed, 40));
+  check(feed_set_seen(feed, NULL, 0) == 1);
+  check(feed->seen_count == 0 && !feed_has_seen(feed, 40));
+
+  feed_free(feed);
+  return 0;
+}
+
+int main(void) {
+  int i;
+  i = testChunkedParsing();
+
+  if(!i) {
+    i = testRecovery();
+  }
+
+  if(!i) {
+    i = testEmptyLinks();
+  }
+
+  if(!i) {
+    i = testStop();
+  }
+
+  if(!i) {
+    i = testSeenItems();
+  }
+
+  return i;
+}
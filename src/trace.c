@@ -0,0 +1,232 @@
+/* $Id$
+ * $Name$
+ * $ProjectName$
+ */
+
+/**
+ * @file trace.c
+ *
+ * Spans of work written to a file in the Chrome trace event format, which can be opened
+ * with chrome://tracing or Perfetto.
+ *
+ * Once the file reaches its maximum size, it is renamed to <file>.1 (replacing an older one)
+ * and a new file is started.
+ */
+
+/*
+ * Copyright (C) 2026 Frank Aurich
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "output.h"
+#include "utils.h"
+
+#ifdef MEMWATCH
+	#include "memwatch.h"
+#endif
+
+uint8_t trace_enabled = 0;
+
+PRIVATE FILE     *traceFile = NULL;
+PRIVATE char     *tracePath = NULL;
+PRIVATE char     *traceOldPath = NULL;
+PRIVATE uint64_t  traceMaxSize = 0;
+PRIVATE uint64_t  traceWritten = 0;
+PRIVATE pid_t     tracePid = 0;
+PRIVATE long      traceTid = 0;
+
+PRIVATE int64_t now_us(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+PRIVATE void writeEvent(const char *format, ...) {
+  va_list ap;
+  int len;
+
+  va_start(ap, format);
+  len = vfprintf(traceFile, format, ap);
+  va_end(ap);
+  if(len > 0) {
+    traceWritten += (uint64_t)len;
+  }
+}
+
+/* start a new file, which tells the viewer the names of the process and the thread */
+PRIVATE int startFile(void) {
+  traceFile = fopen(tracePath, "w");
+  if(!traceFile) {
+    dbg_printf(P_ERROR, "Error: Unable to open trace file '%s': %s", tracePath, strerror(errno));
+    return -1;
+  }
+  traceWritten = 0;
+  writeEvent("[\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"trailermatic\"}}",
+             (int)tracePid, traceTid);
+  writeEvent(",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"event loop\"}}",
+             (int)tracePid, traceTid);
+  return 0;
+}
+
+PRIVATE void endFile(void) {
+  if(traceFile) {
+    fputs("\n]\n", traceFile);
+    fclose(traceFile);
+    traceFile = NULL;
+  }
+}
+
+PRIVATE void rotate(void) {
+  endFile();
+  if(rename(tracePath, traceOldPath) != 0) {
+    dbg_printf(P_ERROR, "Error: Unable to rename trace file '%s': %s", tracePath, strerror(errno));
+  }
+  if(startFile() != 0) {
+    trace_enabled = 0;
+  }
+}
+
+/* the events of a process that was forked from the traced one would end up in the same file */
+PRIVATE uint8_t isTracedProcess(void) {
+  return getpid() == tracePid ? 1 : 0;
+}
+
+PRIVATE void finishEvent(const char *key, int64_t value) {
+  if(key) {
+    writeEvent(",\"args\":{\"%s\":%lld}}", key, (long long)value);
+  } else {
+    writeEvent("}");
+  }
+  if(traceMaxSize > 0 && traceWritten >= traceMaxSize) {
+    rotate();
+  }
+}
+
+/** \brief Start writing spans to a trace file
+ *
+ * \param[in] path Path of the trace file. An existing file is kept as <path>.1
+ * \param[in] max_size Size in bytes at which the file is rotated (0: never)
+ * \return 0 on success, -1 if the file couldn't be opened
+ */
+PUBLIC int trace_open(const char *path, uint64_t max_size) {
+  trace_close();
+
+  if(!path || !*path) {
+    return -1;
+  }
+
+  tracePath = am_strdup(path);
+  traceOldPath = am_malloc(strlen(path) + 3);
+  if(!tracePath || !traceOldPath) {
+    trace_close();
+    return -1;
+  }
+  sprintf(traceOldPath, "%s.1", path);
+  traceMaxSize = max_size;
+  tracePid = getpid();
+  traceTid = (long)syscall(SYS_gettid);
+
+  /* keep the trace of the previous run */
+  rename(tracePath, traceOldPath);
+  if(startFile() != 0) {
+    trace_close();
+    return -1;
+  }
+  trace_enabled = 1;
+  return 0;
+}
+
+/** \brief Complete the trace file and stop tracing */
+PUBLIC void trace_close(void) {
+  trace_enabled = 0;
+  if(isTracedProcess()) {
+    endFile();
+  }
+  am_free(tracePath);
+  tracePath = NULL;
+  am_free(traceOldPath);
+  traceOldPath = NULL;
+}
+
+/** \brief Write the buffered spans to the trace file */
+PUBLIC void trace_flush(void) {
+  if(trace_enabled && isTracedProcess()) {
+    fflush(traceFile);
+  }
+}
+
+/** \brief Start a span (use TRACE_BEGIN() instead)
+ *
+ * \param[out] span The span
+ * \param[in] category Category of the span
+ * \param[in] name Name of the span
+ */
+PUBLIC void trace_span_begin(trace_span *span, const char *category, const char *name) {
+  span->category = category;
+  span->name = name;
+  span->start = now_us();
+}
+
+/** \brief End a span and write it to the trace (use TRACE_END() instead)
+ *
+ * \param[in] span The span
+ * \param[in] key (Optional) Name of an argument that is shown with the span
+ * \param[in] value Value of the argument
+ */
+PUBLIC void trace_span_end(trace_span *span, const char *key, int64_t value) {
+  int64_t end = now_us();
+
+  if(!isTracedProcess()) {
+    return;
+  }
+  writeEvent(",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%ld",
+             span->name, span->category, (long long)span->start, (long long)(end - span->start),
+             (int)tracePid, traceTid);
+  finishEvent(key, value);
+}
+
+/** \brief Start or end a span that crosses function boundaries (use TRACE_ASYNC_BEGIN()/TRACE_ASYNC_END() instead)
+ *
+ * \param[in] category Category of the span
+ * \param[in] name Name of the span
+ * \param[in] id Number that tells the span apart from others of the same category
+ * \param[in] phase 'b' to start the span, 'e' to end it
+ * \param[in] key (Optional) Name of an argument that is shown with the span
+ * \param[in] value Value of the argument
+ */
+PUBLIC void trace_async(const char *category, const char *name, uint64_t id, char phase, const char *key, int64_t value) {
+  if(!isTracedProcess()) {
+    return;
+  }
+  writeEvent(",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"id\":\"0x%llx\",\"ts\":%lld,\"pid\":%d,\"tid\":%ld",
+             name, category, phase, (unsigned long long)id, (long long)now_us(), (int)tracePid, traceTid);
+  finishEvent(key, value);
+}
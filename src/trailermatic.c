@@ -42,14 +42,24 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>     /* open */
+#include <time.h>
 
 #include "config_parser.h"
+#include "control.h"
 #include "downloads.h"
+#include "download_queue.h"
+#include "event_loop.h"
+#include "feed_cache.h"
 #include "feed_item.h"
 #include "file.h"
+#include "hash.h"
+#include "metrics.h"
 #include "output.h"
 #include "prowl.h"
+#include "ratelimit.h"
+#include "scheduler.h"
 #include "state.h"
+#include "trace.h"
 #include "utils.h"
 #include "version.h"
 #include "web.h"
@@ -57,6 +67,7 @@
 
 PRIVATE char AutoConfigFile[MAXPATHLEN + 1];
 PRIVATE void session_free(auto_handle *as);
+PRIVATE void startFeeds(auto_handle *session);
 PRIVATE void callDownloadDoneScript(const char* scriptname, const char* filename);
 
 uint8_t closing = 0;
@@ -66,7 +77,8 @@ uint8_t nofork  = AM_DEFAULT_NOFORK;
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 PRIVATE void usage(void) {
-  printf("usage: trailermatic [-fh] [-v level] [-l logfile] [-c file]\n"
+  printf("usage: trailermatic [-fh] [-v level] [-l logfile] [-c file] [-t tracefile]\n"
+    "       trailermatic [-c file] ctl <command> [args]\n"
     "\n"
     "Trailermatic %s\n"
     "\n"
@@ -76,7 +88,11 @@ PRIVATE void usage(void) {
     "  -c --configfile <path>    Path to configuration file\n"
     "  -o --once                 Quit Trailermatic after first check of RSS feeds\n"
     "  -l --logfile <file>       Log messages to <file>\n"
-    "  -a --append-log           Don't overwrite logfile from a previous session"
+    "  -a --append-log           Don't overwrite logfile from a previous session\n"
+    "  -i --import-state <file>  Import a state file of an older version and quit\n"
+    "  -t --trace <file>         Write a trace of the work done to <file> (Chrome trace format)\n"
+    "\n"
+    "  ctl <command> [args]      Send a command to the running daemon ('ctl help' lists them)"
     "\n", LONG_VERSION_STRING );
   exit(0);
 }
@@ -86,8 +102,8 @@ PRIVATE void usage(void) {
 
 PRIVATE void readargs(int argc, char ** argv, char **c_file, char** logfile, char **xmlfile,
                       uint8_t * nofork, uint8_t * verbose, uint8_t *once, uint8_t *append_log,
-					  uint8_t * match_only) {
-  char optstr[] = "afhv:c:l:ox:m";
+					  uint8_t * match_only, char **import_file, char **trace_file) {
+  char optstr[] = "afhv:c:l:ox:mi:t:";
   struct option longopts[] = {
     { "verbose",    required_argument, NULL, 'v' },
     { "nodaemon",   no_argument,       NULL, 'f' },
@@ -98,6 +114,8 @@ PRIVATE void readargs(int argc, char ** argv, char **c_file, char** logfile, cha
     { "append-log", no_argument,       NULL, 'a' },
     { "xml",        required_argument, NULL, 'x' },
     { "match-only", no_argument,       NULL, 'm' },
+    { "import-state", required_argument, NULL, 'i' },
+    { "trace",      required_argument, NULL, 't' },
     { NULL, 0, NULL, 0 } };
   int opt;
 
@@ -129,6 +147,13 @@ PRIVATE void readargs(int argc, char ** argv, char **c_file, char** logfile, cha
       case 'm':
         *match_only = 1;
         break;
+      case 'i':
+        *import_file = optarg;
+        *nofork = 1;
+        break;
+      case 't':
+        *trace_file = optarg;
+        break;
       default:
         usage();
         break;
@@ -139,14 +164,71 @@ PRIVATE void readargs(int argc, char ** argv, char **c_file, char** logfile, cha
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
+PRIVATE void resetFeedValidators(auto_handle *session, rss_feed *feed) {
+  if(feed && (feed->etag || feed->last_modified || feed->digest)) {
+    am_free(feed->etag);
+    feed->etag = NULL;
+    am_free(feed->last_modified);
+    feed->last_modified = NULL;
+    feed->digest = 0;
+    session->feeds_changed = 1;
+  }
+}
+
+/* hash of all filter patterns, to detect configuration changes between two runs */
+PRIVATE uint64_t getFilterDigest(am_filters filters) {
+  NODE *current = NULL;
+  am_filter filter = NULL;
+  xxh64_state state;
+
+  xxh64_reset(&state, 0);
+  for(current = filters; current && current->data; current = current->next) {
+    filter = (am_filter)current->data;
+    if(filter->pattern) {
+      xxh64_update(&state, filter->pattern, strlen(filter->pattern) + 1);
+    }
+  }
+  return xxh64_digest(&state);
+}
+
+PRIVATE rss_feed* getFeedByID(auto_handle *session, uint16_t id) {
+  NODE *current = session->feeds;
+
+  while(current && current->data) {
+    if(((rss_feed*)current->data)->id == id) {
+      return (rss_feed*)current->data;
+    }
+    current = current->next;
+  }
+  return NULL;
+}
+
 PRIVATE void shutdown_daemon(auto_handle *as) {
+  NODE *current = NULL;
+
+  closing = 1;
   dbg_printft(P_MSG, "Shutting down daemon");
-  if (as && as->bucket_changed) {
+  if (as && as->download_queue &&
+      download_queue_length(as->download_queue) + download_queue_active(as->download_queue) > 0) {
+    /* the feeds have to be fetched completely next time, or the unfinished downloads would be missed */
+    for(current = as->feeds; current && current->data; current = current->next) {
+      resetFeedValidators(as, (rss_feed*)current->data);
+    }
+  }
+  if (as && as->feeds_changed) {
+    feed_cache_save(as->feed_cache, as->feeds, as->filter_digest);
+  }
+  if (as && as->journal) {
+    state_journal_close(as->journal);
+    as->journal = NULL;
+  } else if (as && as->bucket_changed) {
     save_state(as->statefile, as->downloads);
   }
 
   session_free(as);
   SessionID_free();
+  CURLPool_free();
+  trace_close();
   log_close();
   exit(EXIT_SUCCESS);
 }
@@ -214,27 +296,12 @@ PRIVATE int daemonize(void) {
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-PRIVATE void signal_handler(int sig) {
-  switch (sig) {
-    case SIGINT:
-    case SIGTERM: {
-      dbg_printf(P_INFO2, "SIGTERM/SIGINT caught");
-      closing = 1;
-      break;
-    }
-  }
-}
-
-///////////////////////////////////////////////////////////////////////////////////////////////////
-///////////////////////////////////////////////////////////////////////////////////////////////////
-
+/* SIGINT, SIGTERM and SIGHUP are read from the event loop, see onSignal() */
 PRIVATE void setup_signals(void) {
   signal(SIGCHLD, SIG_IGN);       /* ignore child       */
   signal(SIGTSTP, SIG_IGN);       /* ignore tty signals */
   signal(SIGTTOU, SIG_IGN);
   signal(SIGTTIN, SIG_IGN);
-  signal(SIGTERM, signal_handler); /* catch kill signal */
-  signal(SIGINT , signal_handler); /* catch kill signal */
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -258,6 +325,10 @@ auto_handle* session_init(void) {
   ses->max_bucket_items     = AM_DEFAULT_MAXBUCKET;
   ses->bucket_changed       = 0;
   ses->check_interval       = AM_DEFAULT_INTERVAL;
+  ses->min_interval         = 0;
+  ses->max_interval         = 0;
+  ses->max_connections      = AM_DEFAULT_MAXCONNECTIONS;
+  ses->max_host_connections = AM_DEFAULT_MAXHOSTCONNECTIONS;
 
   /* strings */
   ses->download_folder        = get_temp_folder();
@@ -268,12 +339,51 @@ auto_handle* session_init(void) {
   ses->prowl_key             = NULL;
   ses->prowl_key_valid       = 0;
   ses->download_done_script  = NULL;
+  ses->feed_cache            = NULL;
+  ses->control_socket        = NULL;
+  ses->feeds_changed         = 0;
+  ses->filter_digest         = 0;
+  ses->feeds_processed       = 0;
+  ses->feeds_skipped         = 0;
   ses->match_only            = 0;
+  ses->once                  = 0;
+  ses->rounds                = 0;
+  ses->round_checked         = 0;
+  ses->round_processed       = 0;
+  ses->round_skipped         = 0;
+  ses->reload_pending        = 0;
+  ses->started               = time(NULL);
+  ses->downloads_done        = 0;
+  ses->downloads_failed      = 0;
+  ses->metrics_port          = 0;
+  memset(&ses->metrics, 0, sizeof(ses->metrics));
+  memset(&ses->filter_totals, 0, sizeof(ses->filter_totals));
 
   /* lists */
   ses->filters               = NULL;
+  ses->filter_matcher        = NULL;
+  ses->match_cache           = NULL;
   ses->feeds                 = NULL;
-  ses->downloads             = NULL;
+  ses->downloads             = history_new();
+
+  ses->transfers             = NULL;
+  ses->download_queue        = NULL;
+  ses->schedule              = NULL;
+  ses->events                = NULL;
+  ses->feed_timer            = NULL;
+  ses->control               = NULL;
+  ses->max_downloads         = AM_DEFAULT_MAXDOWNLOADS;
+  ses->max_queued_downloads  = AM_DEFAULT_MAXQUEUEDDOWNLOADS;
+  ses->download_segments     = AM_DEFAULT_DOWNLOADSEGMENTS;
+  ses->min_segment_size      = AM_DEFAULT_MINSEGMENTSIZE;
+  ses->download_rate         = 0;
+  ses->rate_windows          = NULL;
+  ses->feeds_pending         = 0;
+
+  ses->journal               = NULL;
+  ses->state_sync            = STATE_SYNC_ALWAYS;
+  ses->journal_size          = AM_DEFAULT_JOURNALSIZE;
+  ses->max_items_per_feed    = 0;
 
   return ses;
 }
@@ -291,9 +401,35 @@ PRIVATE void session_free(auto_handle *as) {
     as->prowl_key = NULL;
     am_free(as->download_done_script);
     as->download_done_script = NULL;
+    am_free(as->feed_cache);
+    as->feed_cache = NULL;
+    am_free(as->control_socket);
+    as->control_socket = NULL;
+    control_server_free(as->control);
+    as->control = NULL;
+    metrics_server_free(as->metrics.server);
+    as->metrics.server = NULL;
+    download_queue_free(as->download_queue);
+    as->download_queue = NULL;
+    web_multi_free(as->transfers);
+    as->transfers = NULL;
+    schedule_free(as->schedule);
+    as->schedule = NULL;
+    /* the transfer engine uses the event loop until it is freed */
+    event_timer_free(as->feed_timer);
+    as->feed_timer = NULL;
+    event_loop_free(as->events);
+    as->events = NULL;
     freeList(&as->feeds, feed_free);
-    freeList(&as->downloads, NULL);
+    history_free(as->downloads);
+    as->downloads = NULL;
+    filter_matcher_free(as->filter_matcher);
+    as->filter_matcher = NULL;
+    match_cache_free(as->match_cache);
+    as->match_cache = NULL;
     freeList(&as->filters, filter_free);
+    freeList(&as->rate_windows, NULL);
+    metrics_free(as->metrics.registry);
     am_free(as);
     as = NULL;
   }
@@ -302,99 +438,1065 @@ PRIVATE void session_free(auto_handle *as) {
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-PRIVATE void processRSSList(auto_handle *session, const simple_list items, uint16_t feedID) {
+PRIVATE uint8_t isFeedDue(const auto_handle *session, time_t now) {
+  return (schedule_count(session->schedule) > 0 && schedule_next_due(session->schedule) <= now) ? 1 : 0;
+}
+
+/* completion callback of the download queue */
+PRIVATE void downloadDone(const download_job *job, HTTPResponse *response, void *userdata) {
+  auto_handle *session = (auto_handle*)userdata;
+  statedb_meta meta;
+
+  /* 206: the download has been resumed */
+  if(response && (response->responseCode == 200 || response->responseCode == 206)) {
+    if(session->prowl_key_valid) {
+      prowl_sendNotification(PROWL_NEW_TRAILER, session->prowl_key, job->name);
+    }
+
+    if(session->download_done_script && *(session->download_done_script))
+    {
+      callDownloadDoneScript(session->download_done_script, job->filename);
+    }
+
+    dbg_printft(P_MSG, "[%d] Download complete: %s (%dMB) (%.2fkB/s)", job->feed_id, basename(job->filename),
+                response->size / 1024 / 1024, response->downloadSpeed / 1024);
+    ++session->downloads_done;
+    metric_add(session->metrics.download_bytes, response->size);
+    metric_observe(session->metrics.download_speed, response->downloadSpeed);
+    /* add url to bucket list */
+    memset(&meta, 0, sizeof(meta));
+    meta.time    = time(NULL);
+    meta.size    = response->size;
+    meta.feed_id = job->feed_id;
+    if (addToBucket(job->url, session->downloads, session->max_bucket_items, &meta) == 0) {
+       session->bucket_changed = 1;
+       if(session->journal) {
+         state_journal_append(session->journal, job->url, &meta);
+       } else {
+         save_state(session->statefile, session->downloads);
+       }
+    }
+  } else {
+    dbg_printft(P_ERROR, "[%d] Error: Download failed: %s (Error Code %d)", job->feed_id, basename(job->filename),
+                response ? response->responseCode : 0);
+    ++session->downloads_failed;
+    if(session->prowl_key_valid) {
+      prowl_sendNotification(PROWL_DOWNLOAD_FAILED, session->prowl_key, job->name);
+    }
+    /* make sure the item is seen again the next time the feed is checked */
+    resetFeedValidators(session, getFeedByID(session, job->feed_id));
+  }
+
+  HTTPResponse_free(response);
+
+  /* feeds that were held back because of the queue length might be able to start now. The timer
+  ** fires once the download queue has moved on to the next job.
+  */
+  if(!closing && isFeedDue(session, time(NULL))) {
+    event_timer_after(session->feed_timer, 0);
+  }
+}
+
+/** \cond */
+struct item_ids {
+  uint64_t *ids;
+  uint32_t  count;
+  uint32_t  size;
+};
+/** \endcond */
+
+PRIVATE void addItemID(struct item_ids *list, uint64_t id) {
+  uint64_t *tmp = NULL;
+
+  if(list->count == list->size) {
+    tmp = am_realloc(list->ids, (list->size > 0 ? list->size * 2 : 64) * sizeof(uint64_t));
+    if(!tmp) {
+      return;
+    }
+    list->ids = tmp;
+    list->size = list->size > 0 ? list->size * 2 : 64;
+  }
+  list->ids[list->count++] = id;
+}
+
+/* items for which nothing is left to do are added to seen (if given), so later polls can skip them */
+PRIVATE void processRSSList(auto_handle *session, const simple_list items, uint16_t feedID, struct item_ids *seen) {
    simple_list current_item = items;
    simple_list current_url = NULL;
    am_filter filter = NULL;
    const char * url;
    char path[4096];
-   HTTPResponse *response = NULL;
+   uint8_t pending;
+   trace_span span;
 
+   TRACE_BEGIN(span, "feed", "processRSSList");
    while(current_item && current_item->data) {
       feed_item item = (feed_item)current_item->data;
       current_url = item->urls;
+      pending = 0;
       while(current_url && current_url->data)
       {
          url = (const char*)current_url->data;
-         if(isMatch(session->filters, url, &filter)) {
+         if(isMatch(session->filter_matcher, url, &filter)) {
+            metric_add(session->metrics.filter_matches, 1);
             if(!session->match_only) {
                get_filename(path, NULL, url, session->download_folder);
-               if (!has_been_downloaded(session->downloads, url) && !file_exists(path)) {
+               if(download_queue_contains(session->download_queue, path)) {
+                 dbg_printf(P_INFO, "File is already queued for download: %s", basename(path));
+                 pending = 1;
+               } else if (!has_been_downloaded(session->downloads, url) && !file_exists(path)) {
                   dbg_printft(P_MSG, "[%d] Found new download: %s (%s)", feedID, item->name, url);
-                  response = downloadFile(url, path, filter->agent);
-                  if(response) {
-                     if(response->responseCode == 200) {
-                        if(session->prowl_key_valid) {
-                           prowl_sendNotification(PROWL_NEW_TRAILER, session->prowl_key, item->name);
-                        }
-
-                        if(session->download_done_script && *(session->download_done_script))
-                        {
-                          callDownloadDoneScript(session->download_done_script, path);
-                        }
-
-                        dbg_printf(P_MSG, "  Download complete (%dMB) (%.2fkB/s)", response->size / 1024 / 1024, response->downloadSpeed / 1024);
-                        /* add url to bucket list */
-                        if (addToBucket(url, &session->downloads, session->max_bucket_items) == 0) {
-                           session->bucket_changed = 1;
-                           save_state(session->statefile, session->downloads);
-                        }
-                     } else {
-                        dbg_printf(P_ERROR, "  Error: Download failed (Error Code %d)", response->responseCode);
-                        if(session->prowl_key_valid) {
-                           prowl_sendNotification(PROWL_DOWNLOAD_FAILED, session->prowl_key, item->name);
-                        }
-                     }
-
-                     HTTPResponse_free(response);
-                  }
+                  download_queue_add(session->download_queue, url, path, filter->agent, item->name, filter->priority,
+                                     feedID, item->urls, (uint64_t)filter->max_speed * 1024);
+                  /* the item is done with once the download has made it into the history */
+                  pending = 1;
                } else {
                  dbg_printf(P_MSG, "File downloaded previously: %s", basename(path));
                }
             } else {
-               dbg_printft(P_MSG, "[%s] Match: %s (%s)", feedID, item->name, url);
+               dbg_printft(P_MSG, "[%d] Match: %s (%s)", feedID, item->name, url);
             }
          }
          current_url = current_url->next;
       }
+      if(!pending && seen) {
+        addItemID(seen, getFeedItemID(item));
+      }
       current_item = current_item->next;
    }
+   TRACE_END_ARG(span, "feed", feedID);
 }
 
-PRIVATE HTTPResponse* getRSSFeed(const rss_feed* feed, CURL **session) {
-  return getHTTPData(feed->url, feed->cookies, session);
+/** \cond */
+struct feed_job {
+  auto_handle *session;
+  rss_feed    *feed;
+  feed_parser *parser;
+  simple_list  items;     /**< items with at least one URL that matches a filter */
+  struct item_ids seen;   /**< items that need no further attention */
+  uint32_t     known;     /**< items that were skipped because they had been seen in an earlier poll */
+  uint32_t     known_run; /**< number of consecutive known items parsed last */
+  double       parse_time; /**< seconds spent parsing the feed (and matching its items) so far */
+  uint8_t      firstrun;
+};
+/** \endcond */
+
+/* remember the validators of a response for the next (conditional) request */
+PRIVATE void updateFeedValidators(auto_handle *session, rss_feed *feed, const HTTPResponse *response) {
+  if(strcmp(feed->etag ? feed->etag : "", response->etag ? response->etag : "") != 0 ||
+     strcmp(feed->last_modified ? feed->last_modified : "", response->last_modified ? response->last_modified : "") != 0) {
+    am_free(feed->etag);
+    feed->etag = am_strdup(response->etag);
+    am_free(feed->last_modified);
+    feed->last_modified = am_strdup(response->last_modified);
+    session->feeds_changed = 1;
+  }
+}
+
+/* the check interval of each feed follows its activity, if max-interval is set */
+PRIVATE void adaptPollInterval(auto_handle *session, rss_feed *feed, uint32_t new_items) {
+  uint32_t shortest = (session->min_interval > 0 ? session->min_interval : session->check_interval) * 60;
+
+  if(session->max_interval > 0 && feed->interval == 0 &&
+     feed_adapt_interval(feed, new_items, time(NULL), shortest, session->max_interval * 60)) {
+    dbg_printf(P_INFO2, "[%d] %d new items, check interval: %d seconds", feed->id, new_items, feed->poll_interval);
+    session->feeds_changed = 1;
+  }
+}
+
+PRIVATE uint16_t processFeed(struct feed_job *job, const HTTPResponse *response) {
+  auto_handle *session = job->session;
+  rss_feed *feed = job->feed;
+  uint32_t item_count = 0;
+
+  if(response->responseCode == 304) {
+    dbg_printf(P_INFO, "[%d] Feed has not been modified", feed->id);
+    item_count = feed->item_count;
+    adaptPollInterval(session, feed, 0);
+    ++session->feeds_skipped;
+    metric_add(session->metrics.feed_not_modified, 1);
+  } else if(response->responseCode == 200 && feed->digest && response->digest == feed->digest) {
+    /* the server doesn't support conditional requests, but sent the same data as last time */
+    dbg_printf(P_INFO, "[%d] Feed content has not changed", feed->id);
+    updateFeedValidators(session, feed, response);
+    item_count = feed->item_count;
+    adaptPollInterval(session, feed, 0);
+    ++session->feeds_skipped;
+    metric_add(session->metrics.feed_unchanged, 1);
+  } else if(response->responseCode == 200) {
+    item_count = feed_parser_item_count(job->parser);
+    if(feed_parser_stopped(job->parser) && feed->item_count > item_count) {
+      /* only part of the feed has been parsed, the last complete count is more accurate */
+      item_count = feed->item_count;
+    }
+    processRSSList(session, job->items, feed->id, &job->seen);
+    dbg_printf(P_INFO2, "[%d] %d items, %d of them known from earlier polls", feed->id, item_count, job->known);
+    /* without the items of an earlier poll, there is no telling which ones are new */
+    if(feed->seen_count > 0) {
+      adaptPollInterval(session, feed, job->seen.count - job->known);
+    }
+    if(feed_set_seen(feed, job->seen.ids, job->seen.count)) {
+      session->feeds_changed = 1;
+    }
+    job->seen.ids = NULL;
+    job->seen.count = job->seen.size = 0;
+    updateFeedValidators(session, feed, response);
+    if(feed->ttl != feed_parser_ttl(job->parser) || feed->skip_hours != feed_parser_skip_hours(job->parser) ||
+       feed->skip_days != feed_parser_skip_days(job->parser)) {
+      feed->ttl = feed_parser_ttl(job->parser);
+      feed->skip_hours = feed_parser_skip_hours(job->parser);
+      feed->skip_days = feed_parser_skip_days(job->parser);
+      session->feeds_changed = 1;
+    }
+    if(feed->item_count != item_count || feed->digest != response->digest) {
+      feed->item_count = item_count;
+      feed->digest = response->digest;
+      session->feeds_changed = 1;
+    }
+    ++session->feeds_processed;
+  } else {
+    metric_add(session->metrics.feed_fetch_errors, 1);
+    return 0;
+  }
+
+  if(job->firstrun) {
+    session->max_bucket_items += item_count;
+    dbg_printf(P_INFO2, "History bucket size changed: %d", session->max_bucket_items);
+  }
+
+  return item_count;
+}
+
+PRIVATE uint8_t isInHistory(const auto_handle *session, const feed_item item) {
+  simple_list current_url = NULL;
+
+  for(current_url = item->urls; current_url && current_url->data; current_url = current_url->next) {
+    if(has_been_downloaded(session->downloads, (const char*)current_url->data)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* newest-first feeds: once a few old items have shown up, the rest of the feed is old as well */
+PRIVATE void checkParserLimits(struct feed_job *job) {
+  const rss_feed *feed = job->feed;
+  uint32_t max_items = feed->max_items > 0 ? feed->max_items : job->session->max_items_per_feed;
+
+  if(feed->stop_after_known > 0 && job->known_run >= feed->stop_after_known) {
+    dbg_printf(P_INFO2, "[%d] %d known items in a row, ignoring the rest of the feed", feed->id, job->known_run);
+    feed_parser_stop(job->parser);
+  } else if(max_items > 0 && feed_parser_item_count(job->parser) >= max_items) {
+    dbg_printf(P_INFO2, "[%d] Parsed %d items, ignoring the rest of the feed", feed->id, max_items);
+    feed_parser_stop(job->parser);
+  }
+}
+
+/* receives the items of a feed while it is downloaded, and keeps only those that are of interest */
+PRIVATE void feedItemParsed(feed_item item, void *userdata) {
+  struct feed_job *job = (struct feed_job*)userdata;
+  simple_list current_url = NULL;
+  am_filter filter = NULL;
+  uint64_t id = getFeedItemID(item);
+  uint8_t seen = feed_has_seen(job->feed, id);
+
+  metric_add(job->session->metrics.feed_items, 1);
+  if(seen || (job->feed->stop_after_known > 0 && isInHistory(job->session, item))) {
+    ++job->known_run;
+  } else {
+    job->known_run = 0;
+  }
+
+  if(seen) {
+    /* nothing has changed about an item that was dealt with before */
+    addItemID(&job->seen, id);
+    ++job->known;
+    freeFeedItem(item);
+  } else {
+    for(current_url = item->urls; current_url && current_url->data; current_url = current_url->next) {
+      if(isMatch(job->session->filter_matcher, (const char*)current_url->data, &filter)) {
+        break;
+      }
+    }
+    if(current_url && current_url->data) {
+      addItem(item, &job->items);
+    } else {
+      addItemID(&job->seen, id);
+      freeFeedItem(item);
+    }
+  }
+
+  checkParserLimits(job);
+}
+
+/* receives the body of a feed while it is downloaded */
+PRIVATE size_t feedDataReceived(const char *data, size_t len, void *userdata) {
+  struct feed_job *job = (struct feed_job*)userdata;
+  double start = metrics_clock();
+
+  feed_parser_push(job->parser, data, len);
+  job->parse_time += metrics_clock() - start;
+  return len;
+}
+
+/* put a feed back into the schedule, due after its interval */
+PRIVATE void scheduleFeed(auto_handle *session, rss_feed *feed) {
+  time_t now = time(NULL);
+  uint32_t interval = session->check_interval * 60;
+  time_t due;
+
+  if(session->max_interval > 0 && feed->poll_interval > 0) {
+    interval = feed->poll_interval;
+  }
+  due = feed_next_check(feed, interval, now, (uint32_t)random());
+
+  if(schedule_add(session->schedule, feed, due) == 0) {
+    dbg_printf(P_INFO2, "[%d] Next check in %ld seconds", feed->id, (long)(due - now));
+  } else {
+    dbg_printf(P_ERROR, "[%d] Unable to schedule the next check of feed '%s'", feed->id, feed->url);
+  }
+}
+
+/* completion callback for feed transfers */
+PRIVATE void feedFetched(HTTPResponse *response, void *userdata) {
+  struct feed_job *job = (struct feed_job*)userdata;
+  auto_handle *session = job->session;
+  trace_span span;
+  double start;
+
+  TRACE_ASYNC_END_ARG("fetch", "fetch", job->feed->id, "dns_us", response ? (int64_t)(response->namelookup_time * 1e6) : -1);
+  if(response && !closing) {
+    dbg_printf(P_INFO2, "[%d] Received %d bytes (response code: %ld)", job->feed->id, response->size, response->responseCode);
+    start = metrics_clock();
+    feed_parser_finish(job->parser);
+    job->parse_time += metrics_clock() - start;
+    metric_observe(session->metrics.feed_fetch_seconds, response->total_time);
+    metric_add(session->metrics.feed_bytes, response->size);
+    if(response->responseCode == 200) {
+      metric_observe(session->metrics.feed_parse_seconds, job->parse_time);
+    }
+    TRACE_BEGIN(span, "feed", "processFeed");
+    processFeed(job, response);
+    TRACE_END_ARG(span, "feed", job->feed->id);
+    job->feed->max_age = response->max_age;
+  } else if(!closing) {
+    metric_add(session->metrics.feed_fetch_errors, 1);
+  }
+  scheduleFeed(session, job->feed);
+
+  --session->feeds_pending;
+  HTTPResponse_free(response);
+  feed_parser_free(job->parser);
+  freeList(&job->items, freeFeedItem);
+  am_free(job->seen.ids);
+  am_free(job);
+
+  startFeeds(session);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
-PRIVATE uint16_t processFeed(auto_handle *session, rss_feed* feed, uint8_t firstrun) {
-  HTTPResponse *response = NULL;
-  CURL         *curl_session = NULL;
-  uint32_t item_count = 0;
-  response = getRSSFeed(feed, &curl_session);
-  dbg_printf(P_INFO2, "[processFeed] curl_session=%p", (void*)curl_session);
+/* apply the bandwidth limit for the current time of the day */
+PRIVATE void updateDownloadRate(auto_handle *session) {
+  time_t now = time(NULL);
+  struct tm now_tm;
+  uint64_t rate;
+
+  localtime_r(&now, &now_tm);
+  rate = rate_schedule_lookup(session->rate_windows, (uint64_t)session->download_rate * 1024,
+                              (uint16_t)(now_tm.tm_hour * 60 + now_tm.tm_min));
+  if(rate != web_multi_get_rate(session->transfers)) {
+    web_multi_set_rate(session->transfers, rate);
+    if(rate > 0) {
+      dbg_printft(P_INFO, "Download rate limited to %llukB/s", (unsigned long long)(rate / 1024));
+    } else {
+      dbg_printft(P_INFO, "Download rate unlimited");
+    }
+  }
+}
+
+/* all feeds that were due have been checked */
+PRIVATE void finishRound(auto_handle *session) {
+  const filter_matcher_stats *stats = NULL;
+
+  dbg_printf(P_INFO, "Checked %d feeds: %d processed, %d unchanged (total: %d processed, %d unchanged)",
+             session->round_checked, session->feeds_processed - session->round_processed,
+             session->feeds_skipped - session->round_skipped, session->feeds_processed, session->feeds_skipped);
+
+  stats = filter_matcher_get_stats(session->filter_matcher);
+  if(stats) {
+    dbg_printf(P_INFO2, "Filters: %llu URLs checked, %llu answered from the cache, %llu rejected by the literal prefilter, %llu regex runs",
+               (unsigned long long)stats->urls, (unsigned long long)stats->cache_hits,
+               (unsigned long long)stats->prefilter_rejects, (unsigned long long)stats->regex_runs);
+  }
 
-  if(!curl_session && response != NULL) {
-    dbg_printf(P_ERROR, "curl_session == NULL but response != NULL");
-    abort();
+  if(session->feeds_changed && feed_cache_save(session->feed_cache, session->feeds, session->filter_digest) == 0) {
+    session->feeds_changed = 0;
   }
+  if(session->rounds == 0) {
+    dbg_printf(P_INFO2, "New bucket size: %d", session->max_bucket_items);
+  }
+  state_journal_sync(session->journal);
+
+  TRACE_ASYNC_END_ARG("cycle", "cycle", session->rounds, "feeds", session->round_checked);
+  trace_flush();
+  ++session->rounds;
+  session->round_checked = 0;
+}
 
-  if (response) {
-    if(response->responseCode == 200 && response->data) {
-      simple_list items = parse_xmldata(response->data, response->size, &item_count, &feed->ttl);
-      if(firstrun) {
-        session->max_bucket_items += item_count;
-        dbg_printf(P_INFO2, "History bucket size changed: %d", session->max_bucket_items);
+/* keep the counters of a filter matcher that is about to be replaced */
+PRIVATE void addFilterStats(filter_matcher_stats *totals, const filter_matcher_stats *stats) {
+  if(stats) {
+    totals->urls += stats->urls;
+    totals->prefilter_rejects += stats->prefilter_rejects;
+    totals->regex_runs += stats->regex_runs;
+    totals->cache_hits += stats->cache_hits;
+  }
+}
+
+/* take the feed with the given URL out of a list */
+PRIVATE rss_feed* takeFeed(rss_feeds *feeds, const char *url) {
+  NODE **pos = NULL;
+  NODE *node = NULL;
+  rss_feed *feed = NULL;
+
+  for(pos = feeds; *pos && (*pos)->data; pos = &(*pos)->next) {
+    feed = (rss_feed*)(*pos)->data;
+    if(!strcmp(feed->url, url)) {
+      node = *pos;
+      *pos = node->next;
+      am_free(node);
+      return feed;
+    }
+  }
+  return NULL;
+}
+
+PRIVATE void replaceString(char **dst, char **src) {
+  am_free(*dst);
+  *dst = *src;
+  *src = NULL;
+}
+
+/* read the configuration file again and apply it to the running session. Feeds that are still in the
+** configuration keep their state. Must not be called while feeds are being checked.
+*/
+PRIVATE int reloadConfig(auto_handle *session) {
+  auto_handle *conf = NULL;
+  filter_matcher *matcher = NULL;
+  NODE *current = NULL;
+  rss_feed *feed = NULL, *old = NULL;
+  uint32_t added = 0, removed = 0;
+  uint32_t i, old_count;
+  uint16_t *ids = NULL;
+  uint64_t digest;
+
+  assert(session->feeds_pending == 0);
+
+  session->reload_pending = 0;
+  dbg_printft(P_MSG, "Reloading config file '%s'", AutoConfigFile);
+
+  conf = session_init();
+  if(parse_config_file(conf, AutoConfigFile) != 0 || listCount(conf->feeds) == 0 || listCount(conf->filters) == 0 ||
+     (matcher = filter_matcher_new(conf->filters)) == NULL) {
+    dbg_printf(P_ERROR, "Error: Unable to reload '%s', keeping the current configuration", AutoConfigFile);
+    session_free(conf);
+    return -1;
+  }
+
+  /* the match cache refers to the old filters */
+  addFilterStats(&session->filter_totals, filter_matcher_get_stats(session->filter_matcher));
+  filter_matcher_free(session->filter_matcher);
+  match_cache_free(session->match_cache);
+  freeList(&session->filters, filter_free);
+  session->filters = conf->filters;
+  conf->filters = NULL;
+  session->filter_matcher = matcher;
+  session->match_cache = match_cache_new(AM_DEFAULT_MATCHCACHESIZE);
+  filter_matcher_set_cache(session->filter_matcher, session->match_cache);
+
+  /* the feeds are numbered anew, the downloads of a feed have to follow its ID */
+  old_count = listCount(session->feeds);
+  ids = am_malloc((old_count > 0 ? old_count : 1) * sizeof(uint16_t));
+  for(i = 0; ids && i < old_count; ++i) {
+    ids[i] = DOWNLOAD_NO_FEED;
+  }
+
+  for(current = conf->feeds; current && current->data; current = current->next) {
+    feed = (rss_feed*)current->data;
+    old = takeFeed(&session->feeds, feed->url);
+    if(old) {
+      if(ids && old->id < old_count) {
+        ids[old->id] = feed->id;
       }
-      processRSSList(session, items, feed->id);
-      freeList(&items, freeFeedItem);
+      old->id = feed->id;
+      replaceString(&old->cookies, &feed->cookies);
+      old->stop_after_known = feed->stop_after_known;
+      old->max_items = feed->max_items;
+      old->interval = feed->interval;
+      current->data = old;
+      feed_free(feed);
+    } else {
+      dbg_printf(P_INFO, "[%d] New feed: %s", feed->id, feed->url);
+      schedule_add(session->schedule, feed, time(NULL));
+      ++added;
     }
-    HTTPResponse_free(response);
-    closeCURLSession(curl_session);
+  }
+  for(current = session->feeds; current && current->data; current = current->next) {
+    feed = (rss_feed*)current->data;
+    dbg_printf(P_INFO, "Removed feed: %s", feed->url);
+    schedule_remove(session->schedule, feed);
+    ++removed;
+  }
+  freeList(&session->feeds, feed_free);
+  session->feeds = conf->feeds;
+  conf->feeds = NULL;
+  download_queue_remap_feeds(session->download_queue, ids, old_count);
+  am_free(ids);
+
+  /* items of unchanged feeds might match the new filters */
+  digest = getFilterDigest(session->filters);
+  if(digest != session->filter_digest) {
+    for(current = session->feeds; current && current->data; current = current->next) {
+      feed = (rss_feed*)current->data;
+      resetFeedValidators(session, feed);
+      feed_set_seen(feed, NULL, 0);
+    }
+    session->filter_digest = digest;
+  }
+  session->feeds_changed = 1;
+
+  session->check_interval = conf->check_interval;
+  session->min_interval = conf->min_interval;
+  session->max_interval = conf->max_interval;
+  session->max_items_per_feed = conf->max_items_per_feed;
+  replaceString(&session->download_folder, &conf->download_folder);
+  replaceString(&session->download_done_script, &conf->download_done_script);
+  if(strcmp(session->prowl_key ? session->prowl_key : "", conf->prowl_key ? conf->prowl_key : "") != 0) {
+    replaceString(&session->prowl_key, &conf->prowl_key);
+    session->prowl_key_valid = (session->prowl_key && verifyProwlAPIKey(session->prowl_key)) ? 1 : 0;
   }
 
-  return item_count;
+  session->max_downloads = conf->max_downloads;
+  session->max_queued_downloads = conf->max_queued_downloads;
+  download_queue_set_limits(session->download_queue, session->max_downloads, session->max_queued_downloads);
+  session->download_segments = conf->download_segments;
+  session->min_segment_size = conf->min_segment_size;
+  download_queue_set_segments(session->download_queue, session->download_segments,
+                              (uint64_t)session->min_segment_size * 1024 * 1024);
+  session->download_rate = conf->download_rate;
+  freeList(&session->rate_windows, NULL);
+  session->rate_windows = conf->rate_windows;
+  conf->rate_windows = NULL;
+  updateDownloadRate(session);
+
+  if(strcmp(session->statefile, conf->statefile) != 0 || session->max_connections != conf->max_connections ||
+     session->max_host_connections != conf->max_host_connections || session->state_sync != conf->state_sync ||
+     session->journal_size != conf->journal_size || session->metrics_port != conf->metrics_port) {
+    dbg_printf(P_MSG, "Changes of the state file, the connection limits, the journal settings and the metrics port take effect after a restart");
+  }
+
+  dbg_printf(P_MSG, "%d feed URLs (%d new, %d removed)", listCount(session->feeds), added, removed);
+  dbg_printf(P_MSG, "Read %d filters from config file", listCount(session->filters));
+  session_free(conf);
+  return 0;
+}
+
+/* fetch the feeds that are due concurrently, as far as the download queue and the connection limits permit.
+** Each feed is processed as soon as it has been received.
+*/
+PRIVATE void startFeeds(auto_handle *session) {
+  time_t now = time(NULL);
+  rss_feed *feed = NULL;
+  struct feed_job *job = NULL;
+  HTTPRequest req;
+
+  if(session->reload_pending && session->feeds_pending == 0) {
+    reloadConfig(session);
+  }
+
+  /* hold back new feed requests while the download queue is too deep, or while the
+  ** transfer engine is still busy with the requests queued so far
+  */
+  while(!closing && !(session->once && session->rounds > 0) && isFeedDue(session, now) &&
+        !download_queue_throttled(session->download_queue) &&
+        web_multi_queued(session->transfers) < session->max_connections) {
+    feed = (rss_feed*)schedule_pop_due(session->schedule, now);
+    if(session->round_checked == 0 && session->feeds_pending == 0) {
+      dbg_printft(P_INFO, "------ Checking for new trailers ------");
+      TRACE_ASYNC_BEGIN("cycle", "cycle", session->rounds);
+      session->round_processed = session->feeds_processed;
+      session->round_skipped = session->feeds_skipped;
+    }
+    ++session->round_checked;
+    dbg_printf(P_INFO2, "Checking feed %d ...", session->round_checked);
+
+    job = am_malloc(sizeof(struct feed_job));
+    if(!job) {
+      dbg_printf(P_ERROR, "[startFeeds] malloc(feed_job) failed!");
+      scheduleFeed(session, feed);
+      continue;
+    }
+    job->session  = session;
+    job->feed     = feed;
+    job->items    = NULL;
+    job->seen.ids = NULL;
+    job->seen.count = job->seen.size = 0;
+    job->known    = 0;
+    job->known_run = 0;
+    job->parse_time = 0;
+    job->firstrun = session->rounds == 0;
+    job->parser   = feed_parser_new(feedItemParsed, job);
+    if(!job->parser) {
+      dbg_printf(P_ERROR, "[%d] Unable to create a parser for feed '%s'", feed->id, feed->url);
+      am_free(job);
+      scheduleFeed(session, feed);
+      continue;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.url           = feed->url;
+    req.cookies       = feed->cookies;
+    req.etag          = feed->etag;
+    req.last_modified = feed->last_modified;
+    req.write_func    = feedDataReceived;
+    req.write_data    = job;
+    TRACE_ASYNC_BEGIN("fetch", "fetch", feed->id);
+    if(web_multi_add(session->transfers, &req, feedFetched, job) == 0) {
+      ++session->feeds_pending;
+    } else {
+      dbg_printf(P_ERROR, "[%d] Unable to queue feed '%s'", feed->id, feed->url);
+      TRACE_ASYNC_END("fetch", "fetch", feed->id);
+      feed_parser_free(job->parser);
+      am_free(job);
+      scheduleFeed(session, feed);
+    }
+  }
+
+  if(session->feeds_pending == 0 && session->round_checked > 0) {
+    finishRound(session);
+  }
+
+  /* feeds that are due but held back are started as soon as a feed or a download has finished */
+  if(closing || schedule_count(session->schedule) == 0 || isFeedDue(session, now)) {
+    event_timer_stop(session->feed_timer);
+  } else {
+    event_timer_at(session->feed_timer, schedule_next_due(session->schedule));
+  }
+}
+
+PRIVATE void onFeedTimer(event_timer *timer, void *userdata) {
+  (void)timer;
+  startFeeds((auto_handle*)userdata);
+}
+
+PRIVATE void onSignal(int sig, void *userdata) {
+  auto_handle *session = (auto_handle*)userdata;
+
+  dbg_printf(P_INFO2, "Signal %d caught", sig);
+  if(sig == SIGHUP) {
+    /* feeds that are being checked still refer to the current configuration */
+    session->reload_pending = 1;
+    startFeeds(session);
+  } else {
+    closing = 1;
+  }
+}
+
+/* path of the control socket: the configured one, or one next to the state file (NULL if it is disabled) */
+PRIVATE char* getControlSocket(const auto_handle *session) {
+  char *path = NULL;
+
+  if(session->control_socket) {
+    return *session->control_socket ? am_strdup(session->control_socket) : NULL;
+  }
+  path = am_malloc(strlen(session->statefile) + 6);
+  if(path) {
+    sprintf(path, "%s.sock", session->statefile);
+  }
+  return path;
+}
+
+PRIVATE void formatDuration(char *buf, size_t size, long seconds) {
+  if(seconds < 0) {
+    seconds = 0;
+  }
+  if(seconds >= 3600) {
+    snprintf(buf, size, "%ldh %02ldm", seconds / 3600, (seconds % 3600) / 60);
+  } else if(seconds >= 60) {
+    snprintf(buf, size, "%ldm %02lds", seconds / 60, seconds % 60);
+  } else {
+    snprintf(buf, size, "%lds", seconds);
+  }
+}
+
+PRIVATE int parseID(const char *str, uint32_t *id) {
+  char *end = NULL;
+  unsigned long value;
+
+  errno = 0;
+  value = strtoul(str, &end, 10);
+  if(errno != 0 || end == str || *end != '\0' || *str == '-' || value > UINT32_MAX) {
+    return -1;
+  }
+  *id = (uint32_t)value;
+  return 0;
+}
+
+/* make a feed due right away. Returns 0 if the feed is being checked at the moment */
+PRIVATE uint8_t pollFeedNow(auto_handle *session, rss_feed *feed, time_t now) {
+  if(schedule_remove(session->schedule, feed) != 0) {
+    return 0;
+  }
+  /* the regular checks continue one interval after this one */
+  feed->slot = 0;
+  if(schedule_add(session->schedule, feed, now) != 0) {
+    dbg_printf(P_ERROR, "[%d] Unable to schedule the next check of feed '%s'", feed->id, feed->url);
+    return 0;
+  }
+  return 1;
+}
+
+PRIVATE void cmdPoll(auto_handle *session, control_client *client, int argc, char **argv) {
+  time_t now = time(NULL);
+  NODE *current = NULL;
+  rss_feed *feed = NULL;
+  uint32_t id, count = 0;
+
+  if(argc > 1) {
+    if(parseID(argv[1], &id) != 0 || id > UINT16_MAX || (feed = getFeedByID(session, (uint16_t)id)) == NULL) {
+      control_reply_error(client, "Unknown feed: %s", argv[1]);
+      return;
+    }
+    if(!pollFeedNow(session, feed, now)) {
+      control_reply_error(client, "Feed %d is being checked right now", feed->id);
+      return;
+    }
+    count = 1;
+  } else {
+    for(current = session->feeds; current && current->data; current = current->next) {
+      count += pollFeedNow(session, (rss_feed*)current->data, now);
+    }
+  }
+
+  dbg_printft(P_INFO, "%d feeds are checked on request", count);
+  startFeeds(session);
+  if(download_queue_throttled(session->download_queue)) {
+    control_reply_ok(client, "%d feeds due, held back until the download queue has drained", count);
+  } else {
+    control_reply_ok(client, "%d feeds due", count);
+  }
+}
+
+PRIVATE void cmdFeeds(auto_handle *session, control_client *client, int argc, char **argv) {
+  time_t now = time(NULL), due;
+  uint32_t i, count = listCount(session->feeds);
+  rss_feed *feed = NULL;
+  char next[32];
+
+  (void)argc;
+  (void)argv;
+
+  for(i = 0; i < count; ++i) {
+    feed = getFeedByID(session, (uint16_t)i);
+    if(!feed) {
+      continue;
+    }
+    due = schedule_due(session->schedule, feed);
+    if(due == 0) {
+      snprintf(next, sizeof(next), "checking");
+    } else if(due <= now) {
+      snprintf(next, sizeof(next), "due");
+    } else {
+      formatDuration(next, sizeof(next), (long)(due - now));
+    }
+    control_reply(client, "%-3d %-9s %s", feed->id, next, feed->url);
+  }
+  control_reply_ok(client, NULL);
+}
+
+PRIVATE void cmdList(auto_handle *session, control_client *client, int argc, char **argv) {
+  const download_job *job = NULL;
+  uint8_t paused = download_queue_paused(session->download_queue);
+
+  (void)argc;
+  (void)argv;
+
+  for(job = download_queue_running(session->download_queue); job; job = job->next) {
+    control_reply(client, "#%-4d running  feed %-3d priority %-3d %s", job->id, job->feed_id, job->priority,
+                  basename(job->filename));
+  }
+  for(job = download_queue_waiting(session->download_queue); job; job = job->next) {
+    control_reply(client, "#%-4d %-8s feed %-3d priority %-3d %s", job->id, paused ? "paused" : "waiting",
+                  job->feed_id, job->priority, basename(job->filename));
+  }
+  control_reply_ok(client, "%d running, %d waiting%s", download_queue_active(session->download_queue),
+                   download_queue_length(session->download_queue), paused ? " (paused)" : "");
+}
+
+PRIVATE void cmdCancel(auto_handle *session, control_client *client, int argc, char **argv) {
+  uint32_t id;
+
+  (void)argc;
+
+  if(argv[1][0] == '#') {
+    ++argv[1];
+  }
+  if(parseID(argv[1], &id) != 0 || download_queue_cancel(session->download_queue, id) != 0) {
+    control_reply_error(client, "No such download: %s", argv[1]);
+    return;
+  }
+  control_reply_ok(client, "Download #%d cancelled", id);
+}
+
+PRIVATE void cmdPause(auto_handle *session, control_client *client, int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  download_queue_pause(session->download_queue, 1);
+  control_reply_ok(client, "Downloads paused (%d waiting)", download_queue_length(session->download_queue));
+}
+
+PRIVATE void cmdResume(auto_handle *session, control_client *client, int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  download_queue_pause(session->download_queue, 0);
+  control_reply_ok(client, "Downloads resumed (%d running, %d waiting)", download_queue_active(session->download_queue),
+                   download_queue_length(session->download_queue));
+}
+
+PRIVATE void cmdReload(auto_handle *session, control_client *client, int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+
+  if(session->feeds_pending > 0) {
+    session->reload_pending = 1;
+    control_reply_ok(client, "The configuration is reloaded once %d running feed checks are done", session->feeds_pending);
+    return;
+  }
+  if(reloadConfig(session) != 0) {
+    control_reply_error(client, "Unable to reload '%s', keeping the current configuration", AutoConfigFile);
+    return;
+  }
+  startFeeds(session);
+  control_reply_ok(client, "Configuration reloaded: %d feeds, %d filters", listCount(session->feeds),
+                   listCount(session->filters));
+}
+
+PRIVATE void cmdStats(auto_handle *session, control_client *client, int argc, char **argv) {
+  const filter_matcher_stats *stats = filter_matcher_get_stats(session->filter_matcher);
+  uint64_t rate = web_multi_get_rate(session->transfers);
+  time_t now = time(NULL);
+  char duration[32];
+
+  (void)argc;
+  (void)argv;
+
+  control_reply(client, "version: %s", LONG_VERSION_STRING);
+  formatDuration(duration, sizeof(duration), (long)(now - session->started));
+  control_reply(client, "uptime: %s", duration);
+  control_reply(client, "feeds: %d", listCount(session->feeds));
+  control_reply(client, "feeds being checked: %d", session->feeds_pending);
+  if(schedule_count(session->schedule) > 0) {
+    formatDuration(duration, sizeof(duration), (long)(schedule_next_due(session->schedule) - now));
+    control_reply(client, "next check: %s", duration);
+  }
+  control_reply(client, "rounds: %d", session->rounds);
+  control_reply(client, "feeds processed: %d", session->feeds_processed);
+  control_reply(client, "feeds unchanged: %d", session->feeds_skipped);
+  control_reply(client, "downloads running: %d", download_queue_active(session->download_queue));
+  control_reply(client, "downloads waiting: %d", download_queue_length(session->download_queue));
+  control_reply(client, "downloads paused: %s", download_queue_paused(session->download_queue) ? "yes" : "no");
+  control_reply(client, "downloads completed: %d", session->downloads_done);
+  control_reply(client, "downloads failed: %d", session->downloads_failed);
+  if(rate > 0) {
+    control_reply(client, "download rate: %llukB/s", (unsigned long long)(rate / 1024));
+  } else {
+    control_reply(client, "download rate: unlimited");
+  }
+  control_reply(client, "history entries: %llu", (unsigned long long)history_count(session->downloads));
+  if(stats) {
+    control_reply(client, "filter URLs checked: %llu", (unsigned long long)stats->urls);
+    control_reply(client, "filter cache hits: %llu", (unsigned long long)stats->cache_hits);
+    control_reply(client, "filter prefilter rejects: %llu", (unsigned long long)stats->prefilter_rejects);
+    control_reply(client, "filter regex runs: %llu", (unsigned long long)stats->regex_runs);
+  }
+  control_reply_ok(client, NULL);
+}
+
+PRIVATE void cmdMetrics(auto_handle *session, control_client *client, int argc, char **argv) {
+  char *text = metrics_render(session->metrics.registry, NULL);
+  char *line = NULL, *saveptr = NULL;
+
+  (void)argc;
+  (void)argv;
+
+  if(!text) {
+    control_reply_error(client, "Metrics are not available");
+    return;
+  }
+  for(line = strtok_r(text, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+    control_reply(client, "%s", line);
+  }
+  am_free(text);
+  control_reply_ok(client, NULL);
+}
+
+PRIVATE void cmdHelp(auto_handle *session, control_client *client, int argc, char **argv);
+
+/** \cond */
+struct control_command {
+  const char *name;
+  const char *args;
+  uint8_t     min_args;
+  uint8_t     max_args;
+  void      (*run)(auto_handle *session, control_client *client, int argc, char **argv);
+  const char *help;
+};
+
+PRIVATE const struct control_command controlCommands[] = {
+  { "poll",    "[feed]", 0, 1, cmdPoll,    "check all feeds (or the given one) right away" },
+  { "feeds",   "",       0, 0, cmdFeeds,   "list the feeds and the time of their next check" },
+  { "list",    "",       0, 0, cmdList,    "list the running and waiting downloads" },
+  { "cancel",  "<id>",   1, 1, cmdCancel,  "cancel a download and delete its partial file" },
+  { "pause",   "",       0, 0, cmdPause,   "stop all downloads until they are resumed" },
+  { "resume",  "",       0, 0, cmdResume,  "continue the paused downloads" },
+  { "reload",  "",       0, 0, cmdReload,  "read the config file again" },
+  { "stats",   "",       0, 0, cmdStats,   "show counters and the state of the daemon" },
+  { "metrics", "",       0, 0, cmdMetrics, "show the metrics in the OpenMetrics text format" },
+  { "help",    "",       0, 0, cmdHelp,    "show this list" },
+  { NULL, NULL, 0, 0, NULL, NULL }
+};
+/** \endcond */
+
+PRIVATE void cmdHelp(auto_handle *session, control_client *client, int argc, char **argv) {
+  const struct control_command *cmd = NULL;
+
+  (void)session;
+  (void)argc;
+  (void)argv;
+
+  for(cmd = controlCommands; cmd->name; ++cmd) {
+    control_reply(client, "%-7s %-6s  %s", cmd->name, cmd->args, cmd->help);
+  }
+  control_reply_ok(client, NULL);
+}
+
+/* command received on the control socket */
+PRIVATE void onControlCommand(control_client *client, int argc, char **argv, void *userdata) {
+  const struct control_command *cmd = NULL;
+
+  for(cmd = controlCommands; cmd->name; ++cmd) {
+    if(!strcmp(cmd->name, argv[0])) {
+      if(argc - 1 < cmd->min_args || argc - 1 > cmd->max_args) {
+        control_reply_error(client, "usage: %s %s", cmd->name, cmd->args);
+      } else {
+        cmd->run((auto_handle*)userdata, client, argc, argv);
+      }
+      return;
+    }
+  }
+  control_reply_error(client, "Unknown command '%s' (see 'help')", argv[0]);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** \cond */
+PRIVATE const double fetchBuckets[] = { 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60 };
+PRIVATE const double parseBuckets[] = { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1 };
+PRIVATE const double speedBuckets[] = { 65536, 131072, 262144, 524288, 1048576, 2097152, 4194304,
+                                        8388608, 16777216, 33554432, 67108864 };
+/** \endcond */
+
+/* values that are kept elsewhere, taken over right before the metrics are rendered */
+PRIVATE void collectMetrics(metrics *registry, void *userdata) {
+  auto_handle *session = (auto_handle*)userdata;
+  struct am_metrics *m = &session->metrics;
+  const filter_matcher_stats *stats = filter_matcher_get_stats(session->filter_matcher);
+
+  (void)registry;
+
+  metric_set_count(m->filter_checks, session->filter_totals.urls + (stats ? stats->urls : 0));
+  metric_set_count(m->filter_regex_runs, session->filter_totals.regex_runs + (stats ? stats->regex_runs : 0));
+  metric_set_count(m->downloads_done, session->downloads_done);
+  metric_set_count(m->downloads_failed, session->downloads_failed);
+  metric_set(m->downloads_running, download_queue_active(session->download_queue));
+  metric_set(m->downloads_waiting, download_queue_length(session->download_queue));
+  metric_set(m->history_entries, (double)history_count(session->downloads));
+  metric_set(m->resident_memory, (double)metrics_resident_memory());
+  metric_set(m->start_time, (double)session->started);
+}
+
+PRIVATE void setupMetrics(auto_handle *session) {
+  struct am_metrics *m = &session->metrics;
+  metrics *r = metrics_new();
+
+  m->registry = r;
+  if(!r) {
+    return;
+  }
+  m->feed_fetch_seconds = metrics_histogram(r, "trailermatic_feed_fetch_duration_seconds", "Time it took to fetch a feed",
+                                            fetchBuckets, sizeof(fetchBuckets) / sizeof(fetchBuckets[0]));
+  m->feed_fetch_errors  = metrics_counter(r, "trailermatic_feed_fetch_errors", "Feed checks that failed");
+  m->feed_bytes         = metrics_counter(r, "trailermatic_feed_received_bytes", "Bytes of feed data received");
+  m->feed_not_modified  = metrics_counter(r, "trailermatic_feed_not_modified", "Feed checks answered with 304 Not Modified");
+  m->feed_unchanged     = metrics_counter(r, "trailermatic_feed_unchanged", "Feed checks that returned the same content as the previous one");
+  m->feed_parse_seconds = metrics_histogram(r, "trailermatic_feed_parse_duration_seconds", "Time spent parsing a feed and matching its items",
+                                            parseBuckets, sizeof(parseBuckets) / sizeof(parseBuckets[0]));
+  m->feed_items         = metrics_counter(r, "trailermatic_feed_items", "Feed items parsed");
+  m->filter_checks      = metrics_counter(r, "trailermatic_filter_checks", "URLs checked against the filters");
+  m->filter_regex_runs  = metrics_counter(r, "trailermatic_filter_regex_evaluations", "Regular expressions evaluated");
+  m->filter_matches     = metrics_counter(r, "trailermatic_filter_matches", "URLs of new feed items that matched a filter");
+  m->downloads_done     = metrics_counter(r, "trailermatic_downloads_completed", "Downloads that completed");
+  m->downloads_failed   = metrics_counter(r, "trailermatic_downloads_failed", "Downloads that failed");
+  m->download_bytes     = metrics_counter(r, "trailermatic_download_bytes", "Size of the completed downloads");
+  m->download_speed     = metrics_histogram(r, "trailermatic_download_speed_bytes_per_second", "Average speed of the completed downloads",
+                                            speedBuckets, sizeof(speedBuckets) / sizeof(speedBuckets[0]));
+  m->downloads_running  = metrics_gauge(r, "trailermatic_downloads_running", "Downloads in progress");
+  m->downloads_waiting  = metrics_gauge(r, "trailermatic_downloads_waiting", "Downloads waiting in the queue");
+  m->history_entries    = metrics_gauge(r, "trailermatic_history_entries", "Entries of the download history");
+  m->resident_memory    = metrics_gauge(r, "process_resident_memory_bytes", "Resident memory size in bytes");
+  m->start_time         = metrics_gauge(r, "process_start_time_seconds", "Start time of the process since the epoch in seconds");
+  metrics_set_collect(r, collectMetrics, session);
+}
+
+/* "trailermatic ctl <command>": hand a command to the running daemon */
+PRIVATE int controlClient(const char *config_file, int argc, char **argv) {
+  auto_handle *session = NULL;
+  char command[CONTROL_MAX_LINE];
+  char *path = NULL;
+  size_t len = 0;
+  int i, result = -1;
+
+  if(argc < 1) {
+    fprintf(stderr, "usage: trailermatic [-c file] ctl <command> [args]  (see 'trailermatic ctl help')\n");
+    return EXIT_FAILURE;
+  }
+
+  command[0] = '\0';
+  for(i = 0; i < argc; ++i) {
+    if(len + strlen(argv[i]) + 2 > sizeof(command)) {
+      fprintf(stderr, "Command too long\n");
+      return EXIT_FAILURE;
+    }
+    len += sprintf(command + len, "%s%s", i > 0 ? " " : "", argv[i]);
+  }
+
+  session = session_init();
+  if(parse_config_file(session, config_file) != 0) {
+    fprintf(stderr, "Error parsing config file: Cannot find file '%s'\n", config_file);
+  } else if((path = getControlSocket(session)) == NULL) {
+    fprintf(stderr, "The control socket is disabled in '%s'\n", config_file);
+  } else {
+    result = control_send(path, command);
+  }
+
+  am_free(path);
+  session_free(session);
+  return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 PRIVATE uint16_t processFile(auto_handle *session, const char* xmlfile) {
@@ -412,7 +1514,7 @@ PRIVATE uint16_t processFile(auto_handle *session, const char* xmlfile) {
     items = parse_xmldata(xmldata, fileLen, &item_count, &dummy_ttl);
     session->max_bucket_items += item_count;
     dbg_printf(P_INFO2, "History bucket size changed: %d", session->max_bucket_items);
-    processRSSList(session, items, 0);
+    processRSSList(session, items, 0, NULL);
     freeList(&items, freeFeedItem);
     am_free(xmldata);
   }
@@ -428,14 +1530,16 @@ int main(int argc, char **argv) {
   char *config_file = NULL;
   char *logfile = NULL;
   char *xmlfile = NULL;
+  char *import_file = NULL;
+  char *trace_file = NULL;
+  char *control_socket = NULL;
   char erbuf[100];
-  NODE *current = NULL;
-  uint32_t count = 0;
-  uint8_t first_run = 1;
   uint8_t once = 0;
   uint8_t verbose = AM_DEFAULT_VERBOSE;
   uint8_t append_log = 0;
   uint8_t match_only = 0;
+  NODE *current = NULL;
+  const int handled_signals[] = { SIGINT, SIGTERM, SIGHUP };
 
   /* this sets the log level to the default before anything else is done.
   ** This way, if any outputting happens in readargs(), it'll be printed
@@ -443,7 +1547,11 @@ int main(int argc, char **argv) {
   */
   log_init(NULL, verbose, 0);
 
-  readargs(argc, argv, &config_file, &logfile, &xmlfile, &nofork, &verbose, &once, &append_log, &match_only);
+  readargs(argc, argv, &config_file, &logfile, &xmlfile, &nofork, &verbose, &once, &append_log, &match_only, &import_file, &trace_file);
+
+  if(optind < argc && !strcmp(argv[optind], "ctl")) {
+    return controlClient(config_file ? config_file : AM_DEFAULT_CONFIGFILE, argc - optind - 1, argv + optind + 1);
+  }
 
   /* reinitialize the logging with the values from the command line */
   log_init(logfile, verbose, append_log);
@@ -479,6 +1587,11 @@ int main(int argc, char **argv) {
     dbg_printft( P_MSG, "Daemon started");
   }
 
+  /* after the fork, so the trace carries the process ID of the daemon */
+  if(trace_file && trace_open(trace_file, (uint64_t)AM_DEFAULT_TRACESIZE * 1024 * 1024) != 0) {
+    dbg_printf(P_ERROR, "Error: Unable to write a trace to '%s'", trace_file);
+  }
+
   filter_printList(session->filters);
 
   dbg_printf(P_MSG, "Trailermatic version: %s", LONG_VERSION_STRING);
@@ -486,6 +1599,18 @@ int main(int argc, char **argv) {
   dbg_printf(P_INFO, "foreground mode: %s", nofork == 1 ? "yes" : "no");
   dbg_printf(P_INFO, "config file: %s", AutoConfigFile);
   dbg_printf(P_INFO, "check interval: %d min", session->check_interval);
+  if(session->max_interval > 0) {
+    dbg_printf(P_INFO, "adaptive check interval: %d to %d min", session->min_interval > 0 ? session->min_interval : session->check_interval,
+               session->max_interval);
+  }
+  dbg_printf(P_INFO, "connections: %d (%d per host)", session->max_connections, session->max_host_connections);
+  dbg_printf(P_INFO, "parallel downloads: %d (polling throttled at %d queued)", session->max_downloads, session->max_queued_downloads);
+  if(session->download_segments > 1) {
+    dbg_printf(P_INFO, "segmented downloads: up to %d segments of at least %dMB", session->download_segments, session->min_segment_size);
+  }
+  if(session->download_rate > 0 || session->rate_windows) {
+    dbg_printf(P_INFO, "download rate: %dkB/s (%d time windows)", session->download_rate, listCount(session->rate_windows));
+  }
   dbg_printf(P_INFO, "download folder: %s", session->download_folder);
   dbg_printf(P_INFO, "state file: %s", session->statefile);
   dbg_printf(P_MSG,  "%d feed URLs", listCount(session->feeds));
@@ -495,6 +1620,14 @@ int main(int argc, char **argv) {
     dbg_printf(P_INFO, "Prowl API key: %s", session->prowl_key);
   }
 
+  if(import_file) {
+    load_state(session->statefile, session->downloads);
+    if(import_state(import_file, session->statefile, session->downloads) < 0) {
+      dbg_printf(P_ERROR, "Error: Unable to import '%s'", import_file);
+    }
+    shutdown_daemon(session);
+  }
+
   if(listCount(session->feeds) == 0) {
     dbg_printf(P_ERROR, "No feed URL specified in trailermatic.conf!\n");
     shutdown_daemon(session);
@@ -505,36 +1638,97 @@ int main(int argc, char **argv) {
     shutdown_daemon(session);
   }
 
+  session->filter_matcher = filter_matcher_new(session->filters);
+  if(!session->filter_matcher) {
+    dbg_printf(P_ERROR, "Error: Unable to prepare the filters. Aborting...");
+    shutdown_daemon(session);
+  }
+
+  /* most items of a feed are the same as in the previous cycle */
+  session->match_cache = match_cache_new(AM_DEFAULT_MATCHCACHESIZE);
+  filter_matcher_set_cache(session->filter_matcher, session->match_cache);
+
   /* check if Prowl API key is given, and if it is valid */
   if(session->prowl_key && verifyProwlAPIKey(session->prowl_key) ) {
     session->prowl_key_valid = 1;
   }
 
-  load_state(session->statefile, &session->downloads);
-  while(!closing) {
+  /* a single thread drives the transfers, the feed checks and the signals */
+  session->events = event_loop_new();
+  session->transfers = web_multi_new(session->max_connections, session->max_host_connections);
+  if(session->events && session->transfers && web_multi_attach(session->transfers, session->events) == 0) {
+    session->feed_timer = event_timer_new(session->events, onFeedTimer, session);
+    event_loop_signals(session->events, handled_signals, sizeof(handled_signals) / sizeof(handled_signals[0]),
+                       onSignal, session);
+    session->download_queue = download_queue_new(session->transfers, session->max_downloads,
+                                                 session->max_queued_downloads, downloadDone, session);
+    download_queue_set_segments(session->download_queue, session->download_segments,
+                                (uint64_t)session->min_segment_size * 1024 * 1024);
+  }
+  if(!session->transfers || !session->download_queue || !session->feed_timer) {
+    dbg_printf(P_ERROR, "Error: Unable to initialize the transfer engine. Aborting...");
+    shutdown_daemon(session);
+  }
+  setupMetrics(session);
+
+  load_state(session->statefile, session->downloads);
+  session->feed_cache = am_malloc(strlen(session->statefile) + 7);
+  if(session->feed_cache) {
+    sprintf(session->feed_cache, "%s.feeds", session->statefile);
+    session->filter_digest = getFilterDigest(session->filters);
+    feed_cache_load(session->feed_cache, session->feeds, session->filter_digest);
+  }
+  /* all feeds are due right away */
+  session->schedule = schedule_new();
+  if(!session->schedule) {
+    dbg_printf(P_ERROR, "Error: Unable to create the feed schedule. Aborting...");
+    shutdown_daemon(session);
+  }
+  for(current = session->feeds; current && current->data; current = current->next) {
+    schedule_add(session->schedule, current->data, time(NULL));
+  }
+  srandom((unsigned int)(time(NULL) ^ getpid()));
+
+  session->journal = state_journal_open(session->statefile, session->downloads, session->state_sync, session->journal_size * 1024);
+  if(!session->journal) {
+    dbg_printf(P_ERROR, "Unable to open the state journal, the complete state is saved after each download");
+  }
+  if(xmlfile && *xmlfile) {
     dbg_printft( P_INFO, "------ Checking for new trailers ------");
-     if(xmlfile && *xmlfile) {
-       processFile(session, xmlfile);
-       once = 1;
-    } else {
-      current = session->feeds;
-      count = 0;
-      while(current && current->data) {
-        ++count;
-        dbg_printf(P_INFO2, "Checking feed %d ...", count);
-        processFeed(session, current->data, first_run);
-        current = current->next;
+    processFile(session, xmlfile);
+    session->once = 1;
+    session->rounds = 1;
+  } else {
+    session->once = once;
+    if(!once && (control_socket = getControlSocket(session)) != NULL) {
+      session->control = control_server_new(session->events, control_socket, onControlCommand, session);
+      if(session->control) {
+        dbg_printf(P_INFO, "control socket: %s", control_socket);
+      } else {
+        dbg_printf(P_ERROR, "Unable to open the control socket '%s'", control_socket);
       }
-      if(first_run) {
-        dbg_printf(P_INFO2, "New bucket size: %d", session->max_bucket_items);
+      am_free(control_socket);
+    }
+    if(!once && session->metrics_port > 0) {
+      session->metrics.server = metrics_server_new(session->events, session->metrics_port, session->metrics.registry);
+      if(session->metrics.server) {
+        dbg_printf(P_INFO, "metrics: http://127.0.0.1:%d/metrics", session->metrics_port);
+      } else {
+        dbg_printf(P_ERROR, "Unable to serve the metrics on port %d", session->metrics_port);
       }
-      first_run = 0;
     }
+    startFeeds(session);
+  }
+
+  while(!closing) {
     /* leave loop when program is only supposed to run once */
-    if(once) {
+    if(session->once && session->rounds > 0 && session->feeds_pending == 0 &&
+       web_multi_pending(session->transfers) == 0) {
       break;
     }
-    sleep(session->check_interval * 60);
+    updateDownloadRate(session);
+    /* wake up once a minute for the time windows of the download rate */
+    event_loop_run(session->events, 60000);
   }
   shutdown_daemon(session);
   return 0;
@@ -559,6 +1753,10 @@ PRIVATE void callDownloadDoneScript(const char* scriptname, const char* filename
 
     if (!fork ())
     {
+      /* the event loop blocks some signals, which the script shouldn't inherit */
+      sigset_t mask;
+      sigemptyset (&mask);
+      sigprocmask (SIG_SETMASK, &mask, NULL);
       if (execvp (scriptname, cmd) == -1)
         dbg_printf(P_ERROR, "error executing script \"%s\": %d", cmd[0], errno);
 
@@ -31,28 +31,46 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
 #include <stdio.h>
 #include <time.h>
 #include <ctype.h>
 #include <curl/curl.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 
 #include "web.h"
+#include "event_loop.h"
+#include "hash.h"
+#include "list.h"
 #include "output.h"
+#include "partfile.h"
+#include "ratelimit.h"
 #include "regex.h"
+#include "trace.h"
 #include "urlcode.h"
 #include "utils.h"
 
 /** \cond */
 #define DATA_BUFFER_SIZE 1024 * 100
 #define HEADER_BUFFER 500
+#define HANDLE_POOL_SIZE 16
 /** \endcond */
 
 PRIVATE char *gSessionID = NULL;
 
 PRIVATE uint8_t gbGlobalInitDone = FALSE;
 
+/** share object for the DNS cache, TLS sessions and (if supported) the connection cache of all handles */
+PRIVATE CURLSH *gShare = NULL;
+
+/** easy handles that have been used before, ready for the next transfer */
+PRIVATE CURL   *gHandlePool[HANDLE_POOL_SIZE];
+PRIVATE uint32_t gHandlePoolCount = 0;
+
 /** Generic struct storing data and the size of the contained data */
 typedef struct HTTPData {
  char   *data;  /**< Stored data */
@@ -64,9 +82,20 @@ typedef struct HTTPData {
 typedef struct WebData {
   char      *url;              /**< URL of the WebData object */
   long       responseCode;     /**< HTTP response code        */
-  size_t     content_length;   /**< size of the received data determined through header field "Content-Length" */
+  uint64_t   content_length;   /**< size of the received data determined through header field "Content-Length" */
+  uint8_t    accept_ranges;    /**< value of the header field "Accept-Ranges" is "bytes" */
   char      *content_filename; /**< name of the downloaded file determined through header field "Content-Length" */
+  char      *etag;             /**< value of the header field "ETag" */
+  char      *last_modified;    /**< value of the header field "Last-Modified" */
+  int32_t    max_age;          /**< "max-age" of the header field "Cache-Control" (-1: none) */
+  time_t     expires;          /**< value of the header field "Expires" (0: none) */
+  time_t     date;             /**< value of the header field "Date" (0: none) */
   HTTPData  *response;         /**< HTTP response in a HTTPData object */
+  xxh64_state body_hash;       /**< hash of the body, updated while it is received */
+  web_data_func sink;          /**< (optional) function that consumes the body instead of buffering it */
+  void      *sink_data;
+  uint8_t    buffered;         /**< keep the body in \a response (not set for downloads into a file) */
+  uint8_t    isMoveHeader;     /**< set while the headers of a redirection response are received */
 } WebData;
 
 
@@ -75,6 +104,56 @@ PUBLIC void SessionID_free(void) {
    gSessionID = NULL;
 }
 
+/* copy the value of a header line, without leading whitespace and the trailing line break */
+PRIVATE char* getHeaderValue(const char *value, size_t len) {
+  while(len > 0 && (*value == ' ' || *value == '\t')) {
+    ++value;
+    --len;
+  }
+  while(len > 0 && isspace((unsigned char)value[len - 1])) {
+    --len;
+  }
+  return len > 0 ? am_strndup(value, len) : NULL;
+}
+
+/* freshness lifetime from the directives of a "Cache-Control" header (-1 if there is none) */
+PRIVATE int32_t getMaxAge(const char *value) {
+  const char *pos;
+  long max_age;
+
+  for(pos = value; pos && *pos; ++pos) {
+    if(!strncasecmp(pos, "no-cache", 8) || !strncasecmp(pos, "no-store", 8)) {
+      return 0;
+    }
+  }
+
+  pos = value;
+  while(pos && (pos = strchr(pos, '=')) != NULL) {
+    /* "max-age", but not "s-maxage" which only concerns shared caches */
+    if(pos - value >= 7 && !strncasecmp(pos - 7, "max-age", 7)) {
+      max_age = strtol(pos + 1 + (pos[1] == '"'), NULL, 10);
+      return max_age < 0 ? 0 : (max_age > INT32_MAX ? INT32_MAX : (int32_t)max_age);
+    }
+    ++pos;
+  }
+  return -1;
+}
+
+/* freshness lifetime of a response in seconds, from "Cache-Control" or "Expires" (-1 if the server didn't say) */
+PRIVATE int32_t getFreshness(const WebData *data) {
+  time_t now;
+  long lifetime;
+
+  if(data->max_age >= 0) {
+    return data->max_age;
+  } else if(data->expires > 0) {
+    now = data->date > 0 ? data->date : time(NULL);
+    lifetime = (long)(data->expires - now);
+    return lifetime < 0 ? 0 : (lifetime > INT32_MAX ? INT32_MAX : (int32_t)lifetime);
+  }
+  return -1;
+}
+
 PRIVATE size_t write_header_callback(void *ptr, size_t size, size_t nmemb, void *data) {
   size_t       line_len = size * nmemb;
   WebData     *mem  = (WebData*)data;
@@ -82,29 +161,35 @@ PRIVATE size_t write_header_callback(void *ptr, size_t size, size_t nmemb, void
   char        *tmp  = NULL;
   char        *filename = NULL;
   const char  *content_pattern = "Content-Disposition:\\s(inline|attachment);\\s+filename=\"?(.+?)\"?;?\\r?\\n?$";
-  int          content_length = 0;
-  static uint8_t isMoveHeader = 0;
+  uint64_t     content_length = 0;
 
   /* check the header if it is a redirection header */
   if(line_len >= 9 && !memcmp(line, "Location:", 9)) {
-    isMoveHeader = 1;
+    mem->isMoveHeader = 1;
     if(mem->response->data != NULL) {
       am_free(mem->response->data);
+      mem->response->data = NULL;
+      mem->response->buffer_size = 0;
+      mem->response->buffer_pos = 0;
       mem->content_length = 0;
     }
-  } else if(line_len >= 15 && !memcmp(line, "Content-Length:", 15)) {
-  /* parse header for Content-Length to allocate correct size for data->response->data */
-    tmp = getRegExMatch("Content-Length:\\s(\\d+)", line, 1);
-    if(tmp != NULL) {
+  } else if(line_len >= 15 && !strncasecmp(line, "Content-Length:", 15)) {
+  /* parse header for Content-Length to allocate correct size for data->response->data
+  ** (HTTP/2 sends the names of header fields in lower case)
+  */
+    tmp = getHeaderValue(line + 15, line_len - 15);
+    if(tmp != NULL && isdigit((unsigned char)*tmp)) {
       dbg_printf(P_INFO2, "Content-Length: %s", tmp);
-      content_length = atoi(tmp);
-      if(content_length > 0 && !isMoveHeader) {
+      content_length = strtoull(tmp, NULL, 10);
+      if(content_length > 0 && !mem->isMoveHeader) {
         mem->content_length = content_length;
+      }
+      if(content_length > 0 && !mem->isMoveHeader && mem->buffered && !mem->sink) {
         mem->response->buffer_size = content_length + 1;
         mem->response->data = am_realloc(mem->response->data, mem->response->buffer_size);
       }
-      am_free(tmp);
     }
+    am_free(tmp);
   } else if(line_len >= 19 && !memcmp(line, "Content-Disposition", 19)) {
     /* parse header for Content-Disposition to get correct filename */
     filename = getRegExMatch(content_pattern, line, 2);
@@ -112,9 +197,48 @@ PRIVATE size_t write_header_callback(void *ptr, size_t size, size_t nmemb, void
       mem->content_filename = filename;
       dbg_printf(P_INFO2, "[write_header_callback] Found filename: %s", mem->content_filename);
     }
+  } else if(line_len >= 5 && !strncasecmp(line, "ETag:", 5)) {
+    am_free(mem->etag);
+    mem->etag = getHeaderValue(line + 5, line_len - 5);
+  } else if(line_len >= 14 && !strncasecmp(line, "Last-Modified:", 14)) {
+    am_free(mem->last_modified);
+    mem->last_modified = getHeaderValue(line + 14, line_len - 14);
+  } else if(line_len >= 14 && !strncasecmp(line, "Cache-Control:", 14)) {
+    tmp = getHeaderValue(line + 14, line_len - 14);
+    mem->max_age = getMaxAge(tmp);
+    am_free(tmp);
+  } else if(line_len >= 8 && !strncasecmp(line, "Expires:", 8)) {
+    tmp = getHeaderValue(line + 8, line_len - 8);
+    /* invalid dates (like "0") mean "already expired" */
+    mem->expires = tmp ? curl_getdate(tmp, NULL) : 0;
+    if(mem->expires <= 0) {
+      mem->expires = 1;
+    }
+    am_free(tmp);
+  } else if(line_len >= 5 && !strncasecmp(line, "Date:", 5)) {
+    tmp = getHeaderValue(line + 5, line_len - 5);
+    mem->date = tmp ? curl_getdate(tmp, NULL) : 0;
+    if(mem->date < 0) {
+      mem->date = 0;
+    }
+    am_free(tmp);
+  } else if(line_len >= 14 && !strncasecmp(line, "Accept-Ranges:", 14)) {
+    tmp = getHeaderValue(line + 14, line_len - 14);
+    mem->accept_ranges = (tmp && !strcasecmp(tmp, "bytes")) ? 1 : 0;
+    am_free(tmp);
+  } else if(line_len >= 5 && !memcmp(line, "HTTP/", 5)) {
+    /* status line: the validators of a previous response (e.g. a redirection) don't apply */
+    mem->accept_ranges = 0;
+    mem->max_age = -1;
+    mem->expires = 0;
+    mem->date = 0;
+    am_free(mem->etag);
+    mem->etag = NULL;
+    am_free(mem->last_modified);
+    mem->last_modified = NULL;
   } else if(line_len >= 2 && !memcmp(line, "\r\n", 2)) {
     /* We're at the end of a header, reaset the relocation flag */
-    isMoveHeader = 0;
+    mem->isMoveHeader = 0;
   }
 
   return line_len;
@@ -127,6 +251,17 @@ PRIVATE size_t write_data_callback(void *ptr, size_t size, size_t nmemb, void *d
   size_t line_len = size * nmemb;
   WebData *mem = data;
 
+  xxh64_update(&mem->body_hash, ptr, line_len);
+
+  /* a sink consumes the body as it arrives, nothing is buffered */
+  if(mem->sink) {
+    if(mem->sink((const char*)ptr, line_len, mem->sink_data) != line_len) {
+      return 0;
+    }
+    mem->response->buffer_pos += line_len;
+    return line_len;
+  }
+
   /**
    * if content-length detection in write_header_callback was not successful, mem->response->data will be NULL
    * as a fallback, allocate a predefined size of memory and realloc if necessary
@@ -194,6 +329,8 @@ PRIVATE void WebData_free(struct WebData *data) {
   if(data) {
     am_free(data->url);
     am_free(data->content_filename);
+    am_free(data->etag);
+    am_free(data->last_modified);
     HTTPData_free(data->response);
     am_free(data);
     data = NULL;
@@ -218,8 +355,19 @@ PRIVATE struct WebData* WebData_new(const char *url) {
 
   data->url = NULL;
   data->content_filename = NULL;
-  data->content_length = -1;
+  data->etag = NULL;
+  data->last_modified = NULL;
+  data->max_age = -1;
+  data->expires = 0;
+  data->date = 0;
+  data->content_length = 0;
+  data->accept_ranges = 0;
   data->response = NULL;
+  data->isMoveHeader = 0;
+  data->sink = NULL;
+  data->sink_data = NULL;
+  data->buffered = 1;
+  xxh64_reset(&data->body_hash, 0);
 
   if(url) {
     data->url = am_strdup((char*)url);
@@ -241,6 +389,15 @@ PRIVATE void WebData_clear(struct WebData *data) {
   if(data) {
     am_free(data->content_filename);
     data->content_filename = NULL;
+    am_free(data->etag);
+    data->etag = NULL;
+    am_free(data->last_modified);
+    data->last_modified = NULL;
+    data->max_age = -1;
+    data->expires = 0;
+    data->date = 0;
+    data->isMoveHeader = 0;
+    xxh64_reset(&data->body_hash, 0);
 
     if(data->response) {
       am_free(data->response->data);
@@ -254,14 +411,22 @@ PRIVATE void WebData_clear(struct WebData *data) {
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
-PRIVATE HTTPResponse* HTTPResponse_new(void) {
+PUBLIC HTTPResponse* HTTPResponse_new(void) {
   HTTPResponse* resp = (HTTPResponse*)am_malloc(sizeof(struct HTTPResponse));
   if(resp) {
     resp->size = 0;
     resp->responseCode = 0;
     resp->data = NULL;
     resp->content_filename = NULL;
+    resp->etag = NULL;
+    resp->last_modified = NULL;
+    resp->max_age = -1;
+    resp->digest = 0;
     resp->downloadSpeed = 0;
+    resp->total_time = 0;
+    resp->namelookup_time = 0;
+    resp->content_length = 0;
+    resp->accept_ranges = 0;
   }
   return resp;
 }
@@ -273,6 +438,8 @@ PUBLIC void HTTPResponse_free(struct HTTPResponse *response) {
   if(response) {
     am_free(response->data);
     am_free(response->content_filename);
+    am_free(response->etag);
+    am_free(response->last_modified);
     am_free(response);
   }
 }
@@ -280,8 +447,60 @@ PUBLIC void HTTPResponse_free(struct HTTPResponse *response) {
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+PRIVATE void am_curl_global_init(void) {
+  if(gbGlobalInitDone == FALSE) {
+    curl_global_init(CURL_GLOBAL_ALL);
+    gbGlobalInitDone = TRUE;
+  }
+
+  if(!gShare) {
+    /* no lock functions needed, all transfers run in the same thread */
+    gShare = curl_share_init();
+    if(gShare) {
+      curl_share_setopt(gShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+      curl_share_setopt(gShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+      curl_share_setopt(gShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    }
+  }
+}
+
+/** \brief Free all pooled curl handles and the shared caches
+ *
+ * Must be called after all transfers have finished, i.e. after the last web_multi object has been freed.
+ */
+PUBLIC void CURLPool_free(void) {
+  while(gHandlePoolCount > 0) {
+    curl_easy_cleanup(gHandlePool[--gHandlePoolCount]);
+  }
+
+  if(gShare) {
+    curl_share_cleanup(gShare);
+    gShare = NULL;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
 PRIVATE CURL* am_curl_init(uint8_t isPost) {
-  CURL * curl = curl_easy_init();
+  CURL * curl = NULL;
+
+  if(gHandlePoolCount > 0) {
+    /* a reset handle keeps its connections and caches */
+    curl = gHandlePool[--gHandlePoolCount];
+    curl_easy_reset(curl);
+  } else {
+    curl = curl_easy_init();
+    if(!curl) {
+      return NULL;
+    }
+  }
+
+  if(gShare) {
+    curl_easy_setopt(curl, CURLOPT_SHARE, gShare);
+  }
 
   curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L );
   curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
@@ -301,7 +520,7 @@ PRIVATE CURL* am_curl_init(uint8_t isPost) {
 #else
   curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "" );
 #endif
-  dbg_printf(P_INFO2, "[am_curl_init] Created new curl session %p", (void*)curl);
+  dbg_printf(P_INFO2, "[am_curl_init] Using curl session %p", (void*)curl);
 
   return curl;
 }
@@ -309,93 +528,47 @@ PRIVATE CURL* am_curl_init(uint8_t isPost) {
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
+/* completion callback of downloadFile() */
+PRIVATE void downloadFinished(HTTPResponse *response, void *userdata) {
+  *(HTTPResponse**)userdata = response;
+}
+
 /** \brief Download a file from a given URL
 *
 * \param[in] url URL of the object to download
+* \param[in] filename Path to where the file shall be saved
+* \param[in] useragent (Optional) User-Agent string
 * \return a HTTPResponse object containing the response code.
 *
-* getHTTPData() attempts to download the file pointed to by \a url and stores the content in a WebData object.
+* downloadFile() blocks until the file pointed to by \a url has been stored in \a filename.
 * The function returns \c NULL if the download failed.
 */
 
 PUBLIC HTTPResponse* downloadFile(const char *url, const char *filename, const char *useragent) {
-  CURLcode      res;
-  CURL         *curl_handle = NULL;
-  char         *escaped_url = NULL;
+  web_multi    *m = NULL;
   HTTPResponse *resp = NULL;
-  long responseCode = -1;
-  FILE *stream = NULL;
-  double downloadSize;
-  double downloadSpeed;  
+  HTTPRequest   req;
+  trace_span    span;
 
   if(!url || !filename) {
     return NULL;
   }
 
-  dbg_printf(P_INFO2, "[getHTTPData] url=%s", url);
-  if(gbGlobalInitDone == FALSE) {
-    curl_global_init(CURL_GLOBAL_ALL);
-    gbGlobalInitDone = TRUE;
-  }
-
-  curl_handle = am_curl_init(FALSE);
-
-  if(!curl_handle)
-  {
-    dbg_printf(P_ERROR, "curl_handle is uninitialized!");
-  }
-
-  if(filename && *filename) {
-    stream = fopen(filename, "wb");
-    if(stream == NULL) {
-      dbg_printf(P_ERROR, "Cannot open '%s' for writing: %s", filename, strerror(errno));
-    }
-  }
-
-  if(curl_handle && stream)
-  {
-    escaped_url = url_encode_whitespace(url);
-    assert(escaped_url);
-    resp = HTTPResponse_new();
-    curl_easy_setopt(curl_handle, CURLOPT_URL, escaped_url);
-    curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, NULL);
-    curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, stream);
-
-    if(useragent && *useragent) {
-      curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, useragent);
-    }
-
-    res = curl_easy_perform(curl_handle);
-
-    curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &responseCode);
-    curl_easy_getinfo(curl_handle, CURLINFO_SIZE_DOWNLOAD, &downloadSize);
-    curl_easy_getinfo(curl_handle, CURLINFO_SPEED_DOWNLOAD, &downloadSpeed);
-    dbg_printf(P_INFO2, "[getHTTPData] response code: %d", responseCode);
-    if(res != 0) {
-        dbg_printf(P_ERROR, "[getHTTPData] '%s': %s (retval: %d)", url, curl_easy_strerror(res), res);
-    } else {
-      /* Only the very first connection attempt (where curl_session == NULL) should store the session,
-      ** and only the last one should close the session.
-      */
-      resp->responseCode = responseCode;
-      resp->size = (size_t)downloadSize;
-      resp->downloadSpeed = downloadSpeed; 
+  TRACE_BEGIN(span, "download", "downloadFile");
+  m = web_multi_new(1, 1);
+  if(m) {
+    memset(&req, 0, sizeof(req));
+    req.url = url;
+    req.filename = filename;
+    req.useragent = useragent;
+    if(web_multi_add(m, &req, downloadFinished, &resp) == 0) {
+      while(web_multi_perform(m, 1000) > 0) {
+        /* NOTHING */
+      }
     }
-
-    am_free(escaped_url);
-  }
-  else
-  {
-    resp = NULL;
-  }
-
-  if(curl_handle != NULL) {
-    closeCURLSession(curl_handle);
-  }
-
-  if(stream != NULL) {
-    fclose(stream);
+    web_multi_free(m);
   }
+  TRACE_END_ARG(span, "bytes", resp ? resp->size : 0);
 
   return resp;
 }
@@ -420,6 +593,7 @@ PUBLIC HTTPResponse* getHTTPData(const char *url, const char *cookies, CURL ** c
   WebData      *data = NULL;
   HTTPResponse *resp = NULL;
   long responseCode = -1;
+  trace_span    span;
 
   if(!url) {
     return NULL;
@@ -431,12 +605,11 @@ PUBLIC HTTPResponse* getHTTPData(const char *url, const char *cookies, CURL ** c
     return NULL;
   }
 
+  TRACE_BEGIN(span, "http", "getHTTPData");
+
   dbg_printf(P_INFO2, "[getHTTPData] url=%s, curl_session=%p", url, (void*)session);
   if(session == NULL) {
-    if(gbGlobalInitDone == FALSE) {
-      curl_global_init(CURL_GLOBAL_ALL);
-      gbGlobalInitDone = TRUE;
-    }
+    am_curl_global_init();
     session = am_curl_init(FALSE);
     *curl_session = session;
   }
@@ -472,6 +645,8 @@ PUBLIC HTTPResponse* getHTTPData(const char *url, const char *cookies, CURL ** c
       */
       resp = HTTPResponse_new();
       resp->responseCode = responseCode;
+      curl_easy_getinfo(curl_handle, CURLINFO_TOTAL_TIME, &resp->total_time);
+      curl_easy_getinfo(curl_handle, CURLINFO_NAMELOOKUP_TIME, &resp->namelookup_time);
       //copy data if present
       if(data->response->data) {
         resp->size = data->response->buffer_pos;
@@ -481,6 +656,10 @@ PUBLIC HTTPResponse* getHTTPData(const char *url, const char *cookies, CURL ** c
       if(data->content_filename) {
         resp->content_filename = am_strdup(data->content_filename);
       }
+      resp->etag = am_strdup(data->etag);
+      resp->last_modified = am_strdup(data->last_modified);
+      resp->max_age = getFreshness(data);
+      resp->digest = xxh64_digest(&data->body_hash);
     }
     am_free(escaped_url);
   } else {
@@ -488,6 +667,7 @@ PUBLIC HTTPResponse* getHTTPData(const char *url, const char *cookies, CURL ** c
     resp = NULL;
   }
   WebData_free(data);
+  TRACE_END_ARG(span, "status", resp ? resp->responseCode : -1);
   return resp;
 }
 
@@ -524,10 +704,7 @@ PUBLIC HTTPResponse* sendHTTPData(const char *url, const void *data, uint32_t da
     WebData_clear(response_data);
 
     if( curl_handle == NULL) {
-      if(gbGlobalInitDone == FALSE) {
-        curl_global_init(CURL_GLOBAL_ALL);
-        gbGlobalInitDone = TRUE;
-      }
+      am_curl_global_init();
       if( ( curl_handle = am_curl_init(TRUE) ) ) {
         curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, write_data_callback);
         curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, write_header_callback);
@@ -590,10 +767,991 @@ PUBLIC HTTPResponse* sendHTTPData(const char *url, const void *data, uint32_t da
   return resp;
 }
 
+/** \brief Hand a curl session back to the pool
+ *
+ * \param[in] curl_handle curl session created by one of the functions of this module
+ *
+ * The handle is kept for later transfers, so that its connections survive. Only if the pool is full,
+ * the handle is closed.
+ */
 PUBLIC void closeCURLSession(CURL* curl_handle) {
   if(curl_handle) {
-    dbg_printf(P_INFO2, "[closeCURLSession] Closing curl session %p", (void*)curl_handle);
-    curl_easy_cleanup(curl_handle);
-    curl_handle = NULL;
+    if(gHandlePoolCount < HANDLE_POOL_SIZE) {
+      dbg_printf(P_INFO2, "[closeCURLSession] Returning curl session %p to the pool", (void*)curl_handle);
+      gHandlePool[gHandlePoolCount++] = curl_handle;
+    } else {
+      dbg_printf(P_INFO2, "[closeCURLSession] Closing curl session %p", (void*)curl_handle);
+      curl_easy_cleanup(curl_handle);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/** \cond */
+typedef struct web_transfer web_transfer;
+
+struct web_transfer {
+  web_transfer  *next;         /**< next transfer in the queue (or the list of running transfers) */
+  CURL          *curl;
+  WebData       *data;
+  FILE          *stream;       /**< target file of a download (NULL for in-memory transfers) */
+  char          *filename;
+  char          *part_file;    /**< file the download is written to until it is complete */
+  char          *range;        /**< byte range to request */
+  uint8_t        head_only;
+  uint8_t        shaped;       /**< subject to the bandwidth limit of the web_multi object */
+  uint8_t        paused;       /**< waiting for a token bucket to be refilled */
+  token_bucket  *bucket;       /**< bucket shared by all shaped transfers */
+  token_bucket   limit;        /**< bandwidth limit of this transfer */
+  size_t       (*write_func)(void *ptr, size_t size, size_t nmemb, void *data); /**< body handler of a shaped transfer */
+  void          *write_data;
+  uint64_t       resume_from;  /**< number of bytes a resumed download started with */
+  uint64_t       written;      /**< number of bytes written to the file by this transfer */
+  uint8_t        body_started;
+  uint8_t        discard_body; /**< the body is an error page and not stored */
+  char          *cookies;
+  char          *useragent;
+  char          *host;
+  struct curl_slist *headers;  /**< additional request headers (conditional GET) */
+  web_done_func  done;
+  void          *userdata;
+};
+
+struct host_slot {
+  char     *name;
+  uint16_t  active;
+};
+
+struct web_multi {
+  CURLM        *multi;
+  web_transfer *queue_head;    /**< transfers waiting for a free connection slot */
+  web_transfer *queue_tail;
+  web_transfer *running;       /**< transfers currently in flight */
+  uint32_t      queued;
+  uint32_t      active;
+  uint16_t      max_total;     /**< maximum number of concurrent transfers */
+  uint16_t      max_per_host;  /**< maximum number of concurrent transfers to the same host */
+  simple_list   hosts;         /**< list of host_slot items */
+  token_bucket  bucket;        /**< bandwidth limit of the shaped transfers */
+  event_loop   *loop;          /**< event loop that drives the transfers (NULL: web_multi_perform() does) */
+  event_timer  *timer;         /**< wakes up curl, starts queued transfers and resumes paused ones */
+  int64_t       curl_timeout;  /**< time (ms) at which curl wants to be woken up (-1: not at all) */
+  uint64_t      resume_at;     /**< time (ms) at which the next paused transfer may continue (0: none is paused) */
+  uint8_t       dispatch_pending; /**< transfers have been queued since the last dispatch */
+};
+/** \endcond */
+
+PRIVATE uint64_t getMilliseconds(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+PRIVATE char* getURLHost(const char *url) {
+  const char *start, *end, *at;
+
+  start = strstr(url, "://");
+  start = start ? start + 3 : url;
+  end = start + strcspn(start, "/?#");
+
+  /* skip login information ("user:password@host") */
+  at = memchr(start, '@', end - start);
+  if(at) {
+    start = at + 1;
+  }
+
+  end = start + strcspn(start, ":/?#");
+  return am_strndup(start, end - start);
+}
+
+PRIVATE struct host_slot* getHostSlot(web_multi *m, const char *host) {
+  NODE *current = m->hosts;
+  struct host_slot *slot = NULL;
+
+  while(current && current->data) {
+    slot = (struct host_slot*)current->data;
+    if(strcasecmp(slot->name, host) == 0) {
+      return slot;
+    }
+    current = current->next;
+  }
+
+  slot = am_malloc(sizeof(struct host_slot));
+  if(slot) {
+    slot->name = am_strdup(host);
+    slot->active = 0;
+    addItem(slot, &m->hosts);
+  }
+  return slot;
+}
+
+PRIVATE void host_slot_free(void *listItem) {
+  struct host_slot *slot = (struct host_slot*)listItem;
+
+  if(slot) {
+    am_free(slot->name);
+    am_free(slot);
+  }
+}
+
+PRIVATE struct curl_slist* appendHeader(struct curl_slist *headers, const char *name, const char *value) {
+  char *line = am_malloc(strlen(name) + strlen(value) + 3);
+  struct curl_slist *result = headers;
+
+  if(line) {
+    sprintf(line, "%s: %s", name, value);
+    result = curl_slist_append(headers, line);
+    if(!result) {
+      result = headers;
+    }
+    am_free(line);
+  }
+  return result;
+}
+
+PRIVATE void web_transfer_free(web_transfer *t) {
+  if(t) {
+    closeCURLSession(t->curl);
+    if(t->headers) {
+      curl_slist_free_all(t->headers);
+    }
+    if(t->stream) {
+      fclose(t->stream);
+    }
+    WebData_free(t->data);
+    am_free(t->filename);
+    am_free(t->part_file);
+    am_free(t->range);
+    am_free(t->useragent);
+    am_free(t->cookies);
+    am_free(t->host);
+    am_free(t);
+  }
+}
+
+/* open the partial file of a download, and continue where a previous attempt stopped if possible */
+PRIVATE uint8_t web_transfer_open_file(web_transfer *t) {
+  part_info info;
+  struct stat st;
+  const char *validator = NULL;
+  uint64_t offset = 0;
+
+  t->part_file = part_file_name(t->filename);
+  if(!t->part_file) {
+    return FALSE;
+  }
+
+  if(part_info_load(t->part_file, &info) == 0 && (validator = part_info_validator(&info, t->data->url)) != NULL &&
+     stat(t->part_file, &st) == 0 && st.st_size > 0) {
+    offset = (uint64_t)st.st_size;
+    if((info.offset > 0 || info.segment_count > 0) && info.offset < offset) {
+      /* drop data that was written after the information had been saved, or beyond the first gap
+      ** of a segmented download */
+      offset = (truncate(t->part_file, (off_t)info.offset) == 0) ? info.offset : 0;
+    }
+    if(offset > 0 && (t->stream = fopen(t->part_file, "ab")) != NULL) {
+      t->resume_from = offset;
+      t->headers = appendHeader(t->headers, "If-Range", validator);
+      dbg_printf(P_INFO, "Resuming download of '%s' at byte %llu", t->filename, (unsigned long long)offset);
+      if(info.segment_count > 0) {
+        /* the segments don't apply anymore */
+        am_free(info.segments);
+        info.segments = NULL;
+        info.segment_count = 0;
+        info.offset = offset;
+        part_info_save(t->part_file, &info);
+      }
+    }
+  }
+  part_info_free(&info);
+
+  if(!t->stream) {
+    part_info_remove(t->part_file);
+    t->resume_from = 0;
+    t->stream = fopen(t->part_file, "wb");
   }
+
+  if(!t->stream) {
+    dbg_printf(P_ERROR, "Cannot open '%s' for writing: %s", t->part_file, strerror(errno));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* write the body of a download to its partial file */
+PRIVATE size_t write_file_callback(void *ptr, size_t size, size_t nmemb, void *data) {
+  web_transfer *t = (web_transfer*)data;
+  size_t len = size * nmemb;
+  long responseCode = 0;
+  part_info info;
+
+  if(!t->body_started) {
+    t->body_started = 1;
+    curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &responseCode);
+    if(responseCode == 200) {
+      if(t->resume_from > 0) {
+        /* the file has changed on the server, or the server ignored the range */
+        dbg_printf(P_INFO, "Unable to resume download of '%s', starting over", t->filename);
+        fflush(t->stream);
+        if(ftruncate(fileno(t->stream), 0) != 0) {
+          dbg_printf(P_ERROR, "Error: Unable to truncate '%s': %s", t->part_file, strerror(errno));
+          return 0;
+        }
+        t->resume_from = 0;
+      }
+      /* save the validators right away, so the download can be resumed even after a crash */
+      memset(&info, 0, sizeof(info));
+      info.url = t->data->url;
+      info.etag = t->data->etag;
+      info.last_modified = t->data->last_modified;
+      part_info_save(t->part_file, &info);
+    } else if(responseCode != 206) {
+      /* error page */
+      t->discard_body = 1;
+    }
+  }
+
+  if(t->discard_body) {
+    return len;
+  }
+
+  if(fwrite(ptr, 1, len, t->stream) != len) {
+    dbg_printf(P_ERROR, "Error: Unable to write to '%s': %s", t->part_file, strerror(errno));
+    return 0;
+  }
+  t->written += len;
+  return len;
+}
+
+/* move a complete download to its final name, or keep the partial file for the next attempt */
+PRIVATE uint8_t web_transfer_finish_file(web_transfer *t, CURLcode result, long responseCode) {
+  part_info info;
+  uint64_t size = t->resume_from + t->written;
+
+  memset(&info, 0, sizeof(info));
+  if(result == CURLE_OK && (responseCode == 200 || responseCode == 206)) {
+    if(rename(t->part_file, t->filename) != 0) {
+      dbg_printf(P_ERROR, "Error: Unable to rename '%s' to '%s': %s", t->part_file, t->filename, strerror(errno));
+      return FALSE;
+    }
+    part_info_remove(t->part_file);
+    return TRUE;
+  }
+
+  /* client errors (e.g. 404 or 416) make the partial file useless */
+  if(size > 0 && (responseCode < 400 || responseCode >= 500) && part_info_load(t->part_file, &info) == 0 &&
+     part_info_validator(&info, t->data->url) != NULL) {
+    info.offset = size;
+    part_info_save(t->part_file, &info);
+    dbg_printf(P_INFO, "Download of '%s' stopped at byte %llu and will be resumed", t->filename, (unsigned long long)size);
+  } else {
+    unlink(t->part_file);
+    part_info_remove(t->part_file);
+  }
+  part_info_free(&info);
+  return FALSE;
+}
+
+/* time until a transfer may receive data again (0 if it may do so right away) */
+PRIVATE uint32_t getTransferDelay(web_transfer *t, uint64_t now) {
+  uint32_t delay = 0, limit_delay;
+
+  if(t->bucket) {
+    token_bucket_refill(t->bucket, now);
+    delay = token_bucket_delay(t->bucket);
+  }
+  if(t->limit.rate > 0) {
+    token_bucket_refill(&t->limit, now);
+    limit_delay = token_bucket_delay(&t->limit);
+    if(limit_delay > delay) {
+      delay = limit_delay;
+    }
+  }
+  return delay;
+}
+
+/* hold back the body of a transfer while one of its token buckets is empty */
+PRIVATE size_t shaped_write_callback(void *ptr, size_t size, size_t nmemb, void *data) {
+  web_transfer *t = (web_transfer*)data;
+  size_t len = size * nmemb;
+  size_t result;
+
+  if(((t->bucket && t->bucket->tokens <= 0) || t->limit.tokens <= 0) &&
+     getTransferDelay(t, getMilliseconds()) > 0) {
+    /* curl keeps the data and hands it over again once the transfer has been resumed */
+    t->paused = 1;
+    return CURL_WRITEFUNC_PAUSE;
+  }
+
+  result = t->write_func(ptr, size, nmemb, t->write_data);
+  if(result == len) {
+    if(t->bucket) {
+      token_bucket_consume(t->bucket, len);
+    }
+    token_bucket_consume(&t->limit, len);
+  }
+  return result;
+}
+
+PRIVATE uint8_t web_transfer_start(web_multi *m, web_transfer *t) {
+  char *escaped_url = NULL;
+  char range[32];
+  CURLMcode rc;
+
+  t->curl = am_curl_init(FALSE);
+  if(!t->curl) {
+    dbg_printf(P_ERROR, "curl_handle is uninitialized!");
+    return FALSE;
+  }
+
+  escaped_url = url_encode_whitespace(t->data->url);
+  assert(escaped_url);
+  curl_easy_setopt(t->curl, CURLOPT_URL, escaped_url);
+  am_free(escaped_url);
+
+  if(t->filename) {
+    if(!web_transfer_open_file(t)) {
+      return FALSE;
+    }
+    curl_easy_setopt(t->curl, CURLOPT_HEADERFUNCTION, write_header_callback);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEHEADER, t->data);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, write_file_callback);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, t);
+    if(t->resume_from > 0) {
+      /* unlike CURLOPT_RESUME_FROM, a plain range accepts a complete response (200) if If-Range fails */
+      sprintf(range, "%llu-", (unsigned long long)t->resume_from);
+      curl_easy_setopt(t->curl, CURLOPT_RANGE, range);
+    }
+  } else {
+    curl_easy_setopt(t->curl, CURLOPT_HEADERFUNCTION, write_header_callback);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, write_data_callback);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, t->data);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEHEADER, t->data);
+  }
+  curl_easy_setopt(t->curl, CURLOPT_PRIVATE, t);
+
+  if(t->shaped || t->limit.rate > 0) {
+    t->write_func = t->filename ? write_file_callback : write_data_callback;
+    t->write_data = t->filename ? (void*)t : (void*)t->data;
+    t->bucket = t->shaped ? &m->bucket : NULL;
+    token_bucket_init(&t->limit, t->limit.rate, getMilliseconds());
+    curl_easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, shaped_write_callback);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, t);
+  }
+
+  if(t->head_only) {
+    curl_easy_setopt(t->curl, CURLOPT_NOBODY, 1L);
+  } else if(t->range) {
+    curl_easy_setopt(t->curl, CURLOPT_RANGE, t->range);
+  }
+
+  if(t->headers) {
+    curl_easy_setopt(t->curl, CURLOPT_HTTPHEADER, t->headers);
+  }
+
+  if(t->useragent && *t->useragent) {
+    curl_easy_setopt(t->curl, CURLOPT_USERAGENT, t->useragent);
+  }
+
+  if(t->cookies && *t->cookies) {
+    /* if there's an explicit cookie string, use it */
+    curl_easy_setopt(t->curl, CURLOPT_COOKIE, t->cookies);
+  } else {
+    /* otherwise, enable cookie-handling since there might be cookies defined within the URL */
+    curl_easy_setopt(t->curl, CURLOPT_COOKIEFILE, "");
+  }
+
+  if((rc = curl_multi_add_handle(m->multi, t->curl)) != CURLM_OK) {
+    dbg_printf(P_ERROR, "[web_transfer_start] '%s': %s", t->data->url, curl_multi_strerror(rc));
+    return FALSE;
+  }
+
+  dbg_printf(P_INFO2, "[web_transfer_start] url=%s, curl_session=%p", t->data->url, (void*)t->curl);
+  return TRUE;
+}
+
+/* hand a finished (or failed) transfer over to its owner */
+PRIVATE void web_transfer_finish(web_transfer *t, CURLcode result) {
+  HTTPResponse *resp = NULL;
+  long responseCode = -1;
+  double downloadSpeed;
+  uint8_t complete = FALSE;
+
+  if(t->stream) {
+    if(fclose(t->stream) != 0 && result == CURLE_OK) {
+      dbg_printf(P_ERROR, "Error: Unable to write to '%s': %s", t->part_file, strerror(errno));
+      result = CURLE_WRITE_ERROR;
+    }
+    t->stream = NULL;
+  }
+
+  if(t->part_file) {
+    if(t->curl) {
+      curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &responseCode);
+    }
+    complete = web_transfer_finish_file(t, result, responseCode);
+    if(result == CURLE_OK && !complete && (responseCode == 200 || responseCode == 206)) {
+      result = CURLE_WRITE_ERROR;
+    }
+  }
+
+  if(result != CURLE_OK) {
+    dbg_printf(P_ERROR, "[web_transfer_finish] '%s': %s (retval: %d)", t->data->url, curl_easy_strerror(result), result);
+  } else {
+    curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &responseCode);
+    dbg_printf(P_INFO2, "[web_transfer_finish] '%s': response code: %ld", t->data->url, responseCode);
+    resp = HTTPResponse_new();
+    resp->responseCode = responseCode;
+    curl_easy_getinfo(t->curl, CURLINFO_TOTAL_TIME, &resp->total_time);
+    curl_easy_getinfo(t->curl, CURLINFO_NAMELOOKUP_TIME, &resp->namelookup_time);
+    if(t->filename) {
+      curl_easy_getinfo(t->curl, CURLINFO_SPEED_DOWNLOAD, &downloadSpeed);
+      resp->size = (size_t)(t->resume_from + t->written);
+      resp->downloadSpeed = downloadSpeed;
+    } else if(t->data->sink) {
+      /* the body has been consumed while it was received */
+      resp->size = t->data->response->buffer_pos;
+      resp->digest = xxh64_digest(&t->data->body_hash);
+    } else if(t->data->response->data) {
+      /* hand over the received data without copying it */
+      resp->size = t->data->response->buffer_pos;
+      resp->data = t->data->response->data;
+      t->data->response->data = NULL;
+      resp->digest = xxh64_digest(&t->data->body_hash);
+    }
+    resp->content_filename = t->data->content_filename;
+    t->data->content_filename = NULL;
+    resp->etag = t->data->etag;
+    t->data->etag = NULL;
+    resp->last_modified = t->data->last_modified;
+    t->data->last_modified = NULL;
+    resp->max_age = getFreshness(t->data);
+    resp->content_length = t->data->content_length;
+    resp->accept_ranges = t->data->accept_ranges;
+  }
+
+  if(t->done) {
+    t->done(resp, t->userdata);
+  } else {
+    HTTPResponse_free(resp);
+  }
+}
+
+/* start as many queued transfers as the global and per-host limits permit */
+PRIVATE void web_multi_dispatch(web_multi *m) {
+  web_transfer *t = m->queue_head, *prev = NULL, *next = NULL;
+  struct host_slot *slot = NULL;
+
+  while(t && m->active < m->max_total) {
+    next = t->next;
+    slot = getHostSlot(m, t->host);
+    if(slot && m->max_per_host > 0 && slot->active >= m->max_per_host) {
+      prev = t;
+      t = next;
+      continue;
+    }
+
+    /* unlink from queue */
+    if(prev) {
+      prev->next = next;
+    } else {
+      m->queue_head = next;
+    }
+    if(m->queue_tail == t) {
+      m->queue_tail = prev;
+    }
+    t->next = NULL;
+    --m->queued;
+
+    if(web_transfer_start(m, t)) {
+      t->next = m->running;
+      m->running = t;
+      ++m->active;
+      if(slot) {
+        ++slot->active;
+      }
+    } else {
+      web_transfer_finish(t, CURLE_FAILED_INIT);
+      web_transfer_free(t);
+    }
+    t = next;
+  }
+}
+
+/* continue the paused transfers whose token buckets have been refilled. Returns the time until
+** the next one may continue (0 if no transfer is paused).
+*/
+PRIVATE uint32_t web_multi_resume(web_multi *m) {
+  web_transfer *t = NULL;
+  uint64_t now = 0;
+  uint32_t delay, next = 0;
+
+  for(t = m->running; t; t = t->next) {
+    if(!t->paused) {
+      continue;
+    }
+    if(now == 0) {
+      now = getMilliseconds();
+    }
+    delay = getTransferDelay(t, now);
+    if(delay == 0) {
+      /* the data curl has kept is handed over right away, which might pause the transfer again */
+      t->paused = 0;
+      curl_easy_pause(t->curl, CURLPAUSE_CONT);
+    } else if(next == 0 || delay < next) {
+      next = delay;
+    }
+  }
+  return next;
+}
+
+PRIVATE void unlinkRunning(web_multi *m, web_transfer *t) {
+  web_transfer **p = &m->running;
+
+  while(*p && *p != t) {
+    p = &(*p)->next;
+  }
+  if(*p) {
+    *p = t->next;
+  }
+  t->next = NULL;
+}
+
+PRIVATE void web_multi_read_info(web_multi *m) {
+  CURLMsg *msg;
+  int msgs_left;
+  web_transfer *t = NULL;
+  struct host_slot *slot = NULL;
+
+  while((msg = curl_multi_info_read(m->multi, &msgs_left))) {
+    if(msg->msg != CURLMSG_DONE) {
+      continue;
+    }
+    t = NULL;
+    curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&t);
+    assert(t && t->curl == msg->easy_handle);
+    curl_multi_remove_handle(m->multi, t->curl);
+    unlinkRunning(m, t);
+    --m->active;
+    slot = getHostSlot(m, t->host);
+    if(slot && slot->active > 0) {
+      --slot->active;
+    }
+    web_transfer_finish(t, msg->data.result);
+    web_transfer_free(t);
+  }
+}
+
+/* set the timer of an attached web_multi object to the earliest time something has to be done */
+PRIVATE void web_multi_arm(web_multi *m) {
+  uint64_t now = getMilliseconds();
+  int64_t next = m->curl_timeout;
+
+  if(m->dispatch_pending) {
+    next = (int64_t)now;
+  }
+  if(m->resume_at > 0 && (next < 0 || (int64_t)m->resume_at < next)) {
+    next = (int64_t)m->resume_at;
+  }
+
+  if(next < 0) {
+    event_timer_stop(m->timer);
+  } else {
+    event_timer_after(m->timer, next > (int64_t)now ? (uint32_t)(next - (int64_t)now) : 0);
+  }
+}
+
+/* bookkeeping after curl has been driven: completed transfers, queued ones, paused ones */
+PRIVATE void web_multi_settle(web_multi *m) {
+  uint32_t delay;
+
+  web_multi_read_info(m);
+  web_multi_dispatch(m);
+  delay = web_multi_resume(m);
+  m->resume_at = delay > 0 ? getMilliseconds() + delay : 0;
+  web_multi_arm(m);
+}
+
+PRIVATE void onSocketReady(int fd, uint32_t events, void *userdata) {
+  web_multi *m = (web_multi*)userdata;
+  int mask = 0;
+  int running = 0;
+
+  mask |= (events & EVENT_READ) ? CURL_CSELECT_IN : 0;
+  mask |= (events & EVENT_WRITE) ? CURL_CSELECT_OUT : 0;
+  mask |= (events & EVENT_ERROR) ? CURL_CSELECT_ERR : 0;
+  curl_multi_socket_action(m->multi, fd, mask, &running);
+  web_multi_settle(m);
+}
+
+PRIVATE void onTimerExpired(event_timer *timer, void *userdata) {
+  web_multi *m = (web_multi*)userdata;
+  int running = 0;
+
+  (void)timer;
+
+  m->dispatch_pending = 0;
+  web_multi_dispatch(m);
+  if(m->curl_timeout >= 0 && m->curl_timeout <= (int64_t)getMilliseconds()) {
+    /* curl reports the next timeout (or that there is none) when it handles this one */
+    m->curl_timeout = -1;
+  }
+  curl_multi_socket_action(m->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+  web_multi_settle(m);
+}
+
+/* curl tells which sockets it is interested in */
+PRIVATE int curlSocketCallback(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp) {
+  web_multi *m = (web_multi*)userp;
+
+  (void)easy;
+  (void)socketp;
+
+  if(what == CURL_POLL_REMOVE) {
+    event_loop_unwatch(m->loop, s);
+  } else {
+    event_loop_watch(m->loop, s, ((what & CURL_POLL_IN) ? EVENT_READ : 0) | ((what & CURL_POLL_OUT) ? EVENT_WRITE : 0),
+                     onSocketReady, m);
+  }
+  return 0;
+}
+
+/* curl tells when it wants to be woken up, regardless of socket activity */
+PRIVATE int curlTimerCallback(CURLM *multi, long timeout_ms, void *userp) {
+  web_multi *m = (web_multi*)userp;
+
+  (void)multi;
+
+  m->curl_timeout = timeout_ms < 0 ? -1 : (int64_t)(getMilliseconds() + timeout_ms);
+  web_multi_arm(m);
+  return 0;
+}
+
+/** \brief Create a new object for running multiple HTTP transfers concurrently
+ *
+ * \param[in] max_total Maximum number of transfers in flight
+ * \param[in] max_per_host Maximum number of transfers in flight to the same host (0 means unlimited)
+ * \return a new web_multi object, or \c NULL in case of an error
+ */
+PUBLIC web_multi* web_multi_new(uint16_t max_total, uint16_t max_per_host) {
+  web_multi *m = NULL;
+
+  am_curl_global_init();
+
+  m = am_malloc(sizeof(struct web_multi));
+  if(!m) {
+    return NULL;
+  }
+
+  m->multi = curl_multi_init();
+  if(!m->multi) {
+    am_free(m);
+    return NULL;
+  }
+
+  m->queue_head = NULL;
+  m->queue_tail = NULL;
+  m->running = NULL;
+  m->queued = 0;
+  m->active = 0;
+  m->max_total = max_total > 0 ? max_total : 1;
+  m->max_per_host = max_per_host;
+  m->hosts = NULL;
+  token_bucket_init(&m->bucket, 0, getMilliseconds());
+  m->loop = NULL;
+  m->timer = NULL;
+  m->curl_timeout = -1;
+  m->resume_at = 0;
+  m->dispatch_pending = 0;
+  return m;
+}
+
+/** \brief Let an event loop drive the transfers of a web_multi object
+ *
+ * \param[in] m Pointer to a web_multi object
+ * \param[in] loop Pointer to an event loop
+ * \return 0 on success, -1 otherwise
+ *
+ * Must be called before the first transfer is added. From then on, the transfers make progress
+ * whenever event_loop_run() is called, and the completion callbacks are called from there.
+ * The event loop has to outlive the web_multi object.
+ */
+PUBLIC int web_multi_attach(web_multi *m, event_loop *loop) {
+  if(!m || !loop || m->loop || m->active + m->queued > 0) {
+    return -1;
+  }
+
+  m->timer = event_timer_new(loop, onTimerExpired, m);
+  if(!m->timer) {
+    return -1;
+  }
+  m->loop = loop;
+  curl_multi_setopt(m->multi, CURLMOPT_SOCKETFUNCTION, curlSocketCallback);
+  curl_multi_setopt(m->multi, CURLMOPT_SOCKETDATA, m);
+  curl_multi_setopt(m->multi, CURLMOPT_TIMERFUNCTION, curlTimerCallback);
+  curl_multi_setopt(m->multi, CURLMOPT_TIMERDATA, m);
+  return 0;
+}
+
+/** \brief Free a web_multi object, aborting all transfers that are still queued or in flight
+ *
+ * \param[in] m Pointer to a web_multi object
+ *
+ * The completion callback of each aborted transfer is called with a \c NULL response so the
+ * owner gets the chance to free its data.
+ */
+PUBLIC void web_multi_free(web_multi *m) {
+  web_transfer *t = NULL;
+
+  if(!m) {
+    return;
+  }
+
+  while((t = m->queue_head) != NULL) {
+    m->queue_head = t->next;
+    web_transfer_finish(t, CURLE_ABORTED_BY_CALLBACK);
+    web_transfer_free(t);
+  }
+
+  while((t = m->running) != NULL) {
+    m->running = t->next;
+    curl_multi_remove_handle(m->multi, t->curl);
+    web_transfer_finish(t, CURLE_ABORTED_BY_CALLBACK);
+    web_transfer_free(t);
+  }
+
+  curl_multi_cleanup(m->multi);
+  event_timer_free(m->timer);
+  freeList(&m->hosts, host_slot_free);
+  am_free(m);
+}
+
+/** \brief Queue a new transfer
+ *
+ * \param[in] m Pointer to a web_multi object
+ * \param[in] req Parameters of the transfer
+ * \param[in] done Function that is called once the transfer has finished
+ * \param[in] userdata Pointer that is handed to \a done
+ * \return 0 if the transfer was queued, -1 otherwise.
+ *
+ * The transfer is started by web_multi_perform() (or the event loop the object is attached to)
+ * as soon as the connection limits permit.
+ * \a done receives the response of the server, or \c NULL if the transfer failed or was aborted.
+ * \a done is responsible for freeing the response with HTTPResponse_free().
+ *
+ * If \a req->filename is set, the body is written to that file instead of being kept in memory.
+ * If \a req->write_func is set, it receives the body while it is downloaded, and the response carries
+ * no data.
+ * If \a req->etag or \a req->last_modified are set, the request is conditional: an unchanged
+ * object results in a response with code 304 and no data.
+ * If \a req->shaped is set, the transfer shares the bandwidth limit set with web_multi_set_rate().
+ * If \a req->max_speed is set, the transfer is additionally limited to that rate on its own.
+ */
+PUBLIC int web_multi_add(web_multi *m, const HTTPRequest *req, web_done_func done, void *userdata) {
+  web_transfer *t = NULL;
+
+  if(!m || !req || !req->url) {
+    return -1;
+  }
+
+  t = am_malloc(sizeof(web_transfer));
+  if(!t) {
+    return -1;
+  }
+
+  t->next = NULL;
+  t->curl = NULL;
+  t->stream = NULL;
+  t->data = WebData_new(req->url);
+  t->filename = am_strdup(req->filename);
+  t->part_file = NULL;
+  t->range = am_strdup(req->range);
+  t->head_only = req->head_only;
+  t->shaped = req->shaped;
+  t->paused = 0;
+  t->bucket = NULL;
+  token_bucket_init(&t->limit, req->max_speed, 0);
+  t->write_func = NULL;
+  t->write_data = NULL;
+  t->resume_from = 0;
+  t->written = 0;
+  t->body_started = 0;
+  t->discard_body = 0;
+  t->cookies = am_strdup(req->cookies);
+  t->useragent = am_strdup(req->useragent);
+  t->host = getURLHost(req->url);
+  t->headers = NULL;
+  t->done = done;
+  t->userdata = userdata;
+
+  if(!t->data || !t->host) {
+    web_transfer_free(t);
+    return -1;
+  }
+
+  if(t->filename || t->head_only) {
+    t->data->buffered = 0;
+  } else if(req->write_func) {
+    t->data->sink = req->write_func;
+    t->data->sink_data = req->write_data;
+    t->data->buffered = 0;
+  }
+
+  if(req->etag && *req->etag) {
+    t->headers = appendHeader(t->headers, "If-None-Match", req->etag);
+  }
+  if(req->last_modified && *req->last_modified) {
+    t->headers = appendHeader(t->headers, "If-Modified-Since", req->last_modified);
+  }
+  if(req->if_range && *req->if_range) {
+    t->headers = appendHeader(t->headers, "If-Range", req->if_range);
+  }
+
+  if(m->queue_tail) {
+    m->queue_tail->next = t;
+  } else {
+    m->queue_head = t;
+  }
+  m->queue_tail = t;
+  ++m->queued;
+
+  if(m->loop && !m->dispatch_pending) {
+    m->dispatch_pending = 1;
+    web_multi_arm(m);
+  }
+  return 0;
+}
+
+/** \brief Drive all queued and running transfers
+ *
+ * \param[in] m Pointer to a web_multi object
+ * \param[in] timeout_ms Maximum time to wait for network activity
+ * \return number of transfers that are still queued or running
+ *
+ * Starts queued transfers as connections become available and calls the completion
+ * callbacks of all finished transfers. Call it repeatedly until it returns 0.
+ * If the object is attached to an event loop, the loop is run once instead.
+ */
+PUBLIC uint32_t web_multi_perform(web_multi *m, int timeout_ms) {
+  int running = 0;
+#if LIBCURL_VERSION_NUM < 0x074200
+  int numfds = 0;
+#endif
+  uint32_t delay;
+
+  if(!m) {
+    return 0;
+  }
+
+  if(m->loop) {
+    event_loop_run(m->loop, timeout_ms);
+    return m->active + m->queued;
+  }
+
+  web_multi_dispatch(m);
+
+  if(m->active > 0) {
+    /* wake up in time to resume paused transfers */
+    delay = web_multi_resume(m);
+    if(delay > 0 && (int)delay < timeout_ms) {
+      timeout_ms = (int)delay;
+    }
+#if LIBCURL_VERSION_NUM >= 0x074200
+    /* unlike curl_multi_wait(), this also waits while all transfers are paused */
+    curl_multi_poll(m->multi, NULL, 0, timeout_ms, NULL);
+#else
+    curl_multi_wait(m->multi, NULL, 0, timeout_ms, &numfds);
+    if(numfds == 0 && delay > 0) {
+      usleep(delay * 1000);
+    }
+#endif
+    curl_multi_perform(m->multi, &running);
+    web_multi_read_info(m);
+    web_multi_dispatch(m);
+  }
+
+  return m->active + m->queued;
+}
+
+/** \brief Number of transfers that are queued or in flight */
+PUBLIC uint32_t web_multi_pending(const web_multi *m) {
+  return m ? m->active + m->queued : 0;
+}
+
+/** \brief Number of transfers that wait for a free connection slot */
+PUBLIC uint32_t web_multi_queued(const web_multi *m) {
+  return m ? m->queued : 0;
+}
+
+/** \brief Abort a queued or running transfer
+ *
+ * \param[in] m Pointer to a web_multi object
+ * \param[in] userdata Pointer that was handed to web_multi_add()
+ * \return 0 if the transfer was found and aborted, -1 otherwise.
+ *
+ * The completion callback of the transfer is called with a \c NULL response.
+ */
+PUBLIC int web_multi_cancel(web_multi *m, void *userdata) {
+  web_transfer *t = NULL, *prev = NULL;
+  struct host_slot *slot = NULL;
+
+  if(!m) {
+    return -1;
+  }
+
+  for(t = m->queue_head; t; prev = t, t = t->next) {
+    if(t->userdata == userdata) {
+      if(prev) {
+        prev->next = t->next;
+      } else {
+        m->queue_head = t->next;
+      }
+      if(m->queue_tail == t) {
+        m->queue_tail = prev;
+      }
+      --m->queued;
+      web_transfer_finish(t, CURLE_ABORTED_BY_CALLBACK);
+      web_transfer_free(t);
+      return 0;
+    }
+  }
+
+  for(t = m->running; t; t = t->next) {
+    if(t->userdata == userdata) {
+      curl_multi_remove_handle(m->multi, t->curl);
+      unlinkRunning(m, t);
+      --m->active;
+      slot = getHostSlot(m, t->host);
+      if(slot && slot->active > 0) {
+        --slot->active;
+      }
+      web_transfer_finish(t, CURLE_ABORTED_BY_CALLBACK);
+      web_transfer_free(t);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/** \brief Limit the bandwidth of the shaped transfers
+ *
+ * \param[in] m Pointer to a web_multi object
+ * \param[in] rate Limit in bytes per second for all shaped transfers together (0 means unlimited)
+ *
+ * The limit may be changed at any time and applies to the running transfers right away.
+ */
+PUBLIC void web_multi_set_rate(web_multi *m, uint64_t rate) {
+  if(m) {
+    token_bucket_refill(&m->bucket, getMilliseconds());
+    token_bucket_set_rate(&m->bucket, rate);
+  }
+}
+
+/** \brief Current bandwidth limit of the shaped transfers (0 means unlimited) */
+PUBLIC uint64_t web_multi_get_rate(const web_multi *m) {
+  return m ? m->bucket.rate : 0;
 }
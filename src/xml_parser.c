@@ -14,131 +14,439 @@
 #include <string.h>
 #include <stdint.h>
 
-#include <libxml/tree.h>
 #include <libxml/parser.h>
-#include <libxml/xpath.h>
-#include <libxml/xpathInternals.h>
+#include <libxml/xmlversion.h>
+#include <libxml/xmlerror.h>
 
 #include "feed_item.h"
 #include "output.h"
+#include "trace.h"
 #include "utils.h"
-#include "web.h"
-
+#include "xml_parser.h"
 
 /** \cond */
 
-struct rssNode {
-	char *url;
-	char *type;
+/** elements of an RSS item the parser is interested in */
+enum item_field {
+	FIELD_NONE = 0,
+	FIELD_TITLE,
+	FIELD_LINK,
+	FIELD_GUID,
+	FIELD_TTL,
+	FIELD_SKIP_HOUR,
+	FIELD_SKIP_DAY
 };
 
-typedef struct rssNode rssNode;
+static const char *day_names[] = { "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "Friday", "Saturday" };
+
+struct feed_parser {
+	xmlParserCtxtPtr ctxt;
+	xmlSAXHandler    sax;
+	feed_item_func   callback;
+	void            *userdata;
+	feed_item        item;          /**< item that is currently being parsed */
+	uint32_t         depth;         /**< nesting level of the current element */
+	uint32_t         channel_depth; /**< nesting level of the "channel" element, 0 if outside */
+	uint32_t         item_depth;    /**< nesting level of the current "item" element, 0 if outside */
+	uint32_t         field_depth;   /**< nesting level of the element whose text is collected */
+	enum item_field  field;
+	char            *text;          /**< text content of the current field */
+	size_t           text_len;
+	size_t           text_size;
+	uint32_t         item_count;
+	uint32_t         ttl;
+	uint32_t         skip_hours;    /**< bit mask of the hours listed in "skipHours" */
+	uint8_t          skip_days;     /**< bit mask of the days listed in "skipDays" (bit 0: Sunday) */
+	uint32_t         skip_depth;    /**< nesting level of the "skipHours" or "skipDays" element, 0 if outside */
+	enum item_field  skip_field;    /**< field of the children of the current skip element */
+	uint8_t          error_reported;
+	uint8_t          stopped;       /**< set by feed_parser_stop() */
+};
 
 /** \endcond */
 
-static void freeNode(rssNode *rss) {
-	if (rss) {
-		am_free(rss->url);
-		rss->url = NULL;
-		am_free(rss->type);
-		rss->type = NULL;
+static void startField(feed_parser *p, enum item_field field) {
+	p->field = field;
+	p->field_depth = p->depth;
+	p->text_len = 0;
+}
+
+static void appendText(feed_parser *p, const xmlChar *ch, int len) {
+	size_t new_size;
+	char *tmp;
+
+	if(p->field == FIELD_NONE || len <= 0) {
+		return;
+	}
+
+	if(p->text_len + len + 1 > p->text_size) {
+		new_size = p->text_size ? p->text_size : 256;
+		while(new_size < p->text_len + len + 1) {
+			new_size *= 2;
+		}
+		tmp = am_realloc(p->text, new_size);
+		if(!tmp) {
+			return;
+		}
+		p->text = tmp;
+		p->text_size = new_size;
 	}
-	am_free(rss);
-	rss = NULL;
+
+	memcpy(p->text + p->text_len, ch, len);
+	p->text_len += len;
+	p->text[p->text_len] = '\0';
 }
 
-static int getNodeText(xmlNodePtr child, char **dest) {
-	xmlChar * textNode;
-	int result = 0;
+static uint8_t isBlank(char c) {
+	return (c == ' ' || c == '\t' || c == '\n' || c == '\r') ? 1 : 0;
+}
 
-   assert(dest && *dest == NULL);
-	textNode = xmlNodeGetContent(child);
-	*dest = am_strdup((char*) textNode);
-	xmlFree(textNode);
-	if (*dest) {
-		result = 1;
-  }
-	return result;
+/* text of the current field without leading and trailing whitespace */
+static const char* trimText(feed_parser *p) {
+	const char *text;
+
+	if(p->text_len == 0) {
+		return "";
+	}
+	while(p->text_len > 0 && isBlank(p->text[p->text_len - 1])) {
+		p->text[--p->text_len] = '\0';
+	}
+	text = p->text;
+	while(isBlank(*text)) {
+		++text;
+	}
+	return text;
 }
 
-static rssNode* getNodeAttributes(xmlNodePtr child) {
-	rssNode *tmp = am_malloc(sizeof(rssNode));
-	xmlAttrPtr attr = child->properties;
+/* finish the field whose end tag has just been read */
+static void endField(feed_parser *p) {
+	const char *text = p->text_len > 0 ? p->text : "";
+	uint32_t i;
 
-   tmp->url = NULL;
-   tmp->type = NULL;
+	switch(p->field) {
+		case FIELD_TITLE:
+			if(p->item && !p->item->name) {
+				p->item->name = am_strdup(text);
+			}
+			break;
+		case FIELD_LINK:
+			/* an empty link is no URL at all */
+			text = trimText(p);
+			if(p->item && *text) {
+				addItem(am_strdup(text), &p->item->urls);
+			}
+			break;
+		case FIELD_GUID:
+			if(p->item && !p->item->guid && *text) {
+				p->item->guid = am_strdup(text);
+			}
+			break;
+		case FIELD_TTL:
+			p->ttl = atoi(text);
+			break;
+		case FIELD_SKIP_HOUR:
+			while(*text == ' ' || *text == '\t' || *text == '\n' || *text == '\r') {
+				++text;
+			}
+			/* both 0 and 24 are used for midnight */
+			if(*text >= '0' && *text <= '9' && atoi(text) <= 24) {
+				p->skip_hours |= 1u << (atoi(text) % 24);
+			}
+			break;
+		case FIELD_SKIP_DAY:
+			for(i = 0; i < 7; ++i) {
+				if(strstr(text, day_names[i])) {
+					p->skip_days |= 1u << i;
+				}
+			}
+			break;
+		default:
+			break;
+	}
+	p->field = FIELD_NONE;
+	p->field_depth = 0;
+}
 
-   while (attr) {
-		if ((strcmp((char*) attr->name, "url") == 0)) {
-			getNodeText(attr->children, &tmp->url);
-		} else if ((strcmp((char*) attr->name, "content") == 0) || (strcmp(
-				(char*) attr->name, "type") == 0)) {
-			getNodeText(attr->children, &tmp->type);
+/* copy an attribute value. Unless entities are substituted (which isn't safe for data from the web),
+** libxml2 hands over '&' as the character reference "&#38;".
+*/
+static char* getAttributeValue(const xmlChar *value, const xmlChar *end) {
+	char *result = am_strndup((const char*)value, end - value);
+	char *src, *dst;
+
+	if(result && strstr(result, "&#38;")) {
+		for(src = dst = result; *src; ++dst) {
+			if(strncmp(src, "&#38;", 5) == 0) {
+				*dst = '&';
+				src += 5;
+			} else {
+				*dst = *src++;
+			}
 		}
-		attr = attr->next;
+		*dst = '\0';
+	}
+	return result;
+}
+
+/* attributes of a SAX2 element are stored as quintuples: localname, prefix, URI, value, end */
+static void addEnclosure(feed_parser *p, int nb_attributes, const xmlChar **attributes) {
+	char *url = NULL;
+	char *type = NULL;
+	const char *name;
+	int i;
+
+	for(i = 0; i < nb_attributes; ++i) {
+		name = (const char*)attributes[i * 5];
+		if(strcmp(name, "url") == 0 && !url) {
+			url = getAttributeValue(attributes[i * 5 + 3], attributes[i * 5 + 4]);
+		} else if((strcmp(name, "content") == 0 || strcmp(name, "type") == 0) && !type) {
+			type = getAttributeValue(attributes[i * 5 + 3], attributes[i * 5 + 4]);
+		}
+	}
+
+	if(url && *url && type && strncmp(type, "video/", 6) == 0) {
+		addItem(url, &p->item->urls);
+		url = NULL;
+	}
+
+	am_free(url);
+	am_free(type);
+}
+
+static void onStartElement(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI,
+                           int nb_namespaces, const xmlChar **namespaces, int nb_attributes, int nb_defaulted,
+                           const xmlChar **attributes) {
+	feed_parser *p = (feed_parser*)ctx;
+	const char *name = (const char*)localname;
+
+	(void)prefix;
+	(void)nb_namespaces;
+	(void)namespaces;
+	(void)nb_defaulted;
+
+	if(p->stopped) {
+		return;
 	}
 
-	return tmp;
+	++p->depth;
+
+	if(p->item_depth == 0) {
+		if(strcmp(name, "item") == 0 && URI == NULL) {
+			++p->item_count;
+			p->item = newFeedItem();
+			p->item_depth = p->depth;
+		} else if(strcmp(name, "channel") == 0 && p->channel_depth == 0) {
+			p->channel_depth = p->depth;
+		} else if(p->channel_depth > 0 && p->depth == p->channel_depth + 1) {
+			if(strcmp(name, "ttl") == 0) {
+				startField(p, FIELD_TTL);
+			} else if(strcmp(name, "skipHours") == 0) {
+				p->skip_depth = p->depth;
+				p->skip_field = FIELD_SKIP_HOUR;
+			} else if(strcmp(name, "skipDays") == 0) {
+				p->skip_depth = p->depth;
+				p->skip_field = FIELD_SKIP_DAY;
+			}
+		} else if(p->skip_depth > 0 && p->depth == p->skip_depth + 1 &&
+		          strcmp(name, p->skip_field == FIELD_SKIP_HOUR ? "hour" : "day") == 0) {
+			startField(p, p->skip_field);
+		}
+	} else if(p->item && p->depth == p->item_depth + 1) {
+		/* direct children of an item */
+		if(strcmp(name, "title") == 0) {
+			startField(p, FIELD_TITLE);
+		} else if(strcmp(name, "link") == 0) {
+			startField(p, FIELD_LINK);
+		} else if(strcmp(name, "guid") == 0) {
+			startField(p, FIELD_GUID);
+		} else if(strcmp(name, "enclosure") == 0) {
+			addEnclosure(p, nb_attributes, attributes);
+		}
+	}
 }
 
-static simple_list extract_feed_items(xmlNodeSetPtr nodes) {
-	xmlNodePtr cur = NULL, child = NULL;
-	uint32_t size, i;
+static void onEndElement(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI) {
+	feed_parser *p = (feed_parser*)ctx;
 	feed_item item = NULL;
-	uint8_t name_set, url_set;
-	rssNode *enclosure = NULL;
-	simple_list itemList = NULL;
-
-	size = (nodes) ? nodes->nodeNr : 0;
-
-	dbg_printf(P_INFO2, "%d items in XML", size);
-	for (i = 0; i < size; ++i) {
-		assert(nodes->nodeTab[i]);
-		if (nodes->nodeTab[i]->type == XML_ELEMENT_NODE) {
-			cur = nodes->nodeTab[i];
-			if (cur->children) {
-				child = cur->children;
-				url_set = 0;
-				name_set = 0;
-				item = newFeedItem();
-
-				while (child) {
-					if ((strcmp((char*) child->name, "title") == 0)) {
-						name_set = getNodeText(child->children, &item->name);
-               } else if((strcmp((char*)child->name, "link") == 0)) {
-                  char* link = NULL;
-                  if(getNodeText(child->children, &link)) {
-                     addItem(link, &item->urls);
-                  }
-               } else if ((strcmp((char*) child->name, "enclosure") == 0)) {
-                  enclosure = getNodeAttributes(child);
-
-                  if ( enclosure->url != NULL && enclosure->type != NULL && strncmp(enclosure->type, "video/", 6) == 0 ) {
-                     addItem(am_strdup(enclosure->url), &item->urls);
-   			      }
-
-                  freeNode(enclosure);
-			      }
-
-			      child = child->next;
-		      }
-
-   	      if (name_set && listCount(item->urls) > 0) {
-	   	      addItem(item, &itemList);
-		      } else {
-               freeFeedItem(item);
-            }
-
-		      child = cur = NULL;
-	      }
-      } else {
-	      cur = nodes->nodeTab[i];
-	      dbg_printf(P_ERROR, "Unknown node \"%s\": type %d", cur->name, cur->type);
-      }
-	}
-
-	dbg_printf(P_INFO2, "== Done extracting RSS items ==");
-	return itemList;
+
+	(void)localname;
+	(void)prefix;
+	(void)URI;
+
+	if(p->stopped) {
+		return;
+	}
+
+	if(p->field != FIELD_NONE && p->depth == p->field_depth) {
+		endField(p);
+	}
+
+	if(p->item_depth > 0 && p->depth == p->item_depth) {
+		item = p->item;
+		p->item = NULL;
+		p->item_depth = 0;
+		if(item && item->name && listCount(item->urls) > 0 && p->callback) {
+			p->callback(item, p->userdata);
+		} else {
+			freeFeedItem(item);
+		}
+	} else if(p->depth == p->skip_depth) {
+		p->skip_depth = 0;
+	} else if(p->depth == p->channel_depth) {
+		p->channel_depth = 0;
+	}
+
+	if(p->depth > 0) {
+		--p->depth;
+	}
+}
+
+static void onCharacters(void *ctx, const xmlChar *ch, int len) {
+	if(!((feed_parser*)ctx)->stopped) {
+		appendText((feed_parser*)ctx, ch, len);
+	}
+}
+
+/* the parser recovers from errors, so only the first one is worth mentioning */
+#if LIBXML_VERSION >= 21200
+static void onError(void *ctx, const xmlError *error) {
+#else
+static void onError(void *ctx, xmlErrorPtr error) {
+#endif
+	feed_parser *p = (feed_parser*)ctx;
+
+	if(error && error->level >= XML_ERR_ERROR && !p->error_reported) {
+		p->error_reported = 1;
+		dbg_printf(P_INFO, "XML error in line %d: %s", error->line, error->message ? error->message : "unknown error");
+	}
+}
+
+/** \brief Create a new incremental RSS parser
+ *
+ * \param callback Function that is called for each complete item
+ * \param userdata Pointer that is handed to \a callback
+ * \return Pointer to the new parser, or NULL on error
+ *
+ * The data of a feed is handed to the parser in arbitrary chunks with feed_parser_push(). Each item is
+ * handed to \a callback as soon as its end tag has been read, so the parser never needs to keep more
+ * than a single item in memory. \a callback takes ownership of the item.
+ * Malformed data is handled in the same pass, on a best-effort basis.
+ */
+feed_parser* feed_parser_new(feed_item_func callback, void *userdata) {
+	feed_parser *p = NULL;
+
+	LIBXML_TEST_VERSION
+	xmlInitParser();
+
+	p = am_malloc(sizeof(struct feed_parser));
+	if(!p) {
+		return NULL;
+	}
+
+	memset(p, 0, sizeof(struct feed_parser));
+	p->callback = callback;
+	p->userdata = userdata;
+
+	p->sax.initialized    = XML_SAX2_MAGIC;
+	p->sax.startElementNs = onStartElement;
+	p->sax.endElementNs   = onEndElement;
+	p->sax.characters     = onCharacters;
+	p->sax.cdataBlock     = onCharacters;
+	p->sax.serror         = onError;
+
+	p->ctxt = xmlCreatePushParserCtxt(&p->sax, p, NULL, 0, NULL);
+	if(!p->ctxt) {
+		dbg_printf(P_ERROR, "Error: Unable to create XML parser context");
+		am_free(p);
+		return NULL;
+	}
+	xmlCtxtUseOptions(p->ctxt, XML_PARSE_RECOVER | XML_PARSE_NONET | XML_PARSE_NOWARNING);
+
+	return p;
+}
+
+/** \brief Free an RSS parser and all items that haven't been completed */
+void feed_parser_free(feed_parser *p) {
+	if(p) {
+		if(p->ctxt) {
+			xmlFreeParserCtxt(p->ctxt);
+		}
+		freeFeedItem(p->item);
+		am_free(p->text);
+		am_free(p);
+	}
+}
+
+/** \brief Hand the next chunk of data to an RSS parser
+ *
+ * \param p Pointer to an RSS parser
+ * \param data The data
+ * \param len Length of the data
+ */
+void feed_parser_push(feed_parser *p, const char *data, size_t len) {
+	trace_span span;
+
+	if(p && p->ctxt && !p->stopped && len > 0) {
+		TRACE_BEGIN(span, "feed", "feed_parser_push");
+		xmlParseChunk(p->ctxt, data, (int)len, 0);
+		TRACE_END_ARG(span, "bytes", len);
+	}
+}
+
+/** \brief Tell an RSS parser that all data has been handed over */
+void feed_parser_finish(feed_parser *p) {
+	trace_span span;
+
+	if(p && p->ctxt && !p->stopped) {
+		TRACE_BEGIN(span, "feed", "feed_parser_finish");
+		xmlParseChunk(p->ctxt, NULL, 0, 1);
+		TRACE_END(span);
+	}
+}
+
+/** \brief Tell an RSS parser to ignore the rest of the feed
+ *
+ * \param p Pointer to an RSS parser
+ *
+ * Can be called from within the item callback. No further items are delivered, and all data
+ * handed over afterwards is discarded without being parsed.
+ */
+void feed_parser_stop(feed_parser *p) {
+	if(p && !p->stopped) {
+		p->stopped = 1;
+		if(p->ctxt) {
+			xmlStopParser(p->ctxt);
+		}
+	}
+}
+
+/** \brief Check whether feed_parser_stop() has been called */
+uint8_t feed_parser_stopped(const feed_parser *p) {
+	return p ? p->stopped : 0;
+}
+
+/** \brief Number of items the parser has seen so far, including incomplete ones */
+uint32_t feed_parser_item_count(const feed_parser *p) {
+	return p ? p->item_count : 0;
+}
+
+/** \brief Time-To-Live value of the feed, or 0 if it has none */
+uint32_t feed_parser_ttl(const feed_parser *p) {
+	return p ? p->ttl : 0;
+}
+
+/** \brief Hours (GMT) in which the feed asks not to be read, one bit per hour */
+uint32_t feed_parser_skip_hours(const feed_parser *p) {
+	return p ? p->skip_hours : 0;
+}
+
+/** \brief Days in which the feed asks not to be read, one bit per day (bit 0: Sunday) */
+uint8_t feed_parser_skip_days(const feed_parser *p) {
+	return p ? p->skip_days : 0;
+}
+
+static void collectItem(feed_item item, void *userdata) {
+	addItem(item, (simple_list*)userdata);
 }
 
 /** \brief Walk through given XML data and extract specific items
@@ -154,19 +462,9 @@ static simple_list extract_feed_items(xmlNodeSetPtr nodes) {
  * The items are then packaged into neat little rss items and returned as a list.
  */
 simple_list parse_xmldata(const char* data, uint32_t size, uint32_t* item_count, uint32_t *ttl) {
-	xmlDocPtr doc = NULL;
-	xmlXPathContextPtr xpathCtx = NULL;
-	xmlXPathObjectPtr xpathObj = NULL;
-	xmlNodeSetPtr ttlNode = NULL;
+	feed_parser *p = NULL;
 	simple_list rss_items = NULL;
-
-
-	const xmlChar* ttlExpr = (xmlChar*) "//channel/ttl";
-	const xmlChar* itemExpr = (xmlChar*) "//item";
-	LIBXML_TEST_VERSION
-
-	/* Init libxml */
-	xmlInitParser();
+	trace_span span;
 
 	*item_count = 0;
 
@@ -174,60 +472,23 @@ simple_list parse_xmldata(const char* data, uint32_t size, uint32_t* item_count,
 		return NULL;
 	}
 
-	/* Load XML document */
-	if((doc = xmlParseMemory(data, size)) == NULL) {
-    doc = xmlRecoverMemory(data, size);
-  }
-  
-	if (doc == NULL) {
-		dbg_printf(P_ERROR, "Error: Unable to parse input data!");
+	p = feed_parser_new(collectItem, &rss_items);
+	if(!p) {
 		return NULL;
 	}
 
-	/* Create XPath evaluation context */
-	xpathCtx = xmlXPathNewContext(doc);
-	if (xpathCtx == NULL) {
-		dbg_printf(P_ERROR, "Error: Unable to create new XPath context");
-		xmlFreeDoc(doc);
-		xmlCleanupParser();
-		return NULL;
-	}
+	TRACE_BEGIN(span, "feed", "parse_xmldata");
+	feed_parser_push(p, data, size);
+	feed_parser_finish(p);
+	TRACE_END_ARG(span, "items", feed_parser_item_count(p));
 
+	*item_count = feed_parser_item_count(p);
 	/* check for time-to-live element in RSS feed */
-	if (ttl == 0) {
-		xpathObj = xmlXPathEvalExpression(ttlExpr, xpathCtx);
-		if (xpathObj != NULL) {
-			ttlNode = xpathObj->nodesetval;
-
-			if (ttlNode->nodeNr == 1 && ttlNode->nodeTab[0]->type == XML_ELEMENT_NODE) {
-				*ttl = atoi((char*) xmlNodeGetContent(ttlNode->nodeTab[0]->children));
-			}
-			xmlXPathFreeObject(xpathObj);
-		} else {
-			dbg_printf(P_ERROR, "Error: Unable to evaluate TTL XPath expression");
-		}
+	if(ttl) {
+		*ttl = feed_parser_ttl(p);
 	}
+	dbg_printf(P_INFO2, "%d items in XML", *item_count);
 
-	/* Extract RSS "items" from feed */
-	xpathObj = xmlXPathEvalExpression(itemExpr, xpathCtx);
-	if (xpathObj == NULL) {
-		dbg_printf(P_ERROR, "Error: Unable to evaluate XPath expression \"%s\"",
-				itemExpr);
-		xmlXPathFreeContext(xpathCtx);
-		xmlFreeDoc(doc);
-		xmlCleanupParser();
-		return NULL;
-	}
-
-	*item_count = xpathObj->nodesetval ? xpathObj->nodesetval->nodeNr : 0;
-	rss_items = extract_feed_items(xpathObj->nodesetval);
-
-	/* Cleanup */
-	xmlXPathFreeObject(xpathObj);
-	xmlXPathFreeContext(xpathCtx);
-	xmlFreeDoc(doc);
-	/* Shutdown libxml */
-	xmlCleanupParser();
+	feed_parser_free(p);
 	return rss_items;
 }
-